@@ -0,0 +1,372 @@
+// Parallel algorithms on TBB, for toolchains without a parallel STL backend:
+// count_if, transform_reduce, inclusive/exclusive scan, copy_if (stream compaction),
+// min/max element.
+//
+// The inputs are ranges: std::vector, std::array, tbb::concurrent_vector, Span (pointer and
+// size) or IteratorRange (any random access iterators). Each task handles its part of the
+// range as contiguous pieces:
+// - contiguous storage: one piece, the loops run on raw pointers and can be vectorized;
+// - concurrent_vector: its iterators are not contiguous, but its segments are (segment k holds
+//   the elements [2^k, 2^(k+1)), the first two elements form segment 0), so the pieces stop at
+//   the segment boundaries and adjacent segments allocated together are merged. The layout is
+//   checked on every piece and the piece shrinks to one element if it does not hold;
+// - other iterators: one piece, indexed through the iterator.
+//
+// Below a few thousand elements the tasks cost more than they save: tbb_ParallelAlgorithms
+// measures the crossover against the sequential STL.
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/concurrent_vector.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/parallel_scan.h"
+
+namespace tbb_demo {
+
+/// Contiguous elements, e.g. a part of a std::vector
+template <class T>
+struct Span
+{
+   T* Data;
+   std::size_t Size;
+};
+
+template <class It>
+struct IteratorRange
+{
+   It First;
+   It Last;
+};
+
+template <class It>
+IteratorRange<It> MakeRange(It First, It Last)
+{
+   return {First, Last};
+}
+
+namespace algorithms_detail {
+
+constexpr std::size_t DefaultGrain = 1 << 14;
+
+template <class T>
+struct ContiguousSource
+{
+   T* Data;
+   std::size_t N;
+
+   std::size_t size() const { return N; }
+   std::pair<T*, std::size_t> Piece(std::size_t Pos, std::size_t End) const { return {Data + Pos, End - Pos}; }
+};
+
+template <class Vector>
+struct SegmentedSource
+{
+   Vector* V;
+
+   std::size_t size() const { return V->size(); }
+
+   /// First index of the segment after the one of Pos
+   static std::size_t SegmentEnd(std::size_t Pos)
+   {
+      std::size_t End = 2;
+      while (End <= Pos)
+         End <<= 1;
+      return End;
+   }
+
+   auto Piece(std::size_t Pos, std::size_t End) const
+   {
+      auto* p = &(*V)[Pos];
+      std::size_t Stop = std::min(End, SegmentEnd(Pos));
+      // Segments allocated in one block (e.g. by the constructor) follow each other
+      while (Stop < End && &(*V)[Stop] == p + (Stop - Pos))
+         Stop = std::min(End, SegmentEnd(Stop));
+      std::size_t n = Stop - Pos;
+      if (n > 1 && &(*V)[Stop - 1] != p + (n - 1))
+         n = 1;
+      return std::make_pair(p, n);
+   }
+};
+
+/// Iterator indexed with the std::size_t positions of the pieces
+template <class It>
+struct SizeIndexed
+{
+   It At;
+
+   decltype(auto) operator*() const { return *At; }
+   decltype(auto) operator[](std::size_t k) const { return At[typename std::iterator_traits<It>::difference_type(k)]; }
+};
+
+template <class It>
+struct IteratorSource
+{
+   using Difference = typename std::iterator_traits<It>::difference_type;
+
+   It First;
+   std::size_t N;
+
+   std::size_t size() const { return N; }
+   std::pair<SizeIndexed<It>, std::size_t> Piece(std::size_t Pos, std::size_t End) const
+   {
+      return {{std::next(First, Difference(Pos))}, End - Pos};
+   }
+};
+
+template <class T, class A>
+ContiguousSource<const T> MakeSource(const std::vector<T, A>& v) { return {v.data(), v.size()}; }
+template <class T, class A>
+ContiguousSource<T> MakeSource(std::vector<T, A>& v) { return {v.data(), v.size()}; }
+template <class T, std::size_t N>
+ContiguousSource<const T> MakeSource(const std::array<T, N>& a) { return {a.data(), N}; }
+template <class T, std::size_t N>
+ContiguousSource<T> MakeSource(std::array<T, N>& a) { return {a.data(), N}; }
+template <class T>
+ContiguousSource<T> MakeSource(const Span<T>& s) { return {s.Data, s.Size}; }
+template <class T, class A>
+SegmentedSource<const tbb::concurrent_vector<T, A>> MakeSource(const tbb::concurrent_vector<T, A>& v) { return {&v}; }
+template <class T, class A>
+SegmentedSource<tbb::concurrent_vector<T, A>> MakeSource(tbb::concurrent_vector<T, A>& v) { return {&v}; }
+template <class It>
+IteratorSource<It> MakeSource(const IteratorRange<It>& r) { return {r.First, std::size_t(std::distance(r.First, r.Last))}; }
+
+/// Element type of a range
+template <class Range>
+using ValueOf = std::decay_t<decltype(*MakeSource(std::declval<const Range&>()).Piece(0, 0).first)>;
+
+/// fPiece(p, n) on the contiguous pieces of [Begin, End)
+template <class Source, class F>
+void ForEachPiece(const Source& Src, std::size_t Begin, std::size_t End, F&& fPiece)
+{
+   while (Begin < End)
+   {
+      const auto [p, n] = Src.Piece(Begin, End);
+      fPiece(p, n);
+      Begin += n;
+   }
+}
+
+/// fPiece(In, Out, n) on the pieces of [Begin, End) contiguous in both sources
+template <class InSource, class OutSource, class F>
+void ForEachPiece(const InSource& In, const OutSource& Out, std::size_t Begin, std::size_t End, F&& fPiece)
+{
+   while (Begin < End)
+   {
+      const auto [pIn, nIn] = In.Piece(Begin, End);
+      const auto [pOut, nOut] = Out.Piece(Begin, End);
+      const std::size_t n = std::min(nIn, nOut);
+      fPiece(pIn, pOut, n);
+      Begin += n;
+   }
+}
+
+/// Value of a reduction over a part of the range, empty before its first element
+template <class T>
+struct Partial
+{
+   T Value{};
+   bool Empty = true;
+};
+
+/// Best element of a part of the range and its position
+template <class T>
+struct Candidate
+{
+   T Value{};
+   std::size_t Index;
+};
+
+template <class Range, class Better>
+std::size_t BestElement(const Range& R, Better fBetter, std::size_t Grain)
+{
+   const auto Src = MakeSource(R);
+   const std::size_t N = Src.size();
+   using T = ValueOf<Range>;
+   if (!N)
+      return 0;
+   const Candidate<T> Best = tbb::parallel_reduce(
+      tbb::blocked_range<std::size_t>(0, N, Grain), Candidate<T>{T{}, N},
+      [&Src, &fBetter, N](const tbb::blocked_range<std::size_t>& r, Candidate<T> c) {
+         std::size_t i = r.begin();
+         ForEachPiece(Src, r.begin(), r.end(), [&c, &fBetter, &i, N](auto p, std::size_t n) {
+            for (std::size_t k = 0; k < n; ++k, ++i)
+               if (c.Index == N || fBetter(p[k], c.Value))
+                  c = {p[k], i};
+         });
+         return c;
+      },
+      [&fBetter, N](const Candidate<T>& Left, const Candidate<T>& Right) {
+         // The left one wins the ties: the first best element, as in the STL
+         if (Left.Index == N)
+            return Right;
+         return Right.Index != N && fBetter(Right.Value, Left.Value) ? Right : Left;
+      });
+   return Best.Index;
+}
+
+} // namespace algorithms_detail
+
+/// Parallel std::count_if
+template <class Range, class Pred>
+std::size_t ParallelCountIf(const Range& R, Pred fPred, std::size_t Grain = algorithms_detail::DefaultGrain)
+{
+   const auto Src = algorithms_detail::MakeSource(R);
+   return tbb::parallel_reduce(
+      tbb::blocked_range<std::size_t>(0, Src.size(), Grain), std::size_t(0),
+      [&Src, &fPred](const tbb::blocked_range<std::size_t>& r, std::size_t Count) {
+         algorithms_detail::ForEachPiece(Src, r.begin(), r.end(), [&Count, &fPred](auto p, std::size_t n) {
+            for (std::size_t k = 0; k < n; ++k)
+               if (fPred(p[k]))
+                  ++Count;
+         });
+         return Count;
+      },
+      std::plus<std::size_t>());
+}
+
+/// Parallel std::transform_reduce: fReduce(Init, fTransform(x0), fTransform(x1), ...). fReduce must
+/// be associative; the grouping depends on the load, so floating-point results may change in the
+/// last bits from one run to the next (see tbb_reduce.h for a deterministic sum).
+template <class Range, class T, class Reduce, class Transform>
+T ParallelTransformReduce(const Range& R, T Init, Reduce fReduce, Transform fTransform, std::size_t Grain = algorithms_detail::DefaultGrain)
+{
+   using algorithms_detail::Partial;
+   const auto Src = algorithms_detail::MakeSource(R);
+   const Partial<T> Total = tbb::parallel_reduce(
+      tbb::blocked_range<std::size_t>(0, Src.size(), Grain), Partial<T>{},
+      [&Src, &fReduce, &fTransform](const tbb::blocked_range<std::size_t>& r, Partial<T> Acc) {
+         algorithms_detail::ForEachPiece(Src, r.begin(), r.end(), [&Acc, &fReduce, &fTransform](auto p, std::size_t n) {
+            std::size_t k = 0;
+            if (Acc.Empty && n)
+               Acc = {T(fTransform(p[k++])), false};
+            T Value = Acc.Value; // a local: the stores to Acc could alias *p
+            for (; k < n; ++k)
+               Value = fReduce(Value, fTransform(p[k]));
+            Acc.Value = Value;
+         });
+         return Acc;
+      },
+      [&fReduce](const Partial<T>& Left, const Partial<T>& Right) {
+         if (Left.Empty)
+            return Right;
+         return Right.Empty ? Left : Partial<T>{fReduce(Left.Value, Right.Value), false};
+      });
+   return Total.Empty ? Init : fReduce(Init, Total.Value);
+}
+
+/// Parallel std::inclusive_scan into Out (at least as large as In). Identity must be neutral for fOp.
+template <class InRange, class OutRange, class Op = std::plus<>, class T = algorithms_detail::ValueOf<InRange>>
+void ParallelInclusiveScan(const InRange& In, OutRange& Out, Op fOp = Op(), T Identity = T(), std::size_t Grain = algorithms_detail::DefaultGrain)
+{
+   const auto InSrc = algorithms_detail::MakeSource(In);
+   const auto OutSrc = algorithms_detail::MakeSource(Out);
+   tbb::parallel_scan(
+      tbb::blocked_range<std::size_t>(0, InSrc.size(), Grain), Identity,
+      [&InSrc, &OutSrc, &fOp](const tbb::blocked_range<std::size_t>& r, T Sum, bool IsFinal) {
+         if (IsFinal)
+            algorithms_detail::ForEachPiece(InSrc, OutSrc, r.begin(), r.end(), [&Sum, &fOp](auto pIn, auto pOut, std::size_t n) {
+               T Value = Sum; // a local: the stores to pOut could alias Sum
+               for (std::size_t k = 0; k < n; ++k)
+                  pOut[k] = Value = fOp(Value, pIn[k]);
+               Sum = Value;
+            });
+         else
+            algorithms_detail::ForEachPiece(InSrc, r.begin(), r.end(), [&Sum, &fOp](auto p, std::size_t n) {
+               for (std::size_t k = 0; k < n; ++k)
+                  Sum = fOp(Sum, p[k]);
+            });
+         return Sum;
+      },
+      fOp);
+}
+
+/// Parallel std::exclusive_scan into Out: Out[i] = Init op In[0] op ... op In[i - 1]. Init is
+/// scanned as the element before In[0]: the range that starts at 0 starts from it.
+template <class InRange, class OutRange, class T, class Op = std::plus<>>
+void ParallelExclusiveScan(const InRange& In, OutRange& Out, T Init, Op fOp = Op(), T Identity = T(), std::size_t Grain = algorithms_detail::DefaultGrain)
+{
+   const auto InSrc = algorithms_detail::MakeSource(In);
+   const auto OutSrc = algorithms_detail::MakeSource(Out);
+   tbb::parallel_scan(
+      tbb::blocked_range<std::size_t>(0, InSrc.size(), Grain), Identity,
+      [&InSrc, &OutSrc, &fOp, &Init](const tbb::blocked_range<std::size_t>& r, T Sum, bool IsFinal) {
+         if (r.begin() == 0)
+            Sum = Init;
+         if (IsFinal)
+            algorithms_detail::ForEachPiece(InSrc, OutSrc, r.begin(), r.end(), [&Sum, &fOp](auto pIn, auto pOut, std::size_t n) {
+               T Value = Sum;
+               for (std::size_t k = 0; k < n; ++k)
+               {
+                  const T x = pIn[k];
+                  pOut[k] = Value;
+                  Value = fOp(Value, x);
+               }
+               Sum = Value;
+            });
+         else
+            algorithms_detail::ForEachPiece(InSrc, r.begin(), r.end(), [&Sum, &fOp](auto p, std::size_t n) {
+               for (std::size_t k = 0; k < n; ++k)
+                  Sum = fOp(Sum, p[k]);
+            });
+         return Sum;
+      },
+      fOp);
+}
+
+/// Parallel std::copy_if (stream compaction), stable: Out is resized to the number of copies,
+/// which is returned. fPred is called twice per element (count, then copy).
+template <class Range, class T, class A, class Pred>
+std::size_t ParallelCopyIf(const Range& In, std::vector<T, A>& Out, Pred fPred, std::size_t Grain = algorithms_detail::DefaultGrain)
+{
+   const auto Src = algorithms_detail::MakeSource(In);
+   const std::size_t N = Src.size();
+   const std::size_t NbBlocks = (N + Grain - 1) / Grain;
+   std::vector<std::size_t> Offsets(NbBlocks + 1, 0);
+   tbb::parallel_for(std::size_t(0), NbBlocks, [&](std::size_t b) {
+      std::size_t Count = 0;
+      algorithms_detail::ForEachPiece(Src, b * Grain, std::min(N, (b + 1) * Grain), [&Count, &fPred](auto p, std::size_t n) {
+         for (std::size_t k = 0; k < n; ++k)
+            if (fPred(p[k]))
+               ++Count;
+      });
+      Offsets[b + 1] = Count;
+   });
+   std::partial_sum(Offsets.begin(), Offsets.end(), Offsets.begin());
+   Out.resize(Offsets.back());
+   T* Dest = Out.data();
+   tbb::parallel_for(std::size_t(0), NbBlocks, [&](std::size_t b) {
+      T* d = Dest + Offsets[b];
+      algorithms_detail::ForEachPiece(Src, b * Grain, std::min(N, (b + 1) * Grain), [&d, &fPred](auto p, std::size_t n) {
+         for (std::size_t k = 0; k < n; ++k)
+            if (fPred(p[k]))
+               *d++ = p[k];
+      });
+   });
+   return Offsets.back();
+}
+
+/// Parallel std::min_element: position of the first smallest element, size() when empty
+template <class Range, class Compare = std::less<>>
+std::size_t ParallelMinElement(const Range& R, Compare fLess = Compare(), std::size_t Grain = algorithms_detail::DefaultGrain)
+{
+   return algorithms_detail::BestElement(R, [&fLess](const auto& a, const auto& b) { return fLess(a, b); }, Grain);
+}
+
+/// Parallel std::max_element: position of the first largest element, size() when empty
+template <class Range, class Compare = std::less<>>
+std::size_t ParallelMaxElement(const Range& R, Compare fLess = Compare(), std::size_t Grain = algorithms_detail::DefaultGrain)
+{
+   return algorithms_detail::BestElement(R, [&fLess](const auto& a, const auto& b) { return fLess(b, a); }, Grain);
+}
+
+} // namespace tbb_demo
@@ -0,0 +1,258 @@
+// Allocation counters (TBB_DEMO_ALLOC_HOOKS), see AllocSnapshot in tbb_memory_usage.h.
+//
+// The executable interposes the malloc family (operator new and the TBB containers end up
+// there) and the scalable_* functions of tbbmalloc called from the demos (tbb::scalable_allocator).
+// Every call is forwarded to glibc (__libc_*) or to tbbmalloc (dlsym RTLD_NEXT) and counted in
+// a slot of the calling thread, so the threads do not share a cache line.
+// libtbb calls tbbmalloc through its own dlsym handle: the segments of a concurrent_vector and
+// the blocks of tbb::cache_aligned_allocator are not counted, only seen in the faults and RSS.
+#include "tbb_memory_usage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GLIBC__)
+#include <dlfcn.h>
+#include <malloc.h>
+#endif
+
+namespace {
+
+struct alignas(64) Slot
+{
+   std::atomic<std::uint64_t> Allocs{0};
+   std::atomic<std::uint64_t> Reallocs{0};
+   std::atomic<std::uint64_t> Frees{0};
+   std::atomic<std::uint64_t> Bytes{0};
+   std::atomic<std::uint64_t> FreedBytes{0};
+};
+
+/// Threads beyond MaxSlots share the last slot, the atomics keep the counts right
+constexpr unsigned MaxSlots = 256;
+Slot g_Slots[MaxSlots];
+std::atomic<unsigned> g_NbSlots{0};
+thread_local Slot* t_Slot = nullptr;
+
+Slot& LocalSlot()
+{
+   if (!t_Slot)
+      t_Slot = &g_Slots[std::min(g_NbSlots.fetch_add(1, std::memory_order_relaxed), MaxSlots - 1)];
+   return *t_Slot;
+}
+
+void CountAlloc(std::size_t Bytes)
+{
+   Slot& s = LocalSlot();
+   s.Allocs.fetch_add(1, std::memory_order_relaxed);
+   s.Bytes.fetch_add(Bytes, std::memory_order_relaxed);
+}
+
+void CountFree(std::size_t Bytes)
+{
+   Slot& s = LocalSlot();
+   s.Frees.fetch_add(1, std::memory_order_relaxed);
+   s.FreedBytes.fetch_add(Bytes, std::memory_order_relaxed);
+}
+
+void CountRealloc(std::size_t OldBytes, std::size_t NewBytes)
+{
+   Slot& s = LocalSlot();
+   s.Reallocs.fetch_add(1, std::memory_order_relaxed);
+   s.FreedBytes.fetch_add(OldBytes, std::memory_order_relaxed);
+   s.Bytes.fetch_add(NewBytes, std::memory_order_relaxed);
+}
+
+} // namespace
+
+namespace tbb_demo {
+
+AllocStats AllocSnapshot()
+{
+   AllocStats Total;
+   const unsigned n = std::min(g_NbSlots.load(std::memory_order_relaxed), MaxSlots);
+   for (unsigned i = 0; i < n; ++i)
+   {
+      Total.Allocs += g_Slots[i].Allocs.load(std::memory_order_relaxed);
+      Total.Reallocs += g_Slots[i].Reallocs.load(std::memory_order_relaxed);
+      Total.Frees += g_Slots[i].Frees.load(std::memory_order_relaxed);
+      Total.Bytes += g_Slots[i].Bytes.load(std::memory_order_relaxed);
+      Total.FreedBytes += g_Slots[i].FreedBytes.load(std::memory_order_relaxed);
+   }
+   return Total;
+}
+
+} // namespace tbb_demo
+
+#if defined(__GLIBC__)
+
+extern "C" {
+
+void* __libc_malloc(std::size_t);
+void* __libc_calloc(std::size_t, std::size_t);
+void* __libc_realloc(void*, std::size_t);
+void* __libc_memalign(std::size_t, std::size_t);
+void __libc_free(void*);
+
+void* malloc(std::size_t Size)
+{
+   void* p = __libc_malloc(Size);
+   if (p)
+      CountAlloc(malloc_usable_size(p));
+   return p;
+}
+
+void* calloc(std::size_t Count, std::size_t Size)
+{
+   void* p = __libc_calloc(Count, Size);
+   if (p)
+      CountAlloc(malloc_usable_size(p));
+   return p;
+}
+
+void* realloc(void* Old, std::size_t Size)
+{
+   const std::size_t OldBytes = Old ? malloc_usable_size(Old) : 0;
+   void* p = __libc_realloc(Old, Size);
+   if (!Old)
+   {
+      if (p)
+         CountAlloc(malloc_usable_size(p));
+   }
+   else if (!Size)
+      CountFree(OldBytes);
+   else if (p)
+      CountRealloc(OldBytes, malloc_usable_size(p));
+   return p;
+}
+
+void free(void* p)
+{
+   if (!p)
+      return;
+   CountFree(malloc_usable_size(p));
+   __libc_free(p);
+}
+
+void* memalign(std::size_t Alignment, std::size_t Size)
+{
+   void* p = __libc_memalign(Alignment, Size);
+   if (p)
+      CountAlloc(malloc_usable_size(p));
+   return p;
+}
+
+void* aligned_alloc(std::size_t Alignment, std::size_t Size)
+{
+   return memalign(Alignment, Size);
+}
+
+int posix_memalign(void** Result, std::size_t Alignment, std::size_t Size)
+{
+   if (Alignment % sizeof(void*) || (Alignment & (Alignment - 1)))
+      return 22; // EINVAL
+   void* p = memalign(Alignment, Size);
+   if (!p)
+      return 12; // ENOMEM
+   *Result = p;
+   return 0;
+}
+
+} // extern "C"
+
+namespace {
+
+/// The tbbmalloc definition of a scalable_* function that the executable interposes
+template <class Fn>
+Fn Next(const char* Name)
+{
+   return reinterpret_cast<Fn>(dlsym(RTLD_NEXT, Name));
+}
+
+} // namespace
+
+extern "C" {
+
+void* scalable_malloc(std::size_t Size)
+{
+   static const auto fNext = Next<void* (*)(std::size_t)>("scalable_malloc");
+   void* p = fNext(Size);
+   if (p)
+      CountAlloc(scalable_msize(p));
+   return p;
+}
+
+void* scalable_calloc(std::size_t Count, std::size_t Size)
+{
+   static const auto fNext = Next<void* (*)(std::size_t, std::size_t)>("scalable_calloc");
+   void* p = fNext(Count, Size);
+   if (p)
+      CountAlloc(scalable_msize(p));
+   return p;
+}
+
+void* scalable_realloc(void* Old, std::size_t Size)
+{
+   static const auto fNext = Next<void* (*)(void*, std::size_t)>("scalable_realloc");
+   const std::size_t OldBytes = Old ? scalable_msize(Old) : 0;
+   void* p = fNext(Old, Size);
+   if (!Old)
+   {
+      if (p)
+         CountAlloc(scalable_msize(p));
+   }
+   else if (!Size)
+      CountFree(OldBytes);
+   else if (p)
+      CountRealloc(OldBytes, scalable_msize(p));
+   return p;
+}
+
+void scalable_free(void* p)
+{
+   static const auto fNext = Next<void (*)(void*)>("scalable_free");
+   if (!p)
+      return;
+   CountFree(scalable_msize(p));
+   fNext(p);
+}
+
+void* scalable_aligned_malloc(std::size_t Size, std::size_t Alignment)
+{
+   static const auto fNext = Next<void* (*)(std::size_t, std::size_t)>("scalable_aligned_malloc");
+   void* p = fNext(Size, Alignment);
+   if (p)
+      CountAlloc(scalable_msize(p));
+   return p;
+}
+
+void* scalable_aligned_realloc(void* Old, std::size_t Size, std::size_t Alignment)
+{
+   static const auto fNext = Next<void* (*)(void*, std::size_t, std::size_t)>("scalable_aligned_realloc");
+   const std::size_t OldBytes = Old ? scalable_msize(Old) : 0;
+   void* p = fNext(Old, Size, Alignment);
+   if (!Old)
+   {
+      if (p)
+         CountAlloc(scalable_msize(p));
+   }
+   else if (!Size)
+      CountFree(OldBytes);
+   else if (p)
+      CountRealloc(OldBytes, scalable_msize(p));
+   return p;
+}
+
+void scalable_aligned_free(void* p)
+{
+   static const auto fNext = Next<void (*)(void*)>("scalable_aligned_free");
+   if (!p)
+      return;
+   CountFree(scalable_msize(p));
+   fNext(p);
+}
+
+} // extern "C"
+
+#endif // __GLIBC__
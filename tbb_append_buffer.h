@@ -0,0 +1,205 @@
+// Sharded append buffer: concurrent push_back without a shared lock or a shared counter.
+//
+// Every thread appends to its own shard (tbb::enumerable_thread_specific, one cache line
+// aligned shard per thread) and reserves its slots in batches: a shard is a list of blocks
+// whose size doubles from FirstBatch up to MaxBatch, so the fast path of push_back is a
+// compare and a store, and the memory wasted is at most one partially filled block per thread.
+//
+// Once the appends are done, Gather concatenates the blocks into one contiguous vector: a
+// parallel prefix sum of the block sizes gives the offset of every block, then the blocks are
+// copied in parallel. The order is the order of the blocks (shard by shard), not the order of
+// the calls; when the elements carry their position, GatherByIndex writes each of them at it.
+//
+//    ShardedAppendBuffer<size_t> Buffer;
+//    tbb::parallel_for(tbb::blocked_range<size_t>(0, N), [&Buffer](const tbb::blocked_range<size_t>& r) {
+//       auto& Local = Buffer.Local(); // one lookup per range instead of one per element
+//       for (size_t i = r.begin(); i != r.end(); ++i)
+//          Local.push_back(i);
+//    });
+//    std::vector<size_t> All = Buffer.Gather();
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/cache_aligned_allocator.h"
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_scan.h"
+
+namespace tbb_demo {
+
+template <class T>
+class ShardedAppendBuffer
+{
+   static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+                 "the blocks are neither constructed nor destroyed element by element");
+
+   struct BlockDeleter
+   {
+      std::size_t Capacity;
+      void operator()(T* p) const { tbb::cache_aligned_allocator<T>().deallocate(p, Capacity); }
+   };
+   using Block = std::unique_ptr<T[], BlockDeleter>;
+
+   /// Block of a shard and the number of elements written in it
+   struct Piece
+   {
+      const T* Data;
+      std::size_t Count;
+      std::size_t Offset; ///< in the gathered vector
+   };
+
+public:
+   static constexpr std::size_t DefaultFirstBatch = 256;
+   static constexpr std::size_t DefaultMaxBatch = 1 << 16;
+
+   /// Appends of one thread. Not thread-safe: only the thread that got it from Local() may use it.
+   class alignas(64) Shard
+   {
+   public:
+      Shard(std::size_t FirstBatch, std::size_t MaxBatch) : m_firstBatch(FirstBatch), m_maxBatch(MaxBatch) {}
+
+      void push_back(const T& Value)
+      {
+         if (m_cur == m_end)
+            Reserve();
+         *m_cur++ = Value;
+      }
+
+      std::size_t size() const { return m_blocks.empty() ? 0 : m_completed + std::size_t(m_cur - m_blocks.back().get()); }
+      std::size_t capacity() const { return m_completed + (m_blocks.empty() ? 0 : m_blocks.back().get_deleter().Capacity); }
+
+   private:
+      friend class ShardedAppendBuffer;
+
+      void Reserve()
+      {
+         std::size_t Batch = m_firstBatch;
+         if (!m_blocks.empty())
+         {
+            m_completed += m_blocks.back().get_deleter().Capacity;
+            Batch = std::min(2 * m_blocks.back().get_deleter().Capacity, m_maxBatch);
+         }
+         m_blocks.emplace_back(tbb::cache_aligned_allocator<T>().allocate(Batch), BlockDeleter{Batch});
+         m_cur = m_blocks.back().get();
+         m_end = m_cur + Batch;
+      }
+
+      template <class F>
+      void ForEachBlock(F fBlock) const
+      {
+         for (std::size_t b = 0; b < m_blocks.size(); ++b)
+            fBlock(m_blocks[b].get(), b + 1 < m_blocks.size() ? m_blocks[b].get_deleter().Capacity : std::size_t(m_cur - m_blocks[b].get()));
+      }
+
+      T* m_cur = nullptr;
+      T* m_end = nullptr;
+      std::size_t m_completed = 0; ///< elements in the full blocks, all but the last one
+      std::size_t m_firstBatch;
+      std::size_t m_maxBatch;
+      std::vector<Block> m_blocks;
+   };
+
+   explicit ShardedAppendBuffer(std::size_t FirstBatch = DefaultFirstBatch, std::size_t MaxBatch = DefaultMaxBatch)
+      : m_shards([FirstBatch, MaxBatch]() { return Shard(std::max<std::size_t>(FirstBatch, 1), std::max(FirstBatch, MaxBatch)); })
+   {}
+
+   /// Shard of the calling thread, to hoist the thread-local lookup out of a loop
+   Shard& Local() { return m_shards.local(); }
+
+   /// Thread-safe append to the shard of the calling thread
+   void push_back(const T& Value) { m_shards.local().push_back(Value); }
+
+   /// Number of elements, not to be called while other threads append
+   std::size_t size() const
+   {
+      std::size_t Total = 0;
+      for (const Shard& S : m_shards)
+         Total += S.size();
+      return Total;
+   }
+
+   /// Bytes reserved by the blocks and the shards
+   std::size_t MemoryBytes() const
+   {
+      std::size_t Bytes = 0;
+      for (const Shard& S : m_shards)
+         Bytes += S.capacity() * sizeof(T) + sizeof(Shard) + S.m_blocks.capacity() * sizeof(Block);
+      return Bytes;
+   }
+
+   std::size_t NbShards() const { return m_shards.size(); }
+
+   /// Releases all the blocks
+   void clear() { m_shards.clear(); }
+
+   /// Concatenation of all the shards in Out (resized to size()), shard after shard and in the
+   /// order of the appends within a block. With an allocator that does not value-initialize
+   /// (DefaultInitAllocator in tbb_numa.h) the resize does not write the memory a second time.
+   template <class Alloc>
+   void GatherInto(std::vector<T, Alloc>& Out) const
+   {
+      std::vector<Piece> Pieces = CollectPieces();
+      const std::size_t Total = tbb::parallel_scan(
+         tbb::blocked_range<std::size_t>(0, Pieces.size()), std::size_t(0),
+         [&Pieces](const tbb::blocked_range<std::size_t>& r, std::size_t Sum, bool IsFinal) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i)
+            {
+               if (IsFinal)
+                  Pieces[i].Offset = Sum;
+               Sum += Pieces[i].Count;
+            }
+            return Sum;
+         },
+         std::plus<std::size_t>());
+      Out.resize(Total);
+      T* Dest = Out.data();
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Pieces.size(), 1), [&Pieces, Dest](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            std::copy_n(Pieces[i].Data, Pieces[i].Count, Dest + Pieces[i].Offset);
+      });
+   }
+
+   std::vector<T> Gather() const
+   {
+      std::vector<T> Out;
+      GatherInto(Out);
+      return Out;
+   }
+
+   /// Ordered gather: every element is written at Out[fIndexOf(element)]. The indices must be
+   /// a permutation of [0, size()), e.g. the loop index of the append.
+   template <class Alloc, class IndexOf>
+   void GatherByIndex(std::vector<T, Alloc>& Out, IndexOf fIndexOf) const
+   {
+      const std::vector<Piece> Pieces = CollectPieces();
+      Out.resize(size());
+      T* Dest = Out.data();
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Pieces.size(), 1), [&Pieces, Dest, &fIndexOf](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            for (const T* p = Pieces[i].Data; p != Pieces[i].Data + Pieces[i].Count; ++p)
+               Dest[fIndexOf(*p)] = *p;
+      });
+   }
+
+private:
+   std::vector<Piece> CollectPieces() const
+   {
+      std::vector<Piece> Pieces;
+      for (const Shard& S : m_shards)
+         S.ForEachBlock([&Pieces](const T* Data, std::size_t Count) {
+            if (Count)
+               Pieces.push_back({Data, Count, 0});
+         });
+      return Pieces;
+   }
+
+   tbb::enumerable_thread_specific<Shard, tbb::cache_aligned_allocator<Shard>, tbb::ets_key_per_instance> m_shards;
+};
+
+} // namespace tbb_demo
@@ -0,0 +1,357 @@
+// Thread-local monotonic arenas with bulk release, for the many short-lived allocations of a
+// task that all die together at the end of the task.
+//
+// - ChunkFreeList: fixed-size chunks shared by all the threads. Released chunks go back to a
+//   lock-free stack (Treiber stack on a 32-bit chunk index plus a 32-bit tag against ABA)
+//   and are reused by any thread; the memory goes back to the system when the list is destroyed.
+// - MonotonicArena: bump allocation in the chunks of one thread. Deallocation is a no-op, the
+//   memory is released in bulk by Rewind(Mark) or Reset(): the chunks used after the mark are
+//   pushed back to the free list as one chain (a single CAS), whatever their number.
+// - ArenaPool: size classes (8 to 256 bytes) over the arena, freed blocks are reused by the
+//   following allocations of the same class before the bulk release.
+// - ArenaScope: RAII mark/rewind of a pool, e.g. around the body of a parallel_for. Scopes nest:
+//   a task stolen while the body waits rewinds only what it allocated.
+// - ArenaAllocator<T>: STL allocator on a pool, for containers local to a task (a container
+//   must be destroyed on the thread, and inside the scope, it was filled in).
+// - ThreadArenas: one pool per thread (tbb::enumerable_thread_specific) sharing one free list.
+//
+//    tbb_demo::ThreadArenas Arenas;
+//    tbb::parallel_for(tbb::blocked_range<size_t>(0, N), [&Arenas](const tbb::blocked_range<size_t>& r) {
+//       auto& Pool = Arenas.Local();
+//       tbb_demo::ArenaScope Scope(Pool); // everything below is released at once on exit
+//       std::list<int, tbb_demo::ArenaAllocator<int>> Nodes{tbb_demo::ArenaAllocator<int>(Pool)};
+//       ...
+//    });
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "tbb/concurrent_vector.h"
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/scalable_allocator.h"
+
+namespace tbb_demo {
+
+/// Start of every chunk, the usable memory follows it
+struct alignas(64) ArenaChunk
+{
+   std::atomic<std::uint32_t> Next{0}; ///< index + 1 of the next chunk in the free list or in the arena, 0: none
+   std::uint32_t Index = 0;            ///< in ChunkFreeList
+};
+
+class ChunkFreeList
+{
+public:
+   static constexpr std::size_t DefaultChunkSize = std::size_t(64) << 10;
+
+   explicit ChunkFreeList(std::size_t ChunkSize = DefaultChunkSize)
+      : m_chunkSize(std::max(ChunkSize, 2 * sizeof(ArenaChunk)))
+   {}
+   ChunkFreeList(const ChunkFreeList&) = delete;
+   ChunkFreeList& operator=(const ChunkFreeList&) = delete;
+   ~ChunkFreeList()
+   {
+      for (ArenaChunk* Chunk : m_chunks)
+      {
+         Chunk->~ArenaChunk();
+         scalable_aligned_free(Chunk);
+      }
+   }
+
+   std::size_t ChunkSize() const { return m_chunkSize; }
+   std::size_t UsableBytes() const { return m_chunkSize - sizeof(ArenaChunk); }
+   /// Chunks allocated from the system so far, free or in use
+   std::size_t NbChunks() const { return m_chunks.size(); }
+   std::size_t ReservedBytes() const { return NbChunks() * m_chunkSize; }
+
+   /// A free chunk, or a new one when the list is empty
+   ArenaChunk* Pop()
+   {
+      std::uint64_t Head = m_head.load(std::memory_order_acquire);
+      while (Head & IndexMask)
+      {
+         // The chunk may be popped and reused by another thread meanwhile, its Next is then
+         // stale but the tag of the head has changed and the CAS fails.
+         ArenaChunk* Chunk = m_chunks[(Head & IndexMask) - 1];
+         const std::uint64_t NewHead = NextTag(Head) | Chunk->Next.load(std::memory_order_relaxed);
+         if (m_head.compare_exchange_weak(Head, NewHead, std::memory_order_acquire, std::memory_order_acquire))
+            return Chunk;
+      }
+      void* Memory = scalable_aligned_malloc(m_chunkSize, alignof(ArenaChunk));
+      if (!Memory)
+         throw std::bad_alloc();
+      ArenaChunk* Chunk = ::new (Memory) ArenaChunk;
+      Chunk->Index = std::uint32_t(m_chunks.push_back(Chunk) - m_chunks.begin());
+      return Chunk;
+   }
+
+   /// Pushes the chain First -> ... -> Last (linked by their Next) in one CAS
+   void PushChain(ArenaChunk* First, ArenaChunk* Last)
+   {
+      std::uint64_t Head = m_head.load(std::memory_order_relaxed);
+      do
+         Last->Next.store(std::uint32_t(Head & IndexMask), std::memory_order_relaxed);
+      while (!m_head.compare_exchange_weak(Head, NextTag(Head) | (First->Index + 1), std::memory_order_release, std::memory_order_relaxed));
+   }
+
+   ArenaChunk* At(std::uint32_t IndexPlusOne) const { return m_chunks[IndexPlusOne - 1]; }
+
+private:
+   static constexpr std::uint64_t IndexMask = 0xffffffffULL;
+   static std::uint64_t NextTag(std::uint64_t Head) { return ((Head >> 32) + 1) << 32; }
+
+   std::size_t m_chunkSize;
+   alignas(64) std::atomic<std::uint64_t> m_head{0}; ///< tag << 32 | (index + 1)
+   tbb::concurrent_vector<ArenaChunk*> m_chunks;
+};
+
+class MonotonicArena
+{
+public:
+   /// Position to rewind to
+   struct Mark
+   {
+      ArenaChunk* Chunk;
+      char* Cur;
+      void* Oversized;
+   };
+
+   explicit MonotonicArena(ChunkFreeList& Chunks) : m_chunks(&Chunks) {}
+   MonotonicArena(const MonotonicArena&) = delete;
+   MonotonicArena& operator=(const MonotonicArena&) = delete;
+   MonotonicArena(MonotonicArena&& Other) noexcept
+      : m_chunks(Other.m_chunks), m_first(Other.m_first), m_current(Other.m_current), m_cur(Other.m_cur), m_end(Other.m_end), m_oversized(Other.m_oversized)
+   {
+      Other.m_first = Other.m_current = nullptr;
+      Other.m_cur = Other.m_end = nullptr;
+      Other.m_oversized = nullptr;
+   }
+   ~MonotonicArena()
+   {
+      Rewind({nullptr, nullptr, nullptr});
+   }
+
+   void* Allocate(std::size_t Bytes, std::size_t Align = alignof(std::max_align_t))
+   {
+      if (m_cur)
+      {
+         char* p = AlignUp(m_cur, Align);
+         if (p <= m_end && Bytes <= std::size_t(m_end - p))
+         {
+            m_cur = p + Bytes;
+            return p;
+         }
+      }
+      return AllocateSlow(Bytes, Align);
+   }
+
+   Mark GetMark() const { return {m_current, m_cur, m_oversized}; }
+
+   /// Releases everything allocated since the mark
+   void Rewind(const Mark& To)
+   {
+      while (m_oversized != To.Oversized)
+      {
+         void* Next = *static_cast<void**>(m_oversized);
+         scalable_aligned_free(m_oversized);
+         m_oversized = Next;
+      }
+      if (m_current == To.Chunk)
+      {
+         m_cur = To.Cur;
+         return;
+      }
+      ArenaChunk* First = To.Chunk ? m_chunks->At(To.Chunk->Next.load(std::memory_order_relaxed)) : m_first;
+      m_chunks->PushChain(First, m_current);
+      m_current = To.Chunk;
+      if (!To.Chunk)
+         m_first = nullptr;
+      m_cur = To.Cur;
+      m_end = To.Chunk ? Begin(To.Chunk) + m_chunks->UsableBytes() : nullptr;
+   }
+
+   /// Releases everything but keeps the first chunk
+   void Reset() { Rewind({m_first, m_first ? Begin(m_first) : nullptr, nullptr}); }
+
+private:
+   static char* Begin(ArenaChunk* Chunk) { return reinterpret_cast<char*>(Chunk + 1); }
+   static char* AlignUp(char* p, std::size_t Align)
+   {
+      return reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(p) + Align - 1) & ~(Align - 1));
+   }
+
+   void* AllocateSlow(std::size_t Bytes, std::size_t Align)
+   {
+      if (Bytes + Align > m_chunks->UsableBytes() / 4)
+      {
+         // Oversized: its own block, linked through a header to be freed by the rewind
+         const std::size_t Header = std::max(Align, sizeof(void*));
+         void* Block = scalable_aligned_malloc(Header + Bytes, std::max(Align, alignof(void*)));
+         if (!Block)
+            throw std::bad_alloc();
+         *static_cast<void**>(Block) = m_oversized;
+         m_oversized = Block;
+         return static_cast<char*>(Block) + Header;
+      }
+      ArenaChunk* Chunk = m_chunks->Pop();
+      if (m_current)
+         m_current->Next.store(Chunk->Index + 1, std::memory_order_relaxed);
+      else
+         m_first = Chunk;
+      m_current = Chunk;
+      m_cur = Begin(Chunk);
+      m_end = m_cur + m_chunks->UsableBytes();
+      return Allocate(Bytes, Align);
+   }
+
+   ChunkFreeList* m_chunks;
+   ArenaChunk* m_first = nullptr;
+   ArenaChunk* m_current = nullptr;
+   char* m_cur = nullptr;
+   char* m_end = nullptr;
+   void* m_oversized = nullptr; ///< list of the oversized blocks, newest first
+};
+
+class ArenaPool
+{
+public:
+   static constexpr std::size_t NbClasses = 6; ///< 8, 16, 32, 64, 128, 256 bytes
+   static constexpr std::size_t MaxClassBytes = std::size_t(8) << (NbClasses - 1);
+   static constexpr std::size_t ClassAlign = 16;
+
+   struct Mark
+   {
+      MonotonicArena::Mark Arena;
+      std::array<void*, NbClasses> Free;
+   };
+
+   explicit ArenaPool(ChunkFreeList& Chunks) : m_arena(Chunks) {}
+
+   void* Allocate(std::size_t Bytes, std::size_t Align = alignof(std::max_align_t))
+   {
+      if (Bytes > MaxClassBytes || Align > ClassAlign)
+         return m_arena.Allocate(Bytes, Align);
+      const std::size_t c = Class(Bytes, Align);
+      if (void* Block = m_free[c])
+      {
+         m_free[c] = *static_cast<void**>(Block);
+         return Block;
+      }
+      return m_arena.Allocate(std::size_t(8) << c, std::min(std::size_t(8) << c, ClassAlign));
+   }
+
+   /// Small blocks are kept for the next allocations of their class, bigger ones wait for the rewind
+   void Deallocate(void* p, std::size_t Bytes, std::size_t Align = alignof(std::max_align_t))
+   {
+      if (!p || Bytes > MaxClassBytes || Align > ClassAlign)
+         return;
+      const std::size_t c = Class(Bytes, Align);
+      *static_cast<void**>(p) = m_free[c];
+      m_free[c] = p;
+   }
+
+   /// The scope starts with empty class lists: a block freed in the scope may be released by the
+   /// rewind, and a block of the lists at the mark must not be handed out and overwritten.
+   Mark Enter()
+   {
+      Mark m{m_arena.GetMark(), m_free};
+      m_free.fill(nullptr);
+      return m;
+   }
+   void Leave(const Mark& m)
+   {
+      m_arena.Rewind(m.Arena);
+      m_free = m.Free;
+   }
+
+   void Reset()
+   {
+      m_arena.Reset();
+      m_free.fill(nullptr);
+   }
+
+   MonotonicArena& Arena() { return m_arena; }
+
+private:
+   /// Smallest class that holds Bytes and whose blocks are aligned to Align (a class of 8 << c
+   /// bytes is aligned to min(8 << c, ClassAlign))
+   static std::size_t Class(std::size_t Bytes, std::size_t Align)
+   {
+      const std::size_t Size = std::max(Bytes, Align);
+      std::size_t c = 0;
+      while ((std::size_t(8) << c) < Size)
+         ++c;
+      return c;
+   }
+
+   MonotonicArena m_arena;
+   std::array<void*, NbClasses> m_free{};
+};
+
+class ArenaScope
+{
+public:
+   explicit ArenaScope(ArenaPool& Pool) : m_pool(Pool), m_mark(Pool.Enter()) {}
+   ArenaScope(const ArenaScope&) = delete;
+   ArenaScope& operator=(const ArenaScope&) = delete;
+   ~ArenaScope() { m_pool.Leave(m_mark); }
+
+private:
+   ArenaPool& m_pool;
+   ArenaPool::Mark m_mark;
+};
+
+template <class T>
+class ArenaAllocator
+{
+public:
+   using value_type = T;
+
+   explicit ArenaAllocator(ArenaPool& Pool) noexcept : m_pool(&Pool) {}
+   template <class U>
+   ArenaAllocator(const ArenaAllocator<U>& Other) noexcept : m_pool(Other.Pool())
+   {}
+
+   T* allocate(std::size_t n) { return static_cast<T*>(m_pool->Allocate(n * sizeof(T), alignof(T))); }
+   void deallocate(T* p, std::size_t n) noexcept { m_pool->Deallocate(p, n * sizeof(T), alignof(T)); }
+
+   ArenaPool* Pool() const noexcept { return m_pool; }
+
+   template <class U>
+   bool operator==(const ArenaAllocator<U>& Other) const noexcept { return m_pool == Other.Pool(); }
+   template <class U>
+   bool operator!=(const ArenaAllocator<U>& Other) const noexcept { return m_pool != Other.Pool(); }
+
+private:
+   ArenaPool* m_pool;
+};
+
+class ThreadArenas
+{
+public:
+   explicit ThreadArenas(std::size_t ChunkSize = ChunkFreeList::DefaultChunkSize)
+      : m_chunks(ChunkSize), m_pools([this]() { return ArenaPool(m_chunks); })
+   {}
+
+   /// Pool of the calling thread
+   ArenaPool& Local() { return m_pools.local(); }
+
+   /// Releases the memory of every pool, not to be called while tasks use them
+   void ResetAll()
+   {
+      for (ArenaPool& Pool : m_pools)
+         Pool.Reset();
+   }
+
+   const ChunkFreeList& Chunks() const { return m_chunks; }
+
+private:
+   ChunkFreeList m_chunks; // before the pools: destroyed after them
+   tbb::enumerable_thread_specific<ArenaPool, tbb::cache_aligned_allocator<ArenaPool>, tbb::ets_key_per_instance> m_pools;
+};
+
+} // namespace tbb_demo
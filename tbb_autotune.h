@@ -0,0 +1,314 @@
+// Grain size and partitioner chosen per kernel by measurement, and remembered between runs.
+//
+// The best grain size depends on the cost of the body: a += per element wants big chunks, an
+// exp/log per element is fine with small ones and gains from the load balancing. The first
+// time a named kernel runs on an input of a given size class (floor(log2 n)), Autotuner times
+// the grid of Candidates() (simple, auto, static and affinity partitioners, grains from 1 to
+// 32768) on a prefix of the input of at most SampleSize elements and keeps the fastest. When
+// the prefix is shorter than the input, the winner is timed again against the default (auto,
+// grain 1) on the whole input, and the faster of the two is kept: a grain that wins on the
+// prefix may lose on a much larger input. The choice is stored in the profile under the CPU
+// model and the thread count (the arena concurrency, capped by a global_control), and written
+// to the profile file: later runs on the same machine load it and skip the search, a profile
+// copied to another machine or run with another thread count does not match and tunes again.
+// - Bodies must give the same result when run again on a sub-range (transforms, reductions):
+//   the search runs them on the prefix, and again on the whole input.
+// - One affinity_partitioner per kernel name is kept for the life of the tuner: call the same
+//   name on the same data and the chunks are replayed on the threads that already hold them.
+// - Not thread-safe: one call at a time on a tuner.
+//
+//    tbb_demo::Autotuner Tuner("tbb_demo.profile");
+//    Tuner.ParallelFor("cart2pol", N, [&](const tbb::blocked_range<size_t>& r) { ... });
+//    const double Sum = Tuner.ParallelReduce("sum_radius", N, 0., [&](const tbb::blocked_range<size_t>& r, double s) { ... }, std::plus<double>());
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/global_control.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/partitioner.h"
+#include "tbb/task_arena.h"
+
+namespace tbb_demo {
+
+enum class PartitionerKind
+{
+   Simple,
+   Auto,
+   Static,
+   Affinity
+};
+
+inline const char* PartitionerName(PartitionerKind Kind)
+{
+   switch (Kind)
+   {
+   case PartitionerKind::Simple: return "simple";
+   case PartitionerKind::Auto: return "auto";
+   case PartitionerKind::Static: return "static";
+   case PartitionerKind::Affinity: return "affinity";
+   }
+   return "?";
+}
+
+struct TuneChoice
+{
+   PartitionerKind Partitioner = PartitionerKind::Auto;
+   std::size_t Grain = 1;
+   double Seconds = 0.; ///< best time during the search, on the whole input when it was validated there
+};
+
+namespace autotune_detail {
+
+constexpr std::size_t DefaultSampleSize = std::size_t(1) << 18;
+/// Timed runs of every candidate, the best one counts
+constexpr int NbTimedRuns = 3;
+constexpr std::size_t Grains[] = {1, 64, 512, 4096, 32768};
+
+inline std::string CpuModel()
+{
+   std::string Model = "unknown";
+#if defined(__linux__)
+   std::ifstream CpuInfo("/proc/cpuinfo");
+   for (std::string Line; std::getline(CpuInfo, Line);)
+      if (Line.compare(0, 10, "model name") == 0)
+      {
+         const std::size_t Colon = Line.find(':');
+         if (Colon != std::string::npos)
+            Model = Line.substr(Line.find_first_not_of(' ', Colon + 1));
+         break;
+      }
+#endif
+   return Model;
+}
+
+/// Threads a parallel algorithm called here can use: the arena, capped by a global_control
+inline int Concurrency()
+{
+   const std::size_t Allowed = tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism);
+   return int(std::min<std::size_t>(std::size_t(tbb::this_task_arena::max_concurrency()), Allowed));
+}
+
+inline int SizeClass(std::size_t N)
+{
+   int c = 0;
+   while (N > 1)
+   {
+      N >>= 1;
+      ++c;
+   }
+   return c;
+}
+
+/// f(Partitioner) with the partitioner object of Kind
+template <class F>
+void WithPartitioner(PartitionerKind Kind, tbb::affinity_partitioner& Affinity, const F& f)
+{
+   switch (Kind)
+   {
+   case PartitionerKind::Simple: f(tbb::simple_partitioner()); break;
+   case PartitionerKind::Auto: f(tbb::auto_partitioner()); break;
+   case PartitionerKind::Static: f(tbb::static_partitioner()); break;
+   case PartitionerKind::Affinity: f(Affinity); break;
+   }
+}
+
+} // namespace autotune_detail
+
+class Autotuner
+{
+public:
+   /// No file with an empty ProfilePath: the choices only live as long as the tuner
+   explicit Autotuner(std::string ProfilePath = {}, std::size_t SampleSize = autotune_detail::DefaultSampleSize)
+      : m_path(std::move(ProfilePath)), m_cpu(autotune_detail::CpuModel()), m_sampleSize(std::max<std::size_t>(SampleSize, 1))
+   {
+      Load();
+   }
+   Autotuner(const Autotuner&) = delete;
+   Autotuner& operator=(const Autotuner&) = delete;
+
+   static std::vector<TuneChoice> Candidates()
+   {
+      std::vector<TuneChoice> ToReturn;
+      for (PartitionerKind Kind : {PartitionerKind::Simple, PartitionerKind::Auto, PartitionerKind::Static, PartitionerKind::Affinity})
+         for (std::size_t Grain : autotune_detail::Grains)
+            ToReturn.push_back({Kind, Grain, 0.});
+      return ToReturn;
+   }
+
+   /// Body(const tbb::blocked_range<std::size_t>&) over [0, N)
+   template <class Body>
+   void ParallelFor(const std::string& Kernel, std::size_t N, const Body& fBody)
+   {
+      auto fRun = [&fBody](std::size_t n, const TuneChoice& c, tbb::affinity_partitioner& Affinity) {
+         autotune_detail::WithPartitioner(c.Partitioner, Affinity, [&](auto&& Partitioner) {
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n, c.Grain), fBody, Partitioner);
+         });
+      };
+      fRun(N, Choose(Kernel, N, fRun), m_affinity[Kernel]);
+   }
+
+   /// RealBody(const tbb::blocked_range<std::size_t>&, const T&) -> T and Reduction(T, T) -> T over [0, N)
+   template <class T, class RealBody, class Reduction>
+   T ParallelReduce(const std::string& Kernel, std::size_t N, const T& Identity, const RealBody& fBody, const Reduction& fReduction)
+   {
+      T ToReturn = Identity;
+      auto fRun = [&](std::size_t n, const TuneChoice& c, tbb::affinity_partitioner& Affinity) {
+         autotune_detail::WithPartitioner(c.Partitioner, Affinity, [&](auto&& Partitioner) {
+            ToReturn = tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, n, c.Grain), Identity, fBody, fReduction, Partitioner);
+         });
+      };
+      fRun(N, Choose(Kernel, N, fRun), m_affinity[Kernel]);
+      return ToReturn;
+   }
+
+   /// Choice for Kernel on N elements on this CPU and this concurrency, nullptr before the first run
+   const TuneChoice* Find(const std::string& Kernel, std::size_t N) const
+   {
+      const auto It = m_profile.find(MakeKey(Kernel, N));
+      return It == m_profile.end() ? nullptr : &It->second;
+   }
+
+   /// Searches run by this tuner (the choices loaded from the file do not count)
+   std::size_t NbSearches() const { return m_nbSearches; }
+   const std::string& CpuModel() const { return m_cpu; }
+   const std::string& ProfilePath() const { return m_path; }
+
+private:
+   /// CPU model, concurrency, kernel name, size class
+   using Key = std::tuple<std::string, int, std::string, int>;
+
+   Key MakeKey(const std::string& Kernel, std::size_t N) const
+   {
+      return Key(m_cpu, autotune_detail::Concurrency(), Kernel, autotune_detail::SizeClass(N));
+   }
+
+   template <class Run>
+   const TuneChoice& Choose(const std::string& Kernel, std::size_t N, const Run& fRun)
+   {
+      if (Kernel.empty() || Kernel.find_first_of("\t\n") != std::string::npos)
+         throw std::invalid_argument("kernel name \"" + Kernel + "\": not empty, no tab or new line");
+      const Key k = MakeKey(Kernel, N);
+      const auto It = m_profile.find(k);
+      if (It != m_profile.end())
+         return It->second;
+
+      const std::size_t Sample = std::min(N, m_sampleSize);
+      const TuneChoice Default;
+      TuneChoice Best;
+      Best.Seconds = std::numeric_limits<double>::infinity();
+      fRun(Sample, Default, m_affinity[Kernel]); // first touch and warm caches
+      for (TuneChoice c : Candidates())
+      {
+         c.Seconds = Time(Sample, c, fRun);
+         if (c.Seconds < Best.Seconds)
+            Best = c;
+      }
+      // The prefix does not always behave as the whole input: the winner must beat the default there too
+      if (Sample < N && (Best.Partitioner != Default.Partitioner || Best.Grain != Default.Grain))
+      {
+         TuneChoice Fallback = Default;
+         Best.Seconds = Time(N, Best, fRun);
+         Fallback.Seconds = Time(N, Fallback, fRun);
+         if (Fallback.Seconds < Best.Seconds)
+            Best = Fallback;
+      }
+      ++m_nbSearches;
+      const TuneChoice& ToReturn = m_profile[k] = Best;
+      Save();
+      return ToReturn;
+   }
+
+   /// Best of NbTimedRuns runs of fRun on n elements with c
+   template <class Run>
+   static double Time(std::size_t n, const TuneChoice& c, const Run& fRun)
+   {
+      tbb::affinity_partitioner Affinity; // replayed by the timed runs, as by repeated calls
+      double Seconds = std::numeric_limits<double>::infinity();
+      for (int t = 0; t < autotune_detail::NbTimedRuns; ++t)
+      {
+         const auto Start = std::chrono::steady_clock::now();
+         fRun(n, c, Affinity);
+         Seconds = std::min(Seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count());
+      }
+      return Seconds;
+   }
+
+   /// One line per choice: cpu, threads, kernel, size class, partitioner, grain, seconds, tab separated
+   void Load()
+   {
+      if (m_path.empty())
+         return;
+      std::ifstream In(m_path);
+      for (std::string Line; std::getline(In, Line);)
+      {
+         if (Line.empty() || Line[0] == '#')
+            continue;
+         std::vector<std::string> Fields;
+         std::istringstream Stream(Line);
+         for (std::string Field; std::getline(Stream, Field, '\t');)
+            Fields.push_back(Field);
+         if (Fields.size() != 7)
+            continue;
+         TuneChoice c;
+         bool Known = false;
+         for (PartitionerKind Kind : {PartitionerKind::Simple, PartitionerKind::Auto, PartitionerKind::Static, PartitionerKind::Affinity})
+            if (Fields[4] == PartitionerName(Kind))
+            {
+               c.Partitioner = Kind;
+               Known = true;
+            }
+         try
+         {
+            c.Grain = std::stoul(Fields[5]);
+            c.Seconds = std::stod(Fields[6]);
+            if (Known && c.Grain > 0)
+               m_profile[Key(Fields[0], std::stoi(Fields[1]), Fields[2], std::stoi(Fields[3]))] = c;
+         }
+         catch (const std::logic_error&)
+         {
+            // a damaged line only costs a new search
+         }
+      }
+   }
+
+   /// Written to a temporary file renamed over the profile: a reader never sees half a file
+   void Save() const
+   {
+      if (m_path.empty())
+         return;
+      const std::string Temporary = m_path + ".tmp";
+      {
+         std::ofstream Out(Temporary, std::ios::trunc);
+         Out << "# tbb_demo autotune profile: cpu, threads, kernel, size class (log2 n), partitioner, grain, seconds in the search\n";
+         for (const auto& [k, c] : m_profile)
+            Out << std::get<0>(k) << '\t' << std::get<1>(k) << '\t' << std::get<2>(k) << '\t' << std::get<3>(k) << '\t'
+                << PartitionerName(c.Partitioner) << '\t' << c.Grain << '\t' << c.Seconds << '\n';
+         if (!Out.flush())
+            throw std::runtime_error(Temporary + ": cannot write the autotune profile");
+      }
+      if (std::rename(Temporary.c_str(), m_path.c_str()) != 0)
+         throw std::runtime_error(m_path + ": cannot replace the autotune profile");
+   }
+
+   std::string m_path;
+   std::string m_cpu;
+   std::size_t m_sampleSize;
+   std::size_t m_nbSearches = 0;
+   std::map<Key, TuneChoice> m_profile;
+   std::map<std::string, tbb::affinity_partitioner> m_affinity;
+};
+
+} // namespace tbb_demo
@@ -0,0 +1,314 @@
+// Benchmark harness implementation, see tbb_bench.h
+#include "tbb_bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <regex>
+#include <sstream>
+
+#include "tbb/global_control.h"
+#include "tbb/info.h"
+
+#include "tbb_kernels.h"
+#include "tbb_memory_usage.h"
+#include "tbb_trace.h"
+
+namespace tbb_bench {
+
+std::vector<Benchmark>& Registry()
+{
+   static std::vector<Benchmark> Benchmarks;
+   return Benchmarks;
+}
+
+double Result::Min() const { return Samples.empty() ? 0. : Samples.front(); }
+double Result::Median() const
+{
+   if (Samples.empty())
+      return 0.;
+   const std::size_t n = Samples.size();
+   return n % 2 ? Samples[n / 2] : 0.5 * (Samples[n / 2 - 1] + Samples[n / 2]);
+}
+double Result::P95() const
+{
+   // nearest rank
+   return Samples.empty() ? 0. : Samples[std::size_t(std::ceil(0.95 * double(Samples.size()))) - 1];
+}
+double Result::Mean() const
+{
+   return Samples.empty() ? 0. : std::accumulate(Samples.begin(), Samples.end(), 0.) / double(Samples.size());
+}
+double Result::ItemsPerSecond() const { return Median() > 0. ? double(Items) / Median() : 0.; }
+double Result::BytesPerSecond() const { return Median() > 0. ? double(Bytes) / Median() : 0.; }
+
+namespace {
+
+void PrintUsage(const char* Program)
+{
+   std::cout << "usage: " << Program << " [options]\n"
+             << "  --list                 list the scenarios and exit\n"
+             << "  --filter=REGEX         run the scenarios whose name matches REGEX\n"
+             << "  --threads=1,2,4|sweep  thread counts (sweep: powers of two up to the core count)\n"
+             << "  --size=N               problem size instead of the default of each scenario\n"
+             << "  --warmup=N             untimed runs before the samples (default 2)\n"
+             << "  --repetitions=N        timed runs (default 10)\n"
+             << "  --json=FILE            write the results as JSON\n"
+             << "  --csv=FILE             write the results as CSV\n"
+             << "  --trace=DIR            write a Chrome trace per result in DIR and print the utilization\n"
+             << "  --huge-pages           let tbbmalloc use huge pages (or TBB_DEMO_HUGE_PAGES=1)\n"
+             << "  --help                 print this help and exit\n";
+}
+
+std::vector<int> SweepThreads()
+{
+   const int Max = tbb::info::default_concurrency();
+   std::vector<int> Threads;
+   for (int n = 1; n < Max; n *= 2)
+      Threads.push_back(n);
+   Threads.push_back(Max);
+   return Threads;
+}
+
+std::string JsonEscape(const std::string& s)
+{
+   std::string Out;
+   for (char c : s)
+   {
+      if (c == '"' || c == '\\')
+         Out += '\\';
+      Out += c;
+   }
+   return Out;
+}
+
+std::string Timestamp()
+{
+   const std::time_t Now = std::time(nullptr);
+   char Buffer[32];
+   std::strftime(Buffer, sizeof(Buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&Now));
+   return Buffer;
+}
+
+/// One line for all the repetitions of a result: times, ranges and busy times add up
+tbb_demo::TraceStageSummary MergeStages(const std::vector<tbb_demo::TraceStageSummary>& Stages)
+{
+   tbb_demo::TraceStageSummary Merged;
+   for (const auto& S : Stages)
+   {
+      Merged.Name = S.Name;
+      Merged.Seconds += S.Seconds;
+      Merged.Concurrency = std::max(Merged.Concurrency, S.Concurrency);
+      Merged.Threads = std::max(Merged.Threads, S.Threads);
+      Merged.Ranges += S.Ranges;
+      Merged.Items += S.Items;
+      Merged.BusySeconds += S.BusySeconds;
+      Merged.MaxBusySeconds += S.MaxBusySeconds;
+   }
+   return Merged;
+}
+
+} // namespace
+
+bool ParseOptions(int argc, char** argv, Options& Opts)
+{
+   for (int a = 1; a < argc; ++a)
+   {
+      const std::string Arg = argv[a];
+      auto fValue = [&Arg](const char* Prefix, std::string& Value) {
+         const std::size_t n = std::char_traits<char>::length(Prefix);
+         if (Arg.compare(0, n, Prefix) != 0)
+            return false;
+         Value = Arg.substr(n);
+         return true;
+      };
+      std::string Value;
+      if (Arg == "--help")
+      {
+         PrintUsage(argv[0]);
+         Opts.Help = true;
+         return true;
+      }
+      else if (Arg == "--list")
+         Opts.List = true;
+      else if (Arg == "--huge-pages")
+         Opts.HugePages = true;
+      else if (fValue("--filter=", Value))
+         Opts.Filter = Value;
+      else if (fValue("--threads=", Value))
+      {
+         if (Value == "sweep")
+            Opts.Threads = SweepThreads();
+         else
+         {
+            std::stringstream Stream(Value);
+            for (std::string Item; std::getline(Stream, Item, ',');)
+               Opts.Threads.push_back(std::max(1, std::atoi(Item.c_str())));
+         }
+      }
+      else if (fValue("--size=", Value))
+         Opts.Size = std::size_t(std::strtoull(Value.c_str(), nullptr, 10));
+      else if (fValue("--warmup=", Value))
+         Opts.Warmup = std::max(0, std::atoi(Value.c_str()));
+      else if (fValue("--repetitions=", Value))
+         Opts.Repetitions = std::max(1, std::atoi(Value.c_str()));
+      else if (fValue("--json=", Value))
+         Opts.JsonPath = Value;
+      else if (fValue("--csv=", Value))
+         Opts.CsvPath = Value;
+      else if (fValue("--trace=", Value))
+         Opts.TraceDir = Value;
+      else
+      {
+         std::cerr << "unknown argument " << Arg << "\n";
+         PrintUsage(argv[0]);
+         return false;
+      }
+   }
+   return true;
+}
+
+std::vector<Result> Run(const Options& Opts)
+{
+   const std::regex Filter(Opts.Filter.empty() ? std::string(".*") : Opts.Filter);
+   const std::vector<int> Threads = Opts.Threads.empty() ? std::vector<int>{tbb::info::default_concurrency()} : Opts.Threads;
+   std::vector<Result> Results;
+   if ((Opts.HugePages || tbb_demo::HugePagesRequested()) && !Opts.List)
+      std::printf("tbbmalloc huge pages %s\n", tbb_demo::UseHugePages(true) ? "on" : "refused");
+   auto& Tracer = tbb_demo::Tracer::Instance();
+   std::unique_ptr<tbb_demo::TraceObserver> Observer;
+   if (!Opts.TraceDir.empty() && !Opts.List)
+   {
+      Tracer.Enable(true);
+      Observer = std::make_unique<tbb_demo::TraceObserver>("default arena");
+   }
+   for (const Benchmark& Bench : Registry())
+   {
+      if (!std::regex_search(Bench.Name, Filter))
+         continue;
+      if (Opts.List)
+      {
+         std::cout << Bench.Name << " (size " << Bench.DefaultSize << ")\n";
+         continue;
+      }
+      for (int NbThreads : Threads)
+      {
+         tbb::global_control Limit(tbb::global_control::max_allowed_parallelism, std::size_t(NbThreads));
+         Context Ctx;
+         Ctx.Size = Opts.Size ? Opts.Size : Bench.DefaultSize;
+         Ctx.Threads = NbThreads;
+         const Body Timed = Bench.Make(Ctx);
+
+         Result R{Bench.Name, NbThreads, Ctx.Size, Ctx.Items, Ctx.Bytes, {}};
+         for (int w = 0; w < Opts.Warmup; ++w)
+         {
+            if (Ctx.BeforeEach)
+               Ctx.BeforeEach();
+            Timed();
+         }
+         Tracer.Clear();
+         // sampled around the timed body only, BeforeEach and the bookkeeping are not counted
+         tbb_demo::MemoryProbe Probe;
+         tbb_demo::MemorySample Memory;
+         for (int r = 0; r < Opts.Repetitions; ++r)
+         {
+            if (Ctx.BeforeEach)
+               Ctx.BeforeEach();
+            Probe.Restart();
+            const auto Start = std::chrono::high_resolution_clock::now();
+            {
+               tbb_demo::TraceStage Stage(Bench.Name.c_str());
+               Timed();
+            }
+            const double Seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - Start).count();
+            if (tbb_demo::MemoryStatsEnabled())
+            {
+               const tbb_demo::MemorySample Run = Probe.Delta();
+               Memory.MinorFaults += Run.MinorFaults;
+               Memory.MajorFaults += Run.MajorFaults;
+               Memory.Allocs.Allocs += Run.Allocs.Allocs;
+               Memory.Allocs.Reallocs += Run.Allocs.Reallocs;
+               Memory.Allocs.Bytes += Run.Allocs.Bytes;
+               Memory.Rss = Run.Rss;
+            }
+            R.Samples.push_back(Seconds);
+         }
+         std::sort(R.Samples.begin(), R.Samples.end());
+         if (tbb_demo::MemoryStatsEnabled())
+         {
+            const double Runs = double(Opts.Repetitions);
+            R.AllocsPerRun = double(Memory.Allocs.Allocs + Memory.Allocs.Reallocs) / Runs;
+            R.AllocBytesPerRun = double(Memory.Allocs.Bytes) / Runs;
+            R.MinorFaultsPerRun = double(Memory.MinorFaults) / Runs;
+            R.MajorFaultsPerRun = double(Memory.MajorFaults) / Runs;
+            R.Rss = Memory.Rss;
+         }
+
+         std::printf("%-40s threads %3d  median %10.6fs  p95 %10.6fs  min %10.6fs", R.Name.c_str(), R.Threads, R.Median(), R.P95(), R.Min());
+         if (R.Items)
+            std::printf("  %9.2f Mitems/s", R.ItemsPerSecond() / 1e6);
+         if (R.Bytes)
+            std::printf("  %7.2f GB/s", R.BytesPerSecond() / 1e9);
+         std::printf("\n");
+         if (tbb_demo::MemoryStatsEnabled())
+            std::printf("%-40s per run: %.0f allocs  %.2f MiB allocated  %.0f minor faults  %.0f major faults  rss %.1f MiB\n", "", R.AllocsPerRun,
+                        R.AllocBytesPerRun / (1 << 20), R.MinorFaultsPerRun, R.MajorFaultsPerRun, double(R.Rss) / (1 << 20));
+         if (Observer)
+         {
+            std::string File = R.Name;
+            std::replace(File.begin(), File.end(), '/', '_');
+            Tracer.WriteChromeTrace(Opts.TraceDir + "/" + File + "_t" + std::to_string(R.Threads) + ".json");
+            std::printf("%s", tbb_demo::FormatTraceSummary({MergeStages(Tracer.Summarize())}).c_str());
+         }
+         std::fflush(stdout);
+         Results.push_back(std::move(R));
+      }
+   }
+   return Results;
+}
+
+void WriteJson(const std::string& Path, const std::vector<Result>& Results)
+{
+   std::ofstream Out(Path);
+   Out.precision(9);
+   Out << "{\n  \"timestamp\": \"" << Timestamp() << "\",\n"
+       << "  \"simd\": \"" << tbb_demo::SimdLevelName(tbb_demo::DetectSimdLevel()) << "\",\n"
+       << "  \"default_concurrency\": " << tbb::info::default_concurrency() << ",\n"
+       << "  \"results\": [\n";
+   for (std::size_t i = 0; i < Results.size(); ++i)
+   {
+      const Result& R = Results[i];
+      Out << "    {\"name\": \"" << JsonEscape(R.Name) << "\", \"threads\": " << R.Threads << ", \"size\": " << R.Size
+          << ", \"items\": " << R.Items << ", \"bytes\": " << R.Bytes << ", \"min\": " << R.Min()
+          << ", \"median\": " << R.Median() << ", \"p95\": " << R.P95() << ", \"mean\": " << R.Mean()
+          << ", \"items_per_second\": " << R.ItemsPerSecond() << ", \"bytes_per_second\": " << R.BytesPerSecond()
+          << ", \"allocs_per_run\": " << R.AllocsPerRun << ", \"alloc_bytes_per_run\": " << R.AllocBytesPerRun
+          << ", \"minor_faults_per_run\": " << R.MinorFaultsPerRun << ", \"major_faults_per_run\": " << R.MajorFaultsPerRun
+          << ", \"rss\": " << R.Rss << ", \"samples\": [";
+      for (std::size_t s = 0; s < R.Samples.size(); ++s)
+         Out << (s ? ", " : "") << R.Samples[s];
+      Out << "]}" << (i + 1 < Results.size() ? "," : "") << "\n";
+   }
+   Out << "  ]\n}\n";
+}
+
+void WriteCsv(const std::string& Path, const std::vector<Result>& Results)
+{
+   std::ofstream Out(Path);
+   Out.precision(9);
+   Out << "name,threads,size,items,bytes,min,median,p95,mean,items_per_second,bytes_per_second,"
+          "allocs_per_run,alloc_bytes_per_run,minor_faults_per_run,major_faults_per_run,rss\n";
+   for (const Result& R : Results)
+      Out << R.Name << "," << R.Threads << "," << R.Size << "," << R.Items << "," << R.Bytes << "," << R.Min() << ","
+          << R.Median() << "," << R.P95() << "," << R.Mean() << "," << R.ItemsPerSecond() << "," << R.BytesPerSecond() << ","
+          << R.AllocsPerRun << "," << R.AllocBytesPerRun << "," << R.MinorFaultsPerRun << "," << R.MajorFaultsPerRun << "," << R.Rss << "\n";
+}
+
+} // namespace tbb_bench
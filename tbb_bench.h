@@ -0,0 +1,115 @@
+// Benchmark harness: registry of named scenarios, warm-up and repetitions, statistics,
+// thread count sweeps and JSON/CSV reports.
+//
+// A scenario is registered with a factory. For every thread count, the factory prepares the
+// data (not timed) and returns the body to time; the body runs Warmup times, then Repetitions
+// times with one sample each. BeforeEach, when set, runs untimed before every run of the body
+// (e.g. to restore the unsorted input of a sort).
+//
+//    static tbb_bench::Registrar Reg("sum/accumulate", 10000000, [](tbb_bench::Context& Ctx) {
+//       auto Data = std::make_shared<std::vector<double>>(Ctx.Size, 1.);
+//       Ctx.Items = Ctx.Size;
+//       Ctx.Bytes = Ctx.Size * sizeof(double);
+//       return [Data]() { tbb_bench::DoNotOptimize(std::accumulate(Data->begin(), Data->end(), 0.)); };
+//    });
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace tbb_bench {
+
+struct Context
+{
+   std::size_t Size = 0;         ///< problem size asked for (items), the factory may ignore it
+   int Threads = 1;              ///< maximum parallelism of this run (tbb::global_control)
+   std::size_t Items = 0;        ///< items processed by one run of the body, for items/s
+   std::size_t Bytes = 0;        ///< bytes moved by one run of the body, for GB/s
+   std::function<void()> BeforeEach; ///< untimed, before every run of the body
+};
+
+using Body = std::function<void()>;
+using Factory = std::function<Body(Context&)>;
+
+struct Benchmark
+{
+   std::string Name;
+   std::size_t DefaultSize;
+   Factory Make;
+};
+
+/// All the registered scenarios, in registration order
+std::vector<Benchmark>& Registry();
+
+struct Registrar
+{
+   Registrar(std::string Name, std::size_t DefaultSize, Factory Make)
+   {
+      Registry().push_back({std::move(Name), DefaultSize, std::move(Make)});
+   }
+};
+
+/// Keeps the compiler from removing a computation whose result is not used
+template <class T>
+inline void DoNotOptimize(const T& Value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   asm volatile("" : : "r,m"(Value) : "memory");
+#else
+   static volatile const T* Sink;
+   Sink = &Value;
+#endif
+}
+
+struct Options
+{
+   std::string Filter;          ///< regular expression searched in the names, empty: all
+   std::vector<int> Threads;    ///< empty: the default concurrency only
+   std::size_t Size = 0;        ///< 0: the default size of each scenario
+   int Warmup = 2;
+   int Repetitions = 10;
+   bool List = false;
+   bool Help = false;           ///< --help: the usage is printed, nothing to run
+   std::string JsonPath;
+   std::string CsvPath;
+   std::string TraceDir;        ///< not empty: Chrome trace and utilization summary per result (tbb_trace.h)
+   bool HugePages = false;      ///< scalable_allocation_mode(TBBMALLOC_USE_HUGE_PAGES), also TBB_DEMO_HUGE_PAGES=1
+};
+
+struct Result
+{
+   std::string Name;
+   int Threads;
+   std::size_t Size;
+   std::size_t Items;
+   std::size_t Bytes;
+   std::vector<double> Samples; ///< seconds, sorted
+   // Memory cost of one timed run, averaged over the repetitions (tbb_memory_usage.h);
+   // the allocations are only counted when built with TBB_DEMO_ALLOC_HOOKS
+   double AllocsPerRun = 0.;
+   double AllocBytesPerRun = 0.;
+   double MinorFaultsPerRun = 0.;
+   double MajorFaultsPerRun = 0.;
+   std::size_t Rss = 0;         ///< after the last run
+   double Min() const;
+   double Median() const;
+   double P95() const;
+   double Mean() const;
+   double ItemsPerSecond() const; ///< at the median
+   double BytesPerSecond() const; ///< at the median
+};
+
+/// Parses --filter=, --threads= (list "1,2,4" or "sweep": powers of two up to the default
+/// concurrency), --size=, --warmup=, --repetitions=, --json=, --csv=, --trace=, --huge-pages,
+/// --list and --help (prints the usage and sets Help). Returns false (after printing the usage)
+/// on an unknown argument.
+bool ParseOptions(int argc, char** argv, Options& Opts);
+
+/// Runs the selected scenarios for every thread count and prints one line per result
+std::vector<Result> Run(const Options& Opts);
+
+void WriteJson(const std::string& Path, const std::vector<Result>& Results);
+void WriteCsv(const std::string& Path, const std::vector<Result>& Results);
+
+} // namespace tbb_bench
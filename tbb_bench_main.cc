@@ -0,0 +1,18 @@
+// Benchmark runner, e.g.
+//    bin/tbb_bench --filter=^sum/ --threads=sweep --json=sum.json
+#include "tbb_bench.h"
+
+int main(int argc, char** argv)
+{
+   tbb_bench::Options Opts;
+   if (!tbb_bench::ParseOptions(argc, argv, Opts))
+      return 1;
+   if (Opts.Help)
+      return 0;
+   const auto Results = tbb_bench::Run(Opts);
+   if (!Opts.JsonPath.empty())
+      tbb_bench::WriteJson(Opts.JsonPath, Results);
+   if (!Opts.CsvPath.empty())
+      tbb_bench::WriteCsv(Opts.CsvPath, Results);
+   return 0;
+}
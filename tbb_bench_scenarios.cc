@@ -0,0 +1,754 @@
+// The scenarios of tbb_test.cc registered in the benchmark harness, grouped by stage:
+// generation/, transform/, sort/, sum/, push_back/, alloc/, pipeline/, search/, algorithms/,
+// index/, stats/, counter/, flow/, precision/, chain/, tune/
+// The bodies wrapped with tbb_demo::Traced report their ranges with --trace.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "tbb/concurrent_vector.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_for_each.h"
+#include "tbb/partitioner.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/parallel_sort.h"
+#include "tbb/scalable_allocator.h"
+
+#include "tbb_algorithms.h"
+#include "tbb_append_buffer.h"
+#include "tbb_arena_allocator.h"
+#include "tbb_autotune.h"
+#include "tbb_bench.h"
+#include "tbb_coordinates.h"
+#include "tbb_fused_pipeline.h"
+#include "tbb_kernels.h"
+#include "tbb_point_generator.h"
+#include "tbb_polar_index.h"
+#include "tbb_radix_sort.h"
+#include "tbb_reduce.h"
+#include "tbb_search.h"
+#include "tbb_sharded_counter.h"
+#include "tbb_soa_points.h"
+#include "tbb_stage_graph.h"
+#include "tbb_stats.h"
+#include "tbb_trace.h"
+#include "tbb_transform_chain.h"
+#include "tbb_typed_points.h"
+
+namespace {
+
+using Point = std::array<double, 3>;
+using Points = std::vector<Point>;
+using tbb_bench::Context;
+using tbb_bench::DoNotOptimize;
+using tbb_bench::Registrar;
+using tbb_demo::Cart2Pol;
+
+constexpr std::size_t NbPoints = 10000000;
+constexpr std::size_t NbToPush = 10000000;
+constexpr std::uint64_t PointsSeed = 20220531;
+
+std::shared_ptr<Points> PhiloxPoints(std::size_t N)
+{
+   auto Data = std::make_shared<Points>(N);
+   tbb_demo::PointGenerator{PointsSeed}.ParallelFill(*Data);
+   return Data;
+}
+
+std::shared_ptr<Points> PolarPoints(std::size_t N)
+{
+   auto Data = PhiloxPoints(N);
+   tbb::parallel_for(std::size_t(0), N, [&Data](std::size_t i) { (*Data)[i] = Cart2Pol((*Data)[i]); });
+   return Data;
+}
+
+void SetPoints(Context& Ctx, std::size_t BytesPerPoint)
+{
+   Ctx.Items = Ctx.Size;
+   Ctx.Bytes = Ctx.Size * BytesPerPoint;
+}
+
+// generation/
+
+Registrar GenerationSeq("generation/mt19937_seq", NbPoints, [](Context& Ctx) {
+   auto Data = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, sizeof(Point));
+   return [Data]() {
+      std::mt19937 Gen(42);
+      std::uniform_real_distribution<double> Dist(-10000., 10000.);
+      for (Point& p : *Data)
+         p = {Dist(Gen), Dist(Gen), Dist(Gen)};
+      DoNotOptimize(Data->back());
+   };
+});
+
+Registrar GenerationTLPar("generation/mt19937_thread_local_par", NbPoints, [](Context& Ctx) {
+   auto Data = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, sizeof(Point));
+   return [Data]() {
+      tbb::parallel_for_each(Data->begin(), Data->end(), [](Point& p) {
+         thread_local std::mt19937 TLGen(std::random_device{}());
+         thread_local std::uniform_real_distribution<double> TLDist(-10000., 10000.);
+         p = {TLDist(TLGen), TLDist(TLGen), TLDist(TLGen)};
+      });
+   };
+});
+
+Registrar GenerationPhilox("generation/philox_par", NbPoints, [](Context& Ctx) {
+   auto Data = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, sizeof(Point));
+   return [Data]() { tbb_demo::PointGenerator{PointsSeed}.ParallelFill(*Data); };
+});
+
+Registrar GenerationPhiloxSoA("generation/philox_soa_par", NbPoints, [](Context& Ctx) {
+   auto Data = std::make_shared<tbb_demo::SoAPoints>(Ctx.Size);
+   SetPoints(Ctx, sizeof(Point));
+   return [Data]() { tbb_demo::PointGenerator{PointsSeed}.ParallelFill(*Data); };
+});
+
+// transform/
+
+Registrar TransformSeq("transform/cart2pol_seq", NbPoints, [](Context& Ctx) {
+   auto In = PhiloxPoints(Ctx.Size);
+   auto Out = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, 2 * sizeof(Point));
+   return [In, Out]() { std::transform(In->begin(), In->end(), Out->begin(), Cart2Pol<double>); };
+});
+
+Registrar TransformPar("transform/cart2pol_par", NbPoints, [](Context& Ctx) {
+   auto In = PhiloxPoints(Ctx.Size);
+   auto Out = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, 2 * sizeof(Point));
+   return [In, Out]() {
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, In->size()), tbb_demo::Traced("cart2pol", [&In, &Out](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            (*Out)[i] = Cart2Pol((*In)[i]);
+      }));
+   };
+});
+
+Registrar TransformSoA("transform/cart2pol_soa_simd_par", NbPoints, [](Context& Ctx) {
+   auto Data = std::make_shared<tbb_demo::SoAPoints>(Ctx.Size);
+   tbb_demo::PointGenerator{PointsSeed}.ParallelFill(*Data);
+   SetPoints(Ctx, 2 * sizeof(Point));
+   return [Data]() { tbb_demo::ParallelCart2Pol(*Data); };
+});
+
+// sort/ (by radius, the input is restored before every run)
+
+template <class SortFn>
+tbb_bench::Body SortBenchmark(Context& Ctx, SortFn fSort)
+{
+   auto Input = PolarPoints(Ctx.Size);
+   auto Data = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, sizeof(Point));
+   Ctx.BeforeEach = [Input, Data]() { *Data = *Input; };
+   return [Data, fSort]() { fSort(*Data); };
+}
+
+auto fByRadius = [](const Point& a, const Point& b) { return a[0] < b[0]; };
+
+Registrar SortSeq("sort/std_sort_seq", NbPoints, [](Context& Ctx) {
+   return SortBenchmark(Ctx, [](Points& Data) { std::sort(Data.begin(), Data.end(), fByRadius); });
+});
+
+Registrar SortPar("sort/parallel_sort", NbPoints, [](Context& Ctx) {
+   return SortBenchmark(Ctx, [](Points& Data) { tbb::parallel_sort(Data.begin(), Data.end(), fByRadius); });
+});
+
+Registrar SortRadix("sort/radix_par", NbPoints, [](Context& Ctx) {
+   return SortBenchmark(Ctx, [](Points& Data) { tbb_demo::ParallelRadixSort(Data, [](const Point& p) { return p[0]; }); });
+});
+
+Registrar SortRadixKeyIndex("sort/radix_key_index_par", NbPoints, [](Context& Ctx) {
+   return SortBenchmark(Ctx, [](Points& Data) { tbb_demo::ParallelRadixSortByKeyIndex(Data, [](const Point& p) { return p[0]; }); });
+});
+
+// sum/ (of the radii)
+
+Registrar SumSeq("sum/accumulate_seq", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   SetPoints(Ctx, sizeof(double));
+   return [Data]() {
+      DoNotOptimize(std::accumulate(Data->begin(), Data->end(), 0., [](double s, const Point& p) { return s + p[0]; }));
+   };
+});
+
+Registrar SumPar("sum/parallel_reduce", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   SetPoints(Ctx, sizeof(double));
+   return [Data]() {
+      DoNotOptimize(tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, Data->size(), 1000), 0.,
+         tbb_demo::Traced("sum", [&Data](const tbb::blocked_range<std::size_t>& r, double s) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i)
+               s += (*Data)[i][0];
+            return s;
+         }),
+         std::plus<double>()));
+   };
+});
+
+Registrar SumDeterministic("sum/deterministic_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   SetPoints(Ctx, sizeof(double));
+   return [Data]() { DoNotOptimize(tbb_demo::DeterministicSum(Data->data()->data(), Data->size(), 3)); };
+});
+
+Registrar SumLogSumExp("sum/log_sum_exp_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   SetPoints(Ctx, sizeof(double));
+   return [Data]() { DoNotOptimize(tbb_demo::LogSumExp(Data->data()->data(), Data->size(), 3)); };
+});
+
+// push_back/
+
+template <class PushFn>
+tbb_bench::Body PushBackBenchmark(Context& Ctx, PushFn fPush)
+{
+   Ctx.Items = Ctx.Size;
+   Ctx.Bytes = Ctx.Size * sizeof(std::size_t);
+   const std::size_t N = Ctx.Size;
+   return [N, fPush]() { fPush(N); };
+}
+
+Registrar PushBackSeq("push_back/vector_seq", NbToPush, [](Context& Ctx) {
+   return PushBackBenchmark(Ctx, [](std::size_t N) {
+      std::vector<std::size_t> Test;
+      for (std::size_t i = 0; i < N; ++i)
+         Test.push_back(i);
+      DoNotOptimize(Test.back());
+   });
+});
+
+Registrar PushBackMutex("push_back/vector_mutex_par", NbToPush, [](Context& Ctx) {
+   return PushBackBenchmark(Ctx, [](std::size_t N) {
+      std::mutex Mtx;
+      std::vector<std::size_t> Test;
+      tbb::parallel_for(std::size_t(0), N, [&Test, &Mtx](std::size_t i) {
+         std::lock_guard<std::mutex> Lock(Mtx);
+         Test.push_back(i);
+      });
+      DoNotOptimize(Test.back());
+   });
+});
+
+Registrar PushBackConcurrent("push_back/concurrent_vector_par", NbToPush, [](Context& Ctx) {
+   return PushBackBenchmark(Ctx, [](std::size_t N) {
+      tbb::concurrent_vector<std::size_t> Test;
+      tbb::parallel_for(std::size_t(0), N, [&Test](std::size_t i) { Test.push_back(i); });
+      DoNotOptimize(Test.back());
+   });
+});
+
+Registrar PushBackConcurrentSeq("push_back/concurrent_vector_seq", NbToPush, [](Context& Ctx) {
+   return PushBackBenchmark(Ctx, [](std::size_t N) {
+      tbb::concurrent_vector<std::size_t> Test;
+      for (std::size_t i = 0; i < N; ++i)
+         Test.push_back(i);
+      DoNotOptimize(Test.back());
+   });
+});
+
+Registrar PushBackScalable("push_back/concurrent_vector_scalable_par", NbToPush, [](Context& Ctx) {
+   return PushBackBenchmark(Ctx, [](std::size_t N) {
+      tbb::concurrent_vector<std::size_t, tbb::scalable_allocator<std::size_t>> Test;
+      tbb::parallel_for(std::size_t(0), N, [&Test](std::size_t i) { Test.push_back(i); });
+      DoNotOptimize(Test.back());
+   });
+});
+
+Registrar PushBackSharded("push_back/sharded_append_par", NbToPush, [](Context& Ctx) {
+   return PushBackBenchmark(Ctx, [](std::size_t N) {
+      tbb_demo::ShardedAppendBuffer<std::size_t> Test;
+      tbb::parallel_for(std::size_t(0), N, [&Test](std::size_t i) { Test.push_back(i); });
+      DoNotOptimize(Test.size());
+   });
+});
+
+Registrar PushBackShardedGather("push_back/sharded_append_gather_par", NbToPush, [](Context& Ctx) {
+   return PushBackBenchmark(Ctx, [](std::size_t N) {
+      tbb_demo::ShardedAppendBuffer<std::size_t> Test;
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N), [&Test](const tbb::blocked_range<std::size_t>& r) {
+         auto& Local = Test.Local();
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            Local.push_back(i);
+      });
+      DoNotOptimize(Test.Gather().back());
+   });
+});
+
+// alloc/ (3 small allocations and deallocations per item)
+
+Registrar AllocNew("alloc/new_delete_par", NbToPush, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size;
+   const std::size_t N = Ctx.Size;
+   return [N]() {
+      tbb::parallel_for(std::size_t(0), N, [](std::size_t) {
+         char* c = new char;
+         int* i = new int;
+         DoNotOptimize(c);
+         delete c;
+         double* d = new double;
+         DoNotOptimize(d);
+         delete d;
+         DoNotOptimize(i);
+         delete i;
+      });
+   };
+});
+
+Registrar AllocScalable("alloc/scalable_allocator_par", NbToPush, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size;
+   const std::size_t N = Ctx.Size;
+   return [N]() {
+      tbb::parallel_for(std::size_t(0), N, [](std::size_t) {
+         tbb::scalable_allocator<char> CharAllocator;
+         tbb::scalable_allocator<int> IntAllocator;
+         tbb::scalable_allocator<double> DoubleAllocator;
+         char* c = CharAllocator.allocate(1);
+         int* i = IntAllocator.allocate(1);
+         DoNotOptimize(c);
+         CharAllocator.deallocate(c, 1);
+         double* d = DoubleAllocator.allocate(1);
+         DoNotOptimize(d);
+         DoubleAllocator.deallocate(d, 1);
+         DoNotOptimize(i);
+         IntAllocator.deallocate(i, 1);
+      });
+   };
+});
+
+Registrar AllocArena("alloc/arena_pool_par", NbToPush, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size;
+   const std::size_t N = Ctx.Size;
+   auto Arenas = std::make_shared<tbb_demo::ThreadArenas>();
+   return [N, Arenas]() {
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N), [&Arenas](const tbb::blocked_range<std::size_t>& r) {
+         auto& Pool = Arenas->Local();
+         tbb_demo::ArenaScope Scope(Pool);
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+         {
+            void* c = Pool.Allocate(sizeof(char), alignof(char));
+            void* n = Pool.Allocate(sizeof(int), alignof(int));
+            DoNotOptimize(c);
+            Pool.Deallocate(c, sizeof(char), alignof(char));
+            void* d = Pool.Allocate(sizeof(double), alignof(double));
+            DoNotOptimize(d);
+            Pool.Deallocate(d, sizeof(double), alignof(double));
+            DoNotOptimize(n);
+            Pool.Deallocate(n, sizeof(int), alignof(int));
+         }
+      });
+   };
+});
+
+// pipeline/
+
+Registrar PipelineFused("pipeline/fused_generate_convert_reduce", NbPoints, [](Context& Ctx) {
+   SetPoints(Ctx, 0);
+   const std::size_t N = Ctx.Size;
+   return [N]() { DoNotOptimize(tbb_demo::FusedCart2PolPipeline(tbb_demo::PointGenerator{PointsSeed}, N).RadiusSum.Result()); };
+});
+
+// search/ (one far point planted in the middle of the points, the time to answer)
+
+bool IsFar(const Point& p) { return p[0] * p[0] + p[1] * p[1] + p[2] * p[2] > 4e8; }
+
+std::shared_ptr<Points> PointsWithFarMiddle(Context& Ctx)
+{
+   auto Data = PhiloxPoints(Ctx.Size);
+   (*Data)[Ctx.Size / 2] = {30000., 0., 0.};
+   SetPoints(Ctx, sizeof(Point));
+   return Data;
+}
+
+Registrar SearchFullScan("search/full_scan_par", NbPoints, [](Context& Ctx) {
+   auto Data = PointsWithFarMiddle(Ctx);
+   return [Data]() {
+      DoNotOptimize(tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, Data->size()), Data->size(),
+         [&Data](const tbb::blocked_range<std::size_t>& r, std::size_t Min) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i)
+               if (IsFar((*Data)[i]))
+                  Min = std::min(Min, i);
+            return Min;
+         },
+         [](std::size_t a, std::size_t b) { return std::min(a, b); }));
+   };
+});
+
+Registrar SearchFindFirstSeq("search/find_if_seq", NbPoints, [](Context& Ctx) {
+   auto Data = PointsWithFarMiddle(Ctx);
+   return [Data]() { DoNotOptimize(std::find_if(Data->begin(), Data->end(), IsFar)); };
+});
+
+Registrar SearchFindFirst("search/find_first_if_par", NbPoints, [](Context& Ctx) {
+   auto Data = PointsWithFarMiddle(Ctx);
+   return [Data]() { DoNotOptimize(tbb_demo::ParallelFindFirstIf(Data->begin(), Data->end(), IsFar)); };
+});
+
+Registrar SearchAnyOf("search/any_of_par", NbPoints, [](Context& Ctx) {
+   auto Data = PointsWithFarMiddle(Ctx);
+   return [Data]() { DoNotOptimize(tbb_demo::ParallelAnyOf(Data->begin(), Data->end(), IsFar)); };
+});
+
+// algorithms/ (sequential STL against tbb_algorithms.h, run both at several --size to find the crossover)
+
+// A lambda rather than a function: the pointer would not be inlined in the parallel bodies
+constexpr auto IsPositive = [](double x) { return x > 0.; };
+
+std::shared_ptr<std::vector<double>> Values(Context& Ctx, std::size_t BytesPerValue)
+{
+   auto Data = std::make_shared<std::vector<double>>(Ctx.Size);
+   tbb::parallel_for(std::size_t(0), Ctx.Size, [&Data](std::size_t i) { (*Data)[i] = std::sin(double(i)) * 1000.; });
+   Ctx.Items = Ctx.Size;
+   Ctx.Bytes = Ctx.Size * BytesPerValue;
+   return Data;
+}
+
+Registrar AlgoCountIfSeq("algorithms/count_if_seq", NbPoints, [](Context& Ctx) {
+   auto Data = Values(Ctx, sizeof(double));
+   return [Data]() { DoNotOptimize(std::count_if(Data->begin(), Data->end(), IsPositive)); };
+});
+
+Registrar AlgoCountIf("algorithms/count_if_par", NbPoints, [](Context& Ctx) {
+   auto Data = Values(Ctx, sizeof(double));
+   return [Data]() { DoNotOptimize(tbb_demo::ParallelCountIf(*Data, IsPositive)); };
+});
+
+Registrar AlgoCountIfSegmented("algorithms/count_if_concurrent_vector_par", NbPoints, [](Context& Ctx) {
+   auto Data = Values(Ctx, sizeof(double));
+   auto Grown = std::make_shared<tbb::concurrent_vector<double>>();
+   for (double x : *Data)
+      Grown->push_back(x);
+   return [Grown]() { DoNotOptimize(tbb_demo::ParallelCountIf(*Grown, IsPositive)); };
+});
+
+Registrar AlgoScanSeq("algorithms/inclusive_scan_seq", NbPoints, [](Context& Ctx) {
+   auto Data = Values(Ctx, 2 * sizeof(double));
+   auto Out = std::make_shared<std::vector<double>>(Ctx.Size);
+   return [Data, Out]() { std::inclusive_scan(Data->begin(), Data->end(), Out->begin()); };
+});
+
+Registrar AlgoScan("algorithms/inclusive_scan_par", NbPoints, [](Context& Ctx) {
+   auto Data = Values(Ctx, 2 * sizeof(double));
+   auto Out = std::make_shared<std::vector<double>>(Ctx.Size);
+   return [Data, Out]() { tbb_demo::ParallelInclusiveScan(*Data, *Out); };
+});
+
+Registrar AlgoCopyIfSeq("algorithms/copy_if_seq", NbPoints, [](Context& Ctx) {
+   auto Data = Values(Ctx, sizeof(double));
+   auto Out = std::make_shared<std::vector<double>>(Ctx.Size);
+   return [Data, Out]() { DoNotOptimize(std::copy_if(Data->begin(), Data->end(), Out->begin(), IsPositive)); };
+});
+
+Registrar AlgoCopyIf("algorithms/copy_if_par", NbPoints, [](Context& Ctx) {
+   auto Data = Values(Ctx, sizeof(double));
+   auto Out = std::make_shared<std::vector<double>>();
+   return [Data, Out]() { DoNotOptimize(tbb_demo::ParallelCopyIf(*Data, *Out, IsPositive)); };
+});
+
+// index/ (tbb_polar_index.h: build against the radius sort of sort/, queries against a scan)
+
+constexpr std::size_t NbQueries = 1000;
+
+std::vector<tbb_demo::ConeQuery> ConeQueries(std::size_t N)
+{
+   std::mt19937 Gen(PointsSeed);
+   std::uniform_real_distribution<double> Unit(0., 1.);
+   std::vector<tbb_demo::ConeQuery> Queries(N);
+   for (auto& q : Queries)
+   {
+      const double RMin = 15000. * Unit(Gen);
+      q = {RMin, RMin + 500. + 2500. * Unit(Gen), M_PI * (2. * Unit(Gen) - 1.), std::acos(2. * Unit(Gen) - 1.), 0.02 + 0.28 * Unit(Gen)};
+   }
+   return Queries;
+}
+
+Registrar IndexBuild("index/polar_build_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   SetPoints(Ctx, sizeof(Point));
+   return [Data]() { DoNotOptimize(tbb_demo::PolarIndex(*Data).size()); };
+});
+
+Registrar IndexCone("index/cone_queries_par", NbPoints, [](Context& Ctx) {
+   auto Index = std::make_shared<tbb_demo::PolarIndex>(*PolarPoints(Ctx.Size));
+   auto Queries = std::make_shared<std::vector<tbb_demo::ConeQuery>>(ConeQueries(NbQueries));
+   Ctx.Items = NbQueries;
+   return [Index, Queries]() {
+      tbb::parallel_for(std::size_t(0), Queries->size(), [&](std::size_t q) { DoNotOptimize(Index->CountCone((*Queries)[q])); });
+   };
+});
+
+Registrar IndexConeBruteForce("index/cone_brute_force_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   const tbb_demo::ConeQuery q = ConeQueries(1)[0];
+   Ctx.Items = 1;
+   Ctx.Bytes = Ctx.Size * sizeof(Point);
+   return [Data, q]() {
+      const double CosHalfAngle = std::cos(q.HalfAngle), CosPhi = std::cos(q.Phi), SinPhi = std::sin(q.Phi);
+      DoNotOptimize(tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, Data->size()), std::size_t(0),
+         [&](const tbb::blocked_range<std::size_t>& r, std::size_t Count) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i)
+            {
+               const Point& p = (*Data)[i];
+               Count += p[0] >= q.RMin && p[0] <= q.RMax &&
+                  CosPhi * std::cos(p[2]) + SinPhi * std::sin(p[2]) * std::cos(p[1] - q.Theta) >= CosHalfAngle;
+            }
+            return Count;
+         },
+         std::plus<std::size_t>()));
+   };
+});
+
+// stats/ (quantiles and top-k of the radii: streaming passes against sort then index)
+
+const std::vector<double> StatsProbabilities = {0.01, 0.25, 0.5, 0.75, 0.99};
+constexpr std::size_t StatsTopK = 100;
+
+Registrar StatsStreaming("stats/streaming_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   SetPoints(Ctx, sizeof(Point)); // per pass, the radii are strided in the points
+   return [Data]() {
+      DoNotOptimize(tbb_demo::ComputeStreamStats(tbb_demo::StridedValues(&(*Data)[0][0], Data->size(), 3), StatsProbabilities, StatsTopK).Quantiles[0]);
+   };
+});
+
+Registrar StatsSortThenIndex("stats/sort_then_index_par", NbPoints, [](Context& Ctx) {
+   return SortBenchmark(Ctx, [](Points& Data) {
+      tbb::parallel_sort(Data.begin(), Data.end(), fByRadius);
+      for (double p : StatsProbabilities)
+         DoNotOptimize(Data[std::size_t(p * double(Data.size() - 1))][0]);
+      for (std::size_t k = 0; k < StatsTopK; ++k)
+         DoNotOptimize(Data[Data.size() - 1 - k][0]);
+   });
+});
+
+// counter/ (one add to a shared statistic per item, meant for --threads=sweep)
+
+Registrar CounterAtomic("counter/shared_atomic_par", NbPoints, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size;
+   const std::size_t N = Ctx.Size;
+   return [N]() {
+      std::atomic<std::size_t> Shared{0};
+      tbb::parallel_for(std::size_t(0), N, [&Shared](std::size_t i) { Shared.fetch_add(i, std::memory_order_relaxed); });
+      DoNotOptimize(Shared.load());
+   };
+});
+
+Registrar CounterRacy("counter/racy_par", NbPoints, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size;
+   const std::size_t N = Ctx.Size;
+   return [N]() {
+      // load then store: the updates of the other threads in between are lost
+      std::atomic<std::size_t> Shared{0};
+      tbb::parallel_for(std::size_t(0), N, [&Shared](std::size_t i) { Shared.store(Shared.load(std::memory_order_relaxed) + i, std::memory_order_relaxed); });
+      DoNotOptimize(Shared.load());
+   };
+});
+
+Registrar CounterSharded("counter/sharded_par", NbPoints, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size;
+   const std::size_t N = Ctx.Size;
+   return [N]() {
+      tbb_demo::ShardedCounter<std::size_t> Counter;
+      tbb::parallel_for(std::size_t(0), N, [&Counter](std::size_t i) { Counter.Add(i); });
+      DoNotOptimize(Counter.Combine());
+   };
+});
+
+// the body of the parallel_for is copied with every task: tiny tasks to show the refcount updates
+constexpr std::size_t CaptureGrain = 64;
+
+Registrar CaptureSharedPtr("counter/shared_ptr_copy_capture_par", NbPoints, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size / CaptureGrain;
+   auto Shared = std::make_shared<std::atomic<std::size_t>>(0);
+   const std::size_t N = Ctx.Size;
+   return [N, Shared]() {
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N, CaptureGrain), [Shared](const tbb::blocked_range<std::size_t>& r) {
+         Shared->fetch_add(r.size(), std::memory_order_relaxed);
+      }, tbb::simple_partitioner());
+   };
+});
+
+Registrar CaptureReference("counter/reference_capture_par", NbPoints, [](Context& Ctx) {
+   Ctx.Items = Ctx.Size / CaptureGrain;
+   auto Shared = std::make_shared<std::atomic<std::size_t>>(0);
+   const std::size_t N = Ctx.Size;
+   return [N, Shared]() {
+      std::atomic<std::size_t>& Ref = *Shared;
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N, CaptureGrain), [&Ref](const tbb::blocked_range<std::size_t>& r) {
+         Ref.fetch_add(r.size(), std::memory_order_relaxed);
+      }, tbb::simple_partitioner());
+   };
+});
+
+// flow/ (generate -> convert -> sort radii and reduce, one stage after the other or as a DAG)
+
+std::shared_ptr<tbb_demo::StageGraph> StageBenchmark(Context& Ctx)
+{
+   struct Data
+   {
+      Points Cart, Polar;
+      std::vector<double> Radii;
+      double Sum = 0.;
+   };
+   auto d = std::make_shared<Data>();
+   d->Cart.resize(Ctx.Size);
+   d->Polar.resize(Ctx.Size);
+   d->Radii.resize(Ctx.Size);
+   SetPoints(Ctx, 2 * sizeof(Point));
+   auto Graph = std::make_shared<tbb_demo::StageGraph>();
+   const auto Generate = Graph->Add("generate", [d]() { tbb_demo::PointGenerator{PointsSeed}.ParallelFill(d->Cart); });
+   const auto Convert = Graph->Add("convert", [d]() {
+      tbb::parallel_for(std::size_t(0), d->Cart.size(), [&d](std::size_t i) { d->Polar[i] = Cart2Pol(d->Cart[i]); });
+   }, {Generate});
+   Graph->Add("sort radii", [d]() {
+      tbb::parallel_for(std::size_t(0), d->Polar.size(), [&d](std::size_t i) { d->Radii[i] = d->Polar[i][0]; });
+      tbb::parallel_sort(d->Radii.begin(), d->Radii.end());
+   }, {Convert});
+   Graph->Add("reduce", [d]() {
+      d->Sum = tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, d->Polar.size()), 0., [&d](const tbb::blocked_range<std::size_t>& r, double s) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            s += d->Polar[i][0];
+         return s;
+      }, std::plus<double>());
+   }, {Convert});
+   return Graph;
+}
+
+Registrar FlowSeq("flow/stages_seq", NbPoints, [](Context& Ctx) {
+   auto Graph = StageBenchmark(Ctx);
+   return [Graph]() { DoNotOptimize(Graph->RunSequential().Makespan); };
+});
+
+Registrar FlowGraph("flow/stage_graph_par", NbPoints, [](Context& Ctx) {
+   auto Graph = StageBenchmark(Ctx);
+   return [Graph]() { DoNotOptimize(Graph->Run().Makespan); };
+});
+
+// precision/ (float and double, AoS and SoA instantiations of tbb_typed_points.h)
+
+template <class Traits>
+tbb_bench::Body PrecisionCart2Pol(Context& Ctx)
+{
+   auto Data = std::make_shared<tbb_demo::TypedPoints<Traits>>(Ctx.Size);
+   tbb_demo::ParallelGenerate(*Data, tbb_demo::PointGenerator{PointsSeed});
+   SetPoints(Ctx, 6 * sizeof(typename Traits::Scalar));
+   return [Data]() { tbb_demo::ParallelCart2Pol(*Data); };
+}
+
+template <class Traits>
+tbb_bench::Body PrecisionSum(Context& Ctx)
+{
+   auto Data = std::make_shared<tbb_demo::TypedPoints<Traits>>(Ctx.Size);
+   tbb_demo::ParallelGenerate(*Data, tbb_demo::PointGenerator{PointsSeed});
+   tbb_demo::ParallelCart2Pol(*Data);
+   SetPoints(Ctx, (Traits::Storage == tbb_demo::PointLayout::SoA ? 1 : 3) * sizeof(typename Traits::Scalar));
+   return [Data]() { DoNotOptimize(tbb_demo::ParallelSumRadius(*Data)); };
+}
+
+using DoubleAoS = tbb_demo::PointTraits<double, tbb_demo::PointLayout::AoS>;
+using DoubleSoA = tbb_demo::PointTraits<double, tbb_demo::PointLayout::SoA>;
+using FloatAoS = tbb_demo::PointTraits<float, tbb_demo::PointLayout::AoS>;
+using FloatSoA = tbb_demo::PointTraits<float, tbb_demo::PointLayout::SoA>;
+using FloatSoADoubleSum = tbb_demo::PointTraits<float, tbb_demo::PointLayout::SoA, double>;
+
+Registrar PrecisionCart2PolDoubleAoS("precision/cart2pol_double_aos_par", NbPoints, PrecisionCart2Pol<DoubleAoS>);
+Registrar PrecisionCart2PolDoubleSoA("precision/cart2pol_double_soa_simd_par", NbPoints, PrecisionCart2Pol<DoubleSoA>);
+Registrar PrecisionCart2PolFloatAoS("precision/cart2pol_float_aos_par", NbPoints, PrecisionCart2Pol<FloatAoS>);
+Registrar PrecisionCart2PolFloatSoA("precision/cart2pol_float_soa_simd_par", NbPoints, PrecisionCart2Pol<FloatSoA>);
+Registrar PrecisionSumDoubleSoA("precision/sum_double_soa_par", NbPoints, PrecisionSum<DoubleSoA>);
+Registrar PrecisionSumFloatSoA("precision/sum_float_soa_par", NbPoints, PrecisionSum<FloatSoA>);
+Registrar PrecisionSumFloatSoADouble("precision/sum_float_soa_double_acc_par", NbPoints, PrecisionSum<FloatSoADoubleSum>);
+
+// chain/ (translate -> rotate -> Cartesian to spherical -> unit conversion of tbb_transform_chain.h)
+
+auto PipelineChain()
+{
+   const double Axis = 1. / std::sqrt(3.);
+   return tbb_demo::MakeChain(tbb_demo::Translate{{-250., 125., 500.}}, tbb_demo::Rotate::AboutAxis({Axis, Axis, Axis}, 0.3))
+          | tbb_demo::CartesianToSpherical{} | tbb_demo::ScaleCoordinates{{1e-3, 180. / M_PI, 180. / M_PI}};
+}
+
+Registrar ChainFused("chain/fused_par", NbPoints, [](Context& Ctx) {
+   auto In = PhiloxPoints(Ctx.Size);
+   auto Out = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, 2 * sizeof(Point));
+   return [In, Out]() { tbb_demo::ParallelTransform(PipelineChain(), *In, *Out); };
+});
+
+Registrar ChainStaged("chain/staged_par", NbPoints, [](Context& Ctx) {
+   auto In = PhiloxPoints(Ctx.Size);
+   auto Out = std::make_shared<Points>(Ctx.Size);
+   SetPoints(Ctx, decltype(PipelineChain())::NbStages * 2 * sizeof(Point));
+   return [In, Out]() { tbb_demo::ParallelTransformStaged(PipelineChain(), *In, *Out); };
+});
+
+// tune/ (the transform and the sums with the grain and partitioner of tbb_autotune.h, against
+// transform/cart2pol_par and sum/parallel_reduce; the search runs in the setup, for every thread count)
+
+Registrar TuneCart2Pol("tune/cart2pol_tuned_par", NbPoints, [](Context& Ctx) {
+   auto In = PhiloxPoints(Ctx.Size);
+   auto Out = std::make_shared<Points>(Ctx.Size);
+   auto Tuner = std::make_shared<tbb_demo::Autotuner>();
+   SetPoints(Ctx, 2 * sizeof(Point));
+   auto fRun = [In, Out, Tuner]() {
+      Tuner->ParallelFor("cart2pol", In->size(), [&In, &Out](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            (*Out)[i] = Cart2Pol((*In)[i]);
+      });
+   };
+   fRun();
+   return fRun;
+});
+
+Registrar TuneSum("tune/sum_tuned_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   auto Tuner = std::make_shared<tbb_demo::Autotuner>();
+   SetPoints(Ctx, sizeof(double));
+   auto fRun = [Data, Tuner]() {
+      DoNotOptimize(Tuner->ParallelReduce("sum_radius", Data->size(), 0., [&Data](const tbb::blocked_range<std::size_t>& r, double s) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            s += (*Data)[i][0];
+         return s;
+      }, std::plus<double>()));
+   };
+   fRun();
+   return fRun;
+});
+
+double SumExpLog(const Points& Data, const tbb::blocked_range<std::size_t>& r, double s)
+{
+   for (std::size_t i = r.begin(); i != r.end(); ++i)
+      s = std::log(std::exp(Data[i][0]) * std::exp(s));
+   return s;
+}
+
+Registrar TuneSumExpLogDefault("tune/sum_exp_log_default_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   SetPoints(Ctx, sizeof(double));
+   return [Data]() {
+      DoNotOptimize(tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, Data->size(), 1000), 0.,
+         [&Data](const tbb::blocked_range<std::size_t>& r, double s) { return SumExpLog(*Data, r, s); }, std::plus<double>()));
+   };
+});
+
+Registrar TuneSumExpLog("tune/sum_exp_log_tuned_par", NbPoints, [](Context& Ctx) {
+   auto Data = PolarPoints(Ctx.Size);
+   auto Tuner = std::make_shared<tbb_demo::Autotuner>();
+   SetPoints(Ctx, sizeof(double));
+   auto fRun = [Data, Tuner]() {
+      DoNotOptimize(Tuner->ParallelReduce("sum_radius_exp_log", Data->size(), 0.,
+         [&Data](const tbb::blocked_range<std::size_t>& r, double s) { return SumExpLog(*Data, r, s); }, std::plus<double>()));
+   };
+   fRun();
+   return fRun;
+});
+
+} // namespace
@@ -0,0 +1,29 @@
+// The conversions of tbb_Cartesian_to_Polar between Cartesian (x, y, z) and polar (r, theta, phi)
+// coordinates, written once for the demos, the benchmarks and the headers that need a scalar
+// reference. Templates on the scalar type, so that float points convert in float.
+#pragma once
+#include <array>
+#include <cmath>
+
+namespace tbb_demo {
+
+/// The formula of fCart2Pol (std::hypot and std::acos overloads of Real)
+template <class Real>
+inline std::array<Real, 3> Cart2Pol(const std::array<Real, 3>& CartPt)
+{
+   std::array<Real, 3> ToReturn;
+   ToReturn[0] = std::hypot(CartPt[0], CartPt[1], CartPt[2]);
+   ToReturn[1] = std::acos(CartPt[0] / std::hypot(CartPt[0], CartPt[1])) * (CartPt[1] < 0 ? -1 : 1);
+   ToReturn[2] = std::acos(CartPt[2] / ToReturn[0]);
+   return ToReturn;
+}
+
+/// Cartesian coordinates of a polar point (r, theta, phi), the inverse of Cart2Pol
+template <class Real>
+inline std::array<Real, 3> PolarToCartesian(const std::array<Real, 3>& Polar)
+{
+   const Real SinPhi = std::sin(Polar[2]);
+   return {Polar[0] * SinPhi * std::cos(Polar[1]), Polar[0] * SinPhi * std::sin(Polar[1]), Polar[0] * std::cos(Polar[2])};
+}
+
+} // namespace tbb_demo
@@ -0,0 +1,146 @@
+// Streaming generate -> convert -> reduce without materializing the dataset.
+//
+// The materialized path of Demo 1 keeps whole vectors of Cartesian and polar points and every
+// stage is a full pass over memory. Here a tbb::parallel_pipeline moves tiles of TileSize points
+// through the stages while they are still in cache:
+//    source (serial)      : takes a free tile and gives it the next [Begin, End) of the dataset
+//    convert (parallel)   : Philox generation and Cart2Pol of the tile
+//    reduce (parallel)    : radius histogram and compensated radius sum of the tile
+//    merge (serial order) : adds the tile results to the totals and gives the tile back
+// At most MaxTiles tiles exist (they are the pipeline tokens), so the memory used does not
+// depend on the number of points. The tiles are merged in dataset order, so the sum is the
+// same bit for bit whatever the number of threads.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "tbb/concurrent_queue.h"
+#include "tbb/parallel_pipeline.h"
+#include "tbb/task_arena.h"
+
+#include "tbb_kernels.h"
+#include "tbb_memory_usage.h"
+#include "tbb_point_generator.h"
+#include "tbb_reduce.h"
+#include "tbb_soa_points.h"
+
+namespace tbb_demo {
+
+struct FusedPipelineConfig
+{
+   std::size_t TileSize = 1 << 14; ///< points per tile, rounded up to SoAPoints::Padding
+   std::size_t MaxTiles = 0;       ///< tiles in flight, 0: twice the arena concurrency
+   std::size_t NbBins = 64;        ///< radius histogram over [0, MaxRadius]
+   double MaxRadius = 0.;          ///< 0: the largest radius of the generator, Extent * sqrt(3)
+};
+
+struct FusedPipelineResult
+{
+   std::size_t NbPoints = 0;
+   CompensatedSum RadiusSum;
+   double BinWidth = 0.;
+   std::vector<std::size_t> Histogram; ///< bin b counts the radii in [b, b + 1) * BinWidth
+   std::size_t MaxTiles = 0;
+   std::size_t TileBytes = 0;       ///< memory of one tile, the pipeline holds MaxTiles of them
+   std::size_t MaxTilesInFlight = 0; ///< observed
+   std::size_t PeakRss = 0;         ///< largest CurrentRss() sampled while the pipeline ran
+};
+
+/// Histogram bin of a radius, the last bin also holds the radii above the range
+inline std::size_t RadiusBin(double r, double BinWidth, std::size_t NbBins)
+{
+   return std::min(NbBins - 1, std::size_t(r / BinWidth));
+}
+
+/// Sum and histogram of the radii of the points [0, NbPoints) of Generator, one tile at a time
+inline FusedPipelineResult FusedCart2PolPipeline(const PointGenerator& Generator, std::size_t NbPoints,
+                                                 const FusedPipelineConfig& Config = {})
+{
+   struct Tile
+   {
+      explicit Tile(std::size_t Size, std::size_t NbBins) : Points(Size), Histogram(NbBins) {}
+      SoAPoints Points;
+      std::size_t Begin = 0, End = 0;
+      CompensatedPair Sum{};
+      std::vector<std::size_t> Histogram;
+   };
+   constexpr std::size_t RssSamplingPeriod = 64; // tiles
+
+   FusedPipelineResult Result;
+   const std::size_t TileSize = (std::max<std::size_t>(Config.TileSize, 1) + SoAPoints::Padding - 1) / SoAPoints::Padding * SoAPoints::Padding;
+   const std::size_t MaxTiles = Config.MaxTiles ? Config.MaxTiles : 2 * std::size_t(tbb::this_task_arena::max_concurrency());
+   const std::size_t NbBins = std::max<std::size_t>(Config.NbBins, 1);
+   const double MaxRadius = Config.MaxRadius > 0. ? Config.MaxRadius : Generator.Extent * std::sqrt(3.);
+   const SimdLevel Level = Generator.Level;
+   Result.NbPoints = NbPoints;
+   Result.BinWidth = MaxRadius / double(NbBins);
+   Result.Histogram.assign(NbBins, 0);
+   Result.MaxTiles = MaxTiles;
+   Result.TileBytes = 6 * TileSize * sizeof(double) + NbBins * sizeof(std::size_t);
+   Result.PeakRss = CurrentRss();
+
+   std::vector<std::unique_ptr<Tile>> Tiles;
+   tbb::concurrent_queue<Tile*> FreeTiles;
+   for (std::size_t t = 0; t < MaxTiles; ++t)
+   {
+      Tiles.push_back(std::make_unique<Tile>(TileSize, NbBins));
+      FreeTiles.push(Tiles.back().get());
+   }
+
+   std::size_t Next = 0, NbMerged = 0;
+   std::atomic<std::size_t> InFlight{0};
+   const double BinWidth = Result.BinWidth;
+   tbb::parallel_pipeline(
+      MaxTiles,
+      tbb::make_filter<void, Tile*>(tbb::filter_mode::serial_in_order,
+         [&](tbb::flow_control& fc) -> Tile* {
+            if (Next >= NbPoints)
+            {
+               fc.stop();
+               return nullptr;
+            }
+            Tile* t = nullptr;
+            FreeTiles.try_pop(t); // never empty: there are as many tiles as tokens
+            t->Begin = Next;
+            t->End = Next = std::min(NbPoints, Next + TileSize);
+            const std::size_t Count = InFlight.fetch_add(1) + 1;
+            Result.MaxTilesInFlight = std::max(Result.MaxTilesInFlight, Count);
+            return t;
+         }) &
+      tbb::make_filter<Tile*, Tile*>(tbb::filter_mode::parallel,
+         [&Generator, Level](Tile* t) -> Tile* {
+            SoAPoints& P = t->Points;
+            const std::size_t Padded = (t->End - t->Begin + SoAPoints::Padding - 1) / SoAPoints::Padding * SoAPoints::Padding;
+            Generator.FillTile(P, t->Begin, t->End);
+            Cart2PolKernel(Level, P.X(), P.Y(), P.Z(), P.R(), P.Theta(), P.Phi(), 0, Padded);
+            return t;
+         }) &
+      tbb::make_filter<Tile*, Tile*>(tbb::filter_mode::parallel,
+         [Level, BinWidth, NbBins](Tile* t) -> Tile* {
+            const std::size_t Count = t->End - t->Begin;
+            const double* R = t->Points.R();
+            std::fill(t->Histogram.begin(), t->Histogram.end(), std::size_t(0));
+            for (std::size_t i = 0; i < Count; ++i)
+               ++t->Histogram[RadiusBin(R[i], BinWidth, NbBins)];
+            t->Sum = CompensatedSumKernel(Level, R, Count, 1);
+            return t;
+         }) &
+      tbb::make_filter<Tile*, void>(tbb::filter_mode::serial_in_order,
+         [&](Tile* t) {
+            Result.RadiusSum += CompensatedSum{t->Sum.Sum, t->Sum.Comp};
+            for (std::size_t b = 0; b < NbBins; ++b)
+               Result.Histogram[b] += t->Histogram[b];
+            if (++NbMerged % RssSamplingPeriod == 0)
+               Result.PeakRss = std::max(Result.PeakRss, CurrentRss());
+            InFlight.fetch_sub(1);
+            FreeTiles.push(t);
+         }));
+   Result.PeakRss = std::max(Result.PeakRss, CurrentRss());
+   return Result;
+}
+
+} // namespace tbb_demo
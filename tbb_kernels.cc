@@ -0,0 +1,141 @@
+// Runtime selection of the kernel instruction set
+#include "tbb_kernels.h"
+
+namespace tbb_demo {
+
+namespace {
+
+bool CpuSupports(SimdLevel Level)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+   switch (Level)
+   {
+   case SimdLevel::Scalar:
+      return true;
+   case SimdLevel::AVX2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+   case SimdLevel::AVX512:
+      return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+   }
+   return false;
+#else
+   return Level == SimdLevel::Scalar;
+#endif
+}
+
+} // namespace
+
+bool IsSimdLevelAvailable(SimdLevel Level)
+{
+   switch (Level)
+   {
+   case SimdLevel::Scalar:
+      return true;
+   case SimdLevel::AVX2:
+      return avx2::Compiled() && CpuSupports(Level);
+   case SimdLevel::AVX512:
+      return avx512::Compiled() && CpuSupports(Level);
+   }
+   return false;
+}
+
+SimdLevel DetectSimdLevel()
+{
+   static const SimdLevel Best = []() {
+      if (IsSimdLevelAvailable(SimdLevel::AVX512))
+         return SimdLevel::AVX512;
+      if (IsSimdLevelAvailable(SimdLevel::AVX2))
+         return SimdLevel::AVX2;
+      return SimdLevel::Scalar;
+   }();
+   return Best;
+}
+
+const char* SimdLevelName(SimdLevel Level)
+{
+   switch (Level)
+   {
+   case SimdLevel::Scalar:
+      return "SCALAR";
+   case SimdLevel::AVX2:
+      return "AVX2";
+   case SimdLevel::AVX512:
+      return "AVX512";
+   }
+   return "?";
+}
+
+void Cart2PolKernel(SimdLevel Level, const double* X, const double* Y, const double* Z,
+                    double* R, double* Theta, double* Phi, std::size_t Begin, std::size_t End)
+{
+   switch (Level)
+   {
+   case SimdLevel::AVX512:
+      return avx512::Cart2Pol(X, Y, Z, R, Theta, Phi, Begin, End);
+   case SimdLevel::AVX2:
+      return avx2::Cart2Pol(X, Y, Z, R, Theta, Phi, Begin, End);
+   case SimdLevel::Scalar:
+      break;
+   }
+   scalar::Cart2Pol(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void Cart2PolKernel(SimdLevel Level, const float* X, const float* Y, const float* Z,
+                    float* R, float* Theta, float* Phi, std::size_t Begin, std::size_t End)
+{
+   switch (Level)
+   {
+   case SimdLevel::AVX512:
+      return avx512::Cart2PolF(X, Y, Z, R, Theta, Phi, Begin, End);
+   case SimdLevel::AVX2:
+      return avx2::Cart2PolF(X, Y, Z, R, Theta, Phi, Begin, End);
+   case SimdLevel::Scalar:
+      break;
+   }
+   scalar::Cart2PolF(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void GeneratePointsKernel(SimdLevel Level, std::uint64_t Seed, double Extent, std::size_t Begin, std::size_t End,
+                          double* X, double* Y, double* Z, std::size_t Stride)
+{
+   switch (Level)
+   {
+   case SimdLevel::AVX512:
+      return avx512::GeneratePoints(Seed, Extent, Begin, End, X, Y, Z, Stride);
+   case SimdLevel::AVX2:
+      return avx2::GeneratePoints(Seed, Extent, Begin, End, X, Y, Z, Stride);
+   case SimdLevel::Scalar:
+      break;
+   }
+   scalar::GeneratePoints(Seed, Extent, Begin, End, X, Y, Z, Stride);
+}
+
+CompensatedPair CompensatedSumKernel(SimdLevel Level, const double* X, std::size_t N, std::size_t Stride)
+{
+   switch (Level)
+   {
+   case SimdLevel::AVX512:
+      return avx512::CompensatedSum(X, N, Stride);
+   case SimdLevel::AVX2:
+      return avx2::CompensatedSum(X, N, Stride);
+   case SimdLevel::Scalar:
+      break;
+   }
+   return scalar::CompensatedSum(X, N, Stride);
+}
+
+LogSumExpPair LogSumExpKernel(SimdLevel Level, const double* X, std::size_t N, std::size_t Stride)
+{
+   switch (Level)
+   {
+   case SimdLevel::AVX512:
+      return avx512::LogSumExp(X, N, Stride);
+   case SimdLevel::AVX2:
+      return avx2::LogSumExp(X, N, Stride);
+   case SimdLevel::Scalar:
+      break;
+   }
+   return scalar::LogSumExp(X, N, Stride);
+}
+
+} // namespace tbb_demo
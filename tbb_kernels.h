@@ -0,0 +1,96 @@
+// Vectorized kernels with runtime selection of the instruction set.
+//
+// Every kernel exists in one namespace per instruction set (scalar, avx2, avx512), each
+// compiled in its own translation unit with the matching flags. The functions in the
+// tbb_demo namespace pick one of them from a SimdLevel, usually DetectSimdLevel().
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace tbb_demo {
+
+enum class SimdLevel
+{
+   Scalar,
+   AVX2,
+   AVX512
+};
+
+/// Best level supported by both this build and the running CPU
+SimdLevel DetectSimdLevel();
+/// True when the kernels of this level were compiled in and the CPU can run them
+bool IsSimdLevelAvailable(SimdLevel Level);
+const char* SimdLevelName(SimdLevel Level);
+
+/// Cartesian to polar (r, theta, phi) over [Begin, End) of separate x/y/z arrays
+void Cart2PolKernel(SimdLevel Level, const double* X, const double* Y, const double* Z,
+                    double* R, double* Theta, double* Phi, std::size_t Begin, std::size_t End);
+/// Same in single precision, twice as many lanes per register
+void Cart2PolKernel(SimdLevel Level, const float* X, const float* Y, const float* Z,
+                    float* R, float* Theta, float* Phi, std::size_t Begin, std::size_t End);
+
+/// Points [Begin, End) of the reproducible dataset of PhiloxPoint() (tbb_philox.h): point i is
+/// written at X[(i - Begin) * Stride], Y[(i - Begin) * Stride], Z[(i - Begin) * Stride] (Stride 1
+/// for SoA columns, 3 for std::array<double, 3> points), i.e. the pointers are those of point Begin.
+/// The bits do not depend on the level nor on the split of [0, N) into [Begin, End) chunks.
+void GeneratePointsKernel(SimdLevel Level, std::uint64_t Seed, double Extent, std::size_t Begin, std::size_t End,
+                          double* X, double* Y, double* Z, std::size_t Stride);
+
+/// Running sum and compensation (rounding errors not yet added back) of a compensated sum
+struct CompensatedPair
+{
+   double Sum;
+   double Comp;
+};
+/// Logical accumulators of CompensatedSumKernel, whatever the SIMD width
+constexpr std::size_t CompensatedSumLanes = 8;
+
+/// Neumaier compensated sum of X[0], X[Stride], ... X[(N - 1) * Stride], the result is the
+/// same bit for bit for every level
+CompensatedPair CompensatedSumKernel(SimdLevel Level, const double* X, std::size_t N, std::size_t Stride);
+
+/// Partial log-sum-exp: log(sum exp(x)) = Max + log(Scaled), with Scaled = sum exp(x - Max)
+struct LogSumExpPair
+{
+   double Max;
+   double Scaled;
+};
+
+/// Max and sum of exp(x - Max) of X[0], X[Stride], ... X[(N - 1) * Stride] with a vectorized
+/// exp (terms below 1e-308 relative to the max are flushed to 0)
+LogSumExpPair LogSumExpKernel(SimdLevel Level, const double* X, std::size_t N, std::size_t Stride);
+
+/// Number of representable doubles between a and b (0 when equal, +/-0 are equal)
+inline std::uint64_t UlpDistance(double a, double b)
+{
+   auto fOrdered = [](double d) -> std::int64_t {
+      std::uint64_t u;
+      std::memcpy(&u, &d, sizeof(d));
+      const auto Magnitude = std::int64_t(u & 0x7FFFFFFFFFFFFFFFULL);
+      return (u >> 63) ? -Magnitude : Magnitude;
+   };
+   const std::int64_t ia = fOrdered(a), ib = fOrdered(b);
+   return ia > ib ? std::uint64_t(ia) - std::uint64_t(ib) : std::uint64_t(ib) - std::uint64_t(ia);
+}
+
+#define TBB_DEMO_DECLARE_KERNELS(NS)                                                          \
+   namespace NS {                                                                             \
+   bool Compiled();                                                                           \
+   void Cart2Pol(const double* X, const double* Y, const double* Z, double* R, double* Theta, \
+                 double* Phi, std::size_t Begin, std::size_t End);                            \
+   void Cart2PolF(const float* X, const float* Y, const float* Z, float* R, float* Theta,      \
+                  float* Phi, std::size_t Begin, std::size_t End);                            \
+   void GeneratePoints(std::uint64_t Seed, double Extent, std::size_t Begin, std::size_t End,   \
+                       double* X, double* Y, double* Z, std::size_t Stride);                    \
+   CompensatedPair CompensatedSum(const double* X, std::size_t N, std::size_t Stride);        \
+   LogSumExpPair LogSumExp(const double* X, std::size_t N, std::size_t Stride);               \
+   }
+
+TBB_DEMO_DECLARE_KERNELS(scalar)
+TBB_DEMO_DECLARE_KERNELS(avx2)
+TBB_DEMO_DECLARE_KERNELS(avx512)
+
+#undef TBB_DEMO_DECLARE_KERNELS
+
+} // namespace tbb_demo
@@ -0,0 +1,82 @@
+// AVX2 + FMA instantiation of the kernels, this file is compiled with -mavx2 -mfma
+// (see CMakeLists.txt). Without those flags it only provides scalar forwarders.
+#include "tbb_kernels.h"
+
+#if defined(__AVX2__)
+#define TBB_DEMO_KERNEL_NS avx2
+#include "tbb_kernels_impl.h"
+
+namespace tbb_demo::avx2 {
+
+bool Compiled() { return true; }
+
+void Cart2Pol(const double* X, const double* Y, const double* Z, double* R, double* Theta,
+              double* Phi, std::size_t Begin, std::size_t End)
+{
+   Cart2PolLoop<Avx2D>(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void Cart2PolF(const float* X, const float* Y, const float* Z, float* R, float* Theta,
+               float* Phi, std::size_t Begin, std::size_t End)
+{
+   Cart2PolLoop<Avx2F>(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void GeneratePoints(std::uint64_t Seed, double Extent, std::size_t Begin, std::size_t End,
+                    double* X, double* Y, double* Z, std::size_t Stride)
+{
+   GeneratePointsLoop<Avx2D>(Seed, Extent, Begin, End, X, Y, Z, Stride);
+   // The loop passes vectors to a call and GCC leaves the upper halves dirty on return: the
+   // SSE code of libm called next (sin, cos...) would then run many times slower
+   _mm256_zeroupper();
+}
+
+CompensatedPair CompensatedSum(const double* X, std::size_t N, std::size_t Stride)
+{
+   return CompensatedSumLoop<Avx2D>(X, N, Stride);
+}
+
+LogSumExpPair LogSumExp(const double* X, std::size_t N, std::size_t Stride)
+{
+   return LogSumExpLoop<Avx2D>(X, N, Stride);
+}
+
+} // namespace tbb_demo::avx2
+
+#else
+
+namespace tbb_demo::avx2 {
+
+bool Compiled() { return false; }
+
+void Cart2Pol(const double* X, const double* Y, const double* Z, double* R, double* Theta,
+              double* Phi, std::size_t Begin, std::size_t End)
+{
+   scalar::Cart2Pol(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void Cart2PolF(const float* X, const float* Y, const float* Z, float* R, float* Theta,
+               float* Phi, std::size_t Begin, std::size_t End)
+{
+   scalar::Cart2PolF(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void GeneratePoints(std::uint64_t Seed, double Extent, std::size_t Begin, std::size_t End,
+                    double* X, double* Y, double* Z, std::size_t Stride)
+{
+   scalar::GeneratePoints(Seed, Extent, Begin, End, X, Y, Z, Stride);
+}
+
+CompensatedPair CompensatedSum(const double* X, std::size_t N, std::size_t Stride)
+{
+   return scalar::CompensatedSum(X, N, Stride);
+}
+
+LogSumExpPair LogSumExp(const double* X, std::size_t N, std::size_t Stride)
+{
+   return scalar::LogSumExp(X, N, Stride);
+}
+
+} // namespace tbb_demo::avx2
+
+#endif
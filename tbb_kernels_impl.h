@@ -0,0 +1,296 @@
+// Kernel templates, written once over the Ops wrappers of tbb_simd.h.
+//
+// Included by tbb_kernels_scalar.cc, tbb_kernels_avx2.cc and tbb_kernels_avx512.cc, each one
+// defining TBB_DEMO_KERNEL_NS to its own namespace and being compiled with its own flags.
+//
+// Only plain functions and the Ops wrappers are used here: an inline std:: template (std::max,
+// containers...) instantiated in an AVX translation unit could be the copy picked by the
+// linker for the scalar code as well.
+#pragma once
+#include "tbb_kernels.h"
+#include "tbb_philox.h"
+#include "tbb_simd.h"
+
+namespace tbb_demo::TBB_DEMO_KERNEL_NS {
+
+// atan(a) for a in [0, 1], Cephes rational approximation (~1 ulp)
+template <class Ops>
+inline typename Ops::V AtanUnit(typename Ops::V a)
+{
+   using V = typename Ops::V;
+   constexpr double PIO4 = 7.85398163397448309616E-1;
+   constexpr double MOREBITS = 6.123233995736765886130E-17;
+
+   const auto Big = Ops::Gt(a, Ops::Set1(0.66));
+   const V One = Ops::Set1(1.);
+   const V x = Ops::Select(Big, Ops::Div(Ops::Sub(a, One), Ops::Add(a, One)), a);
+   const V y0 = Ops::Select(Big, Ops::Set1(PIO4), Ops::Set1(0.));
+   const V More = Ops::Select(Big, Ops::Set1(0.5 * MOREBITS), Ops::Set1(0.));
+
+   const V z = Ops::Mul(x, x);
+   V P = Ops::Set1(-8.750608600031904122785E-1);
+   P = Ops::Fma(P, z, Ops::Set1(-1.615753718733365076637E1));
+   P = Ops::Fma(P, z, Ops::Set1(-7.500855792314704667340E1));
+   P = Ops::Fma(P, z, Ops::Set1(-1.228866684490136173410E2));
+   P = Ops::Fma(P, z, Ops::Set1(-6.485021904942025371773E1));
+   V Q = Ops::Add(z, Ops::Set1(2.485846490142306297962E1));
+   Q = Ops::Fma(Q, z, Ops::Set1(1.650270098316988542046E2));
+   Q = Ops::Fma(Q, z, Ops::Set1(4.328810604912902668951E2));
+   Q = Ops::Fma(Q, z, Ops::Set1(4.853903996359136964868E2));
+   Q = Ops::Fma(Q, z, Ops::Set1(1.945506571482613964425E2));
+
+   const V t = Ops::Fma(x, Ops::Div(Ops::Mul(z, P), Q), x);
+   return Ops::Add(y0, Ops::Add(t, More));
+}
+
+// atan2(y, x) in [-pi, pi], reduced to atan of min(|x|,|y|)/max(|x|,|y|)
+template <class Ops>
+inline typename Ops::V Atan2(typename Ops::V y, typename Ops::V x)
+{
+   using V = typename Ops::V;
+   constexpr double PIO2_HI = 1.57079632679489655800E0;
+   constexpr double PIO2_LO = 6.123233995736765886130E-17;
+   constexpr double PI_HI = 3.14159265358979311600E0;
+   constexpr double PI_LO = 1.2246467991473531772E-16;
+
+   const V Ax = Ops::Abs(x);
+   const V Ay = Ops::Abs(y);
+   const V Hi = Ops::Max(Ax, Ay);
+   const V Lo = Ops::Min(Ax, Ay);
+   const V Zero = Ops::Set1(0.);
+   const V a = Ops::Select(Ops::Gt(Hi, Zero), Ops::Div(Lo, Hi), Zero);
+
+   V t = AtanUnit<Ops>(a);
+   t = Ops::Select(Ops::Gt(Ay, Ax), Ops::Add(Ops::Sub(Ops::Set1(PIO2_HI), t), Ops::Set1(PIO2_LO)), t);
+   t = Ops::Select(Ops::Lt(x, Zero), Ops::Add(Ops::Sub(Ops::Set1(PI_HI), t), Ops::Set1(PI_LO)), t);
+   return Ops::CopySign(t, y);
+}
+
+// Same conversion as fCart2Pol in tbb_test.cc, but with both angles computed through atan2,
+// which is better conditioned than acos close to the axes. Ops may be a float or a double
+// wrapper, the polynomials are rounded to the precision of the lanes.
+template <class Ops>
+inline void Cart2PolLanes(const typename Ops::Scalar* X, const typename Ops::Scalar* Y, const typename Ops::Scalar* Z,
+                          typename Ops::Scalar* R, typename Ops::Scalar* Theta, typename Ops::Scalar* Phi)
+{
+   using V = typename Ops::V;
+   const V x = Ops::Load(X);
+   const V y = Ops::Load(Y);
+   const V z = Ops::Load(Z);
+   const V Rxy2 = Ops::Fma(x, x, Ops::Mul(y, y));
+   const V Rxy = Ops::Sqrt(Rxy2);
+   Ops::Store(R, Ops::Sqrt(Ops::Fma(z, z, Rxy2)));
+   Ops::Store(Theta, Atan2<Ops>(y, x));
+   Ops::Store(Phi, Atan2<Ops>(Rxy, z));
+}
+
+template <class Ops>
+inline void Cart2PolLoop(const typename Ops::Scalar* X, const typename Ops::Scalar* Y, const typename Ops::Scalar* Z,
+                         typename Ops::Scalar* R, typename Ops::Scalar* Theta, typename Ops::Scalar* Phi,
+                         std::size_t Begin, std::size_t End)
+{
+   std::size_t i = Begin;
+   for (; i + Ops::Width <= End; i += Ops::Width)
+      Cart2PolLanes<Ops>(X + i, Y + i, Z + i, R + i, Theta + i, Phi + i);
+   for (; i < End; ++i)
+      Cart2PolLanes<typename Ops::Tail>(X + i, Y + i, Z + i, R + i, Theta + i, Phi + i);
+}
+
+// Philox4x32-10 on Ops::Width counters at once, each 32 bits word in its own 64 bits lane
+// (so that MulLo32 gives the full 64 bits product)
+template <class Ops>
+inline void PhiloxRounds(typename Ops::U (&C)[4], std::uint32_t K0, std::uint32_t K1)
+{
+   using U = typename Ops::U;
+   const U Mask = Ops::SetU(0xFFFFFFFFULL);
+   const U M0 = Ops::SetU(philox::M0);
+   const U M1 = Ops::SetU(philox::M1);
+   for (int Round = 0; Round < philox::Rounds; ++Round)
+   {
+      const U P0 = Ops::MulLo32(C[0], M0);
+      const U P1 = Ops::MulLo32(C[2], M1);
+      C[0] = Ops::XorU(Ops::XorU(Ops::template SrlU<32>(P1), C[1]), Ops::SetU(K0));
+      C[1] = Ops::AndU(P1, Mask);
+      C[2] = Ops::XorU(Ops::XorU(Ops::template SrlU<32>(P0), C[3]), Ops::SetU(K1));
+      C[3] = Ops::AndU(P0, Mask);
+      K0 += philox::W0;
+      K1 += philox::W1;
+   }
+}
+
+// Vector version of PhiloxCoordinate(): the 52 bits integer is turned into a double by
+// pasting it in the mantissa of 2^52, which is exact
+template <class Ops>
+inline typename Ops::V PhiloxCoordinateLanes(typename Ops::U Hi, typename Ops::U Lo, typename Ops::V Scale)
+{
+   const typename Ops::U k = Ops::OrU(Ops::template SllU<20>(Hi), Ops::template SrlU<12>(Lo));
+   const typename Ops::V d = Ops::Sub(Ops::BitsToDouble(Ops::OrU(k, Ops::SetU(0x4330000000000000ULL))),
+                                      Ops::Set1(4503599627370496.));
+   return Ops::Mul(Ops::Sub(d, Ops::Set1(2251799813685248.)), Scale);
+}
+
+// Points [Index, Index + Width) of the dataset, see PhiloxPoint(), written from X[Out * Stride]
+template <class Ops>
+inline void GeneratePointsLanes(std::uint32_t K0, std::uint32_t K1, typename Ops::V Scale, std::size_t Index,
+                                std::size_t Out, double* X, double* Y, double* Z, std::size_t Stride)
+{
+   using U = typename Ops::U;
+   using V = typename Ops::V;
+   const U Idx = Ops::IotaU(Index);
+   const U IdxLo = Ops::AndU(Idx, Ops::SetU(0xFFFFFFFFULL));
+   const U IdxHi = Ops::template SrlU<32>(Idx);
+   U XY[4] = {IdxLo, IdxHi, Ops::SetU(0), Ops::SetU(0)};
+   U Zw[4] = {IdxLo, IdxHi, Ops::SetU(1), Ops::SetU(0)};
+   PhiloxRounds<Ops>(XY, K0, K1);
+   PhiloxRounds<Ops>(Zw, K0, K1);
+   const V x = PhiloxCoordinateLanes<Ops>(XY[0], XY[1], Scale);
+   const V y = PhiloxCoordinateLanes<Ops>(XY[2], XY[3], Scale);
+   const V z = PhiloxCoordinateLanes<Ops>(Zw[0], Zw[1], Scale);
+   if (Stride == 1)
+   {
+      Ops::Store(X + Out, x);
+      Ops::Store(Y + Out, y);
+      Ops::Store(Z + Out, z);
+   }
+   else
+   {
+      double Tx[Ops::Width], Ty[Ops::Width], Tz[Ops::Width];
+      Ops::Store(Tx, x);
+      Ops::Store(Ty, y);
+      Ops::Store(Tz, z);
+      for (std::size_t l = 0; l < Ops::Width; ++l)
+      {
+         X[(Out + l) * Stride] = Tx[l];
+         Y[(Out + l) * Stride] = Ty[l];
+         Z[(Out + l) * Stride] = Tz[l];
+      }
+   }
+}
+
+template <class Ops>
+inline void GeneratePointsLoop(std::uint64_t Seed, double Extent, std::size_t Begin, std::size_t End,
+                               double* X, double* Y, double* Z, std::size_t Stride)
+{
+   const std::uint32_t K0 = std::uint32_t(Seed), K1 = std::uint32_t(Seed >> 32);
+   const double Scale = Extent / 2251799813685248.;
+   std::size_t i = Begin;
+   for (; i + Ops::Width <= End; i += Ops::Width)
+      GeneratePointsLanes<Ops>(K0, K1, Ops::Set1(Scale), i, i - Begin, X, Y, Z, Stride);
+   for (; i < End; ++i)
+      GeneratePointsLanes<ScalarD>(K0, K1, Scale, i, i - Begin, X, Y, Z, Stride);
+}
+
+// One Neumaier (improved Kahan) step: S + x, with the rounding error accumulated in C
+template <class Ops>
+inline void NeumaierAdd(typename Ops::V& S, typename Ops::V& C, typename Ops::V x)
+{
+   const typename Ops::V t = Ops::Add(S, x);
+   C = Ops::Add(C, Ops::Select(Ops::Lt(Ops::Abs(S), Ops::Abs(x)),
+                               Ops::Add(Ops::Sub(x, t), S),
+                               Ops::Add(Ops::Sub(S, t), x)));
+   S = t;
+}
+
+// Compensated sum over CompensatedSumLanes logical lanes, element i always goes to lane
+// i % CompensatedSumLanes whatever Ops::Width, and the lanes are folded in a fixed order,
+// so every instruction set returns the same bits
+template <class Ops>
+inline CompensatedPair CompensatedSumLoop(const double* X, std::size_t N, std::size_t Stride)
+{
+   using V = typename Ops::V;
+   constexpr std::size_t NbRegs = CompensatedSumLanes / Ops::Width;
+   static_assert(NbRegs * Ops::Width == CompensatedSumLanes, "lanes must fill whole registers");
+   V S[NbRegs], C[NbRegs];
+   for (std::size_t r = 0; r < NbRegs; ++r)
+      S[r] = C[r] = Ops::Set1(0.);
+   std::size_t i = 0;
+   for (; i + CompensatedSumLanes <= N; i += CompensatedSumLanes)
+      for (std::size_t r = 0; r < NbRegs; ++r)
+         NeumaierAdd<Ops>(S[r], C[r], Ops::LoadStrided(X + (i + r * Ops::Width) * Stride, Stride));
+
+   double Sl[CompensatedSumLanes], Cl[CompensatedSumLanes];
+   for (std::size_t r = 0; r < NbRegs; ++r)
+   {
+      Ops::Store(Sl + r * Ops::Width, S[r]);
+      Ops::Store(Cl + r * Ops::Width, C[r]);
+   }
+   for (std::size_t l = 0; i < N; ++i, ++l)
+      NeumaierAdd<ScalarD>(Sl[l], Cl[l], X[i * Stride]);
+
+   CompensatedPair Result{Sl[0], Cl[0]};
+   for (std::size_t l = 1; l < CompensatedSumLanes; ++l)
+   {
+      NeumaierAdd<ScalarD>(Result.Sum, Result.Comp, Sl[l]);
+      Result.Comp += Cl[l];
+   }
+   return Result;
+}
+
+// exp(x) for x <= 709, Cephes rational approximation (~1 ulp) after the reduction
+// x = n ln2 + r, |r| <= ln2 / 2. Results below the smallest normal double are flushed to 0.
+template <class Ops>
+inline typename Ops::V Exp(typename Ops::V x)
+{
+   using V = typename Ops::V;
+   constexpr double LOG2E = 1.4426950408889634073599;
+   constexpr double LN2_HI = 6.93145751953125E-1;
+   constexpr double LN2_LO = 1.42860682030941723212E-6;
+   constexpr double MIN_ARG = -708.39641853226410622;
+   constexpr double ROUND = 6755399441055744.; // 1.5 * 2^52: adding it rounds to an integer
+
+   const auto Underflow = Ops::Lt(x, Ops::Set1(MIN_ARG));
+   x = Ops::Max(x, Ops::Set1(MIN_ARG));
+   const V t = Ops::Fma(x, Ops::Set1(LOG2E), Ops::Set1(ROUND));
+   const V n = Ops::Sub(t, Ops::Set1(ROUND));
+   V r = Ops::Fma(n, Ops::Set1(-LN2_HI), x);
+   r = Ops::Fma(n, Ops::Set1(-LN2_LO), r);
+
+   const V rr = Ops::Mul(r, r);
+   V P = Ops::Set1(1.26177193074810590878E-4);
+   P = Ops::Fma(P, rr, Ops::Set1(3.02994407707441961300E-2));
+   P = Ops::Mul(r, Ops::Fma(P, rr, Ops::Set1(9.99999999999999999910E-1)));
+   V Q = Ops::Set1(3.00198505138664455042E-6);
+   Q = Ops::Fma(Q, rr, Ops::Set1(2.52448340349684104192E-3));
+   Q = Ops::Fma(Q, rr, Ops::Set1(2.27265548208155028766E-1));
+   Q = Ops::Fma(Q, rr, Ops::Set1(2.00000000000000000009E0));
+   const V e = Ops::Fma(Ops::Set1(2.), Ops::Div(P, Ops::Sub(Q, P)), Ops::Set1(1.));
+
+   // 2^n: the low bits of t hold n, move n + 1023 to the exponent field
+   const typename Ops::U Pow2 = Ops::template SllU<52>(Ops::AddU(Ops::DoubleToBits(t), Ops::SetU(1023)));
+   return Ops::Select(Underflow, Ops::Set1(0.), Ops::Mul(e, Ops::BitsToDouble(Pow2)));
+}
+
+// Max and sum of exp(x - Max) of one block, two passes over data that is still in cache
+template <class Ops>
+inline LogSumExpPair LogSumExpLoop(const double* X, std::size_t N, std::size_t Stride)
+{
+   using V = typename Ops::V;
+   double Lanes[Ops::Width];
+   std::size_t i = 0;
+
+   V Mv = Ops::Set1(-HUGE_VAL);
+   for (; i + Ops::Width <= N; i += Ops::Width)
+      Mv = Ops::Max(Mv, Ops::LoadStrided(X + i * Stride, Stride));
+   Ops::Store(Lanes, Mv);
+   double Max = -HUGE_VAL;
+   for (double m : Lanes)
+      Max = ScalarD::Max(Max, m);
+   for (; i < N; ++i)
+      Max = ScalarD::Max(Max, X[i * Stride]);
+   if (Max == -HUGE_VAL)
+      return {Max, 0.};
+
+   V Sv = Ops::Set1(0.);
+   const V Mb = Ops::Set1(Max);
+   for (i = 0; i + Ops::Width <= N; i += Ops::Width)
+      Sv = Ops::Add(Sv, Exp<Ops>(Ops::Sub(Ops::LoadStrided(X + i * Stride, Stride), Mb)));
+   Ops::Store(Lanes, Sv);
+   double Scaled = 0.;
+   for (double s : Lanes)
+      Scaled += s;
+   for (; i < N; ++i)
+      Scaled += Exp<ScalarD>(X[i * Stride] - Max);
+   return {Max, Scaled};
+}
+
+} // namespace tbb_demo::TBB_DEMO_KERNEL_NS
@@ -0,0 +1,39 @@
+// Portable instantiation of the kernels, used when the CPU has no AVX2
+#include "tbb_kernels.h"
+
+#define TBB_DEMO_KERNEL_NS scalar
+#include "tbb_kernels_impl.h"
+
+namespace tbb_demo::scalar {
+
+bool Compiled() { return true; }
+
+void Cart2Pol(const double* X, const double* Y, const double* Z, double* R, double* Theta,
+              double* Phi, std::size_t Begin, std::size_t End)
+{
+   Cart2PolLoop<ScalarD>(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void Cart2PolF(const float* X, const float* Y, const float* Z, float* R, float* Theta,
+               float* Phi, std::size_t Begin, std::size_t End)
+{
+   Cart2PolLoop<ScalarF>(X, Y, Z, R, Theta, Phi, Begin, End);
+}
+
+void GeneratePoints(std::uint64_t Seed, double Extent, std::size_t Begin, std::size_t End,
+                    double* X, double* Y, double* Z, std::size_t Stride)
+{
+   GeneratePointsLoop<ScalarD>(Seed, Extent, Begin, End, X, Y, Z, Stride);
+}
+
+CompensatedPair CompensatedSum(const double* X, std::size_t N, std::size_t Stride)
+{
+   return CompensatedSumLoop<ScalarD>(X, N, Stride);
+}
+
+LogSumExpPair LogSumExp(const double* X, std::size_t N, std::size_t Stride)
+{
+   return LogSumExpLoop<ScalarD>(X, N, Stride);
+}
+
+} // namespace tbb_demo::scalar
@@ -0,0 +1,214 @@
+// Resident memory of the process, to compare the footprint of the demos.
+//
+// MemoryProbe records, next to a timing, what a stage cost in memory: allocations and bytes
+// (counted only when built with TBB_DEMO_ALLOC_HOOKS, see tbb_alloc_hooks.cc), resident set
+// growth, minor/major page faults and transparent huge pages. It prints nothing unless the
+// hooks are built in or TBB_DEMO_MEMSTATS=1, so the usual output of the demos does not change.
+//
+//    tbb_demo::MemoryProbe Probe;
+//    ... timed stage ...
+//    BOOST_TEST_MESSAGE("STAGE " << time_span.count() << "s" << Probe);
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+
+#include "tbb/scalable_allocator.h"
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace tbb_demo {
+
+/// Current resident set size in bytes (0 when not available on this platform)
+inline std::size_t CurrentRss()
+{
+#if defined(__linux__)
+   std::size_t Pages = 0, Resident = 0;
+   if (std::FILE* Statm = std::fopen("/proc/self/statm", "r"))
+   {
+      if (std::fscanf(Statm, "%zu %zu", &Pages, &Resident) != 2)
+         Resident = 0;
+      std::fclose(Statm);
+   }
+   return Resident * std::size_t(sysconf(_SC_PAGESIZE));
+#else
+   return 0;
+#endif
+}
+
+/// Highest resident set size of the process since it started or since the last ResetPeakRss,
+/// in bytes (0 when not available)
+inline std::size_t PeakRss()
+{
+#if defined(__linux__)
+   std::size_t KiB = 0;
+   if (std::FILE* Status = std::fopen("/proc/self/status", "r"))
+   {
+      char Line[256];
+      while (std::fgets(Line, sizeof(Line), Status))
+         if (std::sscanf(Line, "VmHWM: %zu kB", &KiB) == 1)
+            break;
+      std::fclose(Status);
+   }
+   if (!KiB)
+   {
+      rusage Usage{};
+      getrusage(RUSAGE_SELF, &Usage);
+      KiB = std::size_t(Usage.ru_maxrss); // kilobytes on Linux, not reset by ResetPeakRss
+   }
+   return KiB * 1024;
+#else
+   return 0;
+#endif
+}
+
+/// Restarts PeakRss from the current resident set size, to measure the peak of one phase.
+/// Returns false when the kernel does not support it (Linux >= 4.0).
+inline bool ResetPeakRss()
+{
+#if defined(__linux__)
+   std::FILE* ClearRefs = std::fopen("/proc/self/clear_refs", "w");
+   if (!ClearRefs)
+      return false;
+   const bool Done = std::fputs("5", ClearRefs) >= 0;
+   return std::fclose(ClearRefs) == 0 && Done;
+#else
+   return false;
+#endif
+}
+
+/// Allocation counters summed over all the threads, since the start of the process
+struct AllocStats
+{
+   std::uint64_t Allocs = 0;     ///< malloc, calloc, aligned allocations, scalable_malloc...
+   std::uint64_t Reallocs = 0;
+   std::uint64_t Frees = 0;
+   std::uint64_t Bytes = 0;      ///< usable size of the allocated blocks
+   std::uint64_t FreedBytes = 0; ///< usable size of the freed blocks
+};
+
+#if defined(TBB_DEMO_ALLOC_HOOKS)
+constexpr bool AllocHooksEnabled = true;
+/// Defined in tbb_alloc_hooks.cc
+AllocStats AllocSnapshot();
+#else
+constexpr bool AllocHooksEnabled = false;
+inline AllocStats AllocSnapshot() { return {}; }
+#endif
+
+/// Transparent huge pages backing anonymous memory of the process, in bytes
+inline std::size_t AnonHugePages()
+{
+#if defined(__linux__)
+   std::size_t KiB = 0;
+   if (std::FILE* Rollup = std::fopen("/proc/self/smaps_rollup", "r"))
+   {
+      char Line[256];
+      while (std::fgets(Line, sizeof(Line), Rollup))
+         if (std::sscanf(Line, "AnonHugePages: %zu kB", &KiB) == 1)
+            break;
+      std::fclose(Rollup);
+   }
+   return KiB * 1024;
+#else
+   return 0;
+#endif
+}
+
+struct MemorySample
+{
+   std::size_t Rss = 0;
+   std::size_t HugePages = 0;
+   std::uint64_t MinorFaults = 0;
+   std::uint64_t MajorFaults = 0;
+   AllocStats Allocs;
+};
+
+inline MemorySample SampleMemory()
+{
+   MemorySample Sample;
+   Sample.Rss = CurrentRss();
+   Sample.HugePages = AnonHugePages();
+#if defined(__linux__)
+   rusage Usage{};
+   getrusage(RUSAGE_SELF, &Usage);
+   Sample.MinorFaults = std::uint64_t(Usage.ru_minflt);
+   Sample.MajorFaults = std::uint64_t(Usage.ru_majflt);
+#endif
+   Sample.Allocs = AllocSnapshot();
+   return Sample;
+}
+
+/// True when the probes print: allocation hooks built in, or TBB_DEMO_MEMSTATS=1
+inline bool MemoryStatsEnabled()
+{
+   static const bool Enabled = AllocHooksEnabled || (std::getenv("TBB_DEMO_MEMSTATS") && std::getenv("TBB_DEMO_MEMSTATS")[0] == '1');
+   return Enabled;
+}
+
+/// Lets tbbmalloc back its large blocks with huge pages (scalable_allocation_mode), only the
+/// memory allocated afterwards is concerned. Returns false when tbbmalloc refuses.
+inline bool UseHugePages(bool On)
+{
+   return scalable_allocation_mode(TBBMALLOC_USE_HUGE_PAGES, On ? 1 : 0) == TBBMALLOC_OK;
+}
+
+/// True when TBB_DEMO_HUGE_PAGES=1, the switch of the tests and of tbb_bench --huge-pages
+inline bool HugePagesRequested()
+{
+   const char* Value = std::getenv("TBB_DEMO_HUGE_PAGES");
+   return Value && Value[0] == '1';
+}
+
+/// Memory cost of a stage, from its construction (or Restart) to the moment it is printed
+class MemoryProbe
+{
+public:
+   MemoryProbe() { Restart(); }
+
+   void Restart()
+   {
+      if (MemoryStatsEnabled())
+         m_start = SampleMemory();
+   }
+
+   /// Difference with the sample of the start; Rss and HugePages are the values at the end
+   MemorySample Delta() const
+   {
+      MemorySample End = SampleMemory();
+      End.MinorFaults -= m_start.MinorFaults;
+      End.MajorFaults -= m_start.MajorFaults;
+      End.Allocs.Allocs -= m_start.Allocs.Allocs;
+      End.Allocs.Reallocs -= m_start.Allocs.Reallocs;
+      End.Allocs.Frees -= m_start.Allocs.Frees;
+      End.Allocs.Bytes -= m_start.Allocs.Bytes;
+      End.Allocs.FreedBytes -= m_start.Allocs.FreedBytes;
+      return End;
+   }
+
+   std::size_t StartRss() const { return m_start.Rss; }
+
+   friend std::ostream& operator<<(std::ostream& Out, const MemoryProbe& Probe)
+   {
+      if (!MemoryStatsEnabled())
+         return Out;
+      const MemorySample d = Probe.Delta();
+      constexpr double MiB = 1 << 20;
+      if (AllocHooksEnabled)
+         Out << " | allocs " << d.Allocs.Allocs << " reallocs " << d.Allocs.Reallocs << " frees " << d.Allocs.Frees << " ("
+             << double(d.Allocs.Bytes) / MiB << " MiB allocated, " << double(d.Allocs.FreedBytes) / MiB << " MiB freed)";
+      return Out << " | faults " << d.MinorFaults << " minor " << d.MajorFaults << " major | rss "
+                 << (double(d.Rss) - double(Probe.m_start.Rss)) / MiB << " MiB to " << double(d.Rss) / MiB << " MiB | thp "
+                 << double(d.HugePages) / MiB << " MiB";
+   }
+
+private:
+   MemorySample m_start;
+};
+
+} // namespace tbb_demo
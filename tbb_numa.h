@@ -0,0 +1,147 @@
+// NUMA-aware execution: one task arena per NUMA node and first-touch data placement.
+//
+// The pages of a std::vector are placed on the node of the thread that writes them first, and
+// std::vector<T>(n) value-initializes every element from the constructing thread: the whole
+// vector ends up on one node. Here vectors are allocated without initialization
+// (DefaultInitAllocator), the index range is cut into one contiguous partition per node, and
+// each partition is first written, then processed, by the threads of the arena pinned to its
+// node (tbb::info::numa_nodes() and task_arena::constraints).
+//
+// Without the TBB NUMA support (tbbbind) or on a single node machine there is one unconstrained
+// arena and the partition is the whole range.
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/cache_aligned_allocator.h"
+#include "tbb/info.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/task_arena.h"
+#include "tbb/task_group.h"
+
+namespace tbb_demo {
+
+/// Allocator that default-initializes instead of value-initializing: std::vector<T>(n) of a
+/// trivial T leaves its pages untouched, the first parallel write places them
+template <class T, class Base = tbb::cache_aligned_allocator<T>>
+struct DefaultInitAllocator : Base
+{
+   using Base::Base;
+   template <class U>
+   struct rebind
+   {
+      using other = DefaultInitAllocator<U, typename std::allocator_traits<Base>::template rebind_alloc<U>>;
+   };
+
+   template <class U>
+   void construct(U* p) noexcept(std::is_nothrow_default_constructible<U>::value)
+   {
+      ::new (static_cast<void*>(p)) U;
+   }
+   template <class U, class... Args>
+   void construct(U* p, Args&&... args)
+   {
+      std::allocator_traits<Base>::construct(static_cast<Base&>(*this), p, std::forward<Args>(args)...);
+   }
+};
+
+/// Vector whose pages are placed by a first-touch (see NumaArenas::FirstTouch)
+template <class T>
+using NumaVector = std::vector<T, DefaultInitAllocator<T>>;
+
+class NumaArenas
+{
+public:
+   NumaArenas()
+   {
+      for (const tbb::numa_node_id Id : tbb::info::numa_nodes())
+      {
+         m_nodes.push_back(Id);
+         m_arenas.push_back(std::make_unique<tbb::task_arena>(tbb::task_arena::constraints(Id)));
+         m_arenas.back()->initialize();
+      }
+   }
+
+   std::size_t size() const { return m_arenas.size(); }
+   /// NUMA node of arena i (-1: not bound to a node)
+   tbb::numa_node_id Node(std::size_t i) const { return m_nodes[i]; }
+   tbb::task_arena& Arena(std::size_t i) const { return *m_arenas[i]; }
+
+   /// Bounds of the partition of each node in [0, N): node i owns [Bounds[i], Bounds[i + 1]).
+   /// The sizes follow the concurrency of the arenas and the bounds are multiples of Align.
+   std::vector<std::size_t> Partition(std::size_t N, std::size_t Align = 1) const
+   {
+      std::size_t TotalConcurrency = 0;
+      for (const auto& a : m_arenas)
+         TotalConcurrency += std::size_t(a->max_concurrency());
+      std::vector<std::size_t> Bounds(size() + 1, N);
+      Bounds[0] = 0;
+      std::size_t Concurrency = 0;
+      for (std::size_t i = 1; i < size(); ++i)
+      {
+         Concurrency += std::size_t(m_arenas[i - 1]->max_concurrency());
+         Bounds[i] = std::min(N, N / TotalConcurrency * Concurrency / Align * Align);
+      }
+      return Bounds;
+   }
+
+   /// fNode(i, Begin, End) on every node i at the same time, inside the arena of the node
+   template <class NodeFn>
+   void ForEachNode(const std::vector<std::size_t>& Bounds, const NodeFn& fNode) const
+   {
+      std::vector<tbb::task_group> Groups(size());
+      for (std::size_t i = 0; i < size(); ++i)
+         m_arenas[i]->execute([&, i]() { Groups[i].run([&, i]() { fNode(i, Bounds[i], Bounds[i + 1]); }); });
+      for (std::size_t i = 0; i < size(); ++i)
+         m_arenas[i]->execute([&Groups, i]() { Groups[i].wait(); });
+   }
+
+   /// parallel_for over every partition by the threads of its node
+   template <class Body>
+   void ParallelFor(const std::vector<std::size_t>& Bounds, std::size_t Grain, const Body& fBody) const
+   {
+      ForEachNode(Bounds, [Grain, &fBody](std::size_t, std::size_t Begin, std::size_t End) {
+         tbb::parallel_for(tbb::blocked_range<std::size_t>(Begin, End, Grain), fBody);
+      });
+   }
+
+   /// parallel_reduce of every partition by the threads of its node, then join of the
+   /// partitions in node order
+   template <class T, class RangeFn, class JoinFn>
+   T ParallelReduce(const std::vector<std::size_t>& Bounds, std::size_t Grain, const T& Identity,
+                    const RangeFn& fRange, const JoinFn& fJoin) const
+   {
+      std::vector<T> Partials(size(), Identity);
+      ForEachNode(Bounds, [&](std::size_t i, std::size_t Begin, std::size_t End) {
+         Partials[i] = tbb::parallel_reduce(tbb::blocked_range<std::size_t>(Begin, End, Grain), Identity, fRange, fJoin);
+      });
+      T Result = Identity;
+      for (const T& Partial : Partials)
+         Result = fJoin(Result, Partial);
+      return Result;
+   }
+
+   /// Write every element of Data once (with fInit(i, element)) from the node owning it, so
+   /// that its pages are allocated there
+   template <class Vector, class InitFn>
+   void FirstTouch(Vector& Data, const std::vector<std::size_t>& Bounds, const InitFn& fInit) const
+   {
+      ParallelFor(Bounds, 1 << 14, [&Data, &fInit](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            fInit(i, Data[i]);
+      });
+   }
+
+private:
+   std::vector<tbb::numa_node_id> m_nodes;
+   std::vector<std::unique_ptr<tbb::task_arena>> m_arenas;
+};
+
+} // namespace tbb_demo
@@ -0,0 +1,65 @@
+// Philox4x32-10 counter-based random number generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3", SC11).
+//
+// The output is a pure function of a (counter, key) pair: point i of a dataset is generated
+// from counter i and the seed as key, independently of every other point. Unlike a shared
+// std::mt19937 there is no state to race on, and unlike thread_local engines the dataset
+// does not depend on which thread generated which point.
+#pragma once
+#include <array>
+#include <cstdint>
+
+namespace tbb_demo {
+
+namespace philox {
+inline constexpr std::uint32_t M0 = 0xD2511F53;
+inline constexpr std::uint32_t M1 = 0xCD9E8D57;
+inline constexpr std::uint32_t W0 = 0x9E3779B9;
+inline constexpr std::uint32_t W1 = 0xBB67AE85;
+inline constexpr int Rounds = 10;
+/// Random bits kept per coordinate, see PhiloxCoordinate()
+inline constexpr int CoordinateBits = 52;
+} // namespace philox
+
+using PhiloxCounter = std::array<std::uint32_t, 4>;
+using PhiloxKey = std::array<std::uint32_t, 2>;
+
+constexpr PhiloxCounter Philox4x32(PhiloxCounter Ctr, PhiloxKey Key)
+{
+   for (int Round = 0; Round < philox::Rounds; ++Round)
+   {
+      const std::uint64_t P0 = std::uint64_t(philox::M0) * Ctr[0];
+      const std::uint64_t P1 = std::uint64_t(philox::M1) * Ctr[2];
+      Ctr = {std::uint32_t(P1 >> 32) ^ Ctr[1] ^ Key[0], std::uint32_t(P1),
+             std::uint32_t(P0 >> 32) ^ Ctr[3] ^ Key[1], std::uint32_t(P0)};
+      Key[0] += philox::W0;
+      Key[1] += philox::W1;
+   }
+   return Ctr;
+}
+
+constexpr PhiloxKey PhiloxKeyFromSeed(std::uint64_t Seed)
+{
+   return {std::uint32_t(Seed), std::uint32_t(Seed >> 32)};
+}
+
+/// Two 32 bits words to a coordinate in [-Extent, Extent): 52 random bits k, then
+/// (k - 2^51) * Extent / 2^51. The subtraction is exact and there is a single rounded
+/// multiplication, so every SIMD flavour of the generator gives the same bits.
+inline double PhiloxCoordinate(std::uint32_t Hi, std::uint32_t Lo, double Extent)
+{
+   const std::uint64_t k = (std::uint64_t(Hi) << 20) | (Lo >> 12);
+   return (double(k) - 2251799813685248.) * (Extent / 2251799813685248.);
+}
+
+/// Point i of the dataset of seed Seed: block {i, 0} gives x and y, block {i, 1} gives z
+inline std::array<double, 3> PhiloxPoint(std::uint64_t Seed, std::uint64_t i, double Extent)
+{
+   const PhiloxKey Key = PhiloxKeyFromSeed(Seed);
+   const PhiloxCounter XY = Philox4x32({std::uint32_t(i), std::uint32_t(i >> 32), 0, 0}, Key);
+   const PhiloxCounter Z = Philox4x32({std::uint32_t(i), std::uint32_t(i >> 32), 1, 0}, Key);
+   return {PhiloxCoordinate(XY[0], XY[1], Extent), PhiloxCoordinate(XY[2], XY[3], Extent),
+           PhiloxCoordinate(Z[0], Z[1], Extent)};
+}
+
+} // namespace tbb_demo
@@ -0,0 +1,636 @@
+// Out-of-core point datasets: a columnar binary file processed through mmap.
+//
+// Layout (native endianness, offsets in bytes):
+//    [0, DataOffset)   PointFileHeader, padded to a page
+//    chunk c           at DataOffset + c * ChunkSize * 24: the values of column 0 of the chunk,
+//                      then those of column 1, then column 2 (ChunkSize points, fewer in the last)
+//    IndexOffset       one PointChunkInfo per chunk: offset, number of points, min/max radius
+// Columns are x, y, z in Cartesian files and r, theta, phi in polar files. ChunkSize is a
+// multiple of 512 points, so every chunk starts on a page.
+//
+// Writers size the file up front, every chunk has a known offset and the chunks are written
+// in parallel through a shared mapping. Readers map the file read-only and go through it chunk
+// by chunk with madvise hints. The pages of the chunks already processed are dropped from the
+// mapping: the page cache keeps or evicts them as memory allows, so the files can be larger
+// than RAM.
+#pragma once
+#if defined(__unix__) || defined(__APPLE__)
+#define TBB_DEMO_HAS_POINT_FILE 1
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/task_arena.h"
+
+#include "tbb_kernels.h"
+#include "tbb_point_generator.h"
+#include "tbb_radix_sort.h"
+#include "tbb_reduce.h"
+
+namespace tbb_demo {
+
+enum class PointKind : std::uint32_t
+{
+   Cartesian = 0, ///< x, y, z
+   Polar = 1      ///< r, theta, phi
+};
+
+struct PointFileHeader
+{
+   char Magic[8];
+   std::uint32_t Version;
+   PointKind Kind;
+   std::uint64_t NbPoints;
+   std::uint64_t ChunkSize; ///< points per chunk
+   std::uint64_t NbChunks;
+   std::uint64_t DataOffset;
+   std::uint64_t IndexOffset;
+};
+
+struct PointChunkInfo
+{
+   std::uint64_t Offset;
+   std::uint64_t NbPoints;
+   double MinRadius; ///< NaN when not computed
+   double MaxRadius;
+};
+
+namespace point_file_detail {
+
+constexpr char Magic[8] = {'T', 'B', 'B', 'P', 'T', 'S', '\0', '\1'};
+constexpr std::uint32_t Version = 1;
+constexpr std::size_t HeaderBytes = 4096;
+constexpr std::uint64_t ChunkAlignment = 512; // points, 512 * 8 bytes is a whole number of pages
+
+[[noreturn]] inline void ThrowErrno(const std::string& What)
+{
+   throw std::system_error(errno, std::generic_category(), What);
+}
+
+/// Read-only or shared read-write mapping of a whole file
+class MappedFile
+{
+public:
+   MappedFile() = default;
+   /// Size 0 opens an existing file read-only, otherwise creates (or truncates) a file of Size bytes
+   MappedFile(const std::string& Path, std::size_t Size)
+   {
+      const bool Create = Size != 0;
+      m_fd = Create ? ::open(Path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(Path.c_str(), O_RDONLY);
+      if (m_fd < 0)
+         ThrowErrno("open " + Path);
+      if (Create)
+      {
+#if defined(__linux__)
+         // reserve the blocks now: a full disk is an error here rather than a SIGBUS later
+         if (const int Error = ::posix_fallocate(m_fd, 0, off_t(Size)))
+         {
+            errno = Error;
+            Close();
+            ThrowErrno("posix_fallocate " + Path);
+         }
+#else
+         if (::ftruncate(m_fd, off_t(Size)) != 0)
+         {
+            Close();
+            ThrowErrno("ftruncate " + Path);
+         }
+#endif
+      }
+      else
+      {
+         struct stat Stat;
+         if (::fstat(m_fd, &Stat) != 0)
+         {
+            Close();
+            ThrowErrno("fstat " + Path);
+         }
+         Size = std::size_t(Stat.st_size);
+      }
+      m_size = Size;
+      void* Data = ::mmap(nullptr, m_size, Create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_fd, 0);
+      if (Data == MAP_FAILED)
+      {
+         Close();
+         ThrowErrno("mmap " + Path);
+      }
+      m_data = static_cast<char*>(Data);
+   }
+   MappedFile(MappedFile&& Other) noexcept { *this = std::move(Other); }
+   MappedFile& operator=(MappedFile&& Other) noexcept
+   {
+      std::swap(m_fd, Other.m_fd);
+      std::swap(m_data, Other.m_data);
+      std::swap(m_size, Other.m_size);
+      return *this;
+   }
+   ~MappedFile() { Close(); }
+
+   char* Data() const { return m_data; }
+   std::size_t Size() const { return m_size; }
+
+   /// madvise on the pages covering [Offset, Offset + Length)
+   void Advise(std::size_t Offset, std::size_t Length, int Advice) const
+   {
+      static const std::size_t PageSize = std::size_t(::sysconf(_SC_PAGESIZE));
+      const std::size_t Begin = Offset / PageSize * PageSize, End = std::min(m_size, Offset + Length);
+      if (m_data && End > Begin)
+         ::madvise(m_data + Begin, End - Begin, Advice);
+   }
+   /// Drop the pages of [Offset, Offset + Length) from the mapping (they stay in the page cache,
+   /// dirty ones are still written back)
+   void Release(std::size_t Offset, std::size_t Length) const
+   {
+#if defined(__linux__)
+      Advise(Offset, Length, MADV_DONTNEED);
+#else
+      (void)Offset, (void)Length; // MADV_DONTNEED may discard dirty shared pages elsewhere
+#endif
+   }
+   void Sync() const
+   {
+      if (m_data && ::msync(m_data, m_size, MS_SYNC) != 0)
+         ThrowErrno("msync");
+   }
+   void Close()
+   {
+      if (m_data)
+         ::munmap(m_data, m_size);
+      if (m_fd >= 0)
+         ::close(m_fd);
+      m_data = nullptr;
+      m_fd = -1;
+      m_size = 0;
+   }
+
+private:
+   int m_fd = -1;
+   char* m_data = nullptr;
+   std::size_t m_size = 0;
+};
+
+} // namespace point_file_detail
+
+/// Creates a point file and gives access to the columns of its chunks, which can be written
+/// concurrently (one chunk per task). Close() writes the index and the header.
+class PointFileWriter
+{
+public:
+   static constexpr std::uint64_t DefaultChunkSize = 1 << 20;
+
+   PointFileWriter(const std::string& Path, PointKind Kind, std::uint64_t NbPoints, std::uint64_t ChunkSize = DefaultChunkSize)
+   {
+      using namespace point_file_detail;
+      ChunkSize = std::max<std::uint64_t>(1, (ChunkSize + ChunkAlignment - 1) / ChunkAlignment) * ChunkAlignment;
+      std::memcpy(m_header.Magic, Magic, sizeof(Magic));
+      m_header.Version = Version;
+      m_header.Kind = Kind;
+      m_header.NbPoints = NbPoints;
+      m_header.ChunkSize = ChunkSize;
+      m_header.NbChunks = (NbPoints + ChunkSize - 1) / ChunkSize;
+      m_header.DataOffset = HeaderBytes;
+      m_header.IndexOffset = HeaderBytes + NbPoints * 3 * sizeof(double);
+      m_index.resize(m_header.NbChunks);
+      for (std::uint64_t c = 0; c < m_header.NbChunks; ++c)
+         m_index[c] = {m_header.DataOffset + c * ChunkSize * 3 * sizeof(double),
+                       std::min(ChunkSize, NbPoints - c * ChunkSize), std::nan(""), std::nan("")};
+      m_file = MappedFile(Path, m_header.IndexOffset + m_index.size() * sizeof(PointChunkInfo));
+   }
+   ~PointFileWriter()
+   {
+      try
+      {
+         Close();
+      }
+      catch (...)
+      {
+      }
+   }
+   PointFileWriter(const PointFileWriter&) = delete;
+   PointFileWriter& operator=(const PointFileWriter&) = delete;
+
+   const PointFileHeader& Header() const { return m_header; }
+   std::size_t NbChunks() const { return m_index.size(); }
+   std::uint64_t ChunkBegin(std::size_t c) const { return c * m_header.ChunkSize; }
+   std::size_t ChunkPoints(std::size_t c) const { return m_index[c].NbPoints; }
+   double* Column(std::size_t c, int k) const
+   {
+      return reinterpret_cast<double*>(m_file.Data() + m_index[c].Offset) + std::size_t(k) * m_index[c].NbPoints;
+   }
+   /// Value of column k of point i
+   double& At(std::uint64_t i, int k) const
+   {
+      const std::size_t c = i / m_header.ChunkSize;
+      return Column(c, k)[i % m_header.ChunkSize];
+   }
+   void SetRadiusRange(std::size_t c, double Min, double Max)
+   {
+      m_index[c].MinRadius = Min;
+      m_index[c].MaxRadius = Max;
+   }
+   /// The chunk is written: drop its pages from the process
+   void ReleaseChunk(std::size_t c) const { m_file.Release(m_index[c].Offset, m_index[c].NbPoints * 3 * sizeof(double)); }
+
+   /// Index then header (a file without a valid header is rejected by the reader), and with Sync
+   /// wait until the data is on disk
+   void Close(bool Sync = true)
+   {
+      if (!m_file.Data())
+         return;
+      std::memcpy(m_file.Data() + m_header.IndexOffset, m_index.data(), m_index.size() * sizeof(PointChunkInfo));
+      std::memcpy(m_file.Data(), &m_header, sizeof(m_header));
+      if (Sync)
+         m_file.Sync();
+      m_file.Close();
+   }
+
+private:
+   using MappedFile = point_file_detail::MappedFile;
+   PointFileHeader m_header{};
+   std::vector<PointChunkInfo> m_index;
+   MappedFile m_file;
+};
+
+/// Read-only view of a point file
+class PointFileReader
+{
+public:
+   explicit PointFileReader(const std::string& Path) : m_file(Path, 0)
+   {
+      using namespace point_file_detail;
+      if (m_file.Size() < HeaderBytes)
+         throw std::runtime_error(Path + ": not a point file");
+      std::memcpy(&m_header, m_file.Data(), sizeof(m_header));
+      if (std::memcmp(m_header.Magic, Magic, sizeof(Magic)) != 0 || m_header.Version != Version ||
+          m_header.IndexOffset + m_header.NbChunks * sizeof(PointChunkInfo) > m_file.Size())
+         throw std::runtime_error(Path + ": not a point file or truncated");
+      m_index = reinterpret_cast<const PointChunkInfo*>(m_file.Data() + m_header.IndexOffset);
+   }
+
+   const PointFileHeader& Header() const { return m_header; }
+   PointKind Kind() const { return m_header.Kind; }
+   std::uint64_t NbPoints() const { return m_header.NbPoints; }
+   std::size_t NbChunks() const { return std::size_t(m_header.NbChunks); }
+   std::uint64_t ChunkBegin(std::size_t c) const { return c * m_header.ChunkSize; }
+   const PointChunkInfo& Chunk(std::size_t c) const { return m_index[c]; }
+   const double* Column(std::size_t c, int k) const
+   {
+      return reinterpret_cast<const double*>(m_file.Data() + m_index[c].Offset) + std::size_t(k) * m_index[c].NbPoints;
+   }
+   double At(std::uint64_t i, int k) const
+   {
+      const std::size_t c = i / m_header.ChunkSize;
+      return Column(c, k)[i % m_header.ChunkSize];
+   }
+   std::size_t FileBytes() const { return m_file.Size(); }
+
+   /// Read-ahead for a front to back pass
+   void AdviseSequential() const { m_file.Advise(0, m_file.Size(), MADV_SEQUENTIAL); }
+   void WillNeed(std::size_t c) const { m_file.Advise(m_index[c].Offset, m_index[c].NbPoints * 3 * sizeof(double), MADV_WILLNEED); }
+   /// The chunk is processed: drop its pages from the process
+   void ReleaseChunk(std::size_t c) const { m_file.Release(m_index[c].Offset, m_index[c].NbPoints * 3 * sizeof(double)); }
+
+private:
+   point_file_detail::MappedFile m_file;
+   PointFileHeader m_header{};
+   const PointChunkInfo* m_index = nullptr;
+};
+
+/// Column k of a point file, chunk by chunk, as a source of ComputeStreamStats (tbb_stats.h): the
+/// pages of a chunk are released once processed, every pass reads the file again
+class PointFileColumn
+{
+public:
+   struct Chunk
+   {
+      const double* Data;
+      std::size_t N;
+      std::size_t Stride;
+   };
+
+   PointFileColumn(const PointFileReader& Reader, int k) : m_reader(Reader), m_k(k) {}
+
+   std::size_t NbChunks() const { return m_reader.NbChunks(); }
+   Chunk Get(std::size_t c) const { return {m_reader.Column(c, m_k), std::size_t(m_reader.Chunk(c).NbPoints), 1}; }
+   void Release(std::size_t c) const { m_reader.ReleaseChunk(c); }
+
+private:
+   const PointFileReader& m_reader;
+   int m_k;
+};
+
+/// Ask the OS to evict the file from the page cache (Linux only), so that the next pass reads the disk
+inline void DropFileCache(const std::string& Path)
+{
+#if defined(__linux__)
+   const int fd = ::open(Path.c_str(), O_RDONLY);
+   if (fd < 0)
+      return;
+   ::fdatasync(fd);
+   ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+   ::close(fd);
+#else
+   (void)Path;
+#endif
+}
+
+/// Sequential write (with fsync) and cold read bandwidth of the disk with plain write/read calls, in GB/s
+struct DiskBandwidth
+{
+   double WriteGBs = 0.;
+   double ReadGBs = 0.;
+};
+inline DiskBandwidth MeasureDiskBandwidth(const std::string& Path, std::size_t Bytes)
+{
+   constexpr std::size_t BlockBytes = 8 << 20;
+   std::vector<char> Block(BlockBytes, 1);
+   DiskBandwidth Result;
+   using Clock = std::chrono::high_resolution_clock;
+   {
+      const int fd = ::open(Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+         point_file_detail::ThrowErrno("open " + Path);
+      const auto Start = Clock::now();
+      std::size_t Done = 0;
+      while (Done < Bytes)
+      {
+         const std::size_t Size = std::min(BlockBytes, Bytes - Done);
+         const ssize_t Written = ::write(fd, Block.data(), Size);
+         if (Written <= 0)
+         {
+            const int Error = errno;
+            ::close(fd);
+            std::remove(Path.c_str());
+            errno = Error;
+            point_file_detail::ThrowErrno("write " + Path);
+         }
+         Done += std::size_t(Written);
+      }
+      ::fsync(fd);
+      Result.WriteGBs = double(Done) / std::chrono::duration<double>(Clock::now() - Start).count() / 1e9;
+      ::close(fd);
+   }
+   DropFileCache(Path);
+   {
+      const int fd = ::open(Path.c_str(), O_RDONLY);
+      if (fd < 0)
+         point_file_detail::ThrowErrno("open " + Path);
+      const auto Start = Clock::now();
+      std::size_t Done = 0;
+      for (ssize_t Read; (Read = ::read(fd, Block.data(), BlockBytes)) > 0;)
+         Done += std::size_t(Read);
+      Result.ReadGBs = double(Done) / std::chrono::duration<double>(Clock::now() - Start).count() / 1e9;
+      ::close(fd);
+   }
+   std::remove(Path.c_str());
+   return Result;
+}
+
+/// The points [0, NbPoints) of Generator into a Cartesian file, one chunk per task. The index
+/// holds the radius range of every chunk.
+inline void WritePointFile(const std::string& Path, const PointGenerator& Generator, std::uint64_t NbPoints,
+                           std::uint64_t ChunkSize = PointFileWriter::DefaultChunkSize)
+{
+   PointFileWriter Writer(Path, PointKind::Cartesian, NbPoints, ChunkSize);
+   tbb::parallel_for(std::size_t(0), Writer.NbChunks(), [&](std::size_t c) {
+      const std::size_t n = Writer.ChunkPoints(c);
+      double *X = Writer.Column(c, 0), *Y = Writer.Column(c, 1), *Z = Writer.Column(c, 2);
+      GeneratePointsKernel(Generator.Level, Generator.Seed, Generator.Extent, Writer.ChunkBegin(c), Writer.ChunkBegin(c) + n, X, Y, Z, 1);
+      double Min2 = HUGE_VAL, Max2 = 0.;
+      for (std::size_t i = 0; i < n; ++i)
+      {
+         const double r2 = X[i] * X[i] + Y[i] * Y[i] + Z[i] * Z[i];
+         Min2 = std::min(Min2, r2);
+         Max2 = std::max(Max2, r2);
+      }
+      Writer.SetRadiusRange(c, std::sqrt(Min2), std::sqrt(Max2)); // within 1 ulp
+      Writer.ReleaseChunk(c);
+   });
+   Writer.Close();
+}
+
+/// Cartesian file to polar file, chunk by chunk with the SIMD Cart2Pol kernel
+inline void ConvertPointFile(const std::string& InPath, const std::string& OutPath, SimdLevel Level = DetectSimdLevel())
+{
+   PointFileReader Reader(InPath);
+   if (Reader.Kind() != PointKind::Cartesian)
+      throw std::runtime_error(InPath + ": Cartesian points expected");
+   PointFileWriter Writer(OutPath, PointKind::Polar, Reader.NbPoints(), Reader.Header().ChunkSize);
+   Reader.AdviseSequential();
+   tbb::parallel_for(std::size_t(0), Reader.NbChunks(), [&](std::size_t c) {
+      const std::size_t n = Writer.ChunkPoints(c);
+      double* R = Writer.Column(c, 0);
+      Cart2PolKernel(Level, Reader.Column(c, 0), Reader.Column(c, 1), Reader.Column(c, 2), R, Writer.Column(c, 1), Writer.Column(c, 2), 0, n);
+      const auto MinMax = std::minmax_element(R, R + n);
+      Writer.SetRadiusRange(c, n ? *MinMax.first : std::nan(""), n ? *MinMax.second : std::nan(""));
+      Reader.ReleaseChunk(c);
+      Writer.ReleaseChunk(c);
+   });
+   Writer.Close();
+}
+
+/// Compensated sum of column k of a point file, bit-identical whatever the number of threads
+inline double SumPointFile(const std::string& Path, int k = 0, SimdLevel Level = DetectSimdLevel())
+{
+   PointFileReader Reader(Path);
+   Reader.AdviseSequential();
+   return DeterministicReduce(Reader.NbChunks(), 1, CompensatedSum{},
+      [&Reader, k, Level](std::size_t Begin, std::size_t End) {
+         CompensatedSum Sum;
+         for (std::size_t c = Begin; c < End; ++c)
+         {
+            const CompensatedPair Chunk = CompensatedSumKernel(Level, Reader.Column(c, k), Reader.Chunk(c).NbPoints, 1);
+            Sum += CompensatedSum{Chunk.Sum, Chunk.Comp};
+            Reader.ReleaseChunk(c);
+         }
+         return Sum;
+      },
+      [](CompensatedSum Left, const CompensatedSum& Right) { return Left += Right; }).Result();
+}
+
+/// External merge sort of a polar file by radius, in two phases:
+///    runs  : MemoryBudget bytes of points at a time are loaded, radix sorted (tbb_radix_sort.h)
+///            and written to a temporary run file in TmpDir
+///    merge : splitters sampled from the runs cut the output into independent ranges; each task
+///            binary searches its range in every run, merges the slices with a heap and copies
+///            its points into every output chunk in one go. A run is unmapped and removed by
+///            the last task done with it.
+/// The sort is stable (equal radii keep the order of the input).
+inline void SortPointFile(const std::string& InPath, const std::string& OutPath, const std::string& TmpDir,
+                          std::size_t MemoryBudget)
+{
+   using Record = std::array<double, 3>;
+   PointFileReader Reader(InPath);
+   if (Reader.Kind() != PointKind::Polar)
+      throw std::runtime_error(InPath + ": polar points expected");
+   const std::uint64_t NbPoints = Reader.NbPoints(), ChunkSize = Reader.Header().ChunkSize;
+   // the radix sort needs the records and as many again as scratch space
+   const std::uint64_t RunPoints = std::max<std::uint64_t>(1, MemoryBudget / (2 * sizeof(Record)) / ChunkSize) * ChunkSize;
+   const std::size_t NbRuns = (NbPoints + RunPoints - 1) / RunPoints;
+
+   // Phase 1: sorted runs
+   std::vector<std::string> RunPaths;
+   for (std::size_t Run = 0; Run < NbRuns; ++Run)
+   {
+      const std::uint64_t Begin = Run * RunPoints, End = std::min(NbPoints, Begin + RunPoints);
+      const std::size_t FirstChunk = Begin / ChunkSize, LastChunk = (End + ChunkSize - 1) / ChunkSize;
+      std::vector<Record> Records(End - Begin);
+      tbb::parallel_for(FirstChunk, LastChunk, [&](std::size_t c) {
+         const double *R = Reader.Column(c, 0), *Theta = Reader.Column(c, 1), *Phi = Reader.Column(c, 2);
+         Record* Out = Records.data() + (Reader.ChunkBegin(c) - Begin);
+         for (std::size_t i = 0, n = Reader.Chunk(c).NbPoints; i < n; ++i)
+            Out[i] = {R[i], Theta[i], Phi[i]};
+         Reader.ReleaseChunk(c);
+      });
+      ParallelRadixSort(Records, [](const Record& p) { return p[0]; });
+
+      RunPaths.push_back(TmpDir + "/run_" + std::to_string(::getpid()) + "_" + std::to_string(Run) + ".pts");
+      PointFileWriter Writer(RunPaths.back(), PointKind::Polar, End - Begin, ChunkSize);
+      tbb::parallel_for(std::size_t(0), Writer.NbChunks(), [&](std::size_t c) {
+         const Record* In = Records.data() + Writer.ChunkBegin(c);
+         double *R = Writer.Column(c, 0), *Theta = Writer.Column(c, 1), *Phi = Writer.Column(c, 2);
+         const std::size_t n = Writer.ChunkPoints(c);
+         for (std::size_t i = 0; i < n; ++i)
+         {
+            R[i] = In[i][0];
+            Theta[i] = In[i][1];
+            Phi[i] = In[i][2];
+         }
+         Writer.SetRadiusRange(c, R[0], R[n - 1]);
+         Writer.ReleaseChunk(c);
+      });
+      Writer.Close(false);
+   }
+
+   // Phase 2: parallel multiway merge
+   std::vector<std::unique_ptr<PointFileReader>> Runs;
+   for (const auto& Path : RunPaths)
+      Runs.push_back(std::make_unique<PointFileReader>(Path));
+   const std::size_t NbRanges = std::max<std::size_t>(1, std::min<std::uint64_t>(
+      NbPoints / ChunkSize + 1, std::uint64_t(tbb::this_task_arena::max_concurrency()) * 4));
+   // splitters: NbRanges - 1 quantiles of a regular sample of every run (the runs are sorted)
+   std::vector<std::uint64_t> Sample;
+   for (const auto& Run : Runs)
+      for (std::size_t s = 1; s < 8 * NbRanges; ++s)
+         Sample.push_back(OrderedKey(Run->At(Run->NbPoints() * s / (8 * NbRanges), 0)));
+   std::sort(Sample.begin(), Sample.end());
+   std::vector<std::uint64_t> Splitters;
+   for (std::size_t s = 1; s < NbRanges && !Sample.empty(); ++s)
+      Splitters.push_back(Sample[Sample.size() * s / NbRanges]);
+   // first position of a key >= Key in a run
+   auto fLowerBound = [](const PointFileReader& Run, std::uint64_t Key) -> std::uint64_t {
+      std::uint64_t Lo = 0, Hi = Run.NbPoints();
+      while (Lo < Hi)
+      {
+         const std::uint64_t Mid = Lo + (Hi - Lo) / 2;
+         if (OrderedKey(Run.At(Mid, 0)) < Key)
+            Lo = Mid + 1;
+         else
+            Hi = Mid;
+      }
+      return Lo;
+   };
+
+   PointFileWriter Writer(OutPath, PointKind::Polar, NbPoints, ChunkSize);
+   // every range reads a slice of every run: the last range done with a run unmaps and removes it
+   std::vector<std::atomic<std::size_t>> NbReaders(Runs.size());
+   for (auto& n : NbReaders)
+      n = Splitters.size() + 1;
+   auto fDone = [&](std::size_t r) {
+      if (--NbReaders[r] == 0)
+      {
+         Runs[r].reset();
+         std::remove(RunPaths[r].c_str());
+      }
+   };
+   tbb::parallel_for(std::size_t(0), Splitters.size() + 1, [&](std::size_t Range) {
+      struct Head
+      {
+         std::uint64_t Key;
+         std::size_t Run;
+         std::uint64_t Pos;
+         bool operator>(const Head& Other) const { return Key != Other.Key ? Key > Other.Key : Run > Other.Run; }
+      };
+      std::priority_queue<Head, std::vector<Head>, std::greater<Head>> Heads;
+      std::vector<std::uint64_t> Ends(Runs.size());
+      std::uint64_t Out = 0; // the range starts after all the smaller keys of all the runs
+      for (std::size_t r = 0; r < Runs.size(); ++r)
+      {
+         const std::uint64_t Begin = Range == 0 ? 0 : fLowerBound(*Runs[r], Splitters[Range - 1]);
+         Ends[r] = Range == Splitters.size() ? Runs[r]->NbPoints() : fLowerBound(*Runs[r], Splitters[Range]);
+         Out += Begin;
+         if (Begin < Ends[r])
+            Heads.push({OrderedKey(Runs[r]->At(Begin, 0)), r, Begin});
+         else
+            fDone(r);
+      }
+
+      // the merged points of the current output chunk, copied into it column by column
+      std::array<std::vector<double>, 3> Columns;
+      std::uint64_t ColumnsBegin = Out;
+      auto fFlush = [&]() {
+         if (Columns[0].empty())
+            return;
+         const std::size_t c = ColumnsBegin / ChunkSize;
+         for (std::size_t k = 0; k < 3; ++k)
+         {
+            std::copy(Columns[k].begin(), Columns[k].end(), Writer.Column(c, int(k)) + ColumnsBegin % ChunkSize);
+            Columns[k].clear();
+         }
+         ColumnsBegin = Out;
+      };
+      while (!Heads.empty())
+      {
+         const Head h = Heads.top();
+         Heads.pop();
+         const PointFileReader& Run = *Runs[h.Run];
+         for (std::size_t k = 0; k < 3; ++k)
+            Columns[k].push_back(Run.At(h.Pos, int(k)));
+         if (++Out % ChunkSize == 0)
+            fFlush();
+         if (h.Pos + 1 == Ends[h.Run])
+            fDone(h.Run);
+         else
+         {
+            // the pages of the run chunks already merged are dropped
+            if ((h.Pos + 1) % ChunkSize == 0)
+               Run.ReleaseChunk(h.Pos / ChunkSize);
+            Heads.push({OrderedKey(Run.At(h.Pos + 1, 0)), h.Run, h.Pos + 1});
+         }
+      }
+      fFlush();
+   });
+   tbb::parallel_for(std::size_t(0), Writer.NbChunks(), [&Writer](std::size_t c) {
+      const double* R = Writer.Column(c, 0);
+      Writer.SetRadiusRange(c, R[0], R[Writer.ChunkPoints(c) - 1]);
+      Writer.ReleaseChunk(c);
+   });
+   Writer.Close();
+}
+
+} // namespace tbb_demo
+
+#endif
@@ -0,0 +1,59 @@
+// Race-free and reproducible parallel point generation.
+//
+// Point i only depends on (Seed, i) through the Philox4x32-10 counter-based generator, so
+// the dataset is bit for bit the same whatever the number of threads, the partitioner or
+// the SIMD level used to fill it.
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+#include "tbb_kernels.h"
+#include "tbb_philox.h"
+#include "tbb_soa_points.h"
+
+namespace tbb_demo {
+
+struct PointGenerator
+{
+   std::uint64_t Seed = 0;
+   double Extent = 10000.; ///< coordinates are in [-Extent, Extent)
+   SimdLevel Level = DetectSimdLevel();
+
+   /// Scalar reference, same bits as the vectorized fills
+   std::array<double, 3> operator()(std::size_t i) const { return PhiloxPoint(Seed, i, Extent); }
+
+   /// Points [Begin, End) of the dataset written in place (no parallelism, meant to be called
+   /// from a parallel body or a pipeline stage)
+   template <class Alloc>
+   void Fill(std::vector<std::array<double, 3>, Alloc>& Points, std::size_t Begin, std::size_t End) const
+   {
+      static_assert(sizeof(std::array<double, 3>) == 3 * sizeof(double), "points must be 3 packed doubles");
+      double* Base = Points.data()->data() + Begin * 3;
+      GeneratePointsKernel(Level, Seed, Extent, Begin, End, Base, Base + 1, Base + 2, 3);
+   }
+   void Fill(SoAPoints& Points, std::size_t Begin, std::size_t End) const
+   {
+      GeneratePointsKernel(Level, Seed, Extent, Begin, End, Points.X() + Begin, Points.Y() + Begin, Points.Z() + Begin, 1);
+   }
+   /// Points [Begin, End) of the dataset written from the start of Tile (Tile.size() >= End - Begin),
+   /// for the stages that only hold a window of the dataset
+   void FillTile(SoAPoints& Tile, std::size_t Begin, std::size_t End) const
+   {
+      GeneratePointsKernel(Level, Seed, Extent, Begin, End, Tile.X(), Tile.Y(), Tile.Z(), 1);
+   }
+
+   /// Whole dataset, in parallel
+   template <class PointsT>
+   void ParallelFill(PointsT& Points) const
+   {
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Points.size(), 1024),
+                        [this, &Points](const tbb::blocked_range<std::size_t>& r) { Fill(Points, r.begin(), r.end()); });
+   }
+};
+
+} // namespace tbb_demo
@@ -0,0 +1,370 @@
+// Spatial index over polar points (r, theta, phi) as produced by fCart2Pol, for range queries
+// "r in [a, b] and direction within a cone" and k nearest neighbours, without a linear scan.
+//
+// The space is cut in cells: radius shells holding about the same number of points (edges
+// taken from a sample of the radii), times equal-area angular buckets (rings of equal width in
+// cos(phi), sectors of equal width in theta, the cylindrical equal-area projection). The
+// points are stored cell after cell (CSR: Offsets[c] .. Offsets[c + 1]) as Cartesian
+// coordinates plus radius, so that the tests in a cell are a dot product.
+//
+// Build: cell of every point, parallel radix sort of (cell, position) pairs (tbb_radix_sort.h),
+// cell offsets from the sorted keys, parallel gather. Queries only read the index: they can
+// run concurrently from any number of threads.
+// - cone: the angular distance from the axis to every angular bucket is computed exactly (the
+//   nearest point of a latitude/longitude box is on one of its meridian edges), only the
+//   buckets within the half angle and the shells within [RMin, RMax] are visited;
+// - nearest: best-first search with lower bounds on the distance, shell, then ring, then cell.
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+
+#include "tbb_coordinates.h"
+#include "tbb_radix_sort.h"
+
+namespace tbb_demo {
+
+/// r in [RMin, RMax] and at most HalfAngle (radians) from the direction (Theta, Phi)
+struct ConeQuery
+{
+   double RMin;
+   double RMax;
+   double Theta; ///< azimuth in [-pi, pi], polar point [1]
+   double Phi;   ///< polar angle in [0, pi], polar point [2]
+   double HalfAngle;
+};
+
+struct Neighbor
+{
+   double Distance;
+   std::uint32_t Index; ///< position in the indexed vector
+};
+
+class PolarIndex
+{
+public:
+   /// 0: from the number of points, about PointsPerCell per cell with twice as many sectors as rings and shells
+   struct Options
+   {
+      unsigned NbShells = 0;
+      unsigned NbRings = 0;
+      unsigned NbSectors = 0;
+      std::size_t PointsPerCell = 128;
+   };
+
+   /// Parallel build over Polar (r, theta, phi), at most 2^32 - 1 points
+   explicit PolarIndex(const std::vector<std::array<double, 3>>& Polar) : PolarIndex(Polar, Options()) {}
+
+   PolarIndex(const std::vector<std::array<double, 3>>& Polar, const Options& Opts)
+      : m_nbShells(Opts.NbShells ? Opts.NbShells : AutoSide(Polar.size(), Opts)),
+        m_nbRings(Opts.NbRings ? Opts.NbRings : AutoSide(Polar.size(), Opts)),
+        m_nbSectors(Opts.NbSectors ? Opts.NbSectors : 2 * AutoSide(Polar.size(), Opts))
+   {
+      if (Polar.size() >= std::numeric_limits<std::uint32_t>::max())
+         throw std::length_error("PolarIndex: too many points");
+      InitAngularEdges();
+      InitShellEdges(Polar);
+      Build(Polar);
+   }
+
+   std::size_t size() const { return m_ids.size(); }
+   std::size_t NbCells() const { return std::size_t(m_nbShells) * m_nbRings * m_nbSectors; }
+   std::size_t MemoryBytes() const
+   {
+      return m_points.size() * sizeof(IndexedPoint) + m_ids.size() * sizeof(std::uint32_t) + m_offsets.size() * sizeof(std::size_t);
+   }
+
+   /// Calls fBatch(const std::uint32_t* Positions, std::size_t n) on the matches of Query, at
+   /// most BatchSize at a time, in the order of the cells
+   template <class Batch>
+   void QueryCone(const ConeQuery& Query, Batch fBatch, std::size_t BatchSize = 1024) const
+   {
+      std::vector<std::uint32_t> Buffer;
+      Buffer.reserve(BatchSize);
+      VisitCone(Query, [&](std::uint32_t Id) {
+         Buffer.push_back(Id);
+         if (Buffer.size() == BatchSize)
+         {
+            fBatch(Buffer.data(), Buffer.size());
+            Buffer.clear();
+         }
+      });
+      if (!Buffer.empty())
+         fBatch(Buffer.data(), Buffer.size());
+   }
+
+   std::size_t CountCone(const ConeQuery& Query) const
+   {
+      std::size_t Count = 0;
+      VisitCone(Query, [&Count](std::uint32_t) { ++Count; });
+      return Count;
+   }
+
+   /// The K points nearest to the Cartesian point Pt (Euclidean distance), nearest first
+   std::vector<Neighbor> Nearest(const std::array<double, 3>& Pt, std::size_t K) const
+   {
+      std::vector<Neighbor> Best; // max-heap on the distance, K at most
+      if (!K || m_ids.empty())
+         return Best;
+      const double RQ = std::hypot(Pt[0], Pt[1], Pt[2]);
+      const Direction Q = RQ > 0. ? MakeDirection(std::atan2(Pt[1], Pt[0]), std::acos(Pt[2] / RQ)) : MakeDirection(0., 0.);
+      auto fFarther = [](const Neighbor& a, const Neighbor& b) { return a.Distance < b.Distance; };
+      auto fWorst = [&]() { return Best.size() < K ? HUGE_VAL : Best.front().Distance; };
+
+      // Shell, ring or cell with a lower bound on the distance to its points, smallest first
+      struct Entry
+      {
+         double Bound;
+         int Level; ///< 0 shell, 1 ring of a shell, 2 cell
+         unsigned Shell, Ring, Sector;
+         bool operator<(const Entry& Other) const { return Bound > Other.Bound; }
+      };
+      std::priority_queue<Entry> Queue;
+      for (unsigned s = 0; s < m_nbShells; ++s)
+         Queue.push({DistanceBound(RQ, 0., s), 0, s, 0, 0});
+      while (!Queue.empty() && Queue.top().Bound < fWorst())
+      {
+         const Entry e = Queue.top();
+         Queue.pop();
+         if (e.Level == 0)
+            for (unsigned j = 0; j < m_nbRings; ++j)
+               Queue.push({DistanceBound(RQ, AngleToRing(Q, j), e.Shell), 1, e.Shell, j, 0});
+         else if (e.Level == 1)
+            for (unsigned k = 0; k < m_nbSectors; ++k)
+               Queue.push({DistanceBound(RQ, AngleToBucket(Q, e.Ring, k), e.Shell), 2, e.Shell, e.Ring, k});
+         else
+         {
+            const std::size_t c = CellOf(e.Shell, e.Ring, e.Sector);
+            for (std::size_t i = m_offsets[c]; i != m_offsets[c + 1]; ++i)
+            {
+               const IndexedPoint& p = m_points[i];
+               const double d = std::hypot(p.X - Pt[0], p.Y - Pt[1], p.Z - Pt[2]);
+               if (Best.size() < K)
+               {
+                  Best.push_back({d, m_ids[i]});
+                  std::push_heap(Best.begin(), Best.end(), fFarther);
+               }
+               else if (d < Best.front().Distance)
+               {
+                  std::pop_heap(Best.begin(), Best.end(), fFarther);
+                  Best.back() = {d, m_ids[i]};
+                  std::push_heap(Best.begin(), Best.end(), fFarther);
+               }
+            }
+         }
+      }
+      std::sort_heap(Best.begin(), Best.end(), fFarther);
+      return Best;
+   }
+
+private:
+   struct IndexedPoint
+   {
+      double X, Y, Z, R;
+   };
+
+   struct Direction
+   {
+      double Theta, Phi, CosTheta, SinTheta, CosPhi, SinPhi;
+   };
+
+   /// Margin on the lower bounds, against the rounding of the trigonometry
+   static constexpr double Slack = 1e-9;
+
+   static unsigned AutoSide(std::size_t N, const Options& Opts)
+   {
+      const double Cells = double(N) / double(std::max<std::size_t>(1, Opts.PointsPerCell));
+      return unsigned(std::clamp(std::cbrt(Cells / 2.), 1., 128.));
+   }
+
+   static Direction MakeDirection(double Theta, double Phi)
+   {
+      return {Theta, Phi, std::cos(Theta), std::sin(Theta), std::cos(Phi), std::sin(Phi)};
+   }
+
+   std::size_t CellOf(unsigned Shell, unsigned Ring, unsigned Sector) const
+   {
+      return (std::size_t(Shell) * m_nbRings + Ring) * m_nbSectors + Sector;
+   }
+
+   unsigned ShellOf(double R) const
+   {
+      return unsigned(std::upper_bound(m_shellEdges.begin() + 1, m_shellEdges.end() - 1, R) - (m_shellEdges.begin() + 1));
+   }
+
+   unsigned RingOf(double CosPhi) const
+   {
+      return std::min(m_nbRings - 1, unsigned(std::max(0., (1. - CosPhi) * 0.5 * m_nbRings)));
+   }
+
+   unsigned SectorOf(double Theta) const
+   {
+      return std::min(m_nbSectors - 1, unsigned(std::max(0., (Theta + M_PI) / (2. * M_PI) * m_nbSectors)));
+   }
+
+   void InitAngularEdges()
+   {
+      for (unsigned j = 0; j <= m_nbRings; ++j)
+         m_ringPhi.push_back(std::acos(std::clamp(1. - 2. * j / m_nbRings, -1., 1.)));
+      for (unsigned k = 0; k <= m_nbSectors; ++k)
+      {
+         const double Theta = -M_PI + 2. * M_PI * k / m_nbSectors;
+         m_sectorCos.push_back(std::cos(Theta));
+         m_sectorSin.push_back(std::sin(Theta));
+      }
+   }
+
+   /// Shells of about the same number of points: the edges are quantiles of a sample of the radii
+   void InitShellEdges(const std::vector<std::array<double, 3>>& Polar)
+   {
+      const std::size_t N = Polar.size();
+      using MinMax = std::pair<double, double>;
+      const MinMax Range = tbb::parallel_reduce(
+         tbb::blocked_range<std::size_t>(0, N), MinMax{HUGE_VAL, -HUGE_VAL},
+         [&Polar](const tbb::blocked_range<std::size_t>& r, MinMax m) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i)
+               m = {std::min(m.first, Polar[i][0]), std::max(m.second, Polar[i][0])};
+            return m;
+         },
+         [](const MinMax& a, const MinMax& b) { return MinMax{std::min(a.first, b.first), std::max(a.second, b.second)}; });
+      std::vector<double> Sample;
+      const std::size_t Step = std::max<std::size_t>(1, N / (std::size_t(64) * m_nbShells));
+      for (std::size_t i = 0; i < N; i += Step)
+         Sample.push_back(Polar[i][0]);
+      std::sort(Sample.begin(), Sample.end());
+      m_shellEdges.assign(m_nbShells + 1, N ? Range.first : 0.);
+      for (unsigned s = 1; s < m_nbShells; ++s)
+         m_shellEdges[s] = Sample.empty() ? 0. : Sample[Sample.size() * s / m_nbShells];
+      m_shellEdges[m_nbShells] = N ? Range.second : 0.;
+   }
+
+   void Build(const std::vector<std::array<double, 3>>& Polar)
+   {
+      const std::size_t N = Polar.size();
+      // Cartesian coordinates and cell of every point in one parallel pass, the gather after the sort only copies
+      std::unique_ptr<IndexedPoint[]> Points(new IndexedPoint[N]);
+      std::unique_ptr<KeyIndex[]> Pairs(new KeyIndex[N]), Buffer(new KeyIndex[N]);
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N, radix_detail::MinBlockSize), [&](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+         {
+            const auto& p = Polar[i];
+            const auto Cart = PolarToCartesian(p);
+            Points[i] = {Cart[0], Cart[1], Cart[2], p[0]};
+            Pairs[i] = {CellOf(ShellOf(p[0]), RingOf(p[0] > 0. ? Cart[2] / p[0] : 1.), SectorOf(p[1])), i};
+         }
+      });
+      const KeyIndex* Sorted = radix_detail::Sort(Pairs.get(), Buffer.get(), N, [](const KeyIndex& p) { return p.Key; });
+
+      // A cell starts where the key changes: every change writes the offsets of its own cells
+      m_offsets.assign(NbCells() + 1, 0);
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N + 1, radix_detail::MinBlockSize), [&](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+         {
+            const std::size_t From = i == 0 ? 0 : Sorted[i - 1].Key + 1;
+            const std::size_t To = i == N ? NbCells() : Sorted[i].Key;
+            for (std::size_t c = From; c <= To; ++c)
+               m_offsets[c] = i;
+         }
+      });
+
+      m_points.resize(N);
+      m_ids.resize(N);
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N, radix_detail::MinBlockSize), [&](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+         {
+            m_points[i] = Points[Sorted[i].Index];
+            m_ids[i] = std::uint32_t(Sorted[i].Index);
+         }
+      });
+   }
+
+   /// Lower bound of the angle between Q and the directions of ring j: the difference of polar angles
+   double AngleToRing(const Direction& Q, unsigned j) const
+   {
+      return std::max({0., m_ringPhi[j] - Q.Phi, Q.Phi - m_ringPhi[j + 1]}) - Slack;
+   }
+
+   /// Smallest angle between Q and the meridian arc of sector edge k in ring j
+   double AngleToMeridian(const Direction& Q, unsigned j, unsigned k) const
+   {
+      const double Phi0 = m_ringPhi[j], Phi1 = m_ringPhi[j + 1];
+      // cos(angle to the point of polar angle phi) = A sin(phi) + B cos(phi), largest at atan2(A, B)
+      const double A = Q.SinPhi * (Q.CosTheta * m_sectorCos[k] + Q.SinTheta * m_sectorSin[k]), B = Q.CosPhi;
+      double Cos = std::max(A * std::sin(Phi0) + B * std::cos(Phi0), A * std::sin(Phi1) + B * std::cos(Phi1));
+      const double PhiStar = std::atan2(A, B);
+      if (PhiStar > Phi0 && PhiStar < Phi1)
+         Cos = std::hypot(A, B);
+      return std::acos(std::clamp(Cos, -1., 1.));
+   }
+
+   /// Smallest angle between Q and the bucket (ring j, sector k): inside the sector the polar
+   /// angles decide, outside the nearest point is on one of the two meridian edges
+   double AngleToBucket(const Direction& Q, unsigned j, unsigned k) const
+   {
+      if (SectorOf(Q.Theta) == k)
+         return AngleToRing(Q, j);
+      return std::min(AngleToMeridian(Q, j, k), AngleToMeridian(Q, j, k + 1)) - Slack;
+   }
+
+   /// Lower bound of the distance from a point of radius RQ to the points of shell s at least Angle away
+   double DistanceBound(double RQ, double Angle, unsigned s) const
+   {
+      const double Cos = std::cos(std::clamp(Angle, 0., M_PI));
+      const double S = std::clamp(RQ * Cos, m_shellEdges[s], m_shellEdges[s + 1]);
+      return std::sqrt(std::max(0., RQ * RQ + S * S - 2. * RQ * S * Cos)) * (1. - Slack);
+   }
+
+   template <class Visit>
+   void VisitCone(const ConeQuery& Query, Visit fVisit) const
+   {
+      const Direction Q = MakeDirection(Query.Theta, Query.Phi);
+      const double Axis[3] = {Q.SinPhi * Q.CosTheta, Q.SinPhi * Q.SinTheta, Q.CosPhi};
+      const double CosHalfAngle = std::cos(Query.HalfAngle);
+
+      // Angular buckets within the half angle, the same for every shell
+      std::vector<std::uint32_t> Buckets;
+      for (unsigned j = 0; j < m_nbRings; ++j)
+         if (AngleToRing(Q, j) <= Query.HalfAngle)
+            for (unsigned k = 0; k < m_nbSectors; ++k)
+               if (AngleToBucket(Q, j, k) <= Query.HalfAngle)
+                  Buckets.push_back(j * m_nbSectors + k);
+
+      for (unsigned s = 0; s < m_nbShells; ++s)
+      {
+         if (m_shellEdges[s + 1] < Query.RMin || m_shellEdges[s] > Query.RMax)
+            continue;
+         const std::size_t ShellBase = std::size_t(s) * m_nbRings * m_nbSectors;
+         for (std::uint32_t b : Buckets)
+            for (std::size_t i = m_offsets[ShellBase + b], End = m_offsets[ShellBase + b + 1]; i != End; ++i)
+            {
+               const IndexedPoint& p = m_points[i];
+               if (p.R >= Query.RMin && p.R <= Query.RMax && p.X * Axis[0] + p.Y * Axis[1] + p.Z * Axis[2] >= CosHalfAngle * p.R)
+                  fVisit(m_ids[i]);
+            }
+      }
+   }
+
+   unsigned m_nbShells;
+   unsigned m_nbRings;
+   unsigned m_nbSectors;
+   std::vector<double> m_shellEdges; ///< NbShells + 1 radii
+   std::vector<double> m_ringPhi;    ///< NbRings + 1 polar angles, increasing
+   std::vector<double> m_sectorCos;  ///< cos and sin of the NbSectors + 1 azimuths
+   std::vector<double> m_sectorSin;
+   std::vector<std::size_t> m_offsets; ///< NbCells + 1, points of cell c in [m_offsets[c], m_offsets[c + 1])
+   std::vector<IndexedPoint> m_points;
+   std::vector<std::uint32_t> m_ids;
+};
+
+} // namespace tbb_demo
@@ -0,0 +1,196 @@
+// Parallel LSD radix sort of records on a floating-point key, an alternative to
+// tbb::parallel_sort with a comparator.
+//
+// Each pass handles 8 bits of the key: per-block histograms (one block per task), a
+// parallel prefix scan of the histograms in (digit, block) order, and a parallel scatter
+// where every block writes its elements in order. The sort is therefore stable.
+//
+// Keys are doubles mapped to order-preserving integers (OrderedKey), which gives
+//    -NaN < -inf < ... < -0.0 < +0.0 < ... < +inf < +NaN
+// i.e. -0.0 is sorted before +0.0, and NaNs are sorted at both ends according to their sign
+// instead of breaking the ordering as they do with operator<.
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/parallel_scan.h"
+#include "tbb/task_arena.h"
+
+namespace tbb_demo {
+
+/// Order-preserving map of a double to an unsigned integer
+inline std::uint64_t OrderedKey(double d)
+{
+   std::uint64_t u;
+   std::memcpy(&u, &d, sizeof(d));
+   return (u >> 63) ? ~u : (u | 0x8000000000000000ULL);
+}
+
+/// Key and position of a record, what the key+index mode sorts instead of the records
+struct KeyIndex
+{
+   std::uint64_t Key;
+   std::uint64_t Index;
+};
+
+namespace radix_detail {
+
+constexpr int DigitBits = 8;
+constexpr std::size_t NbDigits = std::size_t(1) << DigitBits;
+constexpr std::size_t NbPasses = 64 / DigitBits;
+/// Smallest block handled by one task, below that the histograms cost more than they save
+constexpr std::size_t MinBlockSize = 1 << 16;
+
+inline std::size_t Digit(std::uint64_t Key, std::size_t Pass)
+{
+   return (Key >> (Pass * DigitBits)) & (NbDigits - 1);
+}
+
+/// Histograms of every digit of every key, used to skip the passes where all the keys
+/// share the same digit (e.g. the sign and exponent bytes of radii of similar magnitude)
+template <class T, class KeyOf>
+std::array<bool, NbPasses> UsefulPasses(const T* Data, std::size_t N, KeyOf fKeyOf)
+{
+   using Counts = std::array<std::array<std::size_t, NbDigits>, NbPasses>;
+   const Counts Total = tbb::parallel_reduce(
+      tbb::blocked_range<std::size_t>(0, N, MinBlockSize), Counts{},
+      [Data, &fKeyOf](const tbb::blocked_range<std::size_t>& r, Counts c) -> Counts {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+         {
+            const std::uint64_t Key = fKeyOf(Data[i]);
+            for (std::size_t Pass = 0; Pass < NbPasses; ++Pass)
+               ++c[Pass][Digit(Key, Pass)];
+         }
+         return c;
+      },
+      [](Counts a, const Counts& b) -> Counts {
+         for (std::size_t Pass = 0; Pass < NbPasses; ++Pass)
+            for (std::size_t d = 0; d < NbDigits; ++d)
+               a[Pass][d] += b[Pass][d];
+         return a;
+      });
+   std::array<bool, NbPasses> Useful{};
+   for (std::size_t Pass = 0; Pass < NbPasses; ++Pass)
+      for (std::size_t d = 0; d < NbDigits; ++d)
+         if (Total[Pass][d] != 0)
+         {
+            Useful[Pass] = Total[Pass][d] != N;
+            break;
+         }
+   return Useful;
+}
+
+/// One stable counting pass of Src into Dst on the digit Pass of the keys
+template <class T, class KeyOf>
+void Pass(const T* Src, T* Dst, std::size_t N, std::size_t Pass, KeyOf fKeyOf, std::size_t NbBlocks,
+          std::vector<std::size_t>& Offsets)
+{
+   const std::size_t BlockSize = (N + NbBlocks - 1) / NbBlocks;
+   // Offsets[b * NbDigits + d]: first count, then position of digit d for block b
+   tbb::parallel_for(std::size_t(0), NbBlocks, [&](std::size_t b) {
+      std::size_t* Count = &Offsets[b * NbDigits];
+      std::fill(Count, Count + NbDigits, std::size_t(0));
+      for (std::size_t i = b * BlockSize, End = std::min(N, (b + 1) * BlockSize); i < End; ++i)
+         ++Count[Digit(fKeyOf(Src[i]), Pass)];
+   });
+
+   // exclusive scan in (digit, block) order: all the blocks of digit 0, then digit 1...
+   const std::size_t ScanSize = NbDigits * NbBlocks;
+   auto fAt = [&Offsets, NbBlocks](std::size_t k) -> std::size_t& {
+      return Offsets[(k % NbBlocks) * NbDigits + k / NbBlocks];
+   };
+   tbb::parallel_scan(
+      tbb::blocked_range<std::size_t>(0, ScanSize, 1024), std::size_t(0),
+      [&fAt](const tbb::blocked_range<std::size_t>& r, std::size_t Sum, bool IsFinal) -> std::size_t {
+         for (std::size_t k = r.begin(); k != r.end(); ++k)
+         {
+            const std::size_t Count = fAt(k);
+            if (IsFinal)
+               fAt(k) = Sum;
+            Sum += Count;
+         }
+         return Sum;
+      },
+      std::plus<std::size_t>());
+
+   tbb::parallel_for(std::size_t(0), NbBlocks, [&](std::size_t b) {
+      std::size_t* Position = &Offsets[b * NbDigits];
+      for (std::size_t i = b * BlockSize, End = std::min(N, (b + 1) * BlockSize); i < End; ++i)
+         Dst[Position[Digit(fKeyOf(Src[i]), Pass)]++] = Src[i];
+   });
+}
+
+/// Full sort of Data with Buffer as scratch space, returns where the sorted data ended up
+template <class T, class KeyOf>
+T* Sort(T* Data, T* Buffer, std::size_t N, KeyOf fKeyOf)
+{
+   const std::size_t NbBlocks = std::max<std::size_t>(
+      1, std::min<std::size_t>(N / MinBlockSize, std::size_t(tbb::this_task_arena::max_concurrency()) * 4));
+   std::vector<std::size_t> Offsets(NbBlocks * NbDigits);
+   const auto Useful = UsefulPasses(Data, N, fKeyOf);
+   for (std::size_t p = 0; p < NbPasses; ++p)
+   {
+      if (!Useful[p])
+         continue;
+      Pass(Data, Buffer, N, p, fKeyOf, NbBlocks, Offsets);
+      std::swap(Data, Buffer);
+   }
+   return Data;
+}
+
+template <class T>
+void ParallelCopy(const T* Src, T* Dst, std::size_t N)
+{
+   tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N, MinBlockSize), [Src, Dst](const tbb::blocked_range<std::size_t>& r) {
+      std::copy(Src + r.begin(), Src + r.end(), Dst + r.begin());
+   });
+}
+
+} // namespace radix_detail
+
+/// Stable sort of Data by fKey(record) (a double), the records are moved at every pass
+template <class T, class Alloc, class KeyFn>
+void ParallelRadixSort(std::vector<T, Alloc>& Data, KeyFn fKey)
+{
+   static_assert(std::is_trivially_copyable<T>::value, "records are moved with plain copies");
+   const std::size_t N = Data.size();
+   std::unique_ptr<T[]> Buffer(new T[N]); // default initialized: not touched before the first pass
+   auto fKeyOf = [&fKey](const T& Record) { return OrderedKey(fKey(Record)); };
+   const T* Sorted = radix_detail::Sort(Data.data(), Buffer.get(), N, fKeyOf);
+   if (Sorted != Data.data())
+      radix_detail::ParallelCopy(Sorted, Data.data(), N);
+}
+
+/// Stable sort of Data by fKey(record) that only moves 16 bytes (key, index) pairs during the
+/// passes, then applies the permutation to the records with one parallel gather
+template <class T, class Alloc, class KeyFn>
+void ParallelRadixSortByKeyIndex(std::vector<T, Alloc>& Data, KeyFn fKey)
+{
+   static_assert(std::is_trivially_copyable<T>::value, "records are moved with plain copies");
+   const std::size_t N = Data.size();
+   std::unique_ptr<KeyIndex[]> Pairs(new KeyIndex[N]), PairsBuffer(new KeyIndex[N]);
+   tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N, radix_detail::MinBlockSize), [&](const tbb::blocked_range<std::size_t>& r) {
+      for (std::size_t i = r.begin(); i != r.end(); ++i)
+         Pairs[i] = {OrderedKey(fKey(Data[i])), i};
+   });
+   const KeyIndex* Sorted = radix_detail::Sort(Pairs.get(), PairsBuffer.get(), N, [](const KeyIndex& p) { return p.Key; });
+
+   std::unique_ptr<T[]> Gathered(new T[N]);
+   tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N, radix_detail::MinBlockSize), [&](const tbb::blocked_range<std::size_t>& r) {
+      for (std::size_t i = r.begin(); i != r.end(); ++i)
+         Gathered[i] = Data[Sorted[i].Index];
+   });
+   radix_detail::ParallelCopy(Gathered.get(), Data.data(), N);
+}
+
+} // namespace tbb_demo
@@ -0,0 +1,120 @@
+// Reductions whose result does not depend on the number of threads.
+//
+// tbb::parallel_reduce with the default auto_partitioner splits the range depending on the
+// load of the workers, and floating-point additions are not associative: the same sum can
+// give different bits from one run to the next. Here the shape of the reduction tree only
+// depends on the size of the input and on the block size (parallel_deterministic_reduce with
+// a simple_partitioner), and every block is summed with a compensated SIMD kernel.
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/partitioner.h"
+
+#include "tbb_kernels.h"
+
+namespace tbb_demo {
+
+/// Reduce [0, N) with Leaf(Begin, End) on blocks of at most BlockSize elements and
+/// Join(Left, Right), the blocks and the join tree are the same whatever the thread count
+template <class T, class LeafFn, class JoinFn>
+T DeterministicReduce(std::size_t N, std::size_t BlockSize, const T& Identity, const LeafFn& Leaf, const JoinFn& Join)
+{
+   return tbb::parallel_deterministic_reduce(
+      tbb::blocked_range<std::size_t>(0, N, BlockSize), Identity,
+      [&Leaf, &Join](const tbb::blocked_range<std::size_t>& r, const T& Init) -> T { return Join(Init, Leaf(r.begin(), r.end())); },
+      Join, tbb::simple_partitioner());
+}
+
+/// Sum and compensation of a Neumaier sum, the value is Sum + Comp
+struct CompensatedSum
+{
+   double Sum = 0.;
+   double Comp = 0.;
+
+   void Add(double x)
+   {
+      const double t = Sum + x;
+      Comp += std::fabs(Sum) < std::fabs(x) ? (x - t) + Sum : (Sum - t) + x;
+      Sum = t;
+   }
+   CompensatedSum& operator+=(const CompensatedSum& Other)
+   {
+      Add(Other.Sum);
+      Comp += Other.Comp;
+      return *this;
+   }
+   double Result() const { return Sum + Comp; }
+};
+
+/// Reduce X[0], X[Stride], ... X[(N - 1) * Stride] with a monoid, i.e. a type providing
+///    Value Identity() const;
+///    Value Leaf(const double* X, std::size_t N, std::size_t Stride) const;  // one block
+///    Value Combine(Value Left, const Value& Right) const;                  // associative
+/// on the fixed tree of DeterministicReduce
+template <class Monoid>
+typename Monoid::Value MonoidReduce(const Monoid& M, const double* X, std::size_t N, std::size_t Stride = 1,
+                                    std::size_t BlockSize = 1 << 14)
+{
+   using Value = typename Monoid::Value;
+   return DeterministicReduce(
+      N, BlockSize, M.Identity(),
+      [&M, X, Stride](std::size_t Begin, std::size_t End) { return M.Leaf(X + Begin * Stride, End - Begin, Stride); },
+      [&M](Value Left, const Value& Right) { return M.Combine(Left, Right); });
+}
+
+/// Compensated sum
+struct SumMonoid
+{
+   using Value = CompensatedSum;
+   SimdLevel Level = DetectSimdLevel();
+
+   Value Identity() const { return {}; }
+   Value Leaf(const double* X, std::size_t N, std::size_t Stride) const
+   {
+      const CompensatedPair Block = CompensatedSumKernel(Level, X, N, Stride);
+      return {Block.Sum, Block.Comp};
+   }
+   Value Combine(Value Left, const Value& Right) const { return Left += Right; }
+};
+
+/// log(sum exp(x)) without overflow: each block keeps its max and the sum of exp(x - max),
+/// two blocks are combined by rescaling the one with the smaller max
+struct LogSumExpMonoid
+{
+   using Value = LogSumExpPair;
+   SimdLevel Level = DetectSimdLevel();
+
+   Value Identity() const { return {-HUGE_VAL, 0.}; }
+   Value Leaf(const double* X, std::size_t N, std::size_t Stride) const { return LogSumExpKernel(Level, X, N, Stride); }
+   Value Combine(Value Left, const Value& Right) const
+   {
+      if (Right.Max == -HUGE_VAL)
+         return Left;
+      if (Left.Max == -HUGE_VAL)
+         return Right;
+      if (Left.Max >= Right.Max)
+         return {Left.Max, Left.Scaled + Right.Scaled * std::exp(Right.Max - Left.Max)};
+      return {Right.Max, Right.Scaled + Left.Scaled * std::exp(Left.Max - Right.Max)};
+   }
+   static double Result(const Value& v) { return v.Max + std::log(v.Scaled); }
+};
+
+/// Sum of X[0], X[Stride], ... X[(N - 1) * Stride] (e.g. the radius of std::array<double, 3>
+/// points with Stride 3), bit-identical for any number of threads and any SIMD level
+inline double DeterministicSum(const double* X, std::size_t N, std::size_t Stride = 1,
+                               std::size_t BlockSize = 1 << 14, SimdLevel Level = DetectSimdLevel())
+{
+   return MonoidReduce(SumMonoid{Level}, X, N, Stride, BlockSize).Result();
+}
+
+/// log(exp(X[0]) + exp(X[Stride]) + ...), also deterministic
+inline double LogSumExp(const double* X, std::size_t N, std::size_t Stride = 1,
+                        std::size_t BlockSize = 1 << 14, SimdLevel Level = DetectSimdLevel())
+{
+   return LogSumExpMonoid::Result(MonoidReduce(LogSumExpMonoid{Level}, X, N, Stride, BlockSize));
+}
+
+} // namespace tbb_demo
@@ -0,0 +1,167 @@
+// Early-terminating parallel searches: find_first_if (lowest matching index), any_of, all_of
+// and the first k matches.
+//
+// A full parallel_for visits every element even when the answer is known after a few. Here:
+// - a shared atomic cutoff holds the best answer found so far; a range that starts beyond it
+//   returns at once, and a running range re-reads it every CheckEvery elements;
+// - any_of/all_of cancel their task_group_context on the first match: the ranges not yet
+//   started are never executed;
+// - find_first_if and the first k matches cannot cancel (the ranges below the match must still
+//   run to find a lower one), so they search in waves of doubling size from the front and stop
+//   after the first wave with an answer: a match near the start costs one small wave.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
+#include "tbb/partitioner.h"
+#include "tbb/task_arena.h"
+#include "tbb/task_group.h"
+
+namespace tbb_demo {
+
+namespace search_detail {
+
+constexpr std::size_t DefaultGrain = 1 << 12;
+/// Elements between two reads of the cutoff in a running range
+constexpr std::size_t CheckEvery = 1 << 10;
+
+inline std::size_t FirstWaveSize()
+{
+   return std::max<std::size_t>(1 << 16, std::size_t(tbb::this_task_arena::max_concurrency()) << 14);
+}
+
+inline void AtomicMin(std::atomic<std::size_t>& Value, std::size_t Candidate)
+{
+   std::size_t Current = Value.load(std::memory_order_relaxed);
+   while (Candidate < Current && !Value.compare_exchange_weak(Current, Candidate, std::memory_order_relaxed))
+      ;
+}
+
+/// Calls fWave(Begin, End) on [0, N) cut in waves of doubling size while fWave returns false
+template <class Wave>
+void ForEachWave(std::size_t N, Wave fWave)
+{
+   std::size_t Size = FirstWaveSize();
+   for (std::size_t Begin = 0; Begin < N;)
+   {
+      const std::size_t End = N - Begin > Size ? Begin + Size : N;
+      if (fWave(Begin, End))
+         return;
+      Begin = End;
+      Size = Size > std::numeric_limits<std::size_t>::max() / 2 ? Size : 2 * Size;
+   }
+}
+
+} // namespace search_detail
+
+/// Parallel std::find_if: the first element (lowest position) for which fPred is true, Last if none
+template <class RandomIt, class Pred>
+RandomIt ParallelFindFirstIf(RandomIt First, RandomIt Last, Pred fPred, std::size_t Grain = search_detail::DefaultGrain)
+{
+   const std::size_t N = std::size_t(std::distance(First, Last));
+   std::atomic<std::size_t> Cutoff{N};
+   search_detail::ForEachWave(N, [&](std::size_t Begin, std::size_t End) {
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(Begin, End, Grain), [&](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end();)
+         {
+            if (i >= Cutoff.load(std::memory_order_relaxed))
+               return;
+            for (const std::size_t ChunkEnd = std::min(r.end(), i + search_detail::CheckEvery); i != ChunkEnd; ++i)
+               if (fPred(First[std::ptrdiff_t(i)]))
+               {
+                  search_detail::AtomicMin(Cutoff, i);
+                  return;
+               }
+         }
+      });
+      return Cutoff.load() != N;
+   });
+   return std::next(First, std::ptrdiff_t(Cutoff.load()));
+}
+
+/// Parallel std::any_of, stops all the workers on the first match
+template <class RandomIt, class Pred>
+bool ParallelAnyOf(RandomIt First, RandomIt Last, Pred fPred, std::size_t Grain = search_detail::DefaultGrain)
+{
+   std::atomic<bool> Found{false};
+   tbb::task_group_context Context;
+   tbb::parallel_for(
+      tbb::blocked_range<std::size_t>(0, std::size_t(std::distance(First, Last)), Grain),
+      [&](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end();)
+         {
+            if (Found.load(std::memory_order_relaxed))
+               return;
+            for (const std::size_t ChunkEnd = std::min(r.end(), i + search_detail::CheckEvery); i != ChunkEnd; ++i)
+               if (fPred(First[std::ptrdiff_t(i)]))
+               {
+                  Found.store(true, std::memory_order_relaxed);
+                  Context.cancel_group_execution();
+                  return;
+               }
+         }
+      },
+      tbb::auto_partitioner(), Context);
+   return Found.load();
+}
+
+/// Parallel std::all_of, stops all the workers on the first element that fails
+template <class RandomIt, class Pred>
+bool ParallelAllOf(RandomIt First, RandomIt Last, Pred fPred, std::size_t Grain = search_detail::DefaultGrain)
+{
+   return !ParallelAnyOf(First, Last, [&fPred](const auto& x) { return !fPred(x); }, Grain);
+}
+
+/// Positions of the K first elements for which fPred is true, in increasing order (fewer when
+/// there are not K matches). A range that found K matches lowers the cutoff to its K-th one.
+template <class RandomIt, class Pred>
+std::vector<std::size_t> ParallelFindFirstK(RandomIt First, RandomIt Last, std::size_t K, Pred fPred,
+                                            std::size_t Grain = search_detail::DefaultGrain)
+{
+   const std::size_t N = std::size_t(std::distance(First, Last));
+   std::vector<std::size_t> Matches;
+   if (!K)
+      return Matches;
+   std::atomic<std::size_t> Cutoff{N};
+   tbb::enumerable_thread_specific<std::vector<std::size_t>> Local;
+   search_detail::ForEachWave(N, [&](std::size_t Begin, std::size_t End) {
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(Begin, End, Grain), [&](const tbb::blocked_range<std::size_t>& r) {
+         auto& Found = Local.local();
+         std::size_t NbInRange = 0;
+         for (std::size_t i = r.begin(); i != r.end();)
+         {
+            if (i >= Cutoff.load(std::memory_order_relaxed))
+               return;
+            for (const std::size_t ChunkEnd = std::min(r.end(), i + search_detail::CheckEvery); i != ChunkEnd; ++i)
+               if (fPred(First[std::ptrdiff_t(i)]))
+               {
+                  Found.push_back(i);
+                  if (++NbInRange == K)
+                  {
+                     search_detail::AtomicMin(Cutoff, i);
+                     return;
+                  }
+               }
+         }
+      });
+      for (auto& Found : Local)
+      {
+         Matches.insert(Matches.end(), Found.begin(), Found.end());
+         Found.clear();
+      }
+      return Matches.size() >= K;
+   });
+   std::sort(Matches.begin(), Matches.end());
+   if (Matches.size() > K)
+      Matches.resize(K);
+   return Matches;
+}
+
+} // namespace tbb_demo
@@ -0,0 +1,132 @@
+// Sharded counters and accumulators: a shared statistic updated from every task without a
+// shared cache line.
+//
+// A single std::atomic hit by every worker serializes them on its cache line: each fetch_add
+// has to take the line from the core that wrote it last. ShardedAccumulator spreads the updates
+// over one cache-line aligned slot per thread, indexed by
+// tbb::this_task_arena::current_thread_index(): the lookup is a load of the arena slot, no TLS
+// hash. Threads of different arenas can share an index, so a slot is still updated with an
+// atomic read-modify-write, which is uncontended as long as the slot stays with its thread
+// (fetch_add for integer sums, a compare-exchange for the others, and min/max only write when
+// the value improves).
+// - Read() combines the slots with relaxed loads while the writers run: a cheap approximate
+//   value, for a progress report or a monitoring thread.
+// - Combine() is exact once the updates are finished (e.g. after the parallel_for returned).
+//
+//    tbb_demo::ShardedCounter<size_t> NbHits;
+//    tbb::parallel_for(size_t(0), N, [&NbHits](size_t i) { if (Test(i)) NbHits.Add(1); });
+//    const size_t Total = NbHits.Combine();
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+#include "tbb/task_arena.h"
+
+namespace tbb_demo {
+
+namespace counter_detail {
+
+template <class T>
+struct Plus
+{
+   static constexpr T Identity() { return T(0); }
+   static T Combine(T a, T b) { return a + b; }
+};
+
+template <class T>
+struct Min
+{
+   static constexpr T Identity() { return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max(); }
+   static T Combine(T a, T b) { return b < a ? b : a; }
+};
+
+template <class T>
+struct Max
+{
+   static constexpr T Identity() { return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest(); }
+   static T Combine(T a, T b) { return a < b ? b : a; }
+};
+
+template <class T, class Op>
+inline void Update(std::atomic<T>& Slot, T Value)
+{
+   if constexpr (std::is_integral<T>::value && std::is_same<Op, Plus<T>>::value)
+      Slot.fetch_add(Value, std::memory_order_relaxed);
+   else
+   {
+      T Cur = Slot.load(std::memory_order_relaxed);
+      if constexpr (!std::is_same<Op, Plus<T>>::value)
+         if (Op::Combine(Cur, Value) == Cur)
+            return;
+      while (!Slot.compare_exchange_weak(Cur, Op::Combine(Cur, Value), std::memory_order_relaxed))
+         ;
+   }
+}
+
+} // namespace counter_detail
+
+template <class T, class Op>
+class ShardedAccumulator
+{
+   static_assert(std::is_arithmetic<T>::value, "the slots are std::atomic<T>");
+
+   struct alignas(64) Slot
+   {
+      std::atomic<T> Value{Op::Identity()};
+   };
+
+public:
+   /// One slot per thread of the current arena by default. More threads than slots share them.
+   explicit ShardedAccumulator(std::size_t NbSlots = std::size_t(tbb::this_task_arena::max_concurrency()))
+      : m_nbSlots(NbSlots ? NbSlots : 1), m_slots(new Slot[m_nbSlots])
+   {}
+   ShardedAccumulator(const ShardedAccumulator&) = delete;
+   ShardedAccumulator& operator=(const ShardedAccumulator&) = delete;
+
+   void Add(T Value) { counter_detail::Update<T, Op>(LocalSlot(), Value); }
+
+   /// Combination of the slots while they may be updated: every update is counted or not
+   T Read() const { return Fold(std::memory_order_relaxed); }
+   /// Exact value once the updates happened before the call
+   T Combine() const { return Fold(std::memory_order_acquire); }
+
+   /// Not concurrent with Add
+   void Reset()
+   {
+      for (std::size_t s = 0; s < m_nbSlots; ++s)
+         m_slots[s].Value.store(Op::Identity(), std::memory_order_relaxed);
+   }
+
+   std::size_t NbSlots() const { return m_nbSlots; }
+
+private:
+   std::atomic<T>& LocalSlot()
+   {
+      // task_arena::not_initialized (negative) outside an arena wraps to some slot
+      return m_slots[std::size_t(tbb::this_task_arena::current_thread_index()) % m_nbSlots].Value;
+   }
+
+   T Fold(std::memory_order Order) const
+   {
+      T Value = Op::Identity();
+      for (std::size_t s = 0; s < m_nbSlots; ++s)
+         Value = Op::Combine(Value, m_slots[s].Value.load(Order));
+      return Value;
+   }
+
+   std::size_t m_nbSlots;
+   std::unique_ptr<Slot[]> m_slots;
+};
+
+/// Sum of integers or floating-point values (the order of the floating-point sum is not fixed)
+template <class T>
+using ShardedCounter = ShardedAccumulator<T, counter_detail::Plus<T>>;
+template <class T>
+using ShardedMin = ShardedAccumulator<T, counter_detail::Min<T>>;
+template <class T>
+using ShardedMax = ShardedAccumulator<T, counter_detail::Max<T>>;
+
+} // namespace tbb_demo
@@ -0,0 +1,274 @@
+// Thin wrappers over SIMD registers so that a kernel can be written once as a template
+// over an "Ops" type and instantiated for every instruction set. The double wrappers (ScalarD,
+// Avx2D, Avx512D) also have 64 bits integer lanes, the float ones (ScalarF, Avx2F, Avx512F)
+// twice as many lanes and the floating-point operations only.
+//
+// This header is not meant to be included directly: tbb_kernels_impl.h includes it after
+// defining TBB_DEMO_KERNEL_NS, so that every translation unit compiled with a different
+// instruction set gets its own copy of the inline functions (no ODR clash between the
+// scalar and the AVX versions at link time).
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifndef TBB_DEMO_KERNEL_NS
+#error "define TBB_DEMO_KERNEL_NS before including tbb_simd.h"
+#endif
+
+namespace tbb_demo::TBB_DEMO_KERNEL_NS {
+
+// One double per "register", always available
+struct ScalarD
+{
+   using Scalar = double;
+   using Tail = ScalarD; ///< for the elements after the last full register
+   using V = double;
+   using M = bool;
+   static constexpr std::size_t Width = 1;
+
+   static V Load(const double* p) { return *p; }
+   static V LoadStrided(const double* p, std::size_t) { return *p; }
+   static void Store(double* p, V a) { *p = a; }
+   static V Set1(double a) { return a; }
+   static V Add(V a, V b) { return a + b; }
+   static V Sub(V a, V b) { return a - b; }
+   static V Mul(V a, V b) { return a * b; }
+   static V Div(V a, V b) { return a / b; }
+   static V Fma(V a, V b, V c) { return a * b + c; } // contracted only when the target has FMA
+   static V Sqrt(V a) { return std::sqrt(a); }
+   static V Abs(V a) { return std::fabs(a); }
+   static V Min(V a, V b) { return a < b ? a : b; }
+   static V Max(V a, V b) { return a < b ? b : a; }
+   static M Lt(V a, V b) { return a < b; }
+   static M Gt(V a, V b) { return a > b; }
+   static V Select(M m, V a, V b) { return m ? a : b; }
+   static V CopySign(V Mag, V Sign) { return std::copysign(Mag, Sign); }
+
+   // 64 bits integer lanes, as many as double lanes
+   using U = std::uint64_t;
+   static U SetU(std::uint64_t a) { return a; }
+   static U IotaU(std::uint64_t Base) { return Base; }
+   static U MulLo32(U a, U b) { return (a & 0xFFFFFFFFULL) * (b & 0xFFFFFFFFULL); }
+   static U AndU(U a, U b) { return a & b; }
+   static U OrU(U a, U b) { return a | b; }
+   static U XorU(U a, U b) { return a ^ b; }
+   static U AddU(U a, U b) { return a + b; }
+   template <int N> static U SrlU(U a) { return a >> N; }
+   template <int N> static U SllU(U a) { return a << N; }
+   static V BitsToDouble(U a)
+   {
+      double d;
+      std::memcpy(&d, &a, sizeof(d));
+      return d;
+   }
+   static U DoubleToBits(V a)
+   {
+      U u;
+      std::memcpy(&u, &a, sizeof(u));
+      return u;
+   }
+};
+
+// One float per "register": the floating-point operations only, constants are given as doubles
+struct ScalarF
+{
+   using Scalar = float;
+   using Tail = ScalarF;
+   using V = float;
+   using M = bool;
+   static constexpr std::size_t Width = 1;
+
+   static V Load(const float* p) { return *p; }
+   static void Store(float* p, V a) { *p = a; }
+   static V Set1(double a) { return float(a); }
+   static V Add(V a, V b) { return a + b; }
+   static V Sub(V a, V b) { return a - b; }
+   static V Mul(V a, V b) { return a * b; }
+   static V Div(V a, V b) { return a / b; }
+   static V Fma(V a, V b, V c) { return a * b + c; }
+   static V Sqrt(V a) { return std::sqrt(a); }
+   static V Abs(V a) { return std::fabs(a); }
+   static V Min(V a, V b) { return a < b ? a : b; }
+   static V Max(V a, V b) { return a < b ? b : a; }
+   static M Lt(V a, V b) { return a < b; }
+   static M Gt(V a, V b) { return a > b; }
+   static V Select(M m, V a, V b) { return m ? a : b; }
+   static V CopySign(V Mag, V Sign) { return std::copysign(Mag, Sign); }
+};
+
+#if defined(__AVX2__)
+// 4 doubles per register, FMA is assumed to come with AVX2 (every AVX2 CPU has it)
+struct Avx2D
+{
+   using Scalar = double;
+   using Tail = ScalarD;
+   using V = __m256d;
+   using M = __m256d;
+   static constexpr std::size_t Width = 4;
+
+   static V Load(const double* p) { return _mm256_loadu_pd(p); }
+   static V LoadStrided(const double* p, std::size_t Stride)
+   {
+      if (Stride == 1)
+         return Load(p);
+      const long long s = static_cast<long long>(Stride);
+      return _mm256_i64gather_pd(p, _mm256_set_epi64x(3 * s, 2 * s, s, 0), 8);
+   }
+   static void Store(double* p, V a) { _mm256_storeu_pd(p, a); }
+   static V Set1(double a) { return _mm256_set1_pd(a); }
+   static V Add(V a, V b) { return _mm256_add_pd(a, b); }
+   static V Sub(V a, V b) { return _mm256_sub_pd(a, b); }
+   static V Mul(V a, V b) { return _mm256_mul_pd(a, b); }
+   static V Div(V a, V b) { return _mm256_div_pd(a, b); }
+   static V Fma(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+   static V Sqrt(V a) { return _mm256_sqrt_pd(a); }
+   static V Abs(V a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.), a); }
+   static V Min(V a, V b) { return _mm256_min_pd(a, b); }
+   static V Max(V a, V b) { return _mm256_max_pd(a, b); }
+   static M Lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+   static M Gt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+   static V Select(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+   static V CopySign(V Mag, V Sign)
+   {
+      const V SignMask = _mm256_set1_pd(-0.);
+      return _mm256_or_pd(_mm256_andnot_pd(SignMask, Mag), _mm256_and_pd(SignMask, Sign));
+   }
+
+   using U = __m256i;
+   static U SetU(std::uint64_t a) { return _mm256_set1_epi64x(static_cast<long long>(a)); }
+   static U IotaU(std::uint64_t Base) { return _mm256_add_epi64(SetU(Base), _mm256_set_epi64x(3, 2, 1, 0)); }
+   static U MulLo32(U a, U b) { return _mm256_mul_epu32(a, b); }
+   static U AndU(U a, U b) { return _mm256_and_si256(a, b); }
+   static U OrU(U a, U b) { return _mm256_or_si256(a, b); }
+   static U XorU(U a, U b) { return _mm256_xor_si256(a, b); }
+   static U AddU(U a, U b) { return _mm256_add_epi64(a, b); }
+   template <int N> static U SrlU(U a) { return _mm256_srli_epi64(a, N); }
+   template <int N> static U SllU(U a) { return _mm256_slli_epi64(a, N); }
+   static V BitsToDouble(U a) { return _mm256_castsi256_pd(a); }
+   static U DoubleToBits(V a) { return _mm256_castpd_si256(a); }
+};
+// 8 floats per register
+struct Avx2F
+{
+   using Scalar = float;
+   using Tail = ScalarF;
+   using V = __m256;
+   using M = __m256;
+   static constexpr std::size_t Width = 8;
+
+   static V Load(const float* p) { return _mm256_loadu_ps(p); }
+   static void Store(float* p, V a) { _mm256_storeu_ps(p, a); }
+   static V Set1(double a) { return _mm256_set1_ps(float(a)); }
+   static V Add(V a, V b) { return _mm256_add_ps(a, b); }
+   static V Sub(V a, V b) { return _mm256_sub_ps(a, b); }
+   static V Mul(V a, V b) { return _mm256_mul_ps(a, b); }
+   static V Div(V a, V b) { return _mm256_div_ps(a, b); }
+   static V Fma(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+   static V Sqrt(V a) { return _mm256_sqrt_ps(a); }
+   static V Abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+   static V Min(V a, V b) { return _mm256_min_ps(a, b); }
+   static V Max(V a, V b) { return _mm256_max_ps(a, b); }
+   static M Lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+   static M Gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+   static V Select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+   static V CopySign(V Mag, V Sign)
+   {
+      const V SignMask = _mm256_set1_ps(-0.f);
+      return _mm256_or_ps(_mm256_andnot_ps(SignMask, Mag), _mm256_and_ps(SignMask, Sign));
+   }
+};
+#endif
+
+#if defined(__AVX512F__)
+// 8 doubles per register, comparisons produce k-masks
+struct Avx512D
+{
+   using Scalar = double;
+   using Tail = ScalarD;
+   using V = __m512d;
+   using M = __mmask8;
+   static constexpr std::size_t Width = 8;
+
+   static V Load(const double* p) { return _mm512_loadu_pd(p); }
+   static V LoadStrided(const double* p, std::size_t Stride)
+   {
+      if (Stride == 1)
+         return Load(p);
+      const long long s = static_cast<long long>(Stride);
+      return _mm512_i64gather_pd(_mm512_set_epi64(7 * s, 6 * s, 5 * s, 4 * s, 3 * s, 2 * s, s, 0), p, 8);
+   }
+   static void Store(double* p, V a) { _mm512_storeu_pd(p, a); }
+   static V Set1(double a) { return _mm512_set1_pd(a); }
+   static V Add(V a, V b) { return _mm512_add_pd(a, b); }
+   static V Sub(V a, V b) { return _mm512_sub_pd(a, b); }
+   static V Mul(V a, V b) { return _mm512_mul_pd(a, b); }
+   static V Div(V a, V b) { return _mm512_div_pd(a, b); }
+   static V Fma(V a, V b, V c) { return _mm512_fmadd_pd(a, b, c); }
+   static V Sqrt(V a) { return _mm512_sqrt_pd(a); }
+   static V Abs(V a) { return _mm512_abs_pd(a); }
+   static V Min(V a, V b) { return _mm512_min_pd(a, b); }
+   static V Max(V a, V b) { return _mm512_max_pd(a, b); }
+   static M Lt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+   static M Gt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+   static V Select(M m, V a, V b) { return _mm512_mask_blend_pd(m, b, a); }
+   static V CopySign(V Mag, V Sign)
+   {
+      const __m512i SignMask = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ULL));
+      const __m512i Bits = _mm512_or_si512(_mm512_andnot_si512(SignMask, _mm512_castpd_si512(Mag)),
+                                           _mm512_and_si512(SignMask, _mm512_castpd_si512(Sign)));
+      return _mm512_castsi512_pd(Bits);
+   }
+
+   using U = __m512i;
+   static U SetU(std::uint64_t a) { return _mm512_set1_epi64(static_cast<long long>(a)); }
+   static U IotaU(std::uint64_t Base) { return _mm512_add_epi64(SetU(Base), _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0)); }
+   static U MulLo32(U a, U b) { return _mm512_mul_epu32(a, b); }
+   static U AndU(U a, U b) { return _mm512_and_si512(a, b); }
+   static U OrU(U a, U b) { return _mm512_or_si512(a, b); }
+   static U XorU(U a, U b) { return _mm512_xor_si512(a, b); }
+   static U AddU(U a, U b) { return _mm512_add_epi64(a, b); }
+   template <int N> static U SrlU(U a) { return _mm512_srli_epi64(a, N); }
+   template <int N> static U SllU(U a) { return _mm512_slli_epi64(a, N); }
+   static V BitsToDouble(U a) { return _mm512_castsi512_pd(a); }
+   static U DoubleToBits(V a) { return _mm512_castpd_si512(a); }
+};
+// 16 floats per register
+struct Avx512F
+{
+   using Scalar = float;
+   using Tail = ScalarF;
+   using V = __m512;
+   using M = __mmask16;
+   static constexpr std::size_t Width = 16;
+
+   static V Load(const float* p) { return _mm512_loadu_ps(p); }
+   static void Store(float* p, V a) { _mm512_storeu_ps(p, a); }
+   static V Set1(double a) { return _mm512_set1_ps(float(a)); }
+   static V Add(V a, V b) { return _mm512_add_ps(a, b); }
+   static V Sub(V a, V b) { return _mm512_sub_ps(a, b); }
+   static V Mul(V a, V b) { return _mm512_mul_ps(a, b); }
+   static V Div(V a, V b) { return _mm512_div_ps(a, b); }
+   static V Fma(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+   static V Sqrt(V a) { return _mm512_sqrt_ps(a); }
+   static V Abs(V a) { return _mm512_abs_ps(a); }
+   static V Min(V a, V b) { return _mm512_min_ps(a, b); }
+   static V Max(V a, V b) { return _mm512_max_ps(a, b); }
+   static M Lt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+   static M Gt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+   static V Select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+   static V CopySign(V Mag, V Sign)
+   {
+      const __m512i SignMask = _mm512_set1_epi32(static_cast<int>(0x80000000U));
+      const __m512i Bits = _mm512_or_si512(_mm512_andnot_si512(SignMask, _mm512_castps_si512(Mag)),
+                                           _mm512_and_si512(SignMask, _mm512_castps_si512(Sign)));
+      return _mm512_castsi512_ps(Bits);
+   }
+};
+#endif
+
+} // namespace tbb_demo::TBB_DEMO_KERNEL_NS
@@ -0,0 +1,84 @@
+// Structure-of-arrays point store: one column per coordinate instead of one
+// std::array<double, 3> per point, so that the SIMD kernels can load 4 or 8 x (or y, z)
+// values with a single instruction.
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/cache_aligned_allocator.h"
+#include "tbb/parallel_for.h"
+
+#include "tbb_kernels.h"
+
+namespace tbb_demo {
+
+class SoAPoints
+{
+public:
+   /// Columns are padded to a multiple of this many doubles (one AVX-512 register,
+   /// one 64 bytes cache line) so that the kernels never need a scalar tail
+   static constexpr std::size_t Padding = 8;
+   using Column = std::vector<double, tbb::cache_aligned_allocator<double>>;
+
+   explicit SoAPoints(std::size_t NbPoints)
+      : m_size(NbPoints), m_x(PaddedSize()), m_y(PaddedSize()), m_z(PaddedSize()),
+        m_r(PaddedSize()), m_theta(PaddedSize()), m_phi(PaddedSize())
+   {
+   }
+
+   std::size_t size() const { return m_size; }
+   std::size_t PaddedSize() const { return (m_size + Padding - 1) / Padding * Padding; }
+   std::size_t NbPackets() const { return PaddedSize() / Padding; }
+
+   double* X() { return m_x.data(); }
+   double* Y() { return m_y.data(); }
+   double* Z() { return m_z.data(); }
+   double* R() { return m_r.data(); }
+   double* Theta() { return m_theta.data(); }
+   double* Phi() { return m_phi.data(); }
+   const double* X() const { return m_x.data(); }
+   const double* Y() const { return m_y.data(); }
+   const double* Z() const { return m_z.data(); }
+   const double* R() const { return m_r.data(); }
+   const double* Theta() const { return m_theta.data(); }
+   const double* Phi() const { return m_phi.data(); }
+
+   std::array<double, 3> Cartesian(std::size_t i) const { return {m_x[i], m_y[i], m_z[i]}; }
+   std::array<double, 3> Polar(std::size_t i) const { return {m_r[i], m_theta[i], m_phi[i]}; }
+
+   /// Scatter an array of points into the x/y/z columns (in parallel)
+   void AssignCartesian(const std::vector<std::array<double, 3>>& Points)
+   {
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, std::min(Points.size(), m_size)),
+                        [this, &Points](const tbb::blocked_range<std::size_t>& r) {
+                           for (std::size_t i = r.begin(); i != r.end(); ++i)
+                           {
+                              m_x[i] = Points[i][0];
+                              m_y[i] = Points[i][1];
+                              m_z[i] = Points[i][2];
+                           }
+                        });
+   }
+
+private:
+   std::size_t m_size;
+   Column m_x, m_y, m_z;
+   Column m_r, m_theta, m_phi;
+};
+
+/// Convert the whole store, each blocked_range chunk is a whole number of packets so every
+/// chunk starts on a cache line and runs full SIMD registers only
+inline void ParallelCart2Pol(SoAPoints& Points, SimdLevel Level = DetectSimdLevel())
+{
+   tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Points.NbPackets()),
+                     [&Points, Level](const tbb::blocked_range<std::size_t>& r) {
+                        Cart2PolKernel(Level, Points.X(), Points.Y(), Points.Z(),
+                                       Points.R(), Points.Theta(), Points.Phi(),
+                                       r.begin() * SoAPoints::Padding, r.end() * SoAPoints::Padding);
+                     });
+}
+
+} // namespace tbb_demo
@@ -0,0 +1,285 @@
+// Dependency-driven stages on a tbb::flow::graph, timed stage by stage.
+//
+// A workload (generate -> convert -> sort -> reduce, with logging and output on the side) is
+// declared as named stages and the stages they wait for. Run() builds the DAG and lets the
+// flow graph start each stage as soon as its predecessors finished, so independent branches
+// overlap without being listed together as in a parallel_invoke:
+// - a compute stage is a continue_node, its parallel algorithms use the workers of the arena;
+// - a blocking stage (file or console I/O) hands its body to a dedicated I/O thread and returns:
+//   no worker waits on the I/O. Its predecessors join in a lightweight continue_node, which
+//   runs in the thread completing the last of them, and the gateway of an async_node puts the
+//   message to the successors when the body is done (reserve_wait keeps wait_for_all waiting).
+// RunSequential() runs the same stages one after another in declaration order, as straight-line
+// code would. Both return the start and end of every stage, the makespan, the total work and
+// the critical path: the longest chain of dependent stages weighted by their measured time,
+// the makespan no scheduler can beat with these stage durations.
+//
+//    tbb_demo::StageGraph Graph;
+//    const auto Generate = Graph.Add("generate", [&]() { ... });
+//    const auto Convert = Graph.Add("convert", [&]() { ... }, {Generate});
+//    Graph.Add("dump", [&]() { ... }, {Generate}, tbb_demo::StageKind::Blocking);
+//    const auto Report = Graph.Run();
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tbb/flow_graph.h"
+#include "tbb/task_arena.h"
+
+namespace tbb_demo {
+
+enum class StageKind
+{
+   Compute,
+   Blocking ///< runs on the I/O thread, never on a worker
+};
+
+struct StageTiming
+{
+   std::string Name;
+   StageKind Kind = StageKind::Compute;
+   double Start = 0.; ///< seconds since the start of the run
+   double End = 0.;
+   int ThreadIndex = 0; ///< tbb::this_task_arena::current_thread_index(), negative outside the arena
+};
+
+struct StageReport
+{
+   std::vector<StageTiming> Stages;
+   double Makespan = 0.;
+   double TotalWork = 0.;    ///< sum of the stage durations
+   double CriticalPath = 0.; ///< longest dependent chain
+   std::vector<std::string> CriticalStages;
+};
+
+namespace stage_detail {
+
+/// One thread running the blocking bodies in submission order
+class IoThread
+{
+public:
+   IoThread() : m_thread([this]() { Loop(); }) {}
+   IoThread(const IoThread&) = delete;
+   IoThread& operator=(const IoThread&) = delete;
+   ~IoThread() { Join(); }
+
+   /// Runs the bodies already submitted and stops the thread
+   void Join()
+   {
+      {
+         std::lock_guard<std::mutex> Lock(m_mutex);
+         m_stop = true;
+      }
+      m_ready.notify_one();
+      if (m_thread.joinable())
+         m_thread.join();
+   }
+
+   void Submit(std::function<void()> fJob)
+   {
+      {
+         std::lock_guard<std::mutex> Lock(m_mutex);
+         m_jobs.push_back(std::move(fJob));
+      }
+      m_ready.notify_one();
+   }
+
+private:
+   void Loop()
+   {
+      for (;;)
+      {
+         std::function<void()> fJob;
+         {
+            std::unique_lock<std::mutex> Lock(m_mutex);
+            m_ready.wait(Lock, [this]() { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty())
+               return;
+            fJob = std::move(m_jobs.front());
+            m_jobs.pop_front();
+         }
+         fJob();
+      }
+   }
+
+   std::mutex m_mutex;
+   std::condition_variable m_ready;
+   std::deque<std::function<void()>> m_jobs;
+   bool m_stop = false;
+   std::thread m_thread;
+};
+
+} // namespace stage_detail
+
+class StageGraph
+{
+public:
+   using StageId = std::size_t;
+
+   /// A stage may only wait for stages added before it: the declaration order is a topological order
+   StageId Add(std::string Name, std::function<void()> fBody, std::vector<StageId> After = {}, StageKind Kind = StageKind::Compute)
+   {
+      for (StageId p : After)
+         if (p >= m_stages.size())
+            throw std::invalid_argument("stage " + Name + " waits for a stage declared after it");
+      m_stages.push_back({std::move(Name), std::move(fBody), std::move(After), Kind});
+      return m_stages.size() - 1;
+   }
+
+   std::size_t size() const { return m_stages.size(); }
+
+   /// Stages started by the flow graph as soon as their predecessors are done
+   StageReport Run() const
+   {
+      using namespace tbb::flow;
+      // the join of a blocking stage runs inline in the predecessor that completes it
+      using JoinNode = continue_node<continue_msg, lightweight>;
+      using AsyncNode = async_node<continue_msg, continue_msg>;
+      std::vector<StageTiming> Timings(m_stages.size());
+      const auto Origin = std::chrono::steady_clock::now();
+      auto fTimed = [this, &Timings, Origin](StageId s) {
+         Timings[s].Start = Seconds(Origin);
+         Timings[s].ThreadIndex = tbb::this_task_arena::current_thread_index();
+         m_stages[s].fBody();
+         Timings[s].End = Seconds(Origin);
+      };
+
+      graph g;
+      std::exception_ptr IoError;
+      broadcast_node<continue_msg> Start(g);
+      std::vector<std::unique_ptr<continue_node<continue_msg>>> Inputs(m_stages.size()); // compute stages
+      std::vector<std::unique_ptr<JoinNode>> Joins(m_stages.size());
+      std::vector<std::unique_ptr<AsyncNode>> Blocking(m_stages.size());
+      std::vector<sender<continue_msg>*> Outputs(m_stages.size());
+      // declared after the nodes and IoError that its bodies use: when a compute stage throws, the
+      // unwinding joins it (once the bodies submitted are done) before they are destroyed
+      stage_detail::IoThread Io;
+      for (StageId s = 0; s < m_stages.size(); ++s)
+      {
+         if (m_stages[s].Kind == StageKind::Compute)
+         {
+            Inputs[s] = std::make_unique<continue_node<continue_msg>>(g, [&fTimed, s](const continue_msg&) {
+               fTimed(s);
+               return continue_msg();
+            });
+            Outputs[s] = Inputs[s].get();
+         }
+         else
+         {
+            // the async_node only sends the output: the join hands the body over to the I/O thread as
+            // soon as the predecessors are done, a message to the async_node would be a task queued
+            // behind the compute ones
+            Blocking[s] = std::make_unique<AsyncNode>(g, unlimited, [](const continue_msg&, AsyncNode::gateway_type&) {});
+            Joins[s] = std::make_unique<JoinNode>(g, [&Io, &IoError, &fTimed, &Gateway = Blocking[s]->gateway(), s](const continue_msg&) {
+               Gateway.reserve_wait();
+               Io.Submit([&IoError, &fTimed, &Gateway, s]() {
+                  try
+                  {
+                     fTimed(s);
+                     Gateway.try_put(continue_msg());
+                  }
+                  catch (...)
+                  {
+                     // only the I/O thread writes it, the successors of the stage do not run
+                     if (!IoError)
+                        IoError = std::current_exception();
+                  }
+                  Gateway.release_wait();
+               });
+               return continue_msg();
+            });
+            Outputs[s] = Blocking[s].get();
+         }
+         receiver<continue_msg>& Input = Inputs[s] ? static_cast<receiver<continue_msg>&>(*Inputs[s]) : *Joins[s];
+         if (m_stages[s].After.empty())
+            make_edge(Start, Input);
+         for (StageId p : m_stages[s].After)
+            make_edge(*Outputs[p], Input);
+      }
+      Start.try_put(continue_msg());
+      g.wait_for_all();
+      // the last body may still be in release_wait() when wait_for_all returns
+      Io.Join();
+      if (IoError)
+         std::rethrow_exception(IoError);
+      return Report(std::move(Timings), Seconds(Origin));
+   }
+
+   /// The same stages one after another, in declaration order, on the calling thread
+   StageReport RunSequential() const
+   {
+      std::vector<StageTiming> Timings(m_stages.size());
+      const auto Origin = std::chrono::steady_clock::now();
+      for (StageId s = 0; s < m_stages.size(); ++s)
+      {
+         Timings[s].Start = Seconds(Origin);
+         Timings[s].ThreadIndex = tbb::this_task_arena::current_thread_index();
+         m_stages[s].fBody();
+         Timings[s].End = Seconds(Origin);
+      }
+      return Report(std::move(Timings), Seconds(Origin));
+   }
+
+private:
+   struct Stage
+   {
+      std::string Name;
+      std::function<void()> fBody;
+      std::vector<StageId> After;
+      StageKind Kind;
+   };
+
+   static double Seconds(std::chrono::steady_clock::time_point Origin)
+   {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - Origin).count();
+   }
+
+   StageReport Report(std::vector<StageTiming> Timings, double Makespan) const
+   {
+      StageReport r;
+      r.Makespan = Makespan;
+      // longest chain ending at every stage, the predecessors come first
+      std::vector<double> Longest(m_stages.size(), 0.);
+      std::vector<StageId> Previous(m_stages.size(), m_stages.size());
+      StageId Last = 0;
+      for (StageId s = 0; s < m_stages.size(); ++s)
+      {
+         Timings[s].Name = m_stages[s].Name;
+         Timings[s].Kind = m_stages[s].Kind;
+         const double Duration = Timings[s].End - Timings[s].Start;
+         r.TotalWork += Duration;
+         for (StageId p : m_stages[s].After)
+            if (Longest[p] > Longest[s])
+            {
+               Longest[s] = Longest[p];
+               Previous[s] = p;
+            }
+         Longest[s] += Duration;
+         if (Longest[s] > Longest[Last])
+            Last = s;
+      }
+      if (!m_stages.empty())
+      {
+         r.CriticalPath = Longest[Last];
+         for (StageId s = Last; s < m_stages.size(); s = Previous[s])
+            r.CriticalStages.insert(r.CriticalStages.begin(), m_stages[s].Name);
+      }
+      r.Stages = std::move(Timings);
+      return r;
+   }
+
+   std::vector<Stage> m_stages;
+};
+
+} // namespace tbb_demo
@@ -0,0 +1,375 @@
+// Streaming statistics of a column of values (e.g. the radii): count, min, max, mean, variance,
+// exact quantiles and the k largest values, without sorting the data.
+//
+// The values come from a source cut in chunks (StridedValues in memory, PointFileColumn of
+// tbb_point_file.h for a point file larger than RAM), every pass goes once through the chunks in
+// a tbb::parallel_reduce whose bodies keep privatized state, merged by join():
+// - pass 1: moments (every chunk is summed in cache, then merged with the Chan/Welford formula),
+//   a bounded min-heap of the k largest values, and a histogram of the 20 high bits of the
+//   order-preserving key of every value (OrderedKey, tbb_radix_sort.h), which needs no range:
+//   sign, exponent and 8 bits of mantissa, 256 bins per octave. At 8 MB the histogram is one
+//   per thread (tbb::enumerable_thread_specific) rather than one per body, merged once at the end;
+// - the cumulated histogram gives the bin of every quantile and its rank in the bin. A bin with
+//   more than SelectLimit values is refined by the histogram of the next 16 bits of the values
+//   in the bin (one more pass), until the candidates are few enough to be collected in a
+//   selection pass, sorted with ParallelRadixSort (which skips the digits of the shared prefix)
+//   and the quantiles of the probe are read from it.
+// Quantile p is the value at position floor(p * (N - 1)) of the sorted values, what
+// Sorted[size_t(p * (N - 1))] gives. With 1e8 radii the bins of pass 1 hold less than a million
+// values: two passes in all.
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+
+#include "tbb_radix_sort.h"
+
+namespace tbb_demo {
+
+/// Count, min, max, mean and sum of squared deviations (M2) of values
+struct Moments
+{
+   std::uint64_t Count = 0;
+   double Min = HUGE_VAL;
+   double Max = -HUGE_VAL;
+   double Mean = 0.;
+   double M2 = 0.;
+
+   /// Chan et al. merge of two partial results (Welford's update when Other holds one value)
+   Moments& operator+=(const Moments& Other)
+   {
+      if (!Other.Count)
+         return *this;
+      if (!Count)
+         return *this = Other;
+      const double n = double(Count + Other.Count), Delta = Other.Mean - Mean;
+      Mean += Delta * double(Other.Count) / n;
+      M2 += Other.M2 + Delta * Delta * double(Count) * double(Other.Count) / n;
+      Count += Other.Count;
+      Min = std::min(Min, Other.Min);
+      Max = std::max(Max, Other.Max);
+      return *this;
+   }
+
+   double Variance() const { return Count ? M2 / double(Count) : 0.; }
+   double SampleVariance() const { return Count > 1 ? M2 / double(Count - 1) : 0.; }
+
+   /// Moments of X[0], X[Stride], ...: mean first, then the deviations, both on data in cache
+   static Moments Of(const double* X, std::size_t N, std::size_t Stride)
+   {
+      Moments m;
+      if (!N)
+         return m;
+      double Sum = 0.;
+      for (std::size_t i = 0; i < N; ++i)
+      {
+         const double x = X[i * Stride];
+         Sum += x;
+         m.Min = std::min(m.Min, x);
+         m.Max = std::max(m.Max, x);
+      }
+      m.Count = N;
+      m.Mean = Sum / double(N);
+      for (std::size_t i = 0; i < N; ++i)
+      {
+         const double d = X[i * Stride] - m.Mean;
+         m.M2 += d * d;
+      }
+      return m;
+   }
+};
+
+/// Values X[i * Stride] in memory, cut in chunks of ChunkSize
+class StridedValues
+{
+public:
+   struct Chunk
+   {
+      const double* Data;
+      std::size_t N;
+      std::size_t Stride;
+   };
+
+   StridedValues(const double* X, std::size_t N, std::size_t Stride = 1, std::size_t ChunkSize = 1 << 16)
+      : m_x(X), m_n(N), m_stride(Stride), m_chunkSize(std::max<std::size_t>(1, ChunkSize))
+   {
+   }
+
+   std::size_t NbChunks() const { return (m_n + m_chunkSize - 1) / m_chunkSize; }
+   Chunk Get(std::size_t c) const { return {m_x + c * m_chunkSize * m_stride, std::min(m_chunkSize, m_n - c * m_chunkSize), m_stride}; }
+   void Release(std::size_t) const {}
+
+private:
+   const double* m_x;
+   std::size_t m_n;
+   std::size_t m_stride;
+   std::size_t m_chunkSize;
+};
+
+struct StreamStats
+{
+   Moments Summary;
+   std::vector<double> Probabilities;
+   std::vector<double> Quantiles; ///< one per probability, NaN without values
+   std::vector<double> Largest;   ///< the k largest values, largest first
+   int NbPasses = 0;
+};
+
+namespace stats_detail {
+
+constexpr int FirstBits = 20;
+constexpr int DigitBits = 16;
+/// Candidates of a quantile collected in memory for the selection, at most
+constexpr std::uint64_t DefaultSelectLimit = std::uint64_t(1) << 22;
+
+/// Inverse of OrderedKey
+inline double ValueOfKey(std::uint64_t Key)
+{
+   const std::uint64_t u = (Key >> 63) ? (Key & ~0x8000000000000000ULL) : ~Key;
+   double d;
+   std::memcpy(&d, &u, sizeof(d));
+   return d;
+}
+
+/// Values whose key starts with the Bits high bits Prefix
+struct Probe
+{
+   std::uint64_t Prefix;
+   int Bits;
+   std::uint64_t Count; ///< values with this prefix
+   bool Select;         ///< collect them (else refine the prefix by the next digit)
+
+   int NextBits() const { return std::min(DigitBits, 64 - Bits); }
+   bool Matches(std::uint64_t Key) const { return (Key >> (64 - Bits)) == Prefix; }
+   std::size_t Digit(std::uint64_t Key) const { return (Key >> (64 - Bits - NextBits())) & ((std::size_t(1) << NextBits()) - 1); }
+};
+
+using ThreadHistograms = tbb::enumerable_thread_specific<std::vector<std::uint64_t>>;
+
+/// Pass 1: moments, k largest and histogram of the high bits of the keys
+template <class Source>
+struct FirstPass
+{
+   const Source& Src;
+   std::size_t K;
+   ThreadHistograms& Local; ///< shared by the bodies, one histogram per thread
+   Moments Summary;
+   std::vector<double> Heap; ///< min-heap of the K largest
+
+   FirstPass(const Source& S, std::size_t TopK, ThreadHistograms& H) : Src(S), K(TopK), Local(H) {}
+   FirstPass(FirstPass& Other, tbb::split) : Src(Other.Src), K(Other.K), Local(Other.Local) {}
+
+   void Push(double x)
+   {
+      if (Heap.size() < K)
+      {
+         Heap.push_back(x);
+         std::push_heap(Heap.begin(), Heap.end(), std::greater<double>());
+      }
+      else if (K && x > Heap.front())
+      {
+         std::pop_heap(Heap.begin(), Heap.end(), std::greater<double>());
+         Heap.back() = x;
+         std::push_heap(Heap.begin(), Heap.end(), std::greater<double>());
+      }
+   }
+
+   void operator()(const tbb::blocked_range<std::size_t>& r)
+   {
+      auto& Histogram = Local.local();
+      for (std::size_t c = r.begin(); c != r.end(); ++c)
+      {
+         const auto Chunk = Src.Get(c);
+         Summary += Moments::Of(Chunk.Data, Chunk.N, Chunk.Stride);
+         for (std::size_t i = 0; i < Chunk.N; ++i)
+         {
+            const double x = Chunk.Data[i * Chunk.Stride];
+            ++Histogram[OrderedKey(x) >> (64 - FirstBits)];
+            if (K && (Heap.size() < K || x > Heap.front()))
+               Push(x);
+         }
+         Src.Release(c);
+      }
+   }
+
+   void join(FirstPass& Other)
+   {
+      Summary += Other.Summary;
+      for (double x : Other.Heap)
+         Push(x);
+   }
+};
+
+/// Sum of the histograms of the threads, merged once by slices of bins
+inline std::vector<std::uint64_t> MergeHistograms(ThreadHistograms& Local)
+{
+   std::vector<std::uint64_t> Histogram(std::size_t(1) << FirstBits, 0);
+   tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Histogram.size(), 4096), [&](const tbb::blocked_range<std::size_t>& r) {
+      for (const auto& h : Local)
+         for (std::size_t b = r.begin(); b != r.end(); ++b)
+            Histogram[b] += h[b];
+   });
+   return Histogram;
+}
+
+/// Next passes: histogram of the next digit or candidates of every probe
+template <class Source>
+struct RefinePass
+{
+   const Source& Src;
+   const std::vector<Probe>& Probes;
+   std::vector<std::vector<std::uint64_t>> Histograms; ///< empty for the selected probes
+   std::vector<std::vector<double>> Candidates;
+
+   RefinePass(const Source& S, const std::vector<Probe>& P) : Src(S), Probes(P) { Init(); }
+   RefinePass(RefinePass& Other, tbb::split) : Src(Other.Src), Probes(Other.Probes) { Init(); }
+
+   void Init()
+   {
+      Histograms.resize(Probes.size());
+      Candidates.resize(Probes.size());
+      for (std::size_t p = 0; p < Probes.size(); ++p)
+         if (!Probes[p].Select)
+            Histograms[p].assign(std::size_t(1) << Probes[p].NextBits(), 0);
+   }
+
+   void operator()(const tbb::blocked_range<std::size_t>& r)
+   {
+      for (std::size_t c = r.begin(); c != r.end(); ++c)
+      {
+         const auto Chunk = Src.Get(c);
+         for (std::size_t i = 0; i < Chunk.N; ++i)
+         {
+            const double x = Chunk.Data[i * Chunk.Stride];
+            const std::uint64_t Key = OrderedKey(x);
+            for (std::size_t p = 0; p < Probes.size(); ++p)
+               if (Probes[p].Matches(Key))
+               {
+                  if (Probes[p].Select)
+                     Candidates[p].push_back(x);
+                  else
+                     ++Histograms[p][Probes[p].Digit(Key)];
+               }
+         }
+         Src.Release(c);
+      }
+   }
+
+   void join(RefinePass& Other)
+   {
+      for (std::size_t p = 0; p < Probes.size(); ++p)
+      {
+         Candidates[p].insert(Candidates[p].end(), Other.Candidates[p].begin(), Other.Candidates[p].end());
+         for (std::size_t b = 0; b < Histograms[p].size(); ++b)
+            Histograms[p][b] += Other.Histograms[p][b];
+      }
+   }
+};
+
+/// Bin of the value of rank Rank in a histogram, Rank becomes its rank in the bin
+inline std::size_t FindBin(const std::vector<std::uint64_t>& Histogram, std::uint64_t& Rank)
+{
+   std::size_t b = 0;
+   while (Rank >= Histogram[b])
+      Rank -= Histogram[b++];
+   return b;
+}
+
+} // namespace stats_detail
+
+/// Moments, quantiles of Probabilities (in [0, 1]) and the TopK largest values of Src, a source of
+/// chunks (StridedValues, PointFileColumn) providing NbChunks(), Get(c) and Release(c)
+template <class Source>
+StreamStats ComputeStreamStats(const Source& Src, const std::vector<double>& Probabilities, std::size_t TopK,
+                               std::uint64_t SelectLimit = stats_detail::DefaultSelectLimit)
+{
+   using namespace stats_detail;
+   StreamStats Stats;
+   Stats.Probabilities = Probabilities;
+   Stats.Quantiles.assign(Probabilities.size(), std::numeric_limits<double>::quiet_NaN());
+
+   ThreadHistograms Local(std::size_t(1) << FirstBits, std::uint64_t(0));
+   FirstPass<Source> First(Src, TopK, Local);
+   tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, Src.NbChunks(), 1), First);
+   std::vector<std::uint64_t> Histogram = MergeHistograms(Local);
+   Local.clear();
+   Stats.NbPasses = 1;
+   Stats.Summary = First.Summary;
+   Stats.Largest = First.Heap;
+   std::sort(Stats.Largest.begin(), Stats.Largest.end(), std::greater<double>());
+   const std::uint64_t N = Stats.Summary.Count;
+   if (!N)
+      return Stats;
+
+   // Every quantile follows a probe (shared by the quantiles of the same prefix) and its rank in it
+   struct Search
+   {
+      std::size_t Quantile;
+      Probe P;
+      std::uint64_t Rank;
+   };
+   std::vector<Search> Searches;
+   for (std::size_t q = 0; q < Probabilities.size(); ++q)
+   {
+      std::uint64_t Rank = std::uint64_t(std::clamp(Probabilities[q], 0., 1.) * double(N - 1));
+      const std::size_t b = FindBin(Histogram, Rank);
+      Searches.push_back({q, {b, FirstBits, Histogram[b], false}, Rank});
+   }
+   Histogram = {};
+
+   while (!Searches.empty())
+   {
+      std::vector<Probe> Probes;
+      std::vector<std::size_t> ProbeOf(Searches.size());
+      for (std::size_t s = 0; s < Searches.size(); ++s)
+      {
+         Probe& P = Searches[s].P;
+         P.Select = P.Count <= SelectLimit;
+         auto Same = std::find_if(Probes.begin(), Probes.end(), [&P](const Probe& o) { return o.Prefix == P.Prefix && o.Bits == P.Bits; });
+         ProbeOf[s] = std::size_t(Same - Probes.begin());
+         if (Same == Probes.end())
+            Probes.push_back(P);
+      }
+
+      RefinePass<Source> Pass(Src, Probes);
+      tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, Src.NbChunks(), 1), Pass);
+      ++Stats.NbPasses;
+
+      // The candidates of a probe are sorted once for all its quantiles
+      for (std::size_t p = 0; p < Probes.size(); ++p)
+         if (Probes[p].Select)
+            ParallelRadixSort(Pass.Candidates[p], [](double x) { return x; });
+
+      std::vector<Search> Next;
+      for (std::size_t s = 0; s < Searches.size(); ++s)
+      {
+         Search Cur = Searches[s];
+         const std::size_t p = ProbeOf[s];
+         if (Probes[p].Select)
+         {
+            Stats.Quantiles[Cur.Quantile] = Pass.Candidates[p][Cur.Rank];
+            continue;
+         }
+         const std::size_t b = FindBin(Pass.Histograms[p], Cur.Rank);
+         Cur.P = {(Cur.P.Prefix << Cur.P.NextBits()) | b, Cur.P.Bits + Cur.P.NextBits(), Pass.Histograms[p][b], false};
+         if (Cur.P.Bits == 64) // all the values of the bin are equal
+            Stats.Quantiles[Cur.Quantile] = ValueOfKey(Cur.P.Prefix);
+         else
+            Next.push_back(Cur);
+      }
+      Searches = std::move(Next);
+   }
+   return Stats;
+}
+
+} // namespace tbb_demo
@@ -11,6 +11,16 @@
 #include <atomic>
 #include <mutex>
 #include <numeric>
+#include <cstdint>
+#include <functional>
+#include <cstring>
+#include <limits>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <iterator>
+#include <list>
 //#include <execution>
 #include "tbb/tbb.h"
 #include "tbb/parallel_for_each.h"
@@ -25,6 +35,29 @@
 #include "tbb/task_group.h"
 #include "tbb/task_arena.h"
 
+#include "tbb_algorithms.h"
+#include "tbb_append_buffer.h"
+#include "tbb_arena_allocator.h"
+#include "tbb_autotune.h"
+#include "tbb_coordinates.h"
+#include "tbb_fused_pipeline.h"
+#include "tbb_kernels.h"
+#include "tbb_memory_usage.h"
+#include "tbb_numa.h"
+#include "tbb_philox.h"
+#include "tbb_point_file.h"
+#include "tbb_point_generator.h"
+#include "tbb_polar_index.h"
+#include "tbb_radix_sort.h"
+#include "tbb_reduce.h"
+#include "tbb_search.h"
+#include "tbb_sharded_counter.h"
+#include "tbb_soa_points.h"
+#include "tbb_stage_graph.h"
+#include "tbb_stats.h"
+#include "tbb_trace.h"
+#include "tbb_transform_chain.h"
+#include "tbb_typed_points.h"
 
 #include "boost/test/unit_test.hpp"
 BOOST_AUTO_TEST_SUITE(Tests_tbb)
@@ -38,6 +71,7 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
    const bool ActivateGenerator = true;
 
    constexpr int NbPoints = 100000000; // one hundred million 
+   constexpr std::uint64_t PointsSeed = 20220531;
 
    std::vector<std::array<double, 3>> CartPoints_Seq(NbPoints), CartPoints_Par(NbPoints);
 
@@ -55,17 +89,19 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
    // Fill the vector of point sequentially
    if (ActivateGenerator)
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       std::for_each(begin(CartPoints_Seq), end(CartPoints_Seq), fRandomPt);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("Points Generation [SEQ] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("Points Generation [SEQ] " << time_span.count() << "s" << Probe);
    }
    // Fill the vector of points parallel
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::parallel_for_each(begin(CartPoints_Par), end(CartPoints_Par), fRandomPt);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("Points Generation [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("Points Generation [PAR] " << time_span.count() << "s" << Probe);
    }
    std::vector<std::array<double, 3>> CartPoints_Copy = CartPoints_Seq;
    // Fill the vector of points parallel using thread local storage
@@ -80,40 +116,97 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
          CartPt[1] = TLdist(TLgen);
          CartPt[2] = TLdist(TLgen);
       };
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::parallel_for_each(begin(CartPoints_Par), end(CartPoints_Par), fRandomPtTL);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("Points Generation [TLPAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("Points Generation [TLPAR] " << time_span.count() << "s" << Probe);
+   }
+   // Fill the vector of points parallel with a counter-based generator: no shared state to race
+   // on, and the same points whatever the number of threads, so the next stages are reproducible
+   {
+      const tbb_demo::PointGenerator Generator{PointsSeed};
+      tbb_demo::MemoryProbe Probe;
+      auto Start = std::chrono::high_resolution_clock::now();
+      Generator.ParallelFill(CartPoints_Par);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Points Generation [PHILOX " << tbb_demo::SimdLevelName(Generator.Level) << " PAR] " << time_span.count() << "s" << Probe);
    }
 
    std::vector<std::array<double, 3>> PolarPoints_Seq(NbPoints), PolarPoints_Par(NbPoints);
 
    auto fCart2Pol = [](const std::array<double, 3>& CartPt)->std::array<double, 3>
    {
-      std::array<double, 3> ToReturn;
-      ToReturn[0] = std::hypot(CartPt[0], CartPt[1], CartPt[2]);
-      ToReturn[1] = std::acos(CartPt[0] / std::hypot(CartPt[0], CartPt[1])) * (CartPt[1] < 0 ? -1 : 1);
-      ToReturn[2] = std::acos(CartPt[2] / ToReturn[0]);
-      return ToReturn;
+      return tbb_demo::Cart2Pol(CartPt);
    };
    //PolarPoints_Seq[0]=fCart2Pol(CartPoints_Seq[0]);
 
    // Transform the vector of points sequentially
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       std::transform(begin(CartPoints_Seq), end(CartPoints_Seq), begin(PolarPoints_Seq), fCart2Pol);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("Points Transfo [SEQ] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("Points Transfo [SEQ] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e6 << " Mpts/s" << Probe);
    }
 
    // Transform the vector of points parallel
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::parallel_for(size_t(0), PolarPoints_Par.size(), [&fCart2Pol, &CartPoints_Par, &PolarPoints_Par](size_t i) {
          PolarPoints_Par[i] = fCart2Pol(CartPoints_Par[i]);
          });
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("Points Transfo [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("Points Transfo [PAR] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e6 << " Mpts/s" << Probe);
+   }
+
+   // Transform the points stored as structure of arrays with the SIMD kernels
+   {
+      tbb_demo::SoAPoints SoAPoints_Par(NbPoints);
+      SoAPoints_Par.AssignCartesian(CartPoints_Par);
+
+      // r: the kernel is within 1 ulp of the exact radius, the 3 arguments std::hypot used by
+      // fCart2Pol within ~2 ulp, hence the 4 ulp bound.
+      // angles: the kernel uses atan2 for both angles, fCart2Pol goes through acos(c) which amplifies the
+      // rounding of its argument c (up to ~3 ulp after hypot and the division) by 1/sqrt(1-c^2):
+      // allow 4 ulp plus 4 ulp of c amplified
+      constexpr std::uint64_t MaxUlpR = 4, MaxUlpAngle = 4;
+      auto fAngleTolerance = [](double c, double Angle) -> double {
+         auto fUlp = [](double v) { return std::nextafter(std::fabs(v), HUGE_VAL) - std::fabs(v); };
+         return MaxUlpAngle * fUlp(Angle) + 4. * fUlp(c) / std::sqrt(std::max(0., 1. - c * c));
+      };
+
+      for (auto Level : {tbb_demo::SimdLevel::Scalar, tbb_demo::SimdLevel::AVX2, tbb_demo::SimdLevel::AVX512})
+      {
+         if (!tbb_demo::IsSimdLevelAvailable(Level))
+            continue;
+         tbb_demo::MemoryProbe Probe;
+         auto Start = std::chrono::high_resolution_clock::now();
+         tbb_demo::ParallelCart2Pol(SoAPoints_Par, Level);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_TEST_MESSAGE("Points Transfo SoA " << tbb_demo::SimdLevelName(Level) << " [PAR] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e6 << " Mpts/s" << Probe);
+
+         // compare against fCart2Pol (PolarPoints_Par holds fCart2Pol of the same points)
+         const size_t NbErrors = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), size_t(0),
+            [&](const tbb::blocked_range<size_t>& r, size_t Errors) -> size_t {
+               for (size_t i = r.begin(); i != r.end(); ++i)
+               {
+                  const auto& Ref = PolarPoints_Par[i];
+                  const auto Cart = SoAPoints_Par.Cartesian(i);
+                  const auto Pol = SoAPoints_Par.Polar(i);
+                  const double CosTheta = Cart[0] / std::hypot(Cart[0], Cart[1]);
+                  const double CosPhi = Cart[2] / Ref[0];
+                  if (tbb_demo::UlpDistance(Pol[0], Ref[0]) > MaxUlpR ||
+                     std::fabs(Pol[1] - Ref[1]) > fAngleTolerance(CosTheta, Ref[1]) ||
+                     std::fabs(Pol[2] - Ref[2]) > fAngleTolerance(CosPhi, Ref[2]))
+                     ++Errors;
+               }
+               return Errors;
+            },
+            std::plus<size_t>());
+         BOOST_CHECK_MESSAGE(NbErrors == 0, "SoA " << tbb_demo::SimdLevelName(Level) << " kernel: " << NbErrors << " points out of the ulp bound");
+      }
    }
 
 
@@ -123,18 +216,30 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
    };
    // Sort the vector of points by radius sequentially
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       std::sort(begin(PolarPoints_Seq), end(PolarPoints_Seq), fSortPolar);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("Sort By Radius [SEQ] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("Sort By Radius [SEQ] " << time_span.count() << "s" << Probe);
    }
 
    // Sort the vector of points by radius Parallel
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::parallel_sort(begin(PolarPoints_Par), end(PolarPoints_Par), fSortPolar);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("Sort By Radius [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("Sort By Radius [PAR] " << time_span.count() << "s" << Probe);
+   }
+
+   // Spatial index over the converted points, to compare with the sort (tbb_PolarIndex times the queries)
+   {
+      tbb_demo::MemoryProbe Probe;
+      auto Start = std::chrono::high_resolution_clock::now();
+      const tbb_demo::PolarIndex Index(PolarPoints_Par);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_CHECK_EQUAL(Index.size(), PolarPoints_Par.size());
+      BOOST_TEST_MESSAGE("Polar Index Build [PAR] " << time_span.count() << "s " << Index.NbCells() << " cells " << double(Index.MemoryBytes()) / 1e6 << " MB" << Probe);
    }
 
    //computing sum of radius seq
@@ -145,10 +250,11 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
       {
          return PolrPt1[0] + lsum;
       };
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
 	 [[maybe_unused]] double Sum = std::accumulate(begin(PolarPoints_Seq), end(PolarPoints_Seq), 0., fSumPolarR);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("SUM RADIUS [SEQ] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("SUM RADIUS [SEQ] " << time_span.count() << "s" << Probe);
    }
 
    {
@@ -161,7 +267,7 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
       struct Sum {
          double value;
          Sum() : value(0.) {}
-		 Sum(Sum& s, tbb::split) { value = s.value; }
+		 Sum(Sum&, tbb::split) : value(0.) {} // a split body starts from 0, join() adds the partial sums
          void operator()(const tbb::blocked_range< std::vector<std::array<double, 3>>::iterator>& range) {
             auto temp = value;
             for (auto a = range.begin(); a != range.end(); ++a) {
@@ -173,12 +279,22 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
       };
 
       Sum total;
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::parallel_reduce(tbb::blocked_range< std::vector<std::array<double, 3>>::iterator>(PolarPoints_Par.begin(), PolarPoints_Par.end(), 1000),
          total);
       //total.value;
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("SUM RADIUS [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("SUM RADIUS [PAR] " << time_span.count() << "s" << Probe);
+   }
+
+   // Compensated sum on a fixed reduction tree: the same bits whatever the number of threads
+   {
+      tbb_demo::MemoryProbe Probe;
+      auto Start = std::chrono::high_resolution_clock::now();
+      const double Sum = tbb_demo::DeterministicSum(PolarPoints_Par.data()->data(), NbPoints, 3);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("SUM RADIUS DETERMINISTIC [PAR] " << time_span.count() << "s checksum " << std::hexfloat << Sum << std::defaultfloat << Probe);
    }
 
 
@@ -191,10 +307,11 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
          //return PolrPt1[0] + lsum;
          return std::log(std::exp(PolrPt1[0]) * std::exp(lsum));// This a very stupid way to mak a simple sum :-)
       };
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
 	 [[maybe_unused]] double Sum = std::accumulate(begin(PolarPoints_Seq), end(PolarPoints_Seq), 0., fSumPolarR2);
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("SUM RADIUS KILLING POLAR BEAR :-( [SEQ] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("SUM RADIUS KILLING POLAR BEAR :-( [SEQ] " << time_span.count() << "s" << Probe);
    }
 
    if (!SavePolarBears)
@@ -209,7 +326,7 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
       struct Sum {
          double value;
          Sum() : value(0.) {}
-         Sum(Sum& s, tbb::split) { value = s.value; }
+         Sum(Sum&, tbb::split) : value(0.) {} // as for SUM RADIUS [PAR], a split body starts from 0
          void operator()(const tbb::blocked_range< std::vector<std::array<double, 3>>::iterator>& range) {
             auto temp = value;
             for (auto a = range.begin(); a != range.end(); ++a) {
@@ -221,17 +338,67 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
       };
 
       Sum total;
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::parallel_reduce(tbb::blocked_range< std::vector<std::array<double, 3>>::iterator>(PolarPoints_Par.begin(), PolarPoints_Par.end(), 1000),
          total);
       //total.value;
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("SUM RADIUS KILLING POLAR BEAR :-( [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("SUM RADIUS KILLING POLAR BEAR :-( [PAR] " << time_span.count() << "s" << Probe);
+   }
+
+   // The polar bear kernels overflow as soon as exp(r) > DBL_MAX (r > 709), what a transcendental-heavy
+   // reduction should do is a log-sum-exp: log(sum(exp(r))) = max + log(sum(exp(r - max))).
+   // Its partial results (max, sum(exp(r - max))) combine associatively, so it reduces in parallel.
+   if (!SavePolarBears)
+   {
+      // all on PolarPoints_Par, the Philox points (PolarPoints_Seq comes from another generator)
+      // high precision sequential reference
+      long double Reference = 0.;
+      {
+         tbb_demo::MemoryProbe Probe;
+         auto Start = std::chrono::high_resolution_clock::now();
+         long double Max = -HUGE_VALL, Sum = 0., Comp = 0.;
+         for (const auto& PolrPt : PolarPoints_Par)
+            Max = std::max<long double>(Max, PolrPt[0]);
+         for (const auto& PolrPt : PolarPoints_Par)
+         {
+            const long double Term = std::exp(PolrPt[0] - Max), t = Sum + Term;
+            Comp += (Sum - t) + Term;
+            Sum = t;
+         }
+         Reference = Max + std::log(Sum + Comp);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_TEST_MESSAGE("LOG SUM EXP REFERENCE long double [SEQ] " << time_span.count() << "s" << Probe);
+      }
+
+      auto fRelativeError = [&Reference](double Value) -> double { return double(std::fabs((Value - Reference) / Reference)); };
+      {
+         tbb_demo::MemoryProbe Probe;
+         auto Start = std::chrono::high_resolution_clock::now();
+         double Max = -HUGE_VAL;
+         for (const auto& PolrPt : PolarPoints_Par)
+            Max = std::max(Max, PolrPt[0]);
+         const double Sum = std::accumulate(begin(PolarPoints_Par), end(PolarPoints_Par), 0.,
+            [Max](double lsum, const std::array<double, 3>& PolrPt) { return lsum + std::exp(PolrPt[0] - Max); });
+         const double LogSumExp = Max + std::log(Sum);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_TEST_MESSAGE("LOG SUM EXP [SEQ] " << time_span.count() << "s relative error " << fRelativeError(LogSumExp) << Probe);
+      }
+      {
+         tbb_demo::MemoryProbe Probe;
+         auto Start = std::chrono::high_resolution_clock::now();
+         const double LogSumExp = tbb_demo::LogSumExp(PolarPoints_Par.data()->data(), NbPoints, 3);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_TEST_MESSAGE("LOG SUM EXP " << tbb_demo::SimdLevelName(tbb_demo::DetectSimdLevel()) << " [PAR] " << time_span.count() << "s relative error " << fRelativeError(LogSumExp) << Probe);
+         BOOST_CHECK_SMALL(fRelativeError(LogSumExp), 1e-14);
+      }
    }
 
    if (ActivateCompose)
    {
       //Show composition and simple tasks
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::parallel_invoke(
          [&PolarPoints_Par, &CartPoints_Par, &fCart2Pol]() {  // First Call
@@ -257,7 +424,7 @@ BOOST_AUTO_TEST_CASE(tbb_Cartesian_to_Polar)
          );
 
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("\n DOING 3 THINGS AT THE SAME TIME :-) " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("\n DOING 3 THINGS AT THE SAME TIME :-) " << time_span.count() << "s" << Probe);
    }
 
 }
@@ -269,6 +436,7 @@ BOOST_AUTO_TEST_CASE(tbb_Containers)
    constexpr size_t NbToPush = 1e7; //one billion
 
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       std::vector<int> Test;
       for (size_t i = 0;i < NbToPush;i++)
@@ -276,24 +444,26 @@ BOOST_AUTO_TEST_CASE(tbb_Containers)
       if (Test.size() != NbToPush)
          BOOST_TEST_MESSAGE("Error Size has not be reached");
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("PUSH BACK [SEQ] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("PUSH BACK [SEQ] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(Test.capacity() * sizeof(Test[0])) / 1e6 << " MB" << Probe);
    }
 
    if (0) ///Activate this first
    {
       BOOST_TEST_MESSAGE("Start Pushback unsafe ...");
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       std::vector<int> Test;
       tbb::parallel_for(size_t(0), NbToPush, [&Test](size_t i) { std::vector<int> Local; Test.push_back(i);} );
       if (Test.size() != NbToPush)
          BOOST_TEST_MESSAGE("Error Size has not be reached");
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("PUSH BACK NO MUTEX [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("PUSH BACK NO MUTEX [PAR] " << time_span.count() << "s" << Probe);
    }
 
    if (1)
    {
       std::mutex Mtx; //will be use to protect push_back
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       std::vector<int> Test;
       tbb::parallel_for(size_t(0), NbToPush, [&Test, &Mtx](size_t i) {
@@ -303,21 +473,23 @@ BOOST_AUTO_TEST_CASE(tbb_Containers)
       if (Test.size() != NbToPush)
          BOOST_TEST_MESSAGE("Error Size has not be reached");
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("PUSH BACK PAR MUTEX [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("PUSH BACK PAR MUTEX [PAR] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(Test.capacity() * sizeof(Test[0])) / 1e6 << " MB" << Probe);
    }
 
    if (1)
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::concurrent_vector<size_t> Test;
       tbb::parallel_for(size_t(0), NbToPush, [&Test](size_t i) {Test.push_back(i);});
       if (Test.size() != NbToPush)
          BOOST_TEST_MESSAGE("Error Size has not be reached");
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("PUSH BACK TBBVEC [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("PUSH BACK TBBVEC [PAR] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(Test.capacity() * sizeof(Test[0])) / 1e6 << " MB" << Probe);
    }
 
    {
+      tbb_demo::MemoryProbe Probe;
       auto Start = std::chrono::high_resolution_clock::now();
       tbb::concurrent_vector<int> Test;
       for (size_t i = 0;i < NbToPush;i++)
@@ -325,7 +497,56 @@ BOOST_AUTO_TEST_CASE(tbb_Containers)
       if (Test.size() != NbToPush)
          BOOST_TEST_MESSAGE("Error Size has not be reached");
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("PUSH BACK SEQ ON TBB [SEQ] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("PUSH BACK SEQ ON TBB [SEQ] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(Test.capacity() * sizeof(Test[0])) / 1e6 << " MB" << Probe);
+   }
+
+   // Sharded append buffer : one shard per thread, slots reserved by batches, no lock and no shared counter
+   {
+      tbb_demo::MemoryProbe Probe;
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ShardedAppendBuffer<size_t> Test;
+      tbb::parallel_for(size_t(0), NbToPush, [&Test](size_t i) {Test.push_back(i);});
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_CHECK_EQUAL(Test.size(), NbToPush);
+      BOOST_TEST_MESSAGE("PUSH BACK SHARDED [PAR] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(Test.MemoryBytes()) / 1e6 << " MB (" << Test.NbShards() << " shards)" << Probe);
+   }
+
+   {
+      tbb_demo::MemoryProbe Probe;
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ShardedAppendBuffer<size_t> Test;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, NbToPush), [&Test](const tbb::blocked_range<size_t>& r) {
+         auto& Local = Test.Local(); // one thread local lookup per range
+         for (size_t i = r.begin(); i != r.end(); ++i)
+            Local.push_back(i);
+         });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_CHECK_EQUAL(Test.size(), NbToPush);
+      BOOST_TEST_MESSAGE("PUSH BACK SHARDED LOCAL [PAR] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(Test.MemoryBytes()) / 1e6 << " MB" << Probe);
+
+      // Concatenation into one std::vector : parallel prefix sum of the block sizes, parallel copy
+      Probe.Restart();
+      Start = std::chrono::high_resolution_clock::now();
+      std::vector<size_t> All = Test.Gather();
+      time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_CHECK_EQUAL(All.size(), NbToPush);
+      BOOST_CHECK_EQUAL(tbb::parallel_reduce(tbb::blocked_range<size_t>(0, All.size()), size_t(0), [&All](const tbb::blocked_range<size_t>& r, size_t Sum) {
+         return std::accumulate(All.data() + r.begin(), All.data() + r.end(), Sum);
+         }, std::plus<size_t>()), NbToPush * (NbToPush - 1) / 2);
+      BOOST_TEST_MESSAGE("PUSH BACK SHARDED GATHER [PAR] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(All.capacity() * sizeof(All[0])) / 1e6 << " MB" << Probe);
+
+      // Ordered gather : every value is its loop index, so it goes back to its sequential position
+      Probe.Restart();
+      Start = std::chrono::high_resolution_clock::now();
+      std::vector<size_t> Ordered;
+      Test.GatherByIndex(Ordered, [](size_t Value) { return Value; });
+      time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      size_t NbMisplaced = 0;
+      for (size_t i = 0; i < Ordered.size(); i++)
+         NbMisplaced += Ordered[i] != i;
+      BOOST_CHECK_EQUAL(Ordered.size(), NbToPush);
+      BOOST_CHECK_EQUAL(NbMisplaced, 0u);
+      BOOST_TEST_MESSAGE("PUSH BACK SHARDED ORDERED GATHER [PAR] " << time_span.count() << "s " << NbToPush / double(time_span.count()) / 1e6 << " Mitems/s " << double(Ordered.capacity() * sizeof(Ordered[0])) / 1e6 << " MB" << Probe);
    }
 
 
@@ -346,12 +567,14 @@ BOOST_AUTO_TEST_CASE(tbb_ContainersSTL)
       BOOST_TEST_MESSAGE("Multiple 3 [SEQ] " << time_span.count() << "s");
    }
 
-   // {
-   //    auto Start = std::chrono::high_resolution_clock::now();
-   //    auto Nb3Multiple = std::count_if(std::execution::par, begin(Test), end(Test), [](int i)->bool { return i % 3 == 0; });
-   //    std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-   //    BOOST_TEST_MESSAGE("Multiple 3 [PAR] " << time_span.count() << "s");
-   // }
+   // std::execution::par needs a parallel STL backend, tbb_algorithms.h does it on TBB and follows the segments of the concurrent_vector
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      auto Nb3Multiple = tbb_demo::ParallelCountIf(Test, [](int i)->bool { return i % 3 == 0; });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_CHECK_EQUAL(Nb3Multiple, (Test.size() + 2) / 3);
+      BOOST_TEST_MESSAGE("Multiple 3 [PAR] " << time_span.count() << "s");
+   }
 
 }
 
@@ -395,7 +618,7 @@ BOOST_AUTO_TEST_CASE(tbb_Allocator)
          delete dummyi;
          });
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("STD ALLOC TIME [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("STD ALLOC TIME [PAR] " << time_span.count() << "s " << double(time_span.count()) * 1e9 / (3 * NbAllocs) << " ns/alloc");
 
    }
 
@@ -418,10 +641,99 @@ BOOST_AUTO_TEST_CASE(tbb_Allocator)
             IntAllocator.deallocate(dummyi, sizeof(int));
          });
       std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
-      BOOST_TEST_MESSAGE("PPL ALLOC TIME [PAR] " << time_span.count() << "s");
+      BOOST_TEST_MESSAGE("PPL ALLOC TIME [PAR] " << time_span.count() << "s " << double(time_span.count()) * 1e9 / (3 * NbAllocs) << " ns/alloc");
+
+   }
+
+   // Thread local arena : size classes over a bump allocator, everything released at once at the end of the range
+   if (1)
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+
+      tbb_demo::ThreadArenas Arenas;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, NbAllocs), [&Arenas](const tbb::blocked_range<size_t>& r)
+         {
+            auto& Pool = Arenas.Local();
+            tbb_demo::ArenaScope Scope(Pool);
+            for (size_t i = r.begin(); i != r.end(); ++i)
+            {
+               void* dummyc = Pool.Allocate(sizeof(char), alignof(char));
+               void* dummyi = Pool.Allocate(sizeof(int), alignof(int));
+               Pool.Deallocate(dummyc, sizeof(char), alignof(char));
+               void* dummyd = Pool.Allocate(sizeof(double), alignof(double));
+               Pool.Deallocate(dummyd, sizeof(double), alignof(double));
+               Pool.Deallocate(dummyi, sizeof(int), alignof(int));
+            }
+         });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("ARENA ALLOC TIME [PAR] " << time_span.count() << "s " << double(time_span.count()) * 1e9 / (3 * NbAllocs) << " ns/alloc " << Arenas.Chunks().NbChunks() << " chunks");
 
    }
 
+   // The blocks of the size classes honour the alignment asked for, also when it is larger than the size
+   {
+      tbb_demo::ChunkFreeList Chunks;
+      tbb_demo::ArenaPool Pool(Chunks);
+      auto fAligned = [](const void* p, size_t Align) { return reinterpret_cast<std::uintptr_t>(p) % Align == 0; };
+      for (int i = 0; i < 4; ++i) // the first round from the arena, the others from the class lists
+      {
+         Pool.Allocate(1, 1); // moves the bump pointer off a 16-byte boundary
+         void* p8 = Pool.Allocate(8);
+         void* p24 = Pool.Allocate(24, 16);
+         BOOST_CHECK(fAligned(p8, alignof(std::max_align_t)));
+         BOOST_CHECK(fAligned(p24, 16));
+         Pool.Deallocate(p8, 8);
+         Pool.Deallocate(p24, 24, 16);
+      }
+   }
+
+   // Many short-lived objects per task, freed together : one std::list per range, from 1 thread to all the cores
+   {
+      constexpr size_t NbNodes = 1e7;
+      std::vector<int> NbThreads;
+      for (int n = 1; n < tbb::info::default_concurrency(); n *= 2)
+         NbThreads.push_back(n);
+      NbThreads.push_back(tbb::info::default_concurrency());
+
+      auto fListSum = [](auto& Nodes, const tbb::blocked_range<size_t>& r) {
+         for (size_t i = r.begin(); i != r.end(); ++i)
+            Nodes.push_back(i);
+         return std::accumulate(Nodes.begin(), Nodes.end(), size_t(0));
+      };
+      auto fTaskLists = [&NbThreads](const char* Name, auto fBody) {
+         for (int Threads : NbThreads)
+         {
+            tbb::global_control Limit(tbb::global_control::max_allowed_parallelism, size_t(Threads));
+            tbb_demo::ResetPeakRss();
+            const size_t RssBefore = tbb_demo::CurrentRss();
+            auto Start = std::chrono::high_resolution_clock::now();
+            tbb_demo::ThreadArenas Arenas;
+            const size_t Sum = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbNodes), size_t(0), [&Arenas, &fBody](const tbb::blocked_range<size_t>& r, size_t s) {
+               return s + fBody(r, Arenas);
+               }, std::plus<size_t>());
+            std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+            BOOST_CHECK_EQUAL(Sum, NbNodes * (NbNodes - 1) / 2);
+            BOOST_TEST_MESSAGE("TASK LISTS " << Name << " [PAR x" << Threads << "] " << time_span.count() << "s " << double(time_span.count()) * 1e9 / NbNodes << " ns/alloc, peak RSS +"
+                               << (double(tbb_demo::PeakRss()) - double(RssBefore)) / (1 << 20) << " MiB");
+         }
+      };
+
+      fTaskLists("STD", [&fListSum](const tbb::blocked_range<size_t>& r, tbb_demo::ThreadArenas&) {
+         std::list<size_t> Nodes;
+         return fListSum(Nodes, r);
+         });
+      fTaskLists("PPL", [&fListSum](const tbb::blocked_range<size_t>& r, tbb_demo::ThreadArenas&) {
+         std::list<size_t, tbb::scalable_allocator<size_t>> Nodes;
+         return fListSum(Nodes, r);
+         });
+      fTaskLists("ARENA", [&fListSum](const tbb::blocked_range<size_t>& r, tbb_demo::ThreadArenas& Arenas) {
+         auto& Pool = Arenas.Local();
+         tbb_demo::ArenaScope Scope(Pool); // the nodes are not freed one by one but rewound with the scope
+         std::list<size_t, tbb_demo::ArenaAllocator<size_t>> Nodes{tbb_demo::ArenaAllocator<size_t>(Pool)};
+         return fListSum(Nodes, r);
+         });
+   }
+
 
 
    // {
@@ -436,29 +748,25 @@ BOOST_AUTO_TEST_CASE(tbb_Allocator)
 BOOST_AUTO_TEST_CASE(tbb_Exception)
 {
 
-#if 0
    {
-
-      struct Update {
-         void operator()(const tbb::blocked_range<int>& r) const {
-            for (int i = r.begin(); i != r.end(); ++i)
-               if (i < Data.size()) {
-                  ++Data[i];
-               }
-               else {
-                  // Cancel related tasks.
-                  if (current_context()->cancel_group_execution())
-                     std::cout << "Index " << i << " caused cancellation\n";
-                  return;
-               }
-         }
-      };
-      Data.resize(1000);
-      tbb::parallel_for(tbb::blocked_range<int>(0, 2000), Update());
-
-
+      // Cancelling the other tasks of the group from a body, without an exception (tbb_search.h builds its searches on it)
+      std::vector<int> Data(1000);
+      std::atomic<int> CancelledAt{-1};
+      tbb::parallel_for(tbb::blocked_range<int>(0, 2000), [&Data, &CancelledAt](const tbb::blocked_range<int>& r) {
+         for (int i = r.begin(); i != r.end(); ++i)
+            if (i < int(Data.size())) {
+               ++Data[size_t(i)];
+            }
+            else {
+               // Cancel related tasks.
+               if (tbb::task::current_context()->cancel_group_execution())
+                  CancelledAt = i;
+               return;
+            }
+         });
+      BOOST_CHECK_GE(CancelledAt.load(), 1000);
+      BOOST_TEST_MESSAGE("Index " << CancelledAt << " caused cancellation");
    }
-#endif
 
    {
       bool Data[1000][1000];
@@ -543,9 +851,1485 @@ BOOST_AUTO_TEST_CASE(tbb_SharedPtrs)
       } 
    }
 
+   {
+      // one slot per thread instead of one shared atomic, see tbb_ShardedCounters
+      auto ptr=std::make_shared<tbb_demo::ShardedCounter<size_t>>();
+      constexpr size_t UpperLimit=1e6;
+      tbb::parallel_for(size_t(0), size_t(UpperLimit), [&ptr](size_t i){ // by reference: no refcount update per task
+        ptr->Add(i);
+      });
+
+      if( ((UpperLimit*(UpperLimit-1))/2) != ptr->Combine())
+      BOOST_TEST_MESSAGE("shared_ptr+sharded SUM IS WRONG "<<ptr->Combine());
+      else
+      {
+         BOOST_TEST_MESSAGE("shared_ptr+sharded SUM IS OK ");
+      } 
+   }
+
+}
+
+
+
+BOOST_AUTO_TEST_CASE(tbb_ReproducibleGenerator)
+{
+   // Known answers of Philox4x32-10 (Random123 kat_vectors)
+   BOOST_CHECK((tbb_demo::Philox4x32({0, 0, 0, 0}, {0, 0}) == tbb_demo::PhiloxCounter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+   BOOST_CHECK((tbb_demo::Philox4x32({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff}) == tbb_demo::PhiloxCounter{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+   BOOST_CHECK((tbb_demo::Philox4x32({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0}) == tbb_demo::PhiloxCounter{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+
+   constexpr size_t NbPoints = 10000000;
+   const tbb_demo::PointGenerator Generator{20220531};
+
+   std::vector<std::array<double, 3>> Reference(NbPoints);
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      Generator.ParallelFill(Reference);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Points Generation [PHILOX " << tbb_demo::SimdLevelName(Generator.Level) << " PAR] " << time_span.count() << "s");
+   }
+
+   // The vectorized fill gives the points of the scalar reference
+   size_t NbDiffs = 0;
+   for (size_t i = 0; i < NbPoints; i += 997)
+      NbDiffs += (Generator(i) != Reference[i]);
+   BOOST_CHECK_MESSAGE(NbDiffs == 0, NbDiffs << " points differ from the scalar reference");
+
+   // Same dataset bit for bit whatever the arena size...
+   for (int NbThreads : {1, 2, tbb::info::default_concurrency()})
+   {
+      std::vector<std::array<double, 3>> Points(NbPoints);
+      tbb::task_arena Arena(NbThreads);
+      auto Start = std::chrono::high_resolution_clock::now();
+      Arena.execute([&Generator, &Points]() { Generator.ParallelFill(Points); });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Points Generation [PHILOX " << NbThreads << " THREADS] " << time_span.count() << "s");
+      BOOST_CHECK_MESSAGE(std::memcmp(Points.data(), Reference.data(), NbPoints * sizeof(Points[0])) == 0,
+                          "dataset generated with " << NbThreads << " threads differs");
+   }
+
+   // ... and whatever the SIMD level and the layout
+   for (auto Level : {tbb_demo::SimdLevel::Scalar, tbb_demo::SimdLevel::AVX2, tbb_demo::SimdLevel::AVX512})
+   {
+      if (!tbb_demo::IsSimdLevelAvailable(Level))
+         continue;
+      tbb_demo::PointGenerator LevelGenerator = Generator;
+      LevelGenerator.Level = Level;
+      tbb_demo::SoAPoints Points(NbPoints);
+      auto Start = std::chrono::high_resolution_clock::now();
+      LevelGenerator.ParallelFill(Points);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Points Generation SoA [PHILOX " << tbb_demo::SimdLevelName(Level) << " PAR] " << time_span.count() << "s");
+      const size_t NbLevelDiffs = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), size_t(0),
+         [&Points, &Reference](const tbb::blocked_range<size_t>& r, size_t Diffs) -> size_t {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+               Diffs += (Points.Cartesian(i) != Reference[i]);
+            return Diffs;
+         },
+         std::plus<size_t>());
+      BOOST_CHECK_MESSAGE(NbLevelDiffs == 0, NbLevelDiffs << " points differ with " << tbb_demo::SimdLevelName(Level));
+   }
+}
+
+BOOST_AUTO_TEST_CASE(tbb_RadixSort)
+{
+   using Point = std::array<double, 3>;
+   auto fRadius = [](const Point& PolrPt) -> double { return PolrPt[0]; };
+   auto fSortPolar = [](const Point& PolrPt1, const Point& PolrPt2) -> bool { return PolrPt1[0] < PolrPt2[0]; };
+   // reference order of the radix sort: stable, on the order preserving integer keys
+   auto fSortKeys = [](const Point& PolrPt1, const Point& PolrPt2) -> bool {
+      return tbb_demo::OrderedKey(PolrPt1[0]) < tbb_demo::OrderedKey(PolrPt2[0]);
+   };
+
+   // Special values: -0.0 goes before +0.0, NaNs go to the end of their sign,
+   // the second coordinate keeps the original position to check stability
+   {
+      const double Inf = std::numeric_limits<double>::infinity(), NaN = std::numeric_limits<double>::quiet_NaN();
+      const std::vector<double> Keys = {3., NaN, -0., 0., -Inf, 1., -NaN, Inf, 3., 0., -0., -1., 1., NaN};
+      std::vector<Point> Records;
+      for (size_t i = 0; i < Keys.size(); ++i)
+         Records.push_back({Keys[i], double(i), 0.});
+      std::vector<Point> Expected = Records, ByRecords = Records, ByIndex = Records;
+      std::stable_sort(begin(Expected), end(Expected), fSortKeys);
+      tbb_demo::ParallelRadixSort(ByRecords, fRadius);
+      tbb_demo::ParallelRadixSortByKeyIndex(ByIndex, fRadius);
+      BOOST_CHECK(std::memcmp(ByRecords.data(), Expected.data(), Expected.size() * sizeof(Point)) == 0);
+      BOOST_CHECK(std::memcmp(ByIndex.data(), Expected.data(), Expected.size() * sizeof(Point)) == 0);
+      BOOST_CHECK(std::signbit(Expected[0][0]) && std::isnan(Expected[0][0]));
+      BOOST_CHECK(Expected[1][0] == -Inf);
+      BOOST_CHECK(std::signbit(Expected[3][0]) && Expected[3][0] == 0. && !std::signbit(Expected[5][0]));
+      BOOST_CHECK(!std::signbit(Expected.back()[0]) && std::isnan(Expected.back()[0]));
+   }
+
+   constexpr size_t NbPoints = 10000000;
+   std::vector<Point> PolarPoints(NbPoints);
+   {
+      // radii of random points, with many duplicated keys to exercise the stability,
+      // the second coordinate is the original position
+      const tbb_demo::PointGenerator Generator{20220531};
+      tbb::parallel_for(size_t(0), NbPoints, [&Generator, &PolarPoints](size_t i) {
+         const Point CartPt = Generator(i);
+         const double R = std::hypot(CartPt[0], CartPt[1], CartPt[2]);
+         PolarPoints[i] = {i % 16 == 0 ? std::floor(R) : R, double(i), CartPt[2]};
+      });
+   }
+
+   std::vector<Point> Sorted_Par = PolarPoints;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb::parallel_sort(begin(Sorted_Par), end(Sorted_Par), fSortPolar);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Sort By Radius [PAR] " << time_span.count() << "s");
+   }
+
+   std::vector<Point> Sorted_Radix = PolarPoints;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ParallelRadixSort(Sorted_Radix, fRadius);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Sort By Radius RADIX [PAR] " << time_span.count() << "s");
+   }
+
+   std::vector<Point> Sorted_RadixIndex = PolarPoints;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ParallelRadixSortByKeyIndex(Sorted_RadixIndex, fRadius);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Sort By Radius RADIX KEY+INDEX [PAR] " << time_span.count() << "s");
+   }
+
+   std::vector<Point> Sorted_Stable = PolarPoints;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      std::stable_sort(begin(Sorted_Stable), end(Sorted_Stable), fSortPolar);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("Sort By Radius STABLE [SEQ] " << time_span.count() << "s");
+   }
+
+   // both radix modes are stable: same records in the same order as std::stable_sort,
+   // tbb::parallel_sort is not stable but must give the same sequence of radii
+   BOOST_CHECK(std::memcmp(Sorted_Radix.data(), Sorted_Stable.data(), NbPoints * sizeof(Point)) == 0);
+   BOOST_CHECK(std::memcmp(Sorted_RadixIndex.data(), Sorted_Stable.data(), NbPoints * sizeof(Point)) == 0);
+   BOOST_CHECK(std::equal(begin(Sorted_Par), end(Sorted_Par), begin(Sorted_Radix),
+                          [](const Point& a, const Point& b) { return a[0] == b[0]; }));
+}
+
+BOOST_AUTO_TEST_CASE(tbb_DeterministicReduce)
+{
+   constexpr size_t NbPoints = 10000000;
+   std::vector<double> Radius(NbPoints);
+   {
+      const tbb_demo::PointGenerator Generator{20220531};
+      tbb::parallel_for(size_t(0), NbPoints, [&Generator, &Radius](size_t i) {
+         const auto CartPt = Generator(i);
+         Radius[i] = std::hypot(CartPt[0], CartPt[1], CartPt[2]);
+      });
+   }
+
+   // Reference: compensated sum in long double (64 bits mantissa on x86)
+   long double RefSum = 0., RefComp = 0.;
+   for (double r : Radius)
+   {
+      const long double t = RefSum + r;
+      RefComp += std::fabs(RefSum) < r ? (r - t) + RefSum : (RefSum - t) + r;
+      RefSum = t;
+   }
+   const long double Reference = RefSum + RefComp;
+   auto fError = [Reference](double Sum) -> double { return double(std::fabs((Sum - Reference) / Reference)); };
+
+   double Accumulate = 0.;
+   float AccumulateTime = 0.f;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      Accumulate = std::accumulate(begin(Radius), end(Radius), 0.);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      AccumulateTime = time_span.count();
+      BOOST_TEST_MESSAGE("SUM std::accumulate [SEQ] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e9 << " Gelem/s relative error " << fError(Accumulate));
+   }
+
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      const double Sum = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints, 1000), 0.,
+         [&Radius](const tbb::blocked_range<size_t>& r, double Partial) -> double {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+               Partial += Radius[i];
+            return Partial;
+         },
+         std::plus<double>());
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("SUM parallel_reduce [PAR] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e9 << " Gelem/s relative error " << fError(Sum));
+   }
+
+   double Deterministic = 0.;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      Deterministic = tbb_demo::DeterministicSum(Radius.data(), NbPoints);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("SUM DETERMINISTIC [PAR] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e9 << " Gelem/s relative error " << fError(Deterministic)
+                         << " speedup vs std::accumulate " << AccumulateTime / time_span.count());
+   }
+   // the compensated sum is within one rounding of the exact sum
+   BOOST_CHECK_LE(tbb_demo::UlpDistance(Deterministic, double(Reference)), 1u);
+   BOOST_CHECK_LE(fError(Deterministic), fError(Accumulate));
+
+   // Same bits whatever the number of threads, the SIMD level and the layout
+   for (int NbThreads : {1, 2, tbb::info::default_concurrency()})
+   {
+      tbb::task_arena Arena(NbThreads);
+      const double Sum = Arena.execute([&Radius]() { return tbb_demo::DeterministicSum(Radius.data(), NbPoints); });
+      BOOST_CHECK_MESSAGE(std::memcmp(&Sum, &Deterministic, sizeof(Sum)) == 0, "sum with " << NbThreads << " threads differs");
+   }
+   for (auto Level : {tbb_demo::SimdLevel::Scalar, tbb_demo::SimdLevel::AVX2, tbb_demo::SimdLevel::AVX512})
+   {
+      if (!tbb_demo::IsSimdLevelAvailable(Level))
+         continue;
+      const double Sum = tbb_demo::DeterministicSum(Radius.data(), NbPoints, 1, 1 << 14, Level);
+      BOOST_CHECK_MESSAGE(std::memcmp(&Sum, &Deterministic, sizeof(Sum)) == 0, "sum with " << tbb_demo::SimdLevelName(Level) << " differs");
+   }
+   {
+      std::vector<std::array<double, 3>> Points(NbPoints);
+      tbb::parallel_for(size_t(0), NbPoints, [&Points, &Radius](size_t i) { Points[i] = {Radius[i], 0., 0.}; });
+      const double Sum = tbb_demo::DeterministicSum(Points.data()->data(), NbPoints, 3);
+      BOOST_CHECK(std::memcmp(&Sum, &Deterministic, sizeof(Sum)) == 0);
+   }
+
+   // Log-sum-exp of radii up to ~17000, where exp(r) alone overflows: the result is max + log(count)
+   // within rounding, and the SIMD levels only differ by the last bits of their exp
+   {
+      const double LogSumExp = tbb_demo::LogSumExp(Radius.data(), NbPoints, 1, 1 << 14, tbb_demo::SimdLevel::Scalar);
+      const double Max = *std::max_element(begin(Radius), end(Radius));
+      BOOST_CHECK(std::isfinite(LogSumExp));
+      BOOST_CHECK(LogSumExp >= Max && LogSumExp <= Max + std::log(double(NbPoints)));
+      for (int NbThreads : {1, 2, tbb::info::default_concurrency()})
+      {
+         tbb::task_arena Arena(NbThreads);
+         const double Lse = Arena.execute([&Radius]() {
+            return tbb_demo::LogSumExp(Radius.data(), NbPoints, 1, 1 << 14, tbb_demo::SimdLevel::Scalar);
+         });
+         BOOST_CHECK_MESSAGE(std::memcmp(&Lse, &LogSumExp, sizeof(Lse)) == 0, "log-sum-exp with " << NbThreads << " threads differs");
+      }
+      for (auto Level : {tbb_demo::SimdLevel::AVX2, tbb_demo::SimdLevel::AVX512})
+      {
+         if (!tbb_demo::IsSimdLevelAvailable(Level))
+            continue;
+         const double Lse = tbb_demo::LogSumExp(Radius.data(), NbPoints, 1, 1 << 14, Level);
+         BOOST_CHECK_MESSAGE(tbb_demo::UlpDistance(Lse, LogSumExp) <= 4u, "log-sum-exp with " << tbb_demo::SimdLevelName(Level) << " differs");
+      }
+   }
+}
+
+
+BOOST_AUTO_TEST_CASE(tbb_FusedPipeline)
+{
+   constexpr size_t NbPoints = 100000000;
+   const tbb_demo::PointGenerator Generator{20220531};
+   const tbb_demo::FusedPipelineConfig Config;
+   constexpr double MiB = 1024. * 1024.;
+
+   // Streaming: tiles go through generation, conversion and reduction while in cache.
+   // A tenth of the points first: the peak memory must not grow with the number of points
+   double SmallGrowth = 0.;
+   {
+      const size_t RssBefore = tbb_demo::CurrentRss();
+      const auto Small = tbb_demo::FusedCart2PolPipeline(Generator, NbPoints / 10, Config);
+      SmallGrowth = (double(Small.PeakRss) - double(RssBefore)) / MiB;
+   }
+   tbb_demo::FusedPipelineResult Fused;
+   {
+      const size_t RssBefore = tbb_demo::CurrentRss();
+      auto Start = std::chrono::high_resolution_clock::now();
+      Fused = tbb_demo::FusedCart2PolPipeline(Generator, NbPoints, Config);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      const double Growth = (double(Fused.PeakRss) - double(RssBefore)) / MiB;
+      BOOST_TEST_MESSAGE("FUSED PIPELINE [PAR] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e6 << " Mpts/s, "
+                         << Fused.MaxTilesInFlight << "/" << Fused.MaxTiles << " tiles of " << Fused.TileBytes / 1024 << " KiB in flight, RSS growth "
+                         << Growth << " MiB (" << SmallGrowth << " MiB for " << NbPoints / 10 << " points)");
+      BOOST_CHECK_LE(Fused.MaxTilesInFlight, Fused.MaxTiles);
+      BOOST_CHECK_LE(Growth, SmallGrowth + 16.);
+   }
+   BOOST_CHECK_EQUAL(std::accumulate(begin(Fused.Histogram), end(Fused.Histogram), size_t(0)), NbPoints);
+
+   // Same bits with one thread: the tiles are merged in order
+   {
+      tbb::task_arena Arena(1);
+      const auto Single = Arena.execute([&Generator, &Config]() { return tbb_demo::FusedCart2PolPipeline(Generator, NbPoints, Config); });
+      const double Sum = Single.RadiusSum.Result(), Reference = Fused.RadiusSum.Result();
+      BOOST_CHECK(std::memcmp(&Sum, &Reference, sizeof(Sum)) == 0);
+      BOOST_CHECK(Single.Histogram == Fused.Histogram);
+   }
+
+   // Materialized: the whole Cartesian and polar datasets in memory, one pass per stage
+   {
+      const size_t RssBefore = tbb_demo::CurrentRss();
+      auto Start = std::chrono::high_resolution_clock::now();
+      std::vector<std::array<double, 3>> CartPoints(NbPoints), PolarPoints(NbPoints);
+      Generator.ParallelFill(CartPoints);
+      tbb::parallel_for(size_t(0), NbPoints, [&CartPoints, &PolarPoints](size_t i) {
+         PolarPoints[i] = tbb_demo::Cart2Pol(CartPoints[i]);
+      });
+      using Histogram = std::vector<size_t>;
+      const size_t NbBins = Fused.Histogram.size();
+      const double BinWidth = Fused.BinWidth;
+      const Histogram Counts = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints, 1 << 14), Histogram(NbBins),
+         [&PolarPoints, BinWidth, NbBins](const tbb::blocked_range<size_t>& r, Histogram Partial) -> Histogram {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+               ++Partial[tbb_demo::RadiusBin(PolarPoints[i][0], BinWidth, NbBins)];
+            return Partial;
+         },
+         [](Histogram a, const Histogram& b) -> Histogram {
+            for (size_t k = 0; k < a.size(); ++k)
+               a[k] += b[k];
+            return a;
+         });
+      const double Sum = tbb_demo::DeterministicSum(PolarPoints.data()->data(), NbPoints, 3);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("MATERIALIZED [PAR] " << time_span.count() << "s " << NbPoints / double(time_span.count()) / 1e6 << " Mpts/s, RSS growth "
+                         << (double(tbb_demo::CurrentRss()) - double(RssBefore)) / MiB << " MiB");
+
+      // fCart2Pol and the SIMD kernel agree within a few ulp on r
+      BOOST_CHECK_SMALL(std::fabs(Sum - Fused.RadiusSum.Result()) / Sum, 1e-14);
+      BOOST_CHECK(Counts == Fused.Histogram);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(tbb_OutOfCore)
+{
+#if defined(TBB_DEMO_HAS_POINT_FILE)
+   // 24 MB files by default; TBB_DEMO_OOC_POINTS=1000000000 gives 24 GB files, several times the RAM of most machines
+   size_t NbPoints = 1000000;
+   if (const char* Env = std::getenv("TBB_DEMO_OOC_POINTS"))
+      NbPoints = std::stoull(Env);
+   const char* EnvDir = std::getenv("TBB_DEMO_OOC_DIR");
+   const char* TmpDir = std::getenv("TMPDIR");
+   const std::string Dir = EnvDir ? EnvDir : TmpDir ? TmpDir : "/tmp";
+   const std::string Prefix = Dir + "/tbb_demo_" + std::to_string(::getpid());
+   const std::string CartPath = Prefix + "_cart.pts", PolarPath = Prefix + "_polar.pts", SortedPath = Prefix + "_sorted.pts";
+   const std::uint64_t ChunkSize = 1 << 18;
+   // a quarter of the dataset at a time: the sort has to merge several runs
+   const size_t MemoryBudget = std::min<size_t>(size_t(1) << 30, NbPoints * 3 * sizeof(double) / 4);
+   const double FileBytes = double(NbPoints) * 3 * sizeof(double);
+   const tbb_demo::PointGenerator Generator{20220531};
+
+   const auto Raw = tbb_demo::MeasureDiskBandwidth(Prefix + "_raw.bin", std::min<size_t>(size_t(FileBytes), size_t(1) << 31));
+   BOOST_TEST_MESSAGE("OUT OF CORE " << NbPoints << " points, " << FileBytes / 1e9 << " GB per file, raw disk write " << Raw.WriteGBs << " GB/s read " << Raw.ReadGBs << " GB/s");
+
+   auto fReport = [](const char* Stage, std::chrono::high_resolution_clock::time_point Start, double Bytes) {
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE(Stage << " " << time_span.count() << "s " << Bytes / double(time_span.count()) / 1e9 << " GB/s");
+   };
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::WritePointFile(CartPath, Generator, NbPoints, ChunkSize);
+      fReport("OOC GENERATE write [PAR]", Start, FileBytes);
+   }
+   tbb_demo::DropFileCache(CartPath);
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ConvertPointFile(CartPath, PolarPath);
+      fReport("OOC CONVERT read+write [PAR]", Start, 2 * FileBytes);
+   }
+   std::remove(CartPath.c_str());
+   tbb_demo::DropFileCache(PolarPath);
+   double Sum = 0.;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      Sum = tbb_demo::SumPointFile(PolarPath);
+      fReport("OOC SUM RADIUS read r [PAR]", Start, FileBytes / 3);
+   }
+   tbb_demo::DropFileCache(PolarPath);
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::SortPointFile(PolarPath, SortedPath, Dir, MemoryBudget);
+      // read, write runs, read runs, write
+      fReport("OOC EXTERNAL SORT [PAR]", Start, 4 * FileBytes);
+   }
+
+   // the streaming pipeline computes the same radii with the same kernels
+   const auto Fused = tbb_demo::FusedCart2PolPipeline(Generator, NbPoints);
+   BOOST_CHECK_SMALL(std::fabs(Sum - Fused.RadiusSum.Result()) / Sum, 1e-14);
+   {
+      const tbb_demo::PointFileReader Sorted(SortedPath);
+      BOOST_CHECK_EQUAL(Sorted.NbPoints(), NbPoints);
+      std::atomic<size_t> NbUnsorted{0};
+      tbb::parallel_for(size_t(0), Sorted.NbChunks(), [&Sorted, &NbUnsorted](size_t c) {
+         const double* R = Sorted.Column(c, 0);
+         const size_t n = Sorted.Chunk(c).NbPoints;
+         if (!std::is_sorted(R, R + n) || Sorted.Chunk(c).MinRadius != R[0] || Sorted.Chunk(c).MaxRadius != R[n - 1] ||
+             (c + 1 < Sorted.NbChunks() && Sorted.Chunk(c + 1).MinRadius < R[n - 1]))
+            ++NbUnsorted;
+         Sorted.ReleaseChunk(c);
+      });
+      BOOST_CHECK_EQUAL(NbUnsorted, 0u);
+   }
+   BOOST_CHECK_SMALL(std::fabs(tbb_demo::SumPointFile(SortedPath) - Sum) / Sum, 1e-14);
+   std::remove(PolarPath.c_str());
+   std::remove(SortedPath.c_str());
+#else
+   BOOST_TEST_MESSAGE("OUT OF CORE needs mmap, skipped");
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(tbb_NumaArenas)
+{
+   // 1e6 points (96 MB) by default; TBB_DEMO_NUMA_POINTS=100000000 (9.6 GB) loads the memory bandwidth of every node
+   size_t NbPoints = 1000000;
+   if (const char* Env = std::getenv("TBB_DEMO_NUMA_POINTS"))
+      NbPoints = std::stoull(Env);
+   const tbb_demo::PointGenerator Generator{20220531};
+   // read a Cartesian point, write a polar one
+   constexpr double BytesPerPoint = 2 * sizeof(std::array<double, 3>);
+
+   const tbb_demo::NumaArenas Arenas;
+   BOOST_TEST_MESSAGE("NUMA " << Arenas.size() << " node(s)" << (Arenas.size() == 1 ? ", single arena" : ""));
+   for (size_t i = 0; i < Arenas.size(); ++i)
+      BOOST_TEST_MESSAGE("NUMA node " << Arenas.Node(i) << " " << Arenas.Arena(i).max_concurrency() << " threads");
+
+   // Current mode: vectors value-initialized by this thread, transform in the default arena
+   std::vector<std::array<double, 3>> CartPoints(NbPoints), PolarPoints(NbPoints);
+   Generator.ParallelFill(CartPoints);
+   float SingleArenaTime = 0.f;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb::parallel_for(size_t(0), NbPoints, [&CartPoints, &PolarPoints](size_t i) {
+         PolarPoints[i] = tbb_demo::Cart2Pol(CartPoints[i]);
+      });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      SingleArenaTime = time_span.count();
+      BOOST_TEST_MESSAGE("Points Transfo SINGLE ARENA [PAR] " << time_span.count() << "s " << double(NbPoints) * BytesPerPoint / double(time_span.count()) / 1e9 << " GB/s");
+   }
+
+   // NUMA mode: each node first-touches (generates) its partition, then transforms it
+   tbb_demo::NumaVector<std::array<double, 3>> NumaCartPoints(NbPoints), NumaPolarPoints(NbPoints);
+   const auto Bounds = Arenas.Partition(NbPoints, 4096);
+   {
+      Arenas.ParallelFor(Bounds, 1024, [&Generator, &NumaCartPoints](const tbb::blocked_range<size_t>& r) {
+         Generator.Fill(NumaCartPoints, r.begin(), r.end());
+      });
+      Arenas.FirstTouch(NumaPolarPoints, Bounds, [](size_t, std::array<double, 3>& PolrPt) { PolrPt = {0., 0., 0.}; });
+   }
+   {
+      std::vector<float> NodeTimes(Arenas.size());
+      auto Start = std::chrono::high_resolution_clock::now();
+      Arenas.ForEachNode(Bounds, [&](size_t Node, size_t Begin, size_t End) {
+         auto NodeStart = std::chrono::high_resolution_clock::now();
+         tbb::parallel_for(Begin, End, [&NumaCartPoints, &NumaPolarPoints](size_t i) {
+            NumaPolarPoints[i] = tbb_demo::Cart2Pol(NumaCartPoints[i]);
+         });
+         NodeTimes[Node] = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - NodeStart).count();
+      });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      for (size_t Node = 0; Node < Arenas.size(); ++Node)
+         BOOST_TEST_MESSAGE("Points Transfo NUMA node " << Arenas.Node(Node) << " " << NodeTimes[Node] << "s "
+                            << double(Bounds[Node + 1] - Bounds[Node]) * BytesPerPoint / double(NodeTimes[Node]) / 1e9 << " GB/s");
+      BOOST_TEST_MESSAGE("Points Transfo NUMA ARENAS [PAR] " << time_span.count() << "s " << double(NbPoints) * BytesPerPoint / double(time_span.count()) / 1e9
+                         << " GB/s, speedup vs single arena " << SingleArenaTime / time_span.count());
+   }
+   BOOST_CHECK(std::memcmp(NumaPolarPoints.data(), PolarPoints.data(), NbPoints * sizeof(PolarPoints[0])) == 0);
+
+   // reductions are routed the same way: the radius sum of each partition is computed on its node
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      const tbb_demo::CompensatedSum Sum = Arenas.ParallelReduce(Bounds, 1 << 14, tbb_demo::CompensatedSum{},
+         [&NumaPolarPoints](const tbb::blocked_range<size_t>& r, tbb_demo::CompensatedSum Partial) -> tbb_demo::CompensatedSum {
+            const tbb_demo::CompensatedPair Block = tbb_demo::CompensatedSumKernel(tbb_demo::DetectSimdLevel(), NumaPolarPoints[r.begin()].data(), r.size(), 3);
+            return Partial += tbb_demo::CompensatedSum{Block.Sum, Block.Comp};
+         },
+         [](tbb_demo::CompensatedSum a, const tbb_demo::CompensatedSum& b) { return a += b; });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("SUM RADIUS NUMA ARENAS [PAR] " << time_span.count() << "s");
+      const double Reference = tbb_demo::DeterministicSum(PolarPoints.data()->data(), NbPoints, 3);
+      BOOST_CHECK_SMALL(std::fabs(Sum.Result() - Reference) / Reference, 1e-15);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(tbb_SchedulerTrace)
+{
+   constexpr size_t NbPoints = 1e7;
+   std::vector<std::array<double, 3>> CartPoints(NbPoints), PolarPoints(NbPoints);
+   tbb_demo::PointGenerator{20220531}.ParallelFill(CartPoints);
+   auto fTransform = [&CartPoints, &PolarPoints](const tbb::blocked_range<size_t>& r) {
+      for (size_t i = r.begin(); i != r.end(); ++i)
+         PolarPoints[i] = tbb_demo::Cart2Pol(CartPoints[i]);
+   };
+
+   float UntracedTime = 0.f;
+   {
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, NbPoints), fTransform);
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      UntracedTime = time_span.count();
+      BOOST_TEST_MESSAGE("Points Transfo UNTRACED [PAR] " << time_span.count() << "s");
+   }
+
+   auto& Tracer = tbb_demo::Tracer::Instance();
+   Tracer.Enable(true);
+   Tracer.Clear();
+   {
+      tbb_demo::TraceObserver Observer("default arena");
+      {
+         tbb_demo::TraceStage Stage("transform");
+         auto Start = std::chrono::high_resolution_clock::now();
+         tbb::parallel_for(tbb::blocked_range<size_t>(0, NbPoints), tbb_demo::Traced("cart2pol", fTransform));
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_TEST_MESSAGE("Points Transfo TRACED [PAR] " << time_span.count() << "s overhead " << 100. * double(time_span.count() / UntracedTime - 1.f) << "%");
+      }
+      {
+         // the cost of element i grows with i: with a few big chunks the last ones dominate
+         tbb_demo::TraceStage Stage("triangular simple_partitioner");
+         std::vector<double> Sums(4096);
+         tbb::parallel_for(tbb::blocked_range<size_t>(0, 4096, 512), tbb_demo::Traced("triangular", [&CartPoints, &Sums](const tbb::blocked_range<size_t>& r) {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+            {
+               double Sum = 0.;
+               for (size_t k = 0; k < 64 * i; ++k)
+                  Sum += CartPoints[k][0];
+               Sums[i] = Sum;
+            }
+         }), tbb::simple_partitioner());
+      }
+      {
+         tbb_demo::TraceStage Stage("sum radius");
+         const double Sum = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), 0.,
+            tbb_demo::Traced("sum", [&PolarPoints](const tbb::blocked_range<size_t>& r, double Partial) {
+               for (size_t i = r.begin(); i != r.end(); ++i)
+                  Partial += PolarPoints[i][0];
+               return Partial;
+            }),
+            std::plus<double>());
+         BOOST_CHECK_GT(Sum, 0.);
+      }
+   }
+   Tracer.Enable(false);
+
+   const auto Stages = Tracer.Summarize();
+   BOOST_TEST_MESSAGE("SCHEDULER TRACE, " << Tracer.Dropped() << " events dropped\n" << tbb_demo::FormatTraceSummary(Stages));
+   BOOST_REQUIRE_EQUAL(Stages.size(), 3u);
+   BOOST_CHECK_EQUAL(Stages[0].Name, "transform");
+   BOOST_CHECK_EQUAL(Stages[2].Name, "sum radius");
+   if (Tracer.Dropped() == 0)
+   {
+      BOOST_CHECK_EQUAL(Stages[0].Items, NbPoints);
+      BOOST_CHECK_EQUAL(Stages[1].Items, 4096u);
+      BOOST_CHECK_EQUAL(Stages[2].Items, NbPoints);
+   }
+   for (const auto& Stage : Stages)
+   {
+      BOOST_CHECK_GT(Stage.Ranges, 0u);
+      BOOST_CHECK(Stage.Utilization() > 0. && Stage.Utilization() <= 1.01);
+   }
+
+   const std::string TracePath = (std::filesystem::temp_directory_path() / "tbb_demo_trace.json").string();
+   Tracer.WriteChromeTrace(TracePath);
+   std::ifstream Trace(TracePath);
+   const std::string Content((std::istreambuf_iterator<char>(Trace)), std::istreambuf_iterator<char>());
+   BOOST_CHECK(Content.find("\"cat\": \"range\"") != std::string::npos);
+   BOOST_CHECK(Content.find("\"cat\": \"stage\"") != std::string::npos);
+   BOOST_TEST_MESSAGE("SCHEDULER TRACE written to " << TracePath << " (chrome://tracing, ui.perfetto.dev)");
+   Tracer.Clear();
+}
+
+BOOST_AUTO_TEST_CASE(tbb_ParallelSearch)
+{
+   // Time to answer of early-terminating searches against a full scan, for a match at the start, the middle and the end
+   constexpr size_t NbPoints = 1e8;
+   constexpr size_t NbFirst = 10;
+   std::vector<std::array<double, 3>> Points(NbPoints);
+   tbb_demo::PointGenerator{20220531}.ParallelFill(Points);
+
+   // No generated point is that far (coordinates in [-10000, 10000]), the markers are
+   const std::array<double, 3> Marker{30000., 0., 0.};
+   auto fIsFar = [](const std::array<double, 3>& p) { return p[0] * p[0] + p[1] * p[1] + p[2] * p[2] > 4e8; };
+   auto fIsNear = [&fIsFar](const std::array<double, 3>& p) { return !fIsFar(p); };
+
+   const std::pair<const char*, size_t> Places[] = {{"START", NbPoints / 1000}, {"MIDDLE", NbPoints / 2}, {"END", NbPoints - NbFirst}};
+   for (const auto& [Where, Pos] : Places)
+   {
+      // NbFirst markers from Pos
+      const auto MarkFirst = std::next(Points.begin(), std::ptrdiff_t(Pos)), MarkLast = std::next(MarkFirst, std::ptrdiff_t(NbFirst));
+      std::vector<std::array<double, 3>> Saved(MarkFirst, MarkLast);
+      std::fill(MarkFirst, MarkLast, Marker);
+
+      {
+         auto Start = std::chrono::high_resolution_clock::now();
+         const size_t First = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), NbPoints, [&](const tbb::blocked_range<size_t>& r, size_t Min) {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+               if (fIsFar(Points[i]))
+                  Min = std::min(Min, i);
+            return Min;
+            }, [](size_t a, size_t b) { return std::min(a, b); });
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_CHECK_EQUAL(First, Pos);
+         BOOST_TEST_MESSAGE("SEARCH " << Where << " FULL SCAN [PAR] " << time_span.count() << "s");
+      }
+
+      {
+         auto Start = std::chrono::high_resolution_clock::now();
+         auto Found = std::find_if(Points.begin(), Points.end(), fIsFar);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_CHECK_EQUAL(size_t(Found - Points.begin()), Pos);
+         BOOST_TEST_MESSAGE("SEARCH " << Where << " FIND FIRST [SEQ] " << time_span.count() << "s");
+      }
+
+      {
+         auto Start = std::chrono::high_resolution_clock::now();
+         auto Found = tbb_demo::ParallelFindFirstIf(Points.begin(), Points.end(), fIsFar);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_CHECK_EQUAL(size_t(Found - Points.begin()), Pos);
+         BOOST_TEST_MESSAGE("SEARCH " << Where << " FIND FIRST [PAR] " << time_span.count() << "s");
+      }
+
+      {
+         auto Start = std::chrono::high_resolution_clock::now();
+         const bool Any = tbb_demo::ParallelAnyOf(Points.begin(), Points.end(), fIsFar);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_CHECK(Any);
+         BOOST_TEST_MESSAGE("SEARCH " << Where << " ANY OF [PAR] " << time_span.count() << "s");
+      }
+
+      {
+         auto Start = std::chrono::high_resolution_clock::now();
+         const bool All = tbb_demo::ParallelAllOf(Points.begin(), Points.end(), fIsNear);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_CHECK(!All);
+         BOOST_TEST_MESSAGE("SEARCH " << Where << " ALL OF [PAR] " << time_span.count() << "s");
+      }
+
+      {
+         auto Start = std::chrono::high_resolution_clock::now();
+         const std::vector<size_t> FirstK = tbb_demo::ParallelFindFirstK(Points.begin(), Points.end(), NbFirst, fIsFar);
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         std::vector<size_t> Expected(NbFirst);
+         std::iota(Expected.begin(), Expected.end(), Pos);
+         BOOST_CHECK(FirstK == Expected);
+         BOOST_TEST_MESSAGE("SEARCH " << Where << " FIRST " << NbFirst << " [PAR] " << time_span.count() << "s");
+      }
+
+      std::copy(Saved.begin(), Saved.end(), MarkFirst);
+   }
+
+   // Nothing to find : the early-terminating versions visit everything too
+   BOOST_CHECK(tbb_demo::ParallelFindFirstIf(Points.begin(), Points.end(), fIsFar) == Points.end());
+   BOOST_CHECK(!tbb_demo::ParallelAnyOf(Points.begin(), Points.end(), fIsFar));
+   BOOST_CHECK(tbb_demo::ParallelAllOf(Points.begin(), Points.end(), fIsNear));
+   BOOST_CHECK(tbb_demo::ParallelFindFirstK(Points.begin(), Points.end(), NbFirst, fIsFar).empty());
+}
+
+BOOST_AUTO_TEST_CASE(tbb_ParallelAlgorithms)
+{
+   // Parallel algorithms against their sequential STL counterpart from 100 to MaxSize elements: below the crossover the tasks cost more than they save
+   constexpr size_t MaxSize = 1e7;
+   std::vector<double> Values(MaxSize);
+   tbb::parallel_for(size_t(0), MaxSize, [&Values](size_t i) { Values[i] = std::sin(double(i)) * 1000.; });
+   std::vector<double> Out(MaxSize);
+
+   auto fPositive = [](double x) { return x > 0.; };
+   auto fSquare = [](double x) { return x * x; };
+
+   // Seconds per call of fRun on the first N values, repeated to process about MaxSize values
+   auto fTime = [](size_t N, const auto& fRun) {
+      const size_t NbRuns = std::max<size_t>(1, MaxSize / N);
+      auto Start = std::chrono::high_resolution_clock::now();
+      for (size_t r = 0; r < NbRuns; ++r)
+         fRun(N);
+      std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - Start);
+      return time_span.count() / double(NbRuns);
+   };
+
+   auto fCrossover = [&](const char* Name, const auto& fSeq, const auto& fPar) {
+      size_t Crossover = 0; // smallest size from which PAR stays faster
+      for (size_t N = 100; N <= MaxSize; N *= 10)
+      {
+         const double Seq = fTime(N, fSeq);
+         const double Par = fTime(N, fPar);
+         if (Par >= Seq)
+            Crossover = 0;
+         else if (!Crossover)
+            Crossover = N;
+         BOOST_TEST_MESSAGE("ALGO " << Name << " N=" << N << " [SEQ] " << Seq * 1e6 << "us [PAR] " << Par * 1e6 << "us x" << Seq / Par);
+      }
+      if (Crossover)
+         BOOST_TEST_MESSAGE("ALGO " << Name << " CROSSOVER N=" << Crossover);
+      else
+         BOOST_TEST_MESSAGE("ALGO " << Name << " CROSSOVER none up to N=" << MaxSize << " with " << tbb::this_task_arena::max_concurrency() << " threads");
+   };
+
+   size_t Sink = 0; // keeps the results alive
+   auto fEnd = [&Values](size_t N) { return std::next(Values.begin(), std::ptrdiff_t(N)); };
+   fCrossover("COUNT IF",
+      [&](size_t N) { Sink += size_t(std::count_if(Values.begin(), fEnd(N), fPositive)); },
+      [&](size_t N) { Sink += tbb_demo::ParallelCountIf(tbb_demo::Span<const double>{Values.data(), N}, fPositive); });
+   fCrossover("TRANSFORM REDUCE",
+      [&](size_t N) { Sink += size_t(std::transform_reduce(Values.begin(), fEnd(N), 0., std::plus<>(), fSquare)); },
+      [&](size_t N) { Sink += size_t(tbb_demo::ParallelTransformReduce(tbb_demo::Span<const double>{Values.data(), N}, 0., std::plus<>(), fSquare)); });
+   fCrossover("INCLUSIVE SCAN",
+      [&](size_t N) { std::inclusive_scan(Values.begin(), fEnd(N), Out.begin()); },
+      [&](size_t N) { tbb_demo::Span<double> Dest{Out.data(), N}; tbb_demo::ParallelInclusiveScan(tbb_demo::Span<const double>{Values.data(), N}, Dest); });
+   fCrossover("EXCLUSIVE SCAN",
+      [&](size_t N) { std::exclusive_scan(Values.begin(), fEnd(N), Out.begin(), 0.); },
+      [&](size_t N) { tbb_demo::Span<double> Dest{Out.data(), N}; tbb_demo::ParallelExclusiveScan(tbb_demo::Span<const double>{Values.data(), N}, Dest, 0.); });
+   std::vector<double> Kept;
+   fCrossover("COPY IF",
+      [&](size_t N) { Kept.resize(N); Kept.erase(std::copy_if(Values.begin(), fEnd(N), Kept.begin(), fPositive), Kept.end()); },
+      [&](size_t N) { tbb_demo::ParallelCopyIf(tbb_demo::Span<const double>{Values.data(), N}, Kept, fPositive); });
+   fCrossover("MIN ELEMENT",
+      [&](size_t N) { Sink += size_t(std::min_element(Values.begin(), fEnd(N)) - Values.begin()); },
+      [&](size_t N) { Sink += tbb_demo::ParallelMinElement(tbb_demo::Span<const double>{Values.data(), N}); });
+   fCrossover("MAX ELEMENT",
+      [&](size_t N) { Sink += size_t(std::max_element(Values.begin(), fEnd(N)) - Values.begin()); },
+      [&](size_t N) { Sink += tbb_demo::ParallelMaxElement(tbb_demo::Span<const double>{Values.data(), N}); });
+   BOOST_TEST_MESSAGE("ALGO SINK " << Sink);
+
+   // Same results as the STL, on contiguous storage and on a concurrent_vector grown element by element (one piece per segment)
+   std::vector<long> Ints(MaxSize / 10 + 7);
+   tbb::parallel_for(size_t(0), Ints.size(), [&Ints](size_t i) { Ints[i] = long(i * 7919 % 1009) - 500; });
+   tbb::concurrent_vector<long> Grown;
+   for (long x : Ints)
+      Grown.push_back(x);
+   auto fOdd = [](long x) { return x % 2 != 0; };
+   auto fCheck = [&](const auto& In, const char* Kind) {
+      BOOST_TEST_CONTEXT(Kind)
+      {
+         BOOST_CHECK_EQUAL(tbb_demo::ParallelCountIf(In, fOdd), size_t(std::count_if(Ints.begin(), Ints.end(), fOdd)));
+         BOOST_CHECK_EQUAL(tbb_demo::ParallelTransformReduce(In, 3L, std::plus<>(), [](long x) { return x * x; }),
+                           std::transform_reduce(Ints.begin(), Ints.end(), 3L, std::plus<>(), [](long x) { return x * x; }));
+         BOOST_CHECK_EQUAL(tbb_demo::ParallelMinElement(In), size_t(std::min_element(Ints.begin(), Ints.end()) - Ints.begin()));
+         BOOST_CHECK_EQUAL(tbb_demo::ParallelMaxElement(In), size_t(std::max_element(Ints.begin(), Ints.end()) - Ints.begin()));
+
+         std::vector<long> Expected(Ints.size());
+         tbb::concurrent_vector<long> Scanned(Ints.size());
+         std::inclusive_scan(Ints.begin(), Ints.end(), Expected.begin());
+         tbb_demo::ParallelInclusiveScan(In, Scanned);
+         BOOST_CHECK(std::equal(Expected.begin(), Expected.end(), Scanned.begin()));
+         std::exclusive_scan(Ints.begin(), Ints.end(), Expected.begin(), 11L);
+         tbb_demo::ParallelExclusiveScan(In, Scanned, 11L);
+         BOOST_CHECK(std::equal(Expected.begin(), Expected.end(), Scanned.begin()));
+
+         std::vector<long> Copied;
+         Expected.clear();
+         std::copy_if(Ints.begin(), Ints.end(), std::back_inserter(Expected), fOdd);
+         BOOST_CHECK_EQUAL(tbb_demo::ParallelCopyIf(In, Copied, fOdd), Expected.size());
+         BOOST_CHECK(Copied == Expected);
+      }
+   };
+   fCheck(Ints, "VECTOR");
+   fCheck(Grown, "CONCURRENT VECTOR");
+   fCheck(tbb_demo::MakeRange(Grown.begin(), Grown.end()), "ITERATORS");
+   BOOST_CHECK_EQUAL(tbb_demo::ParallelMinElement(std::vector<long>()), size_t(0));
+}
+
+BOOST_AUTO_TEST_CASE(tbb_PolarIndex)
+{
+   // Cone and nearest neighbour queries on the polar points: spatial index against a brute-force parallel scan
+   constexpr size_t NbPoints = 1e7;
+   constexpr size_t NbQueries = 1000;
+   constexpr size_t NbBruteForce = 10; // queries answered by a scan of all the points
+   constexpr size_t K = 16;
+
+   std::vector<std::array<double, 3>> CartPoints(NbPoints), PolarPoints(NbPoints);
+   tbb_demo::PointGenerator{20220531}.ParallelFill(CartPoints);
+   tbb::parallel_for(size_t(0), NbPoints, [&](size_t i) { PolarPoints[i] = tbb_demo::Cart2Pol(CartPoints[i]); });
+
+   {
+      std::vector<std::array<double, 3>> Sorted = PolarPoints;
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb::parallel_sort(Sorted.begin(), Sorted.end(), [](const auto& a, const auto& b) { return a[0] < b[0]; });
+      std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("POLAR INDEX SORT BY RADIUS [PAR] " << time_span.count() << "s");
+   }
+   auto Start = std::chrono::high_resolution_clock::now();
+   const tbb_demo::PolarIndex Index(PolarPoints);
+   std::chrono::duration<float> BuildTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+   BOOST_TEST_MESSAGE("POLAR INDEX BUILD [PAR] " << BuildTime.count() << "s " << Index.NbCells() << " cells " << double(Index.MemoryBytes()) / 1e6 << " MB");
+
+   std::mt19937 Gen(20220531);
+   std::uniform_real_distribution<double> Unit(0., 1.);
+   std::vector<tbb_demo::ConeQuery> Cones(NbQueries);
+   std::vector<std::array<double, 3>> Targets(NbQueries);
+   for (size_t q = 0; q < NbQueries; ++q)
+   {
+      const double RMin = 15000. * Unit(Gen);
+      Cones[q] = {RMin, RMin + 500. + 2500. * Unit(Gen), M_PI * (2. * Unit(Gen) - 1.), std::acos(2. * Unit(Gen) - 1.), 0.02 + 0.28 * Unit(Gen)};
+      Targets[q] = {20000. * Unit(Gen) - 10000., 20000. * Unit(Gen) - 10000., 20000. * Unit(Gen) - 10000.};
+   }
+
+   // Latencies of the queries one after the other on one thread, and the queries per second when they run concurrently
+   auto fReport = [](const char* Name, std::vector<double> Latencies, double ParTime) {
+      std::sort(Latencies.begin(), Latencies.end());
+      BOOST_TEST_MESSAGE("POLAR INDEX " << Name << " latency p50 " << Latencies[Latencies.size() / 2] * 1e6 << "us p99 "
+         << Latencies[Latencies.size() * 99 / 100] * 1e6 << "us, " << double(Latencies.size()) / ParTime << " QPS [PAR]");
+   };
+   auto fQueries = [&fReport](const char* Name, size_t Count, const auto& fQuery) {
+      std::vector<double> Latencies(Count);
+      for (size_t q = 0; q < Count; ++q)
+      {
+         auto QStart = std::chrono::high_resolution_clock::now();
+         fQuery(q);
+         Latencies[q] = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - QStart).count();
+      }
+      auto ParStart = std::chrono::high_resolution_clock::now();
+      tbb::parallel_for(size_t(0), Count, [&fQuery](size_t q) { fQuery(q); });
+      fReport(Name, Latencies, std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - ParStart).count());
+   };
+
+   // Cone queries
+   auto fInCone = [](const tbb_demo::ConeQuery& c, const std::array<double, 3>& p) {
+      return p[0] >= c.RMin && p[0] <= c.RMax &&
+         std::cos(c.Phi) * std::cos(p[2]) + std::sin(c.Phi) * std::sin(p[2]) * std::cos(p[1] - c.Theta) >= std::cos(c.HalfAngle);
+   };
+   std::vector<size_t> BruteCounts(NbQueries), IndexCounts(NbQueries);
+   fQueries("CONE BRUTE FORCE", NbBruteForce, [&](size_t q) {
+      BruteCounts[q] = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), size_t(0), [&](const tbb::blocked_range<size_t>& r, size_t Count) {
+         for (size_t i = r.begin(); i != r.end(); ++i)
+            if (fInCone(Cones[q], PolarPoints[i]))
+               ++Count;
+         return Count;
+         }, std::plus<size_t>());
+      });
+   fQueries("CONE", NbQueries, [&](size_t q) { IndexCounts[q] = Index.CountCone(Cones[q]); });
+   BOOST_CHECK(std::equal(BruteCounts.begin(), BruteCounts.begin() + NbBruteForce, IndexCounts.begin()));
+   for (size_t q = 0; q < 3; ++q)
+   {
+      std::vector<uint32_t> Found, Expected;
+      size_t NbBatches = 0;
+      Index.QueryCone(Cones[q], [&](const uint32_t* Ids, size_t n) { Found.insert(Found.end(), Ids, Ids + n); ++NbBatches; }, 256);
+      for (size_t i = 0; i < NbPoints; ++i)
+         if (fInCone(Cones[q], PolarPoints[i]))
+            Expected.push_back(uint32_t(i));
+      std::sort(Found.begin(), Found.end());
+      BOOST_CHECK(Found == Expected);
+      BOOST_CHECK_EQUAL(NbBatches, (Expected.size() + 255) / 256);
+   }
+
+   // K nearest neighbours, on the points rebuilt from their polar coordinates as the index stores them
+   std::vector<std::array<double, 3>> Rebuilt(NbPoints);
+   tbb::parallel_for(size_t(0), NbPoints, [&](size_t i) { Rebuilt[i] = tbb_demo::PolarToCartesian(PolarPoints[i]); });
+   auto fFarther = [](const tbb_demo::Neighbor& a, const tbb_demo::Neighbor& b) { return a.Distance < b.Distance; };
+   std::vector<std::vector<tbb_demo::Neighbor>> BruteNearest(NbQueries), IndexNearest(NbQueries);
+   fQueries("NEAREST BRUTE FORCE", NbBruteForce, [&](size_t q) {
+      using Heap = std::vector<tbb_demo::Neighbor>;
+      auto fPush = [&fFarther](Heap& h, const tbb_demo::Neighbor& n) {
+         if (h.size() < K)
+         {
+            h.push_back(n);
+            std::push_heap(h.begin(), h.end(), fFarther);
+         }
+         else if (n.Distance < h.front().Distance)
+         {
+            std::pop_heap(h.begin(), h.end(), fFarther);
+            h.back() = n;
+            std::push_heap(h.begin(), h.end(), fFarther);
+         }
+      };
+      Heap Best = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), Heap(), [&](const tbb::blocked_range<size_t>& r, Heap h) {
+         const auto& t = Targets[q];
+         for (size_t i = r.begin(); i != r.end(); ++i)
+            fPush(h, {std::hypot(Rebuilt[i][0] - t[0], Rebuilt[i][1] - t[1], Rebuilt[i][2] - t[2]), uint32_t(i)});
+         return h;
+         }, [&](Heap a, const Heap& b) {
+            for (const auto& n : b)
+               fPush(a, n);
+            return a;
+         });
+      std::sort_heap(Best.begin(), Best.end(), fFarther);
+      BruteNearest[q] = std::move(Best);
+      });
+   fQueries("NEAREST", NbQueries, [&](size_t q) { IndexNearest[q] = Index.Nearest(Targets[q], K); });
+   for (size_t q = 0; q < NbBruteForce; ++q)
+   {
+      BOOST_REQUIRE_EQUAL(IndexNearest[q].size(), K);
+      for (size_t k = 0; k < K; ++k)
+         BOOST_CHECK_EQUAL(IndexNearest[q][k].Distance, BruteNearest[q][k].Distance);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(tbb_RadiusStats)
+{
+   // Histogram, quantiles, top-k and moments of the radii in a few streaming passes, against sort then index
+   constexpr size_t NbPoints = 1e8;
+   constexpr size_t K = 100;
+   const std::vector<double> Probabilities = {0., 0.001, 0.01, 0.25, 0.5, 0.75, 0.99, 0.999, 1.};
+
+   // converted in place: a single copy of the points
+   std::vector<std::array<double, 3>> Points(NbPoints);
+   tbb_demo::PointGenerator{20220531}.ParallelFill(Points);
+   tbb::parallel_for(size_t(0), NbPoints, [&Points](size_t i) { Points[i] = tbb_demo::Cart2Pol(Points[i]); });
+
+   long double Sum = 0.;
+   for (const auto& Pt : Points)
+      Sum += Pt[0];
+   const long double Mean = Sum / NbPoints;
+   long double M2 = 0.;
+   for (const auto& Pt : Points)
+      M2 += (Pt[0] - Mean) * (Pt[0] - Mean);
+
+   auto Start = std::chrono::high_resolution_clock::now();
+   const auto Stats = tbb_demo::ComputeStreamStats(tbb_demo::StridedValues(&Points[0][0], NbPoints, 3), Probabilities, K);
+   std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+   BOOST_TEST_MESSAGE("RADIUS STATS STREAMING [PAR] " << time_span.count() << "s " << Stats.NbPasses << " passes");
+   BOOST_TEST_MESSAGE("RADIUS STATS min " << Stats.Summary.Min << " max " << Stats.Summary.Max << " mean " << Stats.Summary.Mean << " stddev " << std::sqrt(Stats.Summary.Variance()));
+
+   Start = std::chrono::high_resolution_clock::now();
+   tbb::parallel_sort(Points.begin(), Points.end(), [](const auto& a, const auto& b) { return a[0] < b[0]; });
+   std::vector<double> Quantiles(Probabilities.size()), Largest(K);
+   for (size_t q = 0; q < Probabilities.size(); ++q)
+      Quantiles[q] = Points[size_t(Probabilities[q] * (NbPoints - 1))][0];
+   for (size_t k = 0; k < K; ++k)
+      Largest[k] = Points[NbPoints - 1 - k][0];
+   time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+   BOOST_TEST_MESSAGE("RADIUS STATS SORT THEN INDEX [PAR] " << time_span.count() << "s");
+
+   BOOST_CHECK_EQUAL(Stats.Summary.Count, NbPoints);
+   BOOST_CHECK_EQUAL(Stats.Summary.Min, Points.front()[0]);
+   BOOST_CHECK_EQUAL(Stats.Summary.Max, Points.back()[0]);
+   BOOST_CHECK_SMALL(double(std::fabs(Stats.Summary.Mean - Mean) / Mean), 1e-13);
+   BOOST_CHECK_SMALL(double(std::fabs(Stats.Summary.M2 - M2) / M2), 1e-11);
+   BOOST_CHECK(Stats.Quantiles == Quantiles);
+   BOOST_CHECK(Stats.Largest == Largest);
+
+   // refinement down to the last bits: a low selection limit and many equal values
+   {
+      std::vector<double> Values(1000000);
+      for (size_t i = 0; i < Values.size(); ++i)
+         Values[i] = i % 3 ? Points[i * 37 % NbPoints][0] : 1.;
+      const auto Refined = tbb_demo::ComputeStreamStats(tbb_demo::StridedValues(Values.data(), Values.size(), 1, 4096), Probabilities, K, 1000);
+      // without the k largest values
+      const auto NoLargest = tbb_demo::ComputeStreamStats(tbb_demo::StridedValues(Values.data(), Values.size(), 1, 4096), Probabilities, 0, 1000);
+      std::sort(Values.begin(), Values.end());
+      for (size_t q = 0; q < Probabilities.size(); ++q)
+         BOOST_CHECK_EQUAL(Refined.Quantiles[q], Values[size_t(Probabilities[q] * double(Values.size() - 1))]);
+      BOOST_CHECK(std::equal(Refined.Largest.begin(), Refined.Largest.end(), Values.rbegin()));
+      BOOST_CHECK(NoLargest.Largest.empty());
+      BOOST_CHECK(NoLargest.Quantiles == Refined.Quantiles);
+      BOOST_CHECK_EQUAL(NoLargest.Summary.Count, Values.size());
+      BOOST_TEST_MESSAGE("RADIUS STATS REFINED " << Refined.NbPasses << " passes");
+   }
+   Points = {};
+
+#if defined(TBB_DEMO_HAS_POINT_FILE)
+   // the same passes on the radius column of a point file, chunk by chunk
+   constexpr size_t NbFilePoints = 1e7;
+   const char* TmpDir = std::getenv("TMPDIR");
+   const std::string Prefix = std::string(TmpDir ? TmpDir : "/tmp") + "/tbb_demo_stats_" + std::to_string(::getpid());
+   const std::string CartPath = Prefix + "_cart.pts", PolarPath = Prefix + "_polar.pts";
+   tbb_demo::WritePointFile(CartPath, tbb_demo::PointGenerator{20220531}, NbFilePoints, 1 << 18);
+   tbb_demo::ConvertPointFile(CartPath, PolarPath);
+   std::remove(CartPath.c_str());
+   tbb_demo::DropFileCache(PolarPath);
+   {
+      const tbb_demo::PointFileReader Reader(PolarPath);
+      Start = std::chrono::high_resolution_clock::now();
+      const auto FileStats = tbb_demo::ComputeStreamStats(tbb_demo::PointFileColumn(Reader, 0), Probabilities, K);
+      time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+      BOOST_TEST_MESSAGE("RADIUS STATS OUT OF CORE [PAR] " << time_span.count() << "s " << FileStats.NbPasses << " passes");
+
+      std::vector<double> Radii;
+      for (size_t c = 0; c < Reader.NbChunks(); ++c)
+         Radii.insert(Radii.end(), Reader.Column(c, 0), Reader.Column(c, 0) + Reader.Chunk(c).NbPoints);
+      std::sort(Radii.begin(), Radii.end());
+      BOOST_REQUIRE_EQUAL(FileStats.Summary.Count, NbFilePoints);
+      for (size_t q = 0; q < Probabilities.size(); ++q)
+         BOOST_CHECK_EQUAL(FileStats.Quantiles[q], Radii[size_t(Probabilities[q] * (NbFilePoints - 1))]);
+      BOOST_CHECK(std::equal(FileStats.Largest.begin(), FileStats.Largest.end(), Radii.rbegin()));
+   }
+   std::remove(PolarPath.c_str());
+#endif
 }
 
+BOOST_AUTO_TEST_CASE(tbb_ShardedCounters)
+{
+   // One shared statistic updated by every iteration, from 1 thread to all the cores
+   constexpr size_t NbAdds = 1e7;
+   static constexpr size_t Expected = NbAdds * (NbAdds - 1) / 2;
+   std::vector<int> NbThreads;
+   for (int n = 1; n < tbb::info::default_concurrency(); n *= 2)
+      NbThreads.push_back(n);
+   NbThreads.push_back(tbb::info::default_concurrency());
+
+   auto fSweep = [&NbThreads](const char* Name, auto fRun) {
+      for (int Threads : NbThreads)
+      {
+         tbb::global_control Limit(tbb::global_control::max_allowed_parallelism, size_t(Threads));
+         auto Start = std::chrono::high_resolution_clock::now();
+         const size_t Sum = fRun();
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_TEST_MESSAGE("COUNTER " << Name << " [PAR x" << Threads << "] " << time_span.count() << "s " << double(time_span.count()) * 1e9 / NbAdds << " ns/add"
+                            << (Sum == Expected ? "" : " WRONG SUM, lost updates"));
+      }
+   };
+
+   fSweep("SHARED ATOMIC", []() {
+      std::atomic<size_t> Shared{0};
+      tbb::parallel_for(size_t(0), NbAdds, [&Shared](size_t i) { Shared.fetch_add(i, std::memory_order_relaxed); });
+      BOOST_CHECK_EQUAL(Shared.load(), Expected);
+      return Shared.load();
+      });
+   fSweep("RACY", []() {
+      // a load then a store, as the non-atomic += does, without its undefined behaviour
+      std::atomic<size_t> Shared{0};
+      tbb::parallel_for(size_t(0), NbAdds, [&Shared](size_t i) { Shared.store(Shared.load(std::memory_order_relaxed) + i, std::memory_order_relaxed); });
+      return Shared.load();
+      });
+   fSweep("SHARDED", []() {
+      tbb_demo::ShardedCounter<size_t> Counter;
+      tbb::parallel_for(size_t(0), NbAdds, [&Counter](size_t i) { Counter.Add(i); });
+      BOOST_CHECK_EQUAL(Counter.Combine(), Expected);
+      return Counter.Combine();
+      });
+   fSweep("PARALLEL REDUCE", []() {
+      const size_t Sum = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbAdds), size_t(0), [](const tbb::blocked_range<size_t>& r, size_t s) {
+         for (size_t i = r.begin(); i != r.end(); ++i)
+            s += i;
+         return s;
+         }, std::plus<size_t>());
+      BOOST_CHECK_EQUAL(Sum, Expected);
+      return Sum;
+      });
 
+   // double sums, min and max, and approximate reads while the slots are updated
+   {
+      tbb_demo::ShardedCounter<double> Sum;
+      tbb_demo::ShardedMin<double> Min;
+      tbb_demo::ShardedMax<double> Max;
+      tbb_demo::ShardedCounter<size_t> Count;
+      tbb_demo::ShardedMax<size_t> MaxRead;
+      tbb::parallel_for(size_t(0), NbAdds, [&](size_t i) {
+         const double x = std::sin(double(i));
+         Sum.Add(x);
+         Min.Add(x);
+         Max.Add(x);
+         Count.Add(1);
+         if (i % 65536 == 0)
+            MaxRead.Add(Count.Read()); // at least the adds of this thread
+      });
+      double RefSum = 0., RefMin = HUGE_VAL, RefMax = -HUGE_VAL;
+      for (size_t i = 0; i < NbAdds; ++i)
+      {
+         const double x = std::sin(double(i));
+         RefSum += x;
+         RefMin = std::min(RefMin, x);
+         RefMax = std::max(RefMax, x);
+      }
+      BOOST_CHECK_SMALL(Sum.Combine() - RefSum, 1e-6);
+      BOOST_CHECK_EQUAL(Min.Combine(), RefMin);
+      BOOST_CHECK_EQUAL(Max.Combine(), RefMax);
+      BOOST_CHECK_EQUAL(Count.Combine(), NbAdds);
+      BOOST_CHECK(MaxRead.Combine() >= 1 && MaxRead.Combine() <= NbAdds);
+      Sum.Reset();
+      BOOST_CHECK_EQUAL(Sum.Combine(), 0.);
+   }
+
+   // A shared_ptr captured by copy is copied with every task of the parallel_for, each copy an
+   // atomic increment and decrement of the shared reference count
+   {
+      struct Copies
+      {
+         std::atomic<size_t>* Count;
+         Copies(std::atomic<size_t>* c) : Count(c) {}
+         Copies(const Copies& o) : Count(o.Count) { ++*Count; }
+      };
+      constexpr size_t Grain = 64;
+      auto Ptr = std::make_shared<std::atomic<size_t>>(0);
+      std::atomic<size_t> NbCopies{0};
+      const Copies Counted(&NbCopies);
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, NbAdds, Grain), [Counted](const tbb::blocked_range<size_t>&) {}, tbb::simple_partitioner());
+      auto fTime = [](const char* Name, size_t Copies, auto fRun) {
+         auto Start = std::chrono::high_resolution_clock::now();
+         fRun();
+         std::chrono::duration<float> time_span = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start);
+         BOOST_TEST_MESSAGE("CAPTURE " << Name << " [PAR] " << time_span.count() << "s, " << Copies << " copies of the body");
+      };
+      fTime("SHARED_PTR BY COPY", NbCopies.load(), [&Ptr]() {
+         tbb::parallel_for(tbb::blocked_range<size_t>(0, NbAdds, Grain), [Ptr](const tbb::blocked_range<size_t>& r) {
+            Ptr->fetch_add(r.size(), std::memory_order_relaxed);
+            }, tbb::simple_partitioner());
+         });
+      fTime("BY REFERENCE", NbCopies.load(), [&Ptr]() {
+         tbb::parallel_for(tbb::blocked_range<size_t>(0, NbAdds, Grain), [&Ptr](const tbb::blocked_range<size_t>& r) {
+            Ptr->fetch_add(r.size(), std::memory_order_relaxed);
+            }, tbb::simple_partitioner());
+         });
+      BOOST_CHECK_EQUAL(Ptr->load(), 2 * NbAdds);
+      BOOST_CHECK_EQUAL(Ptr.use_count(), 1);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(tbb_FlowGraph)
+{
+   // The composition of tbb_Cartesian_to_Polar as a DAG: generate -> convert -> sort -> quantiles, a reduce
+   // beside the sort, and blocking I/O on the side (dumps and a log line, checked below) kept off the workers
+   constexpr size_t NbPoints = 1e7;
+   const char* TmpDir = std::getenv("TMPDIR");
+   const std::string Prefix = std::string(TmpDir ? TmpDir : "/tmp") + "/tbb_demo_flow_" + std::to_string(::getpid());
+   const std::string CartPath = Prefix + "_cart.bin", RadiiPath = Prefix + "_radii.bin";
+
+   std::vector<std::array<double, 3>> CartPoints(NbPoints), CartPoints_Copy, PolarPoints(NbPoints);
+   std::vector<double> Radii(NbPoints);
+   double Sum = 0., Median = 0., P99 = 0.;
+   std::string LogLine;
+   auto fDump = [](const std::string& Path, const void* Data, size_t Bytes) {
+      std::ofstream File(Path, std::ios::binary);
+      File.write(static_cast<const char*>(Data), std::streamsize(Bytes));
+      File.flush();
+      if (!File)
+         throw std::runtime_error("cannot write " + Path);
+   };
+
+   tbb_demo::StageGraph Graph;
+   const auto Generate = Graph.Add("generate", [&]() { tbb_demo::PointGenerator{20220531}.ParallelFill(CartPoints); });
+   Graph.Add("dump cartesian", [&]() { fDump(CartPath, CartPoints.data(), NbPoints * sizeof(CartPoints[0])); }, {Generate}, tbb_demo::StageKind::Blocking);
+   const auto Convert = Graph.Add("convert", [&]() {
+      tbb::parallel_for(size_t(0), NbPoints, [&](size_t i) { PolarPoints[i] = tbb_demo::Cart2Pol(CartPoints[i]); });
+   }, {Generate});
+   Graph.Add("sort cartesian copy", [&]() {
+      CartPoints_Copy = CartPoints;
+      tbb::parallel_sort(begin(CartPoints_Copy), end(CartPoints_Copy));
+   }, {Generate});
+   const auto SortRadii = Graph.Add("sort radii", [&]() {
+      tbb::parallel_for(size_t(0), NbPoints, [&](size_t i) { Radii[i] = PolarPoints[i][0]; });
+      tbb::parallel_sort(begin(Radii), end(Radii));
+   }, {Convert});
+   const auto Reduce = Graph.Add("reduce", [&]() {
+      Sum = tbb::parallel_deterministic_reduce(tbb::blocked_range<size_t>(0, NbPoints), 0., [&](const tbb::blocked_range<size_t>& r, double s) {
+         for (size_t i = r.begin(); i != r.end(); ++i)
+            s += PolarPoints[i][0];
+         return s;
+         }, std::plus<double>());
+   }, {Convert});
+   const auto Quantiles = Graph.Add("quantiles", [&]() {
+      Median = Radii[(NbPoints - 1) / 2];
+      P99 = Radii[size_t(0.99 * (NbPoints - 1))];
+   }, {SortRadii});
+   Graph.Add("dump radii", [&]() { fDump(RadiiPath, Radii.data(), NbPoints * sizeof(double)); }, {SortRadii}, tbb_demo::StageKind::Blocking);
+   Graph.Add("log", [&]() { LogLine = "mean radius " + std::to_string(Sum / NbPoints) + " median " + std::to_string(Median) + " p99 " + std::to_string(P99); },
+             {Reduce, Quantiles}, tbb_demo::StageKind::Blocking);
+
+   auto fReport = [](const char* Tag, const tbb_demo::StageReport& Report) {
+      BOOST_TEST_MESSAGE("FLOW GRAPH " << Tag << " makespan " << Report.Makespan << "s, work " << Report.TotalWork << "s, critical path " << Report.CriticalPath << "s");
+      for (const auto& Stage : Report.Stages)
+         BOOST_TEST_MESSAGE("   " << Stage.Name << (Stage.Kind == tbb_demo::StageKind::Blocking ? " (blocking)" : "") << " " << Stage.Start << "s -> " << Stage.End << "s");
+      std::string Path;
+      for (const auto& Name : Report.CriticalStages)
+         Path += (Path.empty() ? "" : " -> ") + Name;
+      BOOST_TEST_MESSAGE("   critical path: " << Path);
+   };
+   const auto Sequential = Graph.RunSequential();
+   fReport("[SEQ]", Sequential);
+   const double SeqSum = Sum, SeqMedian = Median;
+   const std::string SeqLogLine = LogLine;
+   Sum = Median = 0.;
+   LogLine.clear();
+   const auto Flow = Graph.Run();
+   fReport("[PAR]", Flow);
+   BOOST_TEST_MESSAGE("FLOW GRAPH speedup " << Sequential.Makespan / Flow.Makespan << ", makespan / critical path " << Flow.Makespan / Flow.CriticalPath);
+
+   BOOST_CHECK_EQUAL(Sum, SeqSum);
+   BOOST_CHECK_EQUAL(Median, SeqMedian);
+   // the log waited for the reduce and the quantiles
+   BOOST_CHECK_EQUAL(LogLine, SeqLogLine);
+   BOOST_CHECK_EQUAL(LogLine, "mean radius " + std::to_string(Sum / NbPoints) + " median " + std::to_string(Median) + " p99 " + std::to_string(P99));
+   BOOST_CHECK(std::is_sorted(begin(CartPoints_Copy), end(CartPoints_Copy)));
+   BOOST_CHECK(Flow.Makespan >= Flow.CriticalPath);
+   for (const auto& Stage : Flow.Stages)
+      if (Stage.Kind == tbb_demo::StageKind::Blocking)
+         BOOST_CHECK_LT(Stage.ThreadIndex, 0); // the I/O thread, not a worker
+   std::remove(CartPath.c_str());
+   std::remove(RadiiPath.c_str());
+
+   // declaration order is the dependency order, and the errors of the blocking stages reach the caller
+   tbb_demo::StageGraph Failing;
+   BOOST_CHECK_THROW(Failing.Add("early", []() {}, {0}), std::invalid_argument);
+   const auto Io = Failing.Add("io", []() { throw std::runtime_error("disk full"); }, {}, tbb_demo::StageKind::Blocking);
+   bool NextRan = false;
+   Failing.Add("next", [&NextRan]() { NextRan = true; }, {Io});
+   BOOST_CHECK_THROW(Failing.Run(), std::runtime_error);
+   BOOST_CHECK(!NextRan);
+
+   // a blocking stage throwing while the other branches run, and a compute stage throwing while a
+   // blocking stage still runs: Run() returns once the I/O thread is done with the nodes
+   for (int Round = 0; Round < 50; ++Round)
+   {
+      std::atomic<int> Done{0};
+      tbb_demo::StageGraph Racing;
+      const auto Root = Racing.Add("root", []() {});
+      const auto Throwing = Racing.Add("throwing io", []() { throw std::runtime_error("disk full"); }, {Root}, tbb_demo::StageKind::Blocking);
+      Racing.Add("slow io", [&Done]() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); ++Done; }, {Root}, tbb_demo::StageKind::Blocking);
+      Racing.Add("compute", [&Done]() { tbb::parallel_for(0, 1000, [](int) {}); ++Done; }, {Root});
+      Racing.Add("after io", [&Done]() { ++Done; }, {Throwing});
+      BOOST_CHECK_THROW(Racing.Run(), std::runtime_error);
+      BOOST_CHECK_EQUAL(Done.load(), 2);
+
+      std::atomic<bool> IoStarted{false}, IoDone{false};
+      tbb_demo::StageGraph Unwinding;
+      const auto Start = Unwinding.Add("start", []() {});
+      Unwinding.Add("slow io", [&IoStarted, &IoDone]() {
+         IoStarted = true;
+         std::this_thread::sleep_for(std::chrono::milliseconds(2));
+         IoDone = true;
+      }, {Start}, tbb_demo::StageKind::Blocking);
+      Unwinding.Add("failing", [&IoStarted]() {
+         while (!IoStarted)
+            std::this_thread::yield();
+         throw std::logic_error("bad input");
+      }, {Start});
+      BOOST_CHECK_THROW(Unwinding.Run(), std::logic_error);
+      BOOST_CHECK(IoDone);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(tbb_PrecisionLayouts)
+{
+   // The pipeline of tbb_Cartesian_to_Polar in float and double, AoS and SoA: speed and accuracy against the double AoS path
+   constexpr size_t NbPoints = 1e7;
+   const tbb_demo::PointGenerator Generator{20220531};
+   using tbb_demo::PointLayout;
+
+   // reference: double AoS, before and after the sort
+   tbb_demo::TypedPoints<tbb_demo::PointTraits<double, PointLayout::AoS>> Reference(NbPoints);
+   tbb_demo::ParallelGenerate(Reference, Generator);
+   tbb_demo::ParallelCart2Pol(Reference);
+   const std::vector<std::array<double, 3>> RefPolar = Reference.PolarPoints();
+   tbb_demo::ParallelSortByRadius(Reference);
+   long double RefSum = 0.;
+   for (const auto& Pt : RefPolar)
+      RefSum += Pt[0];
+
+   auto fSeconds = [](std::chrono::high_resolution_clock::time_point Start) {
+      return std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start).count();
+   };
+   auto fRun = [&](auto Tag, const char* Name, double RTolerance, double AngleTolerance) {
+      using Traits = decltype(Tag);
+      tbb_demo::TypedPoints<Traits> Points(NbPoints);
+      auto Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ParallelGenerate(Points, Generator);
+      const float GenTime = fSeconds(Start);
+      Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ParallelCart2Pol(Points);
+      const float ConvertTime = fSeconds(Start);
+      Start = std::chrono::high_resolution_clock::now();
+      const auto Sum = tbb_demo::ParallelSumRadius(Points);
+      const float SumTime = fSeconds(Start);
+
+      // r relative to r, the angles relative to pi
+      const double MaxErr[3] = {
+         tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), 0., [&](const tbb::blocked_range<size_t>& r, double m) {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+               m = std::max(m, std::fabs(double(Points.Polar(i)[0]) - RefPolar[i][0]) / RefPolar[i][0]);
+            return m;
+            }, [](double a, double b) { return std::max(a, b); }),
+         tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), 0., [&](const tbb::blocked_range<size_t>& r, double m) {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+               m = std::max(m, std::fabs(double(Points.Polar(i)[1]) - RefPolar[i][1]) / M_PI);
+            return m;
+            }, [](double a, double b) { return std::max(a, b); }),
+         tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), 0., [&](const tbb::blocked_range<size_t>& r, double m) {
+            for (size_t i = r.begin(); i != r.end(); ++i)
+               m = std::max(m, std::fabs(double(Points.Polar(i)[2]) - RefPolar[i][2]) / M_PI);
+            return m;
+            }, [](double a, double b) { return std::max(a, b); })};
+      const double SumErr = double(std::fabs((static_cast<long double>(Sum) - RefSum) / RefSum));
+
+      Start = std::chrono::high_resolution_clock::now();
+      tbb_demo::ParallelSortByRadius(Points);
+      const float SortTime = fSeconds(Start);
+      bool Sorted = true;
+      for (size_t i = 1; i < NbPoints && Sorted; ++i)
+         Sorted = Points.Polar(i - 1)[0] <= Points.Polar(i)[0];
+
+      BOOST_TEST_MESSAGE("PRECISION " << Name << " GENERATE " << GenTime << "s CONVERT " << ConvertTime << "s SORT " << SortTime << "s SUM " << SumTime << "s, "
+                         << double(Points.Bytes()) / 1e6 << " MB | max relative error r " << MaxErr[0] << " theta " << MaxErr[1] << " phi " << MaxErr[2] << " sum " << SumErr);
+      BOOST_CHECK(Sorted);
+      BOOST_CHECK_SMALL(MaxErr[0], RTolerance);
+      BOOST_CHECK_SMALL(MaxErr[1], AngleTolerance);
+      BOOST_CHECK_SMALL(MaxErr[2], AngleTolerance);
+      BOOST_CHECK_SMALL(std::fabs(double(Points.Polar(NbPoints / 2)[0]) - Reference.PolarPoints()[NbPoints / 2][0]) / Reference.PolarPoints()[NbPoints / 2][0], RTolerance);
+      return SumErr;
+   };
+
+   // The SoA kernels compute the angles with atan2 where fCart2Pol uses acos, whose argument is close to +/-1
+   // near the axes: there, the rounding of the argument costs ~1e-11 in double and ~1e-4 in float
+   fRun(tbb_demo::PointTraits<double, PointLayout::AoS>{}, "double AoS", 1e-15, 1e-15);
+   fRun(tbb_demo::PointTraits<double, PointLayout::SoA>{}, "double SoA [SIMD]", 1e-15, 1e-9);
+   const double FloatSumErr = fRun(tbb_demo::PointTraits<float, PointLayout::AoS>{}, "float AoS", 1e-6, 1e-3);
+   fRun(tbb_demo::PointTraits<float, PointLayout::SoA>{}, "float SoA [SIMD]", 1e-6, 1e-6);
+   const double MixedSumErr = fRun(tbb_demo::PointTraits<float, PointLayout::AoS, double>{}, "float AoS double sum", 1e-6, 1e-3);
+   fRun(tbb_demo::PointTraits<float, PointLayout::SoA, double>{}, "float SoA [SIMD] double sum", 1e-6, 1e-6);
+   // the rounding of the float radii averages out in a double sum, not in a float one
+   BOOST_CHECK_LT(MixedSumErr, 1e-7);
+   BOOST_CHECK_LE(MixedSumErr, FloatSumErr);
+}
+
+BOOST_AUTO_TEST_CASE(tbb_TransformChain)
+{
+   // translate -> rotate -> Cartesian to spherical -> unit conversion, fused in one pass or run stage by stage
+   constexpr size_t NbPoints = 1e7;
+   const tbb_demo::PointGenerator Generator{20220531};
+   std::vector<std::array<double, 3>> CartPoints(NbPoints);
+   Generator.ParallelFill(CartPoints);
+
+   const double Axis = 1. / std::sqrt(3.);
+   const auto Chain = tbb_demo::MakeChain(tbb_demo::Translate{{-250., 125., 500.}}, tbb_demo::Rotate::AboutAxis({Axis, Axis, Axis}, 0.3))
+                      | tbb_demo::CartesianToSpherical{} | tbb_demo::ScaleCoordinates{{1e-3, 180. / M_PI, 180. / M_PI}};
+   static_assert(decltype(Chain)::NbStages == 4, "one stage per operator|");
+   auto fSeconds = [](std::chrono::high_resolution_clock::time_point Start) {
+      return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - Start).count();
+   };
+
+   std::vector<std::array<double, 3>> Fused;
+   auto Start = std::chrono::high_resolution_clock::now();
+   tbb_demo::ParallelTransform(Chain, CartPoints, Fused);
+   const double FusedTime = fSeconds(Start);
+   const size_t FusedBytes = 2 * NbPoints * sizeof(std::array<double, 3>);
+   BOOST_TEST_MESSAGE("TRANSFORM CHAIN FUSED [PAR] " << FusedTime << "s, " << double(FusedBytes) / 1e9 << " GB moved, " << double(FusedBytes) / 1e9 / FusedTime << " GB/s");
+
+   std::vector<std::array<double, 3>> Staged;
+   Start = std::chrono::high_resolution_clock::now();
+   const size_t StagedBytes = tbb_demo::ParallelTransformStaged(Chain, CartPoints, Staged);
+   const double StagedTime = fSeconds(Start);
+   BOOST_TEST_MESSAGE("TRANSFORM CHAIN STAGED [PAR] " << StagedTime << "s, " << double(StagedBytes) / 1e9 << " GB moved, " << double(StagedBytes) / 1e9 / StagedTime << " GB/s");
+
+   // the same stages in the same order: the same doubles
+   BOOST_CHECK(Fused == Staged);
+   BOOST_CHECK_EQUAL(StagedBytes, Chain.NbStages * FusedBytes);
+   // a chain of the conversion alone is fCart2Pol
+   const auto ToSpherical = tbb_demo::MakeChain(tbb_demo::CartesianToSpherical{});
+   for (size_t i = 0; i < NbPoints; i += NbPoints / 1000)
+      BOOST_CHECK(ToSpherical(CartPoints[i]) == tbb_demo::Cart2Pol(CartPoints[i]));
+
+   // back to the Cartesian points, in place: degrees to radians, spherical to Cartesian, rotation back, translation back
+   Start = std::chrono::high_resolution_clock::now();
+   tbb_demo::ParallelTransform(Chain.Inverse(), Fused, Fused);
+   BOOST_TEST_MESSAGE("TRANSFORM CHAIN INVERSE FUSED [PAR] " << fSeconds(Start) << "s");
+   const double MaxErr = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints), 0., [&](const tbb::blocked_range<size_t>& r, double m) {
+      for (size_t i = r.begin(); i != r.end(); ++i)
+         for (size_t c = 0; c < 3; ++c)
+            m = std::max(m, std::fabs(Fused[i][c] - CartPoints[i][c]));
+      return m;
+      }, [](double a, double b) { return std::max(a, b); });
+   BOOST_TEST_MESSAGE("TRANSFORM CHAIN round trip max error " << MaxErr << " (coordinates in [-" << Generator.Extent << ", " << Generator.Extent << "))");
+   // acos loses ~1e-10 relative near the axes, i.e. ~1e-6 on coordinates of 1e4
+   BOOST_CHECK_SMALL(MaxErr, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(tbb_Autotune)
+{
+   // The kernels of tbb_Cartesian_to_Polar with their hard-coded grain and partitioner, then with the tuned ones
+   constexpr size_t NbPoints = 1e7;
+   std::vector<std::array<double, 3>> CartPoints(NbPoints), PolarPoints(NbPoints), PolarTuned(NbPoints);
+   tbb_demo::PointGenerator{20220531}.ParallelFill(CartPoints);
+   const std::string ProfilePath = (std::filesystem::temp_directory_path() / "tbb_demo_autotune.profile").string();
+   std::filesystem::remove(ProfilePath);
+
+   auto fSeconds = [](std::chrono::high_resolution_clock::time_point Start) {
+      return std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - Start).count();
+   };
+   auto fCart2Pol = [&CartPoints](std::vector<std::array<double, 3>>& Out, const tbb::blocked_range<size_t>& r) {
+      for (size_t i = r.begin(); i != r.end(); ++i)
+         Out[i] = tbb_demo::Cart2Pol(CartPoints[i]);
+   };
+   auto fSumR = [&PolarPoints](const tbb::blocked_range<size_t>& r, double Sum) {
+      for (size_t i = r.begin(); i != r.end(); ++i)
+         Sum += PolarPoints[i][0];
+      return Sum;
+   };
+   auto fSumExpLog = [&PolarPoints](const tbb::blocked_range<size_t>& r, double Sum) {
+      for (size_t i = r.begin(); i != r.end(); ++i)
+         Sum = std::log(std::exp(PolarPoints[i][0]) * std::exp(Sum)); // the polar bear killer of tbb_Cartesian_to_Polar
+      return Sum;
+   };
+   // first tuned call (with the search), then a second one (the choice is cached)
+   auto fCompare = [&](const tbb_demo::Autotuner& Tuner, const char* Kernel, const char* DefaultName, const auto& fDefault, const auto& fTuned) {
+      auto Start = std::chrono::high_resolution_clock::now();
+      fDefault();
+      const float DefaultTime = fSeconds(Start);
+      Start = std::chrono::high_resolution_clock::now();
+      fTuned();
+      const float SearchTime = fSeconds(Start);
+      Start = std::chrono::high_resolution_clock::now();
+      fTuned();
+      const float TunedTime = fSeconds(Start);
+      const tbb_demo::TuneChoice* Choice = Tuner.Find(Kernel, NbPoints);
+      BOOST_REQUIRE(Choice);
+      BOOST_TEST_MESSAGE("AUTOTUNE " << Kernel << " DEFAULT [" << DefaultName << "] " << DefaultTime << "s TUNED [" << tbb_demo::PartitionerName(Choice->Partitioner)
+                         << ", grain " << Choice->Grain << "] " << TunedTime << "s, first call with the search " << SearchTime << "s");
+      return *Choice;
+   };
+
+   std::vector<tbb_demo::TuneChoice> Choices;
+   {
+      tbb_demo::Autotuner Tuner(ProfilePath);
+      Choices.push_back(fCompare(Tuner, "cart2pol", "auto, grain 1",
+         [&]() { tbb::parallel_for(size_t(0), NbPoints, [&](size_t i) { PolarPoints[i] = tbb_demo::Cart2Pol(CartPoints[i]); }); },
+         [&]() { Tuner.ParallelFor("cart2pol", NbPoints, [&](const tbb::blocked_range<size_t>& r) { fCart2Pol(PolarTuned, r); }); }));
+      BOOST_CHECK(PolarTuned == PolarPoints);
+
+      double DefaultSum = 0., TunedSum = 0.;
+      Choices.push_back(fCompare(Tuner, "sum_radius", "auto, grain 1000",
+         [&]() { DefaultSum = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints, 1000), 0., fSumR, std::plus<double>()); },
+         [&]() { TunedSum = Tuner.ParallelReduce("sum_radius", NbPoints, 0., fSumR, std::plus<double>()); }));
+      BOOST_CHECK_CLOSE(TunedSum, DefaultSum, 1e-10);
+
+      // only timed: exp(r) overflows, as in tbb_Cartesian_to_Polar
+      Choices.push_back(fCompare(Tuner, "sum_radius_exp_log", "auto, grain 1000",
+         [&]() { DefaultSum = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, NbPoints, 1000), 0., fSumExpLog, std::plus<double>()); },
+         [&]() { TunedSum = Tuner.ParallelReduce("sum_radius_exp_log", NbPoints, 0., fSumExpLog, std::plus<double>()); }));
+      BOOST_CHECK_EQUAL(Tuner.NbSearches(), 3u);
+      BOOST_TEST_MESSAGE("AUTOTUNE profile " << ProfilePath << " for " << Tuner.CpuModel() << ", " << tbb::this_task_arena::max_concurrency() << " threads");
+   }
+
+   // a later run loads the profile and does not search again
+   {
+      std::ofstream(ProfilePath, std::ios::app) << "damaged\tline\n";
+      tbb_demo::Autotuner Tuner(ProfilePath);
+      const char* Kernels[] = {"cart2pol", "sum_radius", "sum_radius_exp_log"};
+      for (size_t k = 0; k < Choices.size(); ++k)
+      {
+         const tbb_demo::TuneChoice* Choice = Tuner.Find(Kernels[k], NbPoints);
+         BOOST_REQUIRE(Choice);
+         BOOST_CHECK(Choice->Partitioner == Choices[k].Partitioner);
+         BOOST_CHECK_EQUAL(Choice->Grain, Choices[k].Grain);
+      }
+      std::fill(PolarTuned.begin(), PolarTuned.end(), std::array<double, 3>{});
+      auto Start = std::chrono::high_resolution_clock::now();
+      Tuner.ParallelFor("cart2pol", NbPoints, [&](const tbb::blocked_range<size_t>& r) { fCart2Pol(PolarTuned, r); });
+      BOOST_TEST_MESSAGE("AUTOTUNE cart2pol from the profile " << fSeconds(Start) << "s");
+      BOOST_CHECK(PolarTuned == PolarPoints);
+      BOOST_CHECK_EQUAL(Tuner.NbSearches(), 0u);
+      // another size class or another thread count is another entry
+      BOOST_CHECK(!Tuner.Find("cart2pol", NbPoints / 4));
+      if (tbb::this_task_arena::max_concurrency() > 1)
+      {
+         tbb::task_arena Arena(1);
+         Arena.execute([&Tuner]() { BOOST_CHECK(!Tuner.Find("cart2pol", NbPoints)); });
+      }
+      BOOST_CHECK_THROW(Tuner.ParallelFor("bad\tname", NbPoints, [](const tbb::blocked_range<size_t>&) {}), std::invalid_argument);
+   }
+
+   // a sample much smaller than the input: the winner is timed again on the whole input before it is kept
+   {
+      tbb_demo::Autotuner Tuner(std::string(), 1 << 12);
+      std::fill(PolarTuned.begin(), PolarTuned.end(), std::array<double, 3>{});
+      Tuner.ParallelFor("cart2pol", NbPoints, [&](const tbb::blocked_range<size_t>& r) { fCart2Pol(PolarTuned, r); });
+      BOOST_CHECK(PolarTuned == PolarPoints);
+      const tbb_demo::TuneChoice* Choice = Tuner.Find("cart2pol", NbPoints);
+      BOOST_REQUIRE(Choice);
+      BOOST_TEST_MESSAGE("AUTOTUNE cart2pol on a sample of 4096 [" << tbb_demo::PartitionerName(Choice->Partitioner) << ", grain " << Choice->Grain << "] "
+                         << Choice->Seconds << "s on the whole input");
+   }
+
+   // the profile of another CPU does not match this one
+   {
+      std::ifstream In(ProfilePath);
+      std::string Profile((std::istreambuf_iterator<char>(In)), std::istreambuf_iterator<char>());
+      const std::string Cpu = tbb_demo::Autotuner().CpuModel();
+      BOOST_CHECK_NE(Profile.find(Cpu + '\t'), std::string::npos);
+      for (size_t Pos = Profile.find(Cpu + '\t'); Pos != std::string::npos; Pos = Profile.find(Cpu + '\t', Pos))
+         Profile.replace(Pos, Cpu.size(), "another CPU");
+      std::ofstream(ProfilePath, std::ios::trunc) << Profile;
+      tbb_demo::Autotuner Tuner(ProfilePath);
+      BOOST_CHECK(!Tuner.Find("cart2pol", NbPoints));
+   }
+   std::filesystem::remove(ProfilePath);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,380 @@
+// Scheduler instrumentation: per-worker timelines of arena entries/exits, ranges and stages.
+//
+//    tbb_demo::Tracer::Instance().Enable(true);
+//    tbb_demo::TraceObserver Observer("default");            // arena entries and exits
+//    {
+//       tbb_demo::TraceStage Stage("transform");               // one line of the summary
+//       tbb::parallel_for(tbb::blocked_range<size_t>(0, N), tbb_demo::Traced("cart2pol", Body));
+//    }
+//    Tracer::Instance().WriteChromeTrace("transform.json");   // chrome://tracing or ui.perfetto.dev
+//    std::cout << FormatTraceSummary(Tracer::Instance().Summarize());
+//
+// Every thread appends to its own ring buffer (one relaxed load, one clock read and one
+// release store per event, no lock and no shared cache line), the oldest events are
+// overwritten when it is full. Buffers are read after the traced work completed. When the
+// tracer is disabled an event costs one relaxed load.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tbb/task_arena.h"
+#include "tbb/task_scheduler_observer.h"
+
+namespace tbb_demo {
+
+enum class TraceEventKind : std::uint32_t
+{
+   ArenaEnter,
+   ArenaExit,
+   RangeBegin,
+   RangeEnd,
+   StageBegin,
+   StageEnd
+};
+
+struct TraceEvent
+{
+   std::uint64_t Time; ///< nanoseconds since the tracer was created
+   const char* Name;   ///< must outlive the tracer (string literals)
+   std::uint64_t Arg;  ///< range size, worker flag or stage concurrency
+   TraceEventKind Kind;
+};
+
+/// Single producer ring buffer of one thread
+class TraceBuffer
+{
+public:
+   TraceBuffer(std::uint32_t Tid, std::size_t Capacity) : m_tid(Tid), m_mask(RoundUp(Capacity) - 1), m_events(m_mask + 1) {}
+
+   std::uint32_t Tid() const { return m_tid; }
+   void Push(const TraceEvent& Event) noexcept
+   {
+      const std::uint64_t Head = m_head.load(std::memory_order_relaxed);
+      m_events[Head & m_mask] = Event;
+      m_head.store(Head + 1, std::memory_order_release);
+   }
+   /// Events since the last Clear(), oldest first (the newest Capacity ones)
+   std::vector<TraceEvent> Snapshot() const
+   {
+      const std::uint64_t Head = m_head.load(std::memory_order_acquire);
+      const std::uint64_t Begin = std::max(m_base, Head > m_mask + 1 ? Head - (m_mask + 1) : 0);
+      std::vector<TraceEvent> Events;
+      Events.reserve(Head - Begin);
+      for (std::uint64_t i = Begin; i < Head; ++i)
+         Events.push_back(m_events[i & m_mask]);
+      return Events;
+   }
+   /// Events lost because the buffer wrapped since the last Clear()
+   std::uint64_t Dropped() const
+   {
+      const std::uint64_t Head = m_head.load(std::memory_order_acquire), Size = Head - m_base;
+      return Size > m_mask + 1 ? Size - (m_mask + 1) : 0;
+   }
+   void Clear() { m_base = m_head.load(std::memory_order_acquire); }
+
+private:
+   static std::size_t RoundUp(std::size_t n)
+   {
+      std::size_t p = 1;
+      while (p < n)
+         p *= 2;
+      return p;
+   }
+   const std::uint32_t m_tid;
+   const std::uint64_t m_mask;
+   std::vector<TraceEvent> m_events;
+   alignas(64) std::atomic<std::uint64_t> m_head{0};
+   std::uint64_t m_base = 0; // reader side
+};
+
+/// Utilization of one stage (the time between a TraceStage construction and destruction)
+struct TraceStageSummary
+{
+   std::string Name;
+   double Seconds = 0.;
+   int Concurrency = 0;        ///< threads available to the stage
+   std::size_t Threads = 0;    ///< threads that ran at least one range
+   std::size_t Ranges = 0;
+   std::uint64_t Items = 0;    ///< sum of the range sizes
+   double BusySeconds = 0.;    ///< in ranges, all threads
+   double MaxBusySeconds = 0.; ///< busiest thread
+   /// busy time / (concurrency * stage time), 1: no thread was ever idle
+   double Utilization() const { return Seconds > 0. && Concurrency > 0 ? BusySeconds / (Seconds * Concurrency) : 0.; }
+   /// busiest thread / mean thread, 1: perfectly balanced, Concurrency: one thread did everything
+   double Imbalance() const { return BusySeconds > 0. ? MaxBusySeconds * Concurrency / BusySeconds : 0.; }
+};
+
+class Tracer
+{
+public:
+   static Tracer& Instance()
+   {
+      static Tracer Singleton;
+      return Singleton;
+   }
+
+   /// Capacity (events per thread) applies to the buffers of the threads not seen yet
+   void Enable(bool On, std::size_t Capacity = 1 << 16)
+   {
+      m_capacity.store(Capacity, std::memory_order_relaxed);
+      m_enabled.store(On, std::memory_order_relaxed);
+   }
+   bool Enabled() const noexcept { return m_enabled.load(std::memory_order_relaxed); }
+
+   void Record(TraceEventKind Kind, const char* Name, std::uint64_t Arg) noexcept
+   {
+      if (!Enabled())
+         return;
+      Local().Push({Now(), Name, Arg, Kind});
+   }
+
+   /// Forget the events recorded so far (call while nothing is traced)
+   void Clear()
+   {
+      std::lock_guard<std::mutex> Lock(m_mutex);
+      for (auto& Buffer : m_buffers)
+         Buffer->Clear();
+   }
+
+   std::uint64_t Dropped() const
+   {
+      std::lock_guard<std::mutex> Lock(m_mutex);
+      std::uint64_t n = 0;
+      for (const auto& Buffer : m_buffers)
+         n += Buffer->Dropped();
+      return n;
+   }
+
+   /// Events of every thread, with the tid of the thread
+   std::vector<std::pair<std::uint32_t, std::vector<TraceEvent>>> Snapshot() const
+   {
+      std::lock_guard<std::mutex> Lock(m_mutex);
+      std::vector<std::pair<std::uint32_t, std::vector<TraceEvent>>> Threads;
+      for (const auto& Buffer : m_buffers)
+         Threads.emplace_back(Buffer->Tid(), Buffer->Snapshot());
+      return Threads;
+   }
+
+   /// Chrome trace-event JSON (complete "X" events), one timeline per thread
+   void WriteChromeTrace(const std::string& Path) const
+   {
+      std::ofstream Out(Path);
+      Out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+      bool First = true;
+      auto fEmit = [&Out, &First](const std::string& Event) {
+         Out << (First ? "" : ",\n") << Event;
+         First = false;
+      };
+      for (const auto& Thread : Snapshot())
+      {
+         const std::uint32_t Tid = Thread.first;
+         fEmit("{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " + std::to_string(Tid) +
+               ", \"args\": {\"name\": \"thread " + std::to_string(Tid) + "\"}}");
+         ForEachInterval(Thread.second, [&](const TraceEvent& Begin, std::uint64_t End, int) {
+            const char* Category = Begin.Kind == TraceEventKind::ArenaEnter ? "arena" : Begin.Kind == TraceEventKind::RangeBegin ? "range" : "stage";
+            std::ostringstream Event;
+            Event.precision(15);
+            Event << "{\"ph\": \"X\", \"cat\": \"" << Category << "\", \"name\": \"" << Escape(Begin.Name) << "\", \"pid\": 1, \"tid\": " << Tid
+                  << ", \"ts\": " << double(Begin.Time) / 1e3 << ", \"dur\": " << double(End - Begin.Time) / 1e3 << ", \"args\": {\""
+                  << (Begin.Kind == TraceEventKind::RangeBegin ? "items" : Begin.Kind == TraceEventKind::ArenaEnter ? "worker" : "concurrency")
+                  << "\": " << Begin.Arg << "}}";
+            fEmit(Event.str());
+         });
+      }
+      Out << "\n]}\n";
+   }
+
+   /// One line per stage, in the order the stages began
+   std::vector<TraceStageSummary> Summarize() const
+   {
+      const auto Threads = Snapshot();
+      struct Interval
+      {
+         std::uint64_t Begin, End;
+         const char* Name;
+         std::uint64_t Arg;
+      };
+      std::vector<Interval> Stages;
+      std::vector<std::vector<Interval>> Ranges(Threads.size()); // outermost ranges of each thread
+      for (std::size_t t = 0; t < Threads.size(); ++t)
+         ForEachInterval(Threads[t].second, [&](const TraceEvent& Begin, std::uint64_t End, int Depth) {
+            if (Begin.Kind == TraceEventKind::StageBegin)
+               Stages.push_back({Begin.Time, End, Begin.Name, Begin.Arg});
+            else if (Begin.Kind == TraceEventKind::RangeBegin && Depth == 0)
+               Ranges[t].push_back({Begin.Time, End, Begin.Name, Begin.Arg});
+         });
+      std::sort(Stages.begin(), Stages.end(), [](const Interval& a, const Interval& b) { return a.Begin < b.Begin; });
+
+      std::vector<TraceStageSummary> Summaries;
+      for (const Interval& Stage : Stages)
+      {
+         TraceStageSummary S;
+         S.Name = Stage.Name;
+         S.Seconds = double(Stage.End - Stage.Begin) / 1e9;
+         S.Concurrency = int(Stage.Arg);
+         for (const auto& ThreadRanges : Ranges)
+         {
+            double Busy = 0.;
+            for (const Interval& r : ThreadRanges)
+            {
+               if (r.End <= Stage.Begin || r.Begin >= Stage.End)
+                  continue;
+               Busy += double(std::min(r.End, Stage.End) - std::max(r.Begin, Stage.Begin)) / 1e9;
+               ++S.Ranges;
+               S.Items += r.Arg;
+            }
+            S.Threads += Busy > 0. ? 1 : 0;
+            S.BusySeconds += Busy;
+            S.MaxBusySeconds = std::max(S.MaxBusySeconds, Busy);
+         }
+         Summaries.push_back(S);
+      }
+      return Summaries;
+   }
+
+private:
+   Tracer() : m_epoch(std::chrono::steady_clock::now()) {}
+
+   std::uint64_t Now() const noexcept
+   {
+      return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count());
+   }
+
+   TraceBuffer& Local()
+   {
+      thread_local TraceBuffer* Buffer = nullptr;
+      if (!Buffer)
+      {
+         std::lock_guard<std::mutex> Lock(m_mutex); // once per thread
+         m_buffers.push_back(std::make_unique<TraceBuffer>(std::uint32_t(m_buffers.size()), m_capacity.load(std::memory_order_relaxed)));
+         Buffer = m_buffers.back().get();
+      }
+      return *Buffer;
+   }
+
+   /// fInterval(BeginEvent, EndTime, Depth) for every matched begin/end pair of one thread;
+   /// Depth counts the enclosing intervals of the same kind. Intervals still open end at the
+   /// last event of the thread.
+   template <class IntervalFn>
+   static void ForEachInterval(const std::vector<TraceEvent>& Events, const IntervalFn& fInterval)
+   {
+      std::vector<TraceEvent> Open[3]; // arena, range, stage
+      auto fSlot = [](TraceEventKind Kind) { return int(Kind) / 2; };
+      for (const TraceEvent& e : Events)
+      {
+         auto& Stack = Open[fSlot(e.Kind)];
+         const bool IsBegin = int(e.Kind) % 2 == 0;
+         if (IsBegin)
+            Stack.push_back(e);
+         else if (!Stack.empty()) // the begin may have been overwritten
+         {
+            const TraceEvent Begin = Stack.back();
+            Stack.pop_back();
+            fInterval(Begin, e.Time, int(Stack.size()));
+         }
+      }
+      const std::uint64_t Last = Events.empty() ? 0 : Events.back().Time;
+      for (auto& Stack : Open)
+         while (!Stack.empty())
+         {
+            const TraceEvent Begin = Stack.back();
+            Stack.pop_back();
+            fInterval(Begin, Last, int(Stack.size()));
+         }
+   }
+
+   static std::string Escape(const char* Name)
+   {
+      std::string Out;
+      for (const char* c = Name ? Name : ""; *c; ++c)
+      {
+         if (*c == '"' || *c == '\\')
+            Out += '\\';
+         Out += *c;
+      }
+      return Out;
+   }
+
+   const std::chrono::steady_clock::time_point m_epoch;
+   std::atomic<bool> m_enabled{false};
+   std::atomic<std::size_t> m_capacity{1 << 16};
+   mutable std::mutex m_mutex;
+   std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+};
+
+/// Records the entries and exits of the threads in an arena (the arena of the constructing
+/// thread by default)
+class TraceObserver : public tbb::task_scheduler_observer
+{
+public:
+   explicit TraceObserver(const char* Name) : m_name(Name) { observe(true); }
+   TraceObserver(tbb::task_arena& Arena, const char* Name) : tbb::task_scheduler_observer(Arena), m_name(Name) { observe(true); }
+   ~TraceObserver() override { observe(false); }
+
+   void on_scheduler_entry(bool IsWorker) override { Tracer::Instance().Record(TraceEventKind::ArenaEnter, m_name, IsWorker); }
+   void on_scheduler_exit(bool IsWorker) override { Tracer::Instance().Record(TraceEventKind::ArenaExit, m_name, IsWorker); }
+
+private:
+   const char* m_name;
+};
+
+/// A named stage of the summary, from construction to destruction
+class TraceStage
+{
+public:
+   explicit TraceStage(const char* Name) : m_name(Name)
+   {
+      Tracer::Instance().Record(TraceEventKind::StageBegin, Name, std::uint64_t(tbb::this_task_arena::max_concurrency()));
+   }
+   ~TraceStage() { Tracer::Instance().Record(TraceEventKind::StageEnd, m_name, 0); }
+   TraceStage(const TraceStage&) = delete;
+   TraceStage& operator=(const TraceStage&) = delete;
+
+private:
+   const char* m_name;
+};
+
+/// Wraps the body of a range algorithm (parallel_for, the functional parallel_reduce...) so that
+/// every range it runs is recorded with its size
+template <class Body>
+auto Traced(const char* Name, Body fBody)
+{
+   return [Name, fBody](const auto& Range, auto&&... Args) -> decltype(auto) {
+      struct Scope
+      {
+         const char* Name;
+         Scope(const char* n, std::uint64_t Size) : Name(n) { Tracer::Instance().Record(TraceEventKind::RangeBegin, n, Size); }
+         ~Scope() { Tracer::Instance().Record(TraceEventKind::RangeEnd, Name, 0); }
+      } Guard(Name, std::uint64_t(Range.size()));
+      return fBody(Range, std::forward<decltype(Args)>(Args)...);
+   };
+}
+
+/// Table of the stage summaries
+inline std::string FormatTraceSummary(const std::vector<TraceStageSummary>& Stages)
+{
+   std::ostringstream Out;
+   char Line[256];
+   std::snprintf(Line, sizeof(Line), "%-32s %10s %6s %7s %9s %12s %7s %9s\n", "stage", "time (s)", "conc", "threads", "ranges", "items", "util", "imbalance");
+   Out << Line;
+   for (const auto& S : Stages)
+   {
+      std::snprintf(Line, sizeof(Line), "%-32s %10.6f %6d %7zu %9zu %12llu %6.1f%% %9.2f\n", S.Name.c_str(), S.Seconds, S.Concurrency, S.Threads,
+                    S.Ranges, static_cast<unsigned long long>(S.Items), 100. * S.Utilization(), S.Imbalance());
+      Out << Line;
+   }
+   return Out.str();
+}
+
+} // namespace tbb_demo
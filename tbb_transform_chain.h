@@ -0,0 +1,179 @@
+// Coordinate transforms composed at compile time into one fused per-point kernel.
+//
+// A stage is a small struct with a const operator()(Point) and an Inverse(). TransformChain holds
+// its stages in a std::tuple and applies them one after the other to a point held in registers;
+// the type of the chain is the list of its stages, so the compiler inlines the whole chain into
+// the loop of ParallelTransform: every point is loaded once and stored once, whatever the number
+// of stages. ParallelTransformStaged runs the same chain one pass per stage, each pass writing a
+// whole intermediate vector, as separate calls to std::transform would.
+//
+//    const auto Chain = tbb_demo::MakeChain(tbb_demo::Translate{{-1., 0., 0.}}, tbb_demo::Rotate::AboutZ(0.5))
+//                       | tbb_demo::CartesianToSpherical{} | tbb_demo::ScaleCoordinates{{1e-3, 180. / M_PI, 180. / M_PI}};
+//    tbb_demo::ParallelTransform(Chain, CartPoints, Out);
+//    tbb_demo::ParallelTransform(Chain.Inverse(), Out, Back);  // back to the Cartesian points
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+#include "tbb_coordinates.h"
+
+namespace tbb_demo {
+
+using TransformPoint = std::array<double, 3>;
+
+struct Translate
+{
+   TransformPoint Offset;
+
+   TransformPoint operator()(const TransformPoint& p) const { return {p[0] + Offset[0], p[1] + Offset[1], p[2] + Offset[2]}; }
+   Translate Inverse() const { return {{-Offset[0], -Offset[1], -Offset[2]}}; }
+};
+
+/// Multiplication by a 3x3 matrix, a rotation when it is orthonormal (the inverse is the transpose)
+struct Rotate
+{
+   std::array<TransformPoint, 3> M;
+
+   static Rotate AboutZ(double Angle)
+   {
+      const double c = std::cos(Angle), s = std::sin(Angle);
+      return {{{{c, -s, 0.}, {s, c, 0.}, {0., 0., 1.}}}};
+   }
+   /// Rodrigues' formula, Axis of norm 1
+   static Rotate AboutAxis(const TransformPoint& Axis, double Angle)
+   {
+      const double c = std::cos(Angle), s = std::sin(Angle), t = 1. - c;
+      const double x = Axis[0], y = Axis[1], z = Axis[2];
+      return {{{{t * x * x + c, t * x * y - s * z, t * x * z + s * y},
+                {t * x * y + s * z, t * y * y + c, t * y * z - s * x},
+                {t * x * z - s * y, t * y * z + s * x, t * z * z + c}}}};
+   }
+
+   TransformPoint operator()(const TransformPoint& p) const
+   {
+      return {M[0][0] * p[0] + M[0][1] * p[1] + M[0][2] * p[2],
+              M[1][0] * p[0] + M[1][1] * p[1] + M[1][2] * p[2],
+              M[2][0] * p[0] + M[2][1] * p[1] + M[2][2] * p[2]};
+   }
+   Rotate Inverse() const { return {{{{M[0][0], M[1][0], M[2][0]}, {M[0][1], M[1][1], M[2][1]}, {M[0][2], M[1][2], M[2][2]}}}}; }
+};
+
+struct SphericalToCartesian;
+
+/// (x, y, z) to (r, theta, phi), Cart2Pol
+struct CartesianToSpherical
+{
+   TransformPoint operator()(const TransformPoint& p) const
+   {
+      return Cart2Pol(p);
+   }
+   SphericalToCartesian Inverse() const;
+};
+
+/// (r, theta, phi) to (x, y, z), PolarToCartesian
+struct SphericalToCartesian
+{
+   TransformPoint operator()(const TransformPoint& p) const { return PolarToCartesian(p); }
+   CartesianToSpherical Inverse() const { return {}; }
+};
+
+inline SphericalToCartesian CartesianToSpherical::Inverse() const { return {}; }
+
+/// Unit conversion, one factor per coordinate (e.g. m to km for r, radians to degrees for the angles)
+struct ScaleCoordinates
+{
+   TransformPoint Factors;
+
+   TransformPoint operator()(const TransformPoint& p) const { return {p[0] * Factors[0], p[1] * Factors[1], p[2] * Factors[2]}; }
+   ScaleCoordinates Inverse() const { return {{1. / Factors[0], 1. / Factors[1], 1. / Factors[2]}}; }
+};
+
+template <class... Stages>
+class TransformChain
+{
+public:
+   static constexpr std::size_t NbStages = sizeof...(Stages);
+
+   constexpr explicit TransformChain(Stages... s) : m_stages(std::move(s)...) {}
+
+   TransformPoint operator()(TransformPoint p) const
+   {
+      std::apply([&p](const Stages&... s) { ((p = s(p)), ...); }, m_stages);
+      return p;
+   }
+
+   template <std::size_t I>
+   const auto& Stage() const { return std::get<I>(m_stages); }
+   const std::tuple<Stages...>& AllStages() const { return m_stages; }
+
+   /// The inverse of every stage, last stage first
+   auto Inverse() const { return Reversed(std::make_index_sequence<NbStages>()); }
+
+private:
+   template <std::size_t... I>
+   auto Reversed(std::index_sequence<I...>) const
+   {
+      return TransformChain<decltype(std::get<NbStages - 1 - I>(m_stages).Inverse())...>(std::get<NbStages - 1 - I>(m_stages).Inverse()...);
+   }
+
+   std::tuple<Stages...> m_stages;
+};
+
+template <class... Stages>
+constexpr TransformChain<Stages...> MakeChain(Stages... s)
+{
+   return TransformChain<Stages...>(std::move(s)...);
+}
+
+/// Chain followed by one more stage
+template <class... Stages, class Next>
+TransformChain<Stages..., Next> operator|(const TransformChain<Stages...>& Chain, Next Stage)
+{
+   return std::apply([&Stage](const Stages&... s) { return TransformChain<Stages..., Next>(s..., Stage); }, Chain.AllStages());
+}
+
+/// Out[i] = Chain(In[i]): one load and one store per point (Out may be In)
+template <class Chain>
+void ParallelTransform(const Chain& fChain, const std::vector<TransformPoint>& In, std::vector<TransformPoint>& Out)
+{
+   Out.resize(In.size());
+   tbb::parallel_for(tbb::blocked_range<std::size_t>(0, In.size()), [&fChain, &In, &Out](const tbb::blocked_range<std::size_t>& r) {
+      for (std::size_t i = r.begin(); i != r.end(); ++i)
+         Out[i] = fChain(In[i]);
+   });
+}
+
+/// Same result, one parallel pass per stage through a new intermediate vector each time (the
+/// first pass reads In). Returns the bytes read and written by the passes.
+template <class... Stages>
+std::size_t ParallelTransformStaged(const TransformChain<Stages...>& Chain, const std::vector<TransformPoint>& In, std::vector<TransformPoint>& Out)
+{
+   std::vector<TransformPoint> Current;
+   const std::vector<TransformPoint>* From = &In;
+   std::apply([&In, &Current, &From](const Stages&... s) {
+      auto fPass = [&In, &Current, &From](const auto& Stage) {
+         std::vector<TransformPoint> Next(In.size());
+         tbb::parallel_for(tbb::blocked_range<std::size_t>(0, In.size()), [&Stage, Src = From, &Next](const tbb::blocked_range<std::size_t>& r) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i)
+               Next[i] = Stage((*Src)[i]);
+         });
+         Current = std::move(Next);
+         From = &Current;
+      };
+      (fPass(s), ...);
+   }, Chain.AllStages());
+   if (From == &In)
+      Out = In;
+   else
+      Out = std::move(Current);
+   return Chain.NbStages * 2 * In.size() * sizeof(TransformPoint);
+}
+
+} // namespace tbb_demo
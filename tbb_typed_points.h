@@ -0,0 +1,221 @@
+// The point pipeline of tbb_Cartesian_to_Polar (generate, convert, sort by radius, reduce)
+// specialized at compile time on the scalar type and the memory layout.
+//
+// PointTraits<Real, Layout, Accum> picks float or double coordinates, one std::array<Real, 3> per
+// point (AoS) or one column per coordinate (SoA), and the type the reductions accumulate in
+// (float coordinates summed in double keep the halved memory traffic without the rounding
+// drift of a float sum). Every function is a template over the traits and chooses its code
+// with if constexpr, nothing is decided at runtime:
+// - ParallelGenerate: the Philox dataset of PointGenerator, written directly for double, and
+//   rounded from a tile of doubles for float, so every instantiation sees the same points;
+// - ParallelCart2Pol: the SIMD kernels on SoA columns (8 doubles or 16 floats per AVX-512
+//   register), the formula of fCart2Pol on AoS points;
+// - ParallelSortByRadius: parallel_sort of the points for AoS, of (r, index) pairs followed by a
+//   gather for SoA;
+// - ParallelSumRadius: parallel_reduce in the accumulator type.
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/cache_aligned_allocator.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/parallel_sort.h"
+
+#include "tbb_coordinates.h"
+#include "tbb_kernels.h"
+#include "tbb_point_generator.h"
+
+namespace tbb_demo {
+
+enum class PointLayout
+{
+   AoS,
+   SoA
+};
+
+template <class Real, PointLayout Layout, class Accum = Real>
+struct PointTraits
+{
+   static_assert(std::is_floating_point<Real>::value && std::is_floating_point<Accum>::value, "floating-point coordinates");
+   using Scalar = Real;
+   using Accumulator = Accum;
+   static constexpr PointLayout Storage = Layout;
+   /// Columns padded to a whole cache line, i.e. to a whole AVX-512 register
+   static constexpr std::size_t Padding = 64 / sizeof(Real);
+};
+
+template <class Traits>
+class TypedPoints
+{
+public:
+   using Real = typename Traits::Scalar;
+   using Point = std::array<Real, 3>;
+   using Column = std::vector<Real, tbb::cache_aligned_allocator<Real>>;
+   static constexpr bool IsSoA = Traits::Storage == PointLayout::SoA;
+
+   explicit TypedPoints(std::size_t NbPoints) : m_size(NbPoints)
+   {
+      if constexpr (IsSoA)
+         for (Column& c : m_columns)
+            c.resize(PaddedSize());
+      else
+      {
+         m_cart.resize(NbPoints);
+         m_polar.resize(NbPoints);
+      }
+   }
+
+   std::size_t size() const { return m_size; }
+   std::size_t PaddedSize() const { return (m_size + Traits::Padding - 1) / Traits::Padding * Traits::Padding; }
+   /// Memory held by the Cartesian and polar coordinates
+   std::size_t Bytes() const { return (IsSoA ? 6 * PaddedSize() : 6 * m_size) * sizeof(Real); }
+
+   Point Cartesian(std::size_t i) const
+   {
+      if constexpr (IsSoA)
+         return {m_columns[0][i], m_columns[1][i], m_columns[2][i]};
+      else
+         return m_cart[i];
+   }
+   Point Polar(std::size_t i) const
+   {
+      if constexpr (IsSoA)
+         return {m_columns[3][i], m_columns[4][i], m_columns[5][i]};
+      else
+         return m_polar[i];
+   }
+
+   /// SoA: x, y, z, r, theta, phi
+   Real* Col(std::size_t c) { return m_columns[c].data(); }
+   const Real* Col(std::size_t c) const { return m_columns[c].data(); }
+   /// AoS
+   std::vector<Point>& CartPoints() { return m_cart; }
+   std::vector<Point>& PolarPoints() { return m_polar; }
+   const std::vector<Point>& PolarPoints() const { return m_polar; }
+
+private:
+   std::size_t m_size;
+   std::array<Column, 6> m_columns;
+   std::vector<Point> m_cart, m_polar;
+};
+
+namespace typed_detail {
+
+/// Points rounded from a tile of doubles
+constexpr std::size_t TileSize = 512;
+
+} // namespace typed_detail
+
+template <class Traits>
+void ParallelGenerate(TypedPoints<Traits>& Points, const PointGenerator& Generator)
+{
+   using Real = typename Traits::Scalar;
+   constexpr bool IsSoA = TypedPoints<Traits>::IsSoA;
+   tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Points.size(), 1024), [&Points, &Generator](const tbb::blocked_range<std::size_t>& r) {
+      if constexpr (std::is_same<Real, double>::value)
+      {
+         if constexpr (IsSoA)
+            GeneratePointsKernel(Generator.Level, Generator.Seed, Generator.Extent, r.begin(), r.end(),
+                                 Points.Col(0) + r.begin(), Points.Col(1) + r.begin(), Points.Col(2) + r.begin(), 1);
+         else
+         {
+            double* Base = Points.CartPoints()[r.begin()].data();
+            GeneratePointsKernel(Generator.Level, Generator.Seed, Generator.Extent, r.begin(), r.end(), Base, Base + 1, Base + 2, 3);
+         }
+      }
+      else
+      {
+         double Tile[3][typed_detail::TileSize];
+         for (std::size_t b = r.begin(); b < r.end(); b += typed_detail::TileSize)
+         {
+            const std::size_t n = std::min(typed_detail::TileSize, r.end() - b);
+            GeneratePointsKernel(Generator.Level, Generator.Seed, Generator.Extent, b, b + n, Tile[0], Tile[1], Tile[2], 1);
+            for (std::size_t k = 0; k < n; ++k)
+               if constexpr (IsSoA)
+                  for (std::size_t c = 0; c < 3; ++c)
+                     Points.Col(c)[b + k] = Real(Tile[c][k]);
+               else
+                  Points.CartPoints()[b + k] = {Real(Tile[0][k]), Real(Tile[1][k]), Real(Tile[2][k])};
+         }
+      }
+   });
+}
+
+template <class Traits>
+void ParallelCart2Pol(TypedPoints<Traits>& Points, SimdLevel Level = DetectSimdLevel())
+{
+   if constexpr (TypedPoints<Traits>::IsSoA)
+   {
+      // whole registers only: every chunk is a whole number of padded packets
+      constexpr std::size_t Padding = Traits::Padding;
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Points.PaddedSize() / Padding), [&Points, Level](const tbb::blocked_range<std::size_t>& r) {
+         Cart2PolKernel(Level, Points.Col(0), Points.Col(1), Points.Col(2), Points.Col(3), Points.Col(4), Points.Col(5),
+                        r.begin() * Padding, r.end() * Padding);
+      });
+   }
+   else
+   {
+      auto& Cart = Points.CartPoints();
+      auto& Polar = Points.PolarPoints();
+      tbb::parallel_for(tbb::blocked_range<std::size_t>(0, Points.size()), [&Cart, &Polar](const tbb::blocked_range<std::size_t>& r) {
+         for (std::size_t i = r.begin(); i != r.end(); ++i)
+            Polar[i] = Cart2Pol(Cart[i]);
+      });
+   }
+}
+
+/// Polar coordinates sorted by radius (the Cartesian ones are left as they are), at most
+/// 2^32 - 1 points for SoA
+template <class Traits>
+void ParallelSortByRadius(TypedPoints<Traits>& Points)
+{
+   using Real = typename Traits::Scalar;
+   if constexpr (TypedPoints<Traits>::IsSoA)
+   {
+      struct RadiusIndex
+      {
+         Real R;
+         std::uint32_t Index;
+      };
+      const std::size_t N = Points.size();
+      if (N >= std::numeric_limits<std::uint32_t>::max())
+         throw std::length_error("ParallelSortByRadius: too many points");
+      std::vector<RadiusIndex> Keys(N);
+      tbb::parallel_for(std::size_t(0), N, [&Points, &Keys](std::size_t i) { Keys[i] = {Points.Col(3)[i], std::uint32_t(i)}; });
+      tbb::parallel_sort(Keys.begin(), Keys.end(), [](const RadiusIndex& a, const RadiusIndex& b) { return a.R < b.R; });
+      std::vector<Real> Theta(Points.Col(4), Points.Col(4) + N), Phi(Points.Col(5), Points.Col(5) + N);
+      tbb::parallel_for(std::size_t(0), N, [&](std::size_t i) {
+         Points.Col(3)[i] = Keys[i].R;
+         Points.Col(4)[i] = Theta[Keys[i].Index];
+         Points.Col(5)[i] = Phi[Keys[i].Index];
+      });
+   }
+   else
+      tbb::parallel_sort(Points.PolarPoints().begin(), Points.PolarPoints().end(),
+                         [](const auto& a, const auto& b) { return a[0] < b[0]; });
+}
+
+template <class Traits>
+typename Traits::Accumulator ParallelSumRadius(const TypedPoints<Traits>& Points)
+{
+   using Accum = typename Traits::Accumulator;
+   return tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, Points.size()), Accum(0), [&Points](const tbb::blocked_range<std::size_t>& r, Accum Sum) {
+      for (std::size_t i = r.begin(); i != r.end(); ++i)
+         if constexpr (TypedPoints<Traits>::IsSoA)
+            Sum += Accum(Points.Col(3)[i]);
+         else
+            Sum += Accum(Points.PolarPoints()[i][0]);
+      return Sum;
+   }, std::plus<Accum>());
+}
+
+} // namespace tbb_demo
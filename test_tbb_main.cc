@@ -4,4 +4,17 @@
 #define BOOST_TEST_MODULE tbb_tests
 #include "boost/test/unit_test.hpp"
 
+#include "tbb_memory_usage.h"
+
+// TBB_DEMO_HUGE_PAGES=1 : tbbmalloc backs its large blocks with huge pages for the whole run
+struct MemoryModeFixture
+{
+   MemoryModeFixture()
+   {
+      if (tbb_demo::HugePagesRequested())
+         std::cout << "tbbmalloc huge pages " << (tbb_demo::UseHugePages(true) ? "on" : "refused") << std::endl;
+   }
+};
+BOOST_TEST_GLOBAL_FIXTURE(MemoryModeFixture);
+
 